@@ -0,0 +1,115 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Host side companion of the shell 'adc compress' command
+//   rice -d < dump.txt             decode 'rice N xx xx ...' blocks printed by the shell
+//   rice -b [-c column] file...    corpus benchmark; compression ratio and time per byte
+
+#include "rice.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static int
+decode( std::istream& in )
+{
+    std::string token;
+    size_t blocks = 0;
+    while ( in >> token ) {
+        if ( token != "rice" )
+            continue;
+        size_t size = 0;
+        in >> size;
+        std::vector< uint8_t > block;
+        for ( size_t i = 0; i < size && in >> token; ++i )
+            block.emplace_back( uint8_t( std::strtoul( token.c_str(), nullptr, 16 ) ) );
+        std::vector< int32_t > x( codec::rice::block_samples( block.data(), block.size() ) );
+        if ( x.empty() || codec::rice::decode( block.data(), block.size(), x.data(), x.size() ) != x.size() ) {
+            std::cerr << "block " << blocks << ": decode error" << std::endl;
+            return 1;
+        }
+        for ( auto& v: x )
+            std::cout << v << std::endl;
+        ++blocks;
+    }
+    return 0;
+}
+
+static bool
+benchmark( const char * file, size_t column )
+{
+    std::ifstream in( file );
+    if ( !in ) {
+        std::cerr << file << ": cannot open" << std::endl;
+        return false;
+    }
+    std::vector< int32_t > x;
+    std::string line;
+    while ( std::getline( in, line ) ) {
+        std::istringstream s( line );
+        std::string token;
+        for ( size_t i = 0; s >> token; ++i ) {
+            char * end;
+            double v = std::strtod( token.c_str(), &end );
+            if ( i == column && *end == '\0' ) {
+                x.emplace_back( int32_t( v * ( token.find( '.' ) == std::string::npos ? 1 : 100 ) ) ); // keep 2 decimals
+                break;
+            }
+        }
+    }
+    if ( x.empty() ) {
+        std::cerr << file << ": no data in column " << column << std::endl;
+        return false;
+    }
+
+    constexpr size_t block = 256;
+    std::vector< uint8_t > out( codec::rice::max_encoded_size( block ) );
+    std::vector< int32_t > y( block );
+    size_t encoded = 0;
+    std::chrono::nanoseconds elapsed( 0 );
+    for ( size_t i = 0; i < x.size(); i += block ) {
+        size_t n = std::min( block, x.size() - i );
+        auto t0 = std::chrono::steady_clock::now();
+        size_t size = codec::rice::encode( &x[ i ], n, out.data(), out.size() );
+        elapsed += std::chrono::steady_clock::now() - t0;
+        if ( size == 0 || codec::rice::decode( out.data(), size, y.data(), y.size() ) != n
+             || !std::equal( y.begin(), y.begin() + n, x.begin() + i ) ) {
+            std::cerr << file << ": round trip failed at block " << i / block << std::endl;
+            return false;
+        }
+        encoded += size;
+    }
+    const size_t raw = x.size() * sizeof( uint16_t );
+    std::cout << file << "\tsamples: " << x.size() << "\tratio (16bit): " << double( raw ) / encoded
+              << "\tencode: " << double( elapsed.count() ) / raw << " ns/byte" << std::endl;
+    return true;
+}
+
+int
+main( int argc, char ** argv )
+{
+    if ( argc > 1 && std::strcmp( argv[ 1 ], "-d" ) == 0 )
+        return decode( std::cin );
+
+    if ( argc > 2 && std::strcmp( argv[ 1 ], "-b" ) == 0 ) {
+        size_t column = 0;
+        bool ok = true;
+        for ( int i = 2; i < argc; ++i ) {
+            if ( std::strcmp( argv[ i ], "-c" ) == 0 && i + 1 < argc )
+                column = std::strtoul( argv[ ++i ], nullptr, 10 );
+            else
+                ok &= benchmark( argv[ i ], column );
+        }
+        return ok ? 0 : 1;
+    }
+
+    std::cerr << "usage: " << argv[ 0 ] << " -d < dump.txt | -b [-c column] file..." << std::endl;
+    return 1;
+}
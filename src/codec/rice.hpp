@@ -0,0 +1,210 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Block oriented lossless compressor for slowly varying sensor data: first order delta,
+// zigzag mapping and Rice (Golomb, m = 2^k) coding, k chosen per block from the mean residual.
+// Memory use is the caller supplied output buffer only; time is O(n) with the unary part
+// limited to 'escape' bits, so that both are bounded by max_encoded_size().
+//
+// Block format (little endian):
+//   [0]     k
+//   [1..2]  number of samples
+//   [3..6]  first sample
+//   [7..]   residuals, MSB first; q ones, a zero, k bits remainder
+//           or 'escape' ones followed by 32 bit zigzag value
+// This header is shared by the target (shell) and host tools.
+
+namespace codec {
+
+    namespace rice {
+
+        constexpr size_t header_size = 7;
+        constexpr uint32_t escape = 24;
+
+        constexpr size_t max_encoded_size( size_t n ) {
+            return header_size + ( n ? ( ( n - 1 ) * ( escape + 32 ) + 7 ) / 8 : 0 );
+        }
+
+        // deltas are taken modulo 2^32, so that any pair of int32_t samples round trips without overflow
+        inline uint32_t delta( uint32_t x, uint32_t prev ) { return x - prev; }
+        inline uint32_t zigzag( uint32_t d ) { return ( d << 1 ) ^ ( 0 - ( d >> 31 ) ); }
+        inline uint32_t unzigzag( uint32_t v ) { return ( v >> 1 ) ^ ( 0 - ( v & 1 ) ); }
+
+        class bit_writer {
+            uint8_t * p_;
+            uint8_t * end_;
+            uint32_t acc_;
+            uint32_t bits_;
+        public:
+            bit_writer( uint8_t * p, uint8_t * end ) : p_( p ), end_( end ), acc_( 0 ), bits_( 0 ) {}
+
+            // n <= 24
+            inline bool put( uint32_t v, uint32_t n ) {
+                acc_ = ( acc_ << n ) | ( v & ( ( 1u << n ) - 1 ) );
+                bits_ += n;
+                while ( bits_ >= 8 ) {
+                    if ( p_ == end_ )
+                        return false;
+                    bits_ -= 8;
+                    *p_++ = uint8_t( acc_ >> bits_ );
+                }
+                return true;
+            }
+
+            inline bool put32( uint32_t v ) { return put( v >> 16, 16 ) && put( v & 0xffff, 16 ); }
+
+            inline bool unary( uint32_t q ) { // q ones
+                while ( q >= 16 ) {
+                    if ( !put( 0xffff, 16 ) )
+                        return false;
+                    q -= 16;
+                }
+                return q ? put( ( 1u << q ) - 1, q ) : true;
+            }
+
+            bool flush() {
+                if ( bits_ ) {
+                    if ( p_ == end_ )
+                        return false;
+                    *p_++ = uint8_t( acc_ << ( 8 - bits_ ) );
+                    bits_ = 0;
+                }
+                return true;
+            }
+
+            uint8_t * position() const { return p_; }
+        };
+
+        class bit_reader {
+            const uint8_t * p_;
+            const uint8_t * end_;
+            uint32_t acc_;
+            uint32_t bits_;
+        public:
+            bit_reader( const uint8_t * p, const uint8_t * end ) : p_( p ), end_( end ), acc_( 0 ), bits_( 0 ) {}
+
+            // n <= 24
+            inline bool get( uint32_t& v, uint32_t n ) {
+                while ( bits_ < n ) {
+                    if ( p_ == end_ )
+                        return false;
+                    acc_ = ( acc_ << 8 ) | *p_++;
+                    bits_ += 8;
+                }
+                bits_ -= n;
+                v = ( acc_ >> bits_ ) & ( ( 1u << n ) - 1 );
+                return true;
+            }
+
+            inline bool get32( uint32_t& v ) {
+                uint32_t hi, lo;
+                if ( !get( hi, 16 ) || !get( lo, 16 ) )
+                    return false;
+                v = ( hi << 16 ) | lo;
+                return true;
+            }
+        };
+
+        // returns encoded size, 0 if 'out' is too small
+        template< typename T >
+        size_t encode( const T * x, size_t n, uint8_t * out, size_t size ) {
+            if ( n == 0 || n > 0xffff || size < header_size )
+                return 0;
+
+            // k = floor( log2( mean residual ) )
+            uint64_t sum = 0;
+            for ( size_t i = 1; i < n; ++i )
+                sum += zigzag( delta( uint32_t( int32_t( x[ i ] ) ), uint32_t( int32_t( x[ i - 1 ] ) ) ) );
+            uint32_t k = 0;
+            while ( k < 30 && ( uint64_t( n - 1 ) << ( k + 1 ) ) <= sum )
+                ++k;
+
+            const uint32_t first = uint32_t( int32_t( x[ 0 ] ) );
+            out[ 0 ] = uint8_t( k );
+            out[ 1 ] = uint8_t( n );
+            out[ 2 ] = uint8_t( n >> 8 );
+            for ( int i = 0; i < 4; ++i )
+                out[ 3 + i ] = uint8_t( first >> ( 8 * i ) );
+
+            bit_writer w( out + header_size, out + size );
+            for ( size_t i = 1; i < n; ++i ) {
+                uint32_t v = zigzag( delta( uint32_t( int32_t( x[ i ] ) ), uint32_t( int32_t( x[ i - 1 ] ) ) ) );
+                uint32_t q = v >> k;
+                bool ok;
+                if ( q >= escape ) {
+                    ok = w.unary( escape ) && w.put32( v );
+                } else {
+                    ok = w.unary( q ) && w.put( 0, 1 );
+                    if ( k > 16 )
+                        ok = ok && w.put( v >> 16, k - 16 ) && w.put( v & 0xffff, 16 );
+                    else if ( k )
+                        ok = ok && w.put( v, k );
+                }
+                if ( !ok )
+                    return 0;
+            }
+            if ( !w.flush() )
+                return 0;
+            return size_t( w.position() - out );
+        }
+
+        // number of samples in an encoded block
+        inline size_t block_samples( const uint8_t * in, size_t size ) {
+            return size < header_size ? 0 : size_t( in[ 1 ] ) | ( size_t( in[ 2 ] ) << 8 );
+        }
+
+        // returns number of decoded samples, 0 on error
+        template< typename T >
+        size_t decode( const uint8_t * in, size_t size, T * x, size_t n ) {
+            const size_t count = block_samples( in, size );
+            if ( count == 0 || count > n )
+                return 0;
+            const uint32_t k = in[ 0 ];  // header is present, as count != 0
+            if ( k > 30 )
+                return 0;
+            uint32_t first = 0;
+            for ( int i = 0; i < 4; ++i )
+                first |= uint32_t( in[ 3 + i ] ) << ( 8 * i );
+            x[ 0 ] = T( int32_t( first ) );
+
+            bit_reader r( in + header_size, in + size );
+            uint32_t prev = first;
+            for ( size_t i = 1; i < count; ++i ) {
+                uint32_t q = 0, bit = 1, v = 0;
+                while ( q < escape ) {
+                    if ( !r.get( bit, 1 ) )
+                        return 0;
+                    if ( bit == 0 )
+                        break;
+                    ++q;
+                }
+                if ( q == escape ) {
+                    if ( !r.get32( v ) )
+                        return 0;
+                } else {
+                    uint32_t rem = 0;
+                    if ( k > 16 ) {
+                        uint32_t hi, lo;
+                        if ( !r.get( hi, k - 16 ) || !r.get( lo, 16 ) )
+                            return 0;
+                        rem = ( hi << 16 ) | lo;
+                    } else if ( k && !r.get( rem, k ) ) {
+                        return 0;
+                    }
+                    v = ( q << k ) | rem;
+                }
+                prev += unzigzag( v );
+                x[ i ] = T( int32_t( prev ) );
+            }
+            return count;
+        }
+    }
+}
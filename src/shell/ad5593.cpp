@@ -26,6 +26,7 @@
 #include "condition_wait.hpp"
 #include "debug_print.hpp"
 #include "i2c.hpp"
+#include "i2c_scheduler.hpp"
 #include "scoped_spinlock.hpp"
 #include "utility.hpp"
 #include "stream.hpp"
@@ -212,15 +213,14 @@ AD5593::AD5593( const char * device
                 , int address ) : i2c_( std::make_unique< i2c_linux::i2c >() )
                                 , address_( address )
                                 , functions_{ UNUSED_PULLDOWN }
-                                , dirty_( true )
 {
     i2c_->init( device, address );
 }
 #else
 AD5593::AD5593( stm32f103::i2c& t, int address ) : i2c_( &t )
+                                                 , device_( t.scheduler().register_device( address ) )
                                                  , address_( address )
                                                  , functions_{ UNUSED_PULLDOWN }
-                                                 , dirty_( true )
 {
 }
 #endif
@@ -238,50 +238,41 @@ AD5593::operator bool () const
     return *i2c_;
 }
 
+// Transactions go through the bus scheduler at normal priority; a time critical device on the same bus
+// (BMP280) gets the bus between them.  On linux the i2c-dev device serializes them.
 bool
 AD5593::write( const uint8_t * data, size_t size ) const
 {
+#if defined __linux
+    return i2c_ && i2c_->write( data, size );
+#else
     bool success( false );
-    if ( i2c_ ) {
-        if ( i2c_->has_dma( stm32f103::i2c::DMA_Tx ) )
-            success = i2c_->dma_transfer( address_, data, size );
-        else
-            success = i2c_->write( address_, data, size );
-    }
+    stm32f103::i2c_request r( device_, stm32f103::I2C_PRIORITY_NORMAL, address_, data, size );
+    if ( i2c_ )
+        success = i2c_->scheduler().transact( r );
     if ( !success )
-        i2c_->print_result( stream(__FILE__,__LINE__,__FUNCTION__) ) << std::endl;
+        stm32f103::i2c::print_result( stream(__FILE__,__LINE__,__FUNCTION__), r.result() ) << std::endl;
     return success;
+#endif
 }
 
 bool
 AD5593::read(  uint8_t addr, uint8_t * data, size_t size ) const
 {
+#if defined __linux
+    return i2c_ && i2c_->read( addr, data, size );
+#else
     if ( i2c_ ) {
-        bool success( false );
-
-        if ( i2c_->has_dma( stm32f103::i2c::DMA_Tx ) ) {
-            success = i2c_->dma_transfer( address_, &addr, 1 );
-        } else {
-            success = i2c_->write( address_, &addr, 1 );
-        }
-        
-        if ( success ) {
-            std::array< uint8_t, 2 > buf = { 0 };
-
-            if ( i2c_->has_dma( stm32f103::i2c::DMA_Rx ) ) {
-                // workaround -- AD5593 often cause a read timeout -- retry up to 5 times --
-                if ( condition_wait( 5 )( [&]{ return i2c_->dma_receive( address_, data, size ); } ) )
-                    return true;
-                else
-                    i2c_->print_result( stream(__FILE__,__LINE__) ) << "\tread -- dma_recieve(" << addr << ") error\n";
-            } else {
-                return i2c_->read( address_, data, size );
-            }
-        } else {
-            i2c_->print_result( stream(__FILE__,__LINE__) ) << "\tread -- write(" << addr << ") error\n";
-        }
+        // pointer byte, then readback on repeated START
+        // workaround -- AD5593 often cause a read timeout -- retry up to 5 times --
+        stm32f103::i2c_request r( device_, stm32f103::I2C_PRIORITY_NORMAL, address_, &addr, 1, data, size );
+        if ( condition_wait( 5 )( [&]{ return i2c_->scheduler().transact( r ); } ) )
+            return true;
+        else
+            stm32f103::i2c::print_result( stream(__FILE__,__LINE__), r.result() ) << "\tread -- write_read(" << addr << ") error\n";
     }
     return false;
+#endif
 }
 
 uint8_t
@@ -312,7 +303,6 @@ AD5593::read_adc_sequence ( uint16_t * data, size_t size ) const
 bool
 AD5593::set_function( int pin, AD5593R_IO_FUNCTION f )
 {
-    dirty_ = true;
     functions_[ pin ] = f;
     switch( f ) {
     case ADC:
@@ -368,9 +358,19 @@ AD5593::set_function( int pin, AD5593R_IO_FUNCTION f )
     default:
         return false;
     };
+    stage();
     return true;
 }
 
+// bitmaps_ to the register cache; only registers that changed become dirty
+void
+AD5593::stage()
+{
+    size_t i = 0;
+    for ( auto reg: __fetch_reg_list )
+        regmap_.write( reg, uint16_t( bitmaps_[ i++ ].to_ulong() ) );
+}
+
 AD5593R_IO_FUNCTION
 AD5593::function( int pin ) const
 {
@@ -387,6 +387,7 @@ bool
 AD5593::reset()
 {
     scoped_spinlock<> lock( mutex_ );
+    regmap_.invalidate();
     return write( std::array< uint8_t, 1 >{ AD5593R_REG_RESET } );
 }
 
@@ -396,21 +397,46 @@ AD5593::fetch()
     scoped_spinlock<> lock( mutex_ );
     
     uint32_t failed(0);
-    size_t i = 0;
+    constexpr size_t count = sizeof( __fetch_reg_list ) / sizeof( __fetch_reg_list[ 0 ] );
+
+    // registers held in the cache do not go to the bus; the rest are queued at once, and go out in batches
+    // the scheduler interleaves with other devices; one that failed is retried alone
+    std::array< uint8_t, count > regs;
+    std::array< std::array< uint8_t, 2 >, count > data;
+#if !defined __linux
+    std::array< stm32f103::i2c_request, count > requests;
+#endif
+    uint32_t queued(0);
+    for ( size_t i = 0; i < count; ++i ) {
+        if ( regmap_.valid( __fetch_reg_list[ i ] ) )
+            continue;
+        queued |= 1 << i;
+        regs[ i ] = register_map::read_pointer( __fetch_reg_list[ i ] );
+#if !defined __linux
+        new ( &requests[ i ] ) stm32f103::i2c_request( device_, stm32f103::I2C_PRIORITY_NORMAL, address_
+                                                      , &regs[ i ], 1, data[ i ].data(), data[ i ].size() );
+        i2c_->scheduler().submit( requests[ i ] );
+#endif
+    }
 
-    for ( auto reg: __fetch_reg_list ) {
-        std::array< uint8_t, 2 > data;
-        if ( read( AD5593R_MODE_REG_READBACK | reg, data ) ) {
-            bitmaps_[ i++ ] = data[ 1 ];
+    for ( size_t i = 0; i < count; ++i ) {
+        auto reg = __fetch_reg_list[ i ];
+        if ( ( queued & ( 1 << i ) ) == 0 ) {
+            bitmaps_[ i ] = regmap_.value( reg );
+#if defined __linux
+        } else if ( read( regs[ i ], data[ i ] ) ) {
+#else
+        } else if ( i2c_->scheduler().wait( requests[ i ] ) || read( regs[ i ], data[ i ] ) ) {
+#endif
+            regmap_.fill( reg, uint16_t( data[ i ][ 0 ] ) << 8 | data[ i ][ 1 ] );
+            bitmaps_[ i ] = data[ i ][ 1 ];
         } else {
             stream(__FILE__,__LINE__) << "fetch failed to read " << __fetch_reg_name[ i ] << std::endl;
             failed |= 1 << i;
-            bitmaps_[ i++ ] = uint16_t( -1 );
+            bitmaps_[ i ] = uint16_t( -1 );
         }
     }
 
-    dirty_ = !failed;
-
     if ( failed == 0 ) {
         for ( int pin = 0; pin < number_of_pins; ++pin )
             functions_[ pin ] = io_function()( bitmaps_, pin );
@@ -424,15 +450,11 @@ AD5593::commit()
 {
     scoped_spinlock<> lock( mutex_ );
 
-    size_t i = 0;
-    for ( auto reg: __fetch_reg_list ) {
-        auto x = bitmaps_[ i++ ].to_ulong();
-        if ( ! write( std::array< uint8_t, 3 >{ uint8_t( AD5593R_MODE_CONF | reg ), uint8_t( x >> 8 ), uint8_t( x ) } ) ) {
-            i2c_->print_result( stream(__FILE__,__LINE__,__FUNCTION__) ) << std::endl;
-            return false;
-        }
+    // registers that set_function() did not change are not written
+    if ( ! regmap_.commit( *this ) ) {
+        i2c_->print_result( stream(__FILE__,__LINE__,__FUNCTION__) ) << std::endl;
+        return false;
     }
-    dirty_ = false;
     return true;
 }
 
@@ -491,16 +513,15 @@ bool
 AD5593::set_adc_sequence( uint16_t sequence )
 {
     scoped_spinlock<> lock( mutex_ );
-    return write( std::array< uint8_t, 3 >{ AD5593R_REG_ADC_SEQ, uint8_t( sequence >> 8 ), uint8_t( sequence ) } );
+    return regmap_.write( AD5593R_REG_ADC_SEQ, sequence ) && regmap_.commit( *this, AD5593R_REG_ADC_SEQ, 1 );
 }
 
 uint16_t
 AD5593::adc_sequence() const
 {
-    std::array< uint8_t, 2 > data;
-    if ( read( AD5593R_MODE_REG_READBACK | AD5593R_REG_ADC_SEQ, data ) ) {
-        return uint16_t( data[0] ) << 8 | data[1];
-    }
+    uint16_t sequence;
+    if ( regmap_.read( *this, AD5593R_REG_ADC_SEQ, sequence ) )
+        return sequence;
     return (-1);
 }
 
@@ -539,6 +560,10 @@ AD5593::print_config( stream&& o ) const
             o << "pin #" << pin << " = " << functions_[ pin ] << ( pin == 3 ? "\n" : "\t" );
     }
     o << std::endl;
+
+    auto& stat = regmap_.stat();
+    o << "cache: hits " << int( stat.hits ) << ", bus reads " << int( stat.reads )
+      << ", writes " << int( stat.writes ) << ", unchanged " << int( stat.suppressed ) << std::endl;
 }
 
 void
@@ -11,6 +11,7 @@
 
 #pragma once
 
+#include "i2c_regmap.hpp"
 #include <array>
 #include <atomic>
 #include <bitset>
@@ -48,6 +49,22 @@ namespace ad5593 {
     constexpr size_t number_of_pins = 8;
     constexpr size_t number_of_functions = nFunctions - 1;
 
+    // control registers for the register cache (i2c_regmap.hpp); 16 bit, one per transaction.
+    // Configuration registers only change when written.  DAC readback selects what the next read returns,
+    // power down is written directly by 'ad5593 pd', and reset is a command.
+    struct register_map {
+        typedef uint16_t value_type;
+        static constexpr uint8_t first = 0x0;
+        static constexpr size_t size = 0x10;
+        static constexpr bool burst_read = false;
+        static constexpr stm32f103::I2C_REGMAP_WRITE write_mode = stm32f103::I2C_REGMAP_WRITE_SINGLE;
+        static constexpr uint8_t read_pointer( uint8_t reg ) { return 0x70 | reg; }   // register readback mode
+        static constexpr uint8_t write_pointer( uint8_t reg ) { return reg; }         // configuration mode
+        static constexpr stm32f103::I2C_REGISTER_KIND kind( uint8_t reg ) {
+            return ( reg >= 0x2 && reg <= 0xd && reg != 0xb ) ? stm32f103::I2C_REGISTER_CACHED : stm32f103::I2C_REGISTER_VOLATILE;
+        }
+    };
+
     class AD5593 {
         std::array< AD5593R_IO_FUNCTION, number_of_pins > functions_;
         std::array< std::bitset< number_of_pins >, number_of_functions > bitmaps_;
@@ -56,9 +73,11 @@ namespace ad5593 {
         std::unique_ptr< i2c_linux::i2c > i2c_;
 #else
         stm32f103::i2c * i2c_;
+        uint8_t device_;      // i2c scheduler device id
 #endif
-        bool dirty_;
+        mutable stm32f103::i2c_regmap< register_map > regmap_;
         const int address_;
+        void stage();
     public:
 #if defined __linux
         AD5593( const char * device = "/dev/i2c-2", int address = 0x10 );
@@ -71,7 +90,8 @@ namespace ad5593 {
 
         operator bool () const;
 
-        inline bool is_dirty() const { return dirty_; }
+        inline bool is_dirty() const { return regmap_.dirty(); }
+        inline const stm32f103::i2c_regmap_statistics& regmap_statistics() const { return regmap_.stat(); }
 
         bool write( const uint8_t *, size_t size ) const;
         bool read( uint8_t addr, uint8_t *, size_t size ) const;
@@ -5,6 +5,11 @@
 //
 
 #include "adc.hpp"
+#include "adc_calibration.hpp"
+#include "adc_filter.hpp"
+#include "bkp.hpp"
+#include "buffer_pool.hpp"
+#include "cycle_counter.hpp"
 #include "dma.hpp"
 #include "dma_channel.hpp"
 #include "scoped_spinlock.hpp"
@@ -24,12 +29,63 @@ extern "C" {
 namespace stm32f103 {
     static dma_channel_t< DMA_ADC1 > * __dma_adc1;
     static uint8_t __adc1_dma[ sizeof( dma_channel_t< DMA_ADC1 > ) ];
-    static std::array< uint16_t, 4 > __adc1_data;
-    static std::array< uint32_t, 4 > __adc1_accumulated_data;
+    static std::array< uint16_t, adc::number_of_channels > __adc1_data;
+    static std::array< uint16_t, adc::number_of_channels > __adc1_filtered;
+    static std::array< adc_filter_chain, adc::max_filtered_channels > __adc1_filters;
+    static std::array< adc_filter_chain *, adc::number_of_channels > __adc1_filter_of; // chain of each channel
+    static adc_calibration __adc1_calibration;
+    static uint32_t __adc1_vref_sum;
+    static adc::capture_type __adc1_capture;
+    static size_t __adc1_capture_channel;
+    static adc::averager_type __adc1_averager;
+    static size_t __adc1_averager_channel;
+    static std::array< uint32_t, adc::number_of_channels > __adc1_accumulated_data;
     static uint32_t __number_of_adc_samples;
     static constexpr uint32_t __number_of_accumulation = 4096;
+    static std::atomic< uint16_t * > __capture_data;
+    static std::atomic< size_t > __capture_count;
+    static size_t __capture_size;
+    static size_t __capture_channel;
+    // block stream; __block_fill is owned by the DMA callback, full blocks are queued to the thread
+    static std::atomic< bool > __block_stream;
+    static size_t __block_channel;
+    static size_t __block_samples;
+    static uint16_t * __block_fill;
+    static size_t __block_fill_count;
+    static std::array< uint16_t *, 4 > __block_queue;
+    static std::atomic< uint32_t > __block_head;    // thread only
+    static std::atomic< uint32_t > __block_tail;    // DMA callback only
+    static std::atomic< uint32_t > __block_lost;
+
+    static void
+    block_stream_push( uint16_t x )
+    {
+        auto& pool = shared_buffer_pool();
+        if ( __block_fill == nullptr ) {
+            __block_fill = reinterpret_cast< uint16_t * >( pool.allocate( __block_samples * sizeof( uint16_t ) ) );
+            __block_fill_count = 0;
+            if ( __block_fill == nullptr ) {
+                ++__block_lost;
+                return;
+            }
+        }
+        __block_fill[ __block_fill_count++ ] = x;
+        if ( __block_fill_count == __block_samples ) {
+            const uint32_t tail = __block_tail.load();
+            if ( tail - __block_head.load() < __block_queue.size() ) {
+                __block_queue[ tail % __block_queue.size() ] = __block_fill;
+                __block_tail = tail + 1; // publish
+            } else {
+                pool.release( __block_fill );
+                __block_lost += __block_samples;
+            }
+            __block_fill = nullptr;
+        }
+    }
 };
 
+extern std::atomic< uint32_t > atomic_milliseconds;
+
 
 extern stm32f103::dma __dma0;
 
@@ -49,7 +105,11 @@ adc::~adc()
 void
 adc::attach( dma& dma )
 {
-    __dma_adc1 = new (&__adc1_dma) dma_channel_t< DMA_ADC1 >( dma, 0, 0 );
+    if ( !dma.acquire( DMA_ADC1, ADC1_BASE, DMA_PL_HIGH ) ) {
+        stream() << "adc: DMA channel " << int( DMA_ADC1 + 1 ) << " is owned by " << dma.owner( DMA_ADC1 ) << std::endl;
+        return;
+    }
+    __dma_adc1 = new (&__adc1_dma) dma_channel_t< DMA_ADC1 >( dma, 0, 0, ADC1_BASE );
     __dma_adc1->set_receive_buffer( reinterpret_cast< uint8_t * >(__adc1_data.data()), size_t( __adc1_data.size() ) );
 
     adc_->CR1 |= (1 << 8); // SCAN conv mode
@@ -57,33 +117,72 @@ adc::attach( dma& dma )
     adc_->CR2 |= 0x01 << 1;  // Continuous conversion mode
     adc_->CR2 |= 0x01 << 8;  // DMA enable
 
-    constexpr uint8_t sample_time = 07; // 239.5 cycles
+    adc_->CR2 |= 0x01 << 23; // TSVREFE, temperature sensor and Vrefint enable (p241)
+
+    constexpr uint8_t sample_time = 07; // 239.5 cycles (17.1us min. for temperature sensor)
     uint32_t smpr = 0;
-    for ( size_t i = 0; i < __adc1_data.size(); ++i )
+    for ( size_t i = 0; i < number_of_inputs; ++i )
         smpr |= sample_time << (3*i);
     adc_->SMPR2 |= smpr;
+    adc_->SMPR1 |= ( sample_time << 18 ) | ( sample_time << 21 ); // IN16, IN17
 
-    adc_->SQR1 = (3 << 20);  // p246, Regular channel sequence length [23:20] = 3 (4-1 channels to be converted)
+    adc_->SQR1 = (5 << 20);  // p246, Regular channel sequence length [23:20] = 5 (6-1 channels to be converted)
     adc_->SQR2 = 0;          // p247, Regular channel sequence, 12th down to 7th
-    adc_->SQR3 = 0|(1<<5)|(2<<10)|(3<<15);      // p248, Regular channel sequence [0->1->2->3]
+    uint32_t sqr3 = 0;
+    for ( size_t i = 0; i < number_of_channels; ++i )
+        sqr3 |= uint32_t( scan_sequence[ i ] ) << ( 5 * i );
+    adc_->SQR3 = sqr3;       // p248, Regular channel sequence [0->1->2->3->16->17]
+
+    if ( !load_calibration() )
+        __adc1_calibration.reset();
 
     auto callback = +[]( uint32_t flag ){
         if ( flag & 02 ) { // transfer complete
+            for ( size_t i = 0; i < __adc1_data.size(); ++i ) {
+                auto chain = __adc1_filter_of[ i ];
+                __adc1_filtered[ i ] = chain && chain->enabled ? ( *chain )( __adc1_data[ i ] ) : __adc1_data[ i ];
+            }
+
+            if ( auto capture = __capture_data.load() ) {
+                size_t count = __capture_count.load();
+                if ( count < __capture_size ) {
+                    capture[ count ] = __adc1_filtered[ __capture_channel ];
+                    __capture_count = count + 1;
+                }
+            }
+
+            // ratiometric factors follow 64 scans average of Vrefint
+            __adc1_vref_sum += __adc1_data[ vrefint_channel ];
+            if ( ( __number_of_adc_samples & 63 ) == 63 ) {
+                __adc1_calibration.update( __adc1_vref_sum );
+                __adc1_vref_sum = 0;
+            }
+
+            if ( __block_stream.load() )
+                block_stream_push( __adc1_filtered[ __block_channel ] );
+
+            if ( __adc1_averager.enabled() )
+                __adc1_averager.push( __adc1_filtered[ __adc1_averager_channel ], cycle_counter::now() );
+
+            auto state = __adc1_capture.state();
+            if ( state == dsp::capture_armed || state == dsp::capture_triggered )
+                __adc1_capture.push( __adc1_filtered[ __adc1_capture_channel ] );
+
             if ( ( __number_of_adc_samples++ % __number_of_accumulation ) == 0 ) {
-                std::copy( __adc1_data.begin(), __adc1_data.end(), __adc1_accumulated_data.begin() );
+                std::copy( __adc1_filtered.begin(), __adc1_filtered.end(), __adc1_accumulated_data.begin() );
             } else {
-                std::transform( __adc1_data.begin(), __adc1_data.end()
+                std::transform( __adc1_filtered.begin(), __adc1_filtered.end()
                                 , __adc1_accumulated_data.begin(), __adc1_accumulated_data.begin()
                                 , [](const uint16_t& b, const uint32_t& a){ return a + b; } );
             }
 
             if ( ( __number_of_adc_samples % __number_of_accumulation ) == ( __number_of_accumulation - 1 ) ) {
-                int i = 0;
-                for ( const auto& a: __adc1_accumulated_data ) {
-                    stream() << "[" << i << "]:" << int( a / __number_of_accumulation ) << "\t";
-                    ++i;
+                for ( size_t i = 0; i < number_of_inputs; ++i ) {
+                    auto raw = uint16_t( __adc1_accumulated_data[ i ] / __number_of_accumulation );
+                    stream() << "[" << int( i ) << "]:" << int( raw ) << " " << ( __adc1_calibration.microvolts( i, raw ) / 1000 ) << "mV\t";
                 }
-                stream() << std::endl;
+                auto temp = __adc1_calibration.centidegree( uint16_t( __adc1_accumulated_data[ temperature_channel ] / __number_of_accumulation ) );
+                stream() << "T:" << ( temp / 100 ) << "C\tVdda:" << ( __adc1_calibration.supply_microvolts() / 1000 ) << "mV" << std::endl;
             }
         }
     };
@@ -103,6 +202,7 @@ adc::init( PERIPHERAL_BASE base )
     // RM0008, p251, ADC register map
     lock_.clear();
     flag_ = false;
+    __adc1_calibration.reset(); // nominal until attach() loads from backup registers
 
     if ( auto ADC = reinterpret_cast< stm32f103::ADC * >( base ) ) {
 
@@ -138,6 +238,245 @@ adc::enable( bool onoff )
         __dma_adc1->enable( onoff );    
 }
 
+size_t
+adc::acquire( uint16_t * data, size_t size, size_t channel, uint32_t timeout_ms )
+{
+    if ( __dma_adc1 == nullptr || channel >= __adc1_data.size() )
+        return 0;
+
+    __capture_size = size;
+    __capture_channel = channel;
+    __capture_count = 0;
+    __capture_data = data; // arm
+
+    uint32_t tp = atomic_milliseconds.load();
+    while ( __capture_count.load() < size && ( atomic_milliseconds.load() - tp ) < timeout_ms )
+        ;
+
+    __capture_data = nullptr;
+    return __capture_count.load();
+}
+
+bool
+adc::start_block_stream( size_t channel, size_t samples )
+{
+    if ( __dma_adc1 == nullptr || channel >= __adc1_data.size()
+         || samples == 0 || samples * sizeof( uint16_t ) > buffer_pool_type::max_size )
+        return false;
+    stop_block_stream();
+    __block_channel = channel;
+    __block_samples = samples;
+    __block_lost = 0;
+    __block_stream = true;
+    return true;
+}
+
+void
+adc::stop_block_stream()
+{
+    // the DMA callback runs to completion ahead of the thread, so it is out of block_stream_push() from here on
+    __block_stream = false;
+    auto& pool = shared_buffer_pool();
+    if ( __block_fill ) {
+        pool.release( __block_fill );
+        __block_fill = nullptr;
+    }
+    while ( auto p = take_block() )
+        pool.release( p );
+}
+
+const uint16_t *
+adc::take_block( uint32_t timeout_ms )
+{
+    uint32_t tp = atomic_milliseconds.load();
+    uint32_t head = __block_head.load();
+    while ( head == __block_tail.load() ) {
+        if ( ( atomic_milliseconds.load() - tp ) >= timeout_ms )
+            return nullptr;
+    }
+    auto p = __block_queue[ head % __block_queue.size() ];
+    __block_head = head + 1;
+    return p;
+}
+
+uint32_t
+adc::block_stream_lost() const
+{
+    return __block_lost.load();
+}
+
+adc_filter_chain *
+adc::filter( size_t channel )
+{
+    return channel < __adc1_filter_of.size() ? __adc1_filter_of[ channel ] : nullptr;
+}
+
+adc_filter_chain *
+adc::assign_filter( size_t channel )
+{
+    if ( channel >= __adc1_filter_of.size() )
+        return nullptr;
+    if ( auto chain = __adc1_filter_of[ channel ] )
+        return chain;
+    for ( auto& chain: __adc1_filters ) {
+        if ( std::find( __adc1_filter_of.begin(), __adc1_filter_of.end(), &chain ) == __adc1_filter_of.end() ) {
+            chain.clear();
+            __adc1_filter_of[ channel ] = &chain;   // disabled; the DMA callback passes the channel through
+            return &chain;
+        }
+    }
+    return nullptr;
+}
+
+void
+adc::release_filter( size_t channel )
+{
+    if ( channel < __adc1_filter_of.size() ) {
+        if ( auto chain = __adc1_filter_of[ channel ] ) {
+            __adc1_filter_of[ channel ] = nullptr;  // the DMA callback no longer sees it
+            chain->clear();
+        }
+    }
+}
+
+adc_calibration&
+adc::calibration()
+{
+    return __adc1_calibration;
+}
+
+// backup data register layout; medium-density devices have DR[0..9] (BKP_DR1..DR10) only, and DR[0] is used by rtc.
+// The offsets are stored as bytes, two to a register; the temperature slope is the datasheet value, not stored.
+namespace stm32f103 {
+    enum adc_bkp_index : size_t {
+        bkp_adc_magic = 1
+        , bkp_adc_vrefint
+        , bkp_adc_v25
+        , bkp_adc_offset  // 2 words
+        , bkp_adc_gain = bkp_adc_offset + adc_calibration::number_of_inputs / 2 // 4 words
+        , bkp_adc_end = bkp_adc_gain + adc_calibration::number_of_inputs
+    };
+    static_assert( bkp_adc_end <= 10, "ADC calibration must fit in BKP_DR2..DR10" );
+    constexpr uint16_t adc_bkp_magic = 0xadc2;
+}
+
+void
+adc::lock_calibration( bool lock )
+{
+    if ( __dma_adc1 ) {
+        if ( lock )
+            disable_interrupt( DMA1_Channel1_IRQn );
+        else
+            enable_interrupt( DMA1_Channel1_IRQn );
+    }
+}
+
+bool
+adc::load_calibration()
+{
+    if ( bkp::data( bkp_adc_magic ) != adc_bkp_magic )
+        return false;
+    auto& c = __adc1_calibration;
+    lock_calibration( true );
+    const auto vref_raw = c.factors().vref_raw;
+    c.reset();  // defaults for what is not stored, or is not valid
+    if ( auto vrefint = bkp::data( bkp_adc_vrefint ) )
+        c.vrefint_dmv = vrefint;
+    if ( auto v25 = bkp::data( bkp_adc_v25 ) )
+        c.v25_dmv = v25;
+    for ( size_t i = 0; i < c.number_of_inputs; ++i ) {
+        c.offset[ i ] = int8_t( bkp::data( bkp_adc_offset + i / 2 ) >> ( 8 * ( i % 2 ) ) );
+        if ( auto gain = bkp::data( bkp_adc_gain + i ) )
+            c.gain[ i ] = gain;
+    }
+    c.update( vref_raw ? vref_raw : uint32_t( ( uint64_t( c.vrefint_dmv ) * 4095 * 64 ) / 33000 ) );
+    lock_calibration( false );
+    return true;
+}
+
+void
+adc::save_calibration()
+{
+    const auto& c = __adc1_calibration;
+    bkp::set_data( bkp_adc_vrefint, uint16_t( c.vrefint_dmv ) );
+    bkp::set_data( bkp_adc_v25, uint16_t( c.v25_dmv ) );
+    for ( size_t i = 0; i < c.number_of_inputs; i += 2 )
+        bkp::set_data( bkp_adc_offset + i / 2, uint16_t( uint8_t( c.offset[ i ] ) | uint8_t( c.offset[ i + 1 ] ) << 8 ) );
+    for ( size_t i = 0; i < c.number_of_inputs; ++i )
+        bkp::set_data( bkp_adc_gain + i, uint16_t( c.gain[ i ] ) );
+    bkp::set_data( bkp_adc_magic, uint16_t( adc_bkp_magic ) );
+}
+
+adc::capture_type&
+adc::capture()
+{
+    return __adc1_capture;
+}
+
+bool
+adc::set_capture_channel( size_t channel )
+{
+    if ( channel >= __adc1_data.size() )
+        return false;
+    __adc1_capture_channel = channel;
+    return true;
+}
+
+size_t
+adc::capture_channel() const
+{
+    return __adc1_capture_channel;
+}
+
+adc::averager_type&
+adc::averager()
+{
+    return __adc1_averager;
+}
+
+bool
+adc::set_averager_channel( size_t channel )
+{
+    if ( channel >= __adc1_data.size() )
+        return false;
+    __adc1_averager_channel = channel;
+    return true;
+}
+
+size_t
+adc::averager_channel() const
+{
+    return __adc1_averager_channel;
+}
+
+bool
+adc::set_watchdog( size_t channel, uint16_t low, uint16_t high )
+{
+    // RM0008, 11.3.7 Analog watchdog, p221
+    if ( !adc_ || channel >= number_of_channels || low > high || high > 0x0fff )
+        return false;
+    const uint32_t input = scan_sequence[ channel ];    // AWDCH takes the ADC input number, not the scan index
+
+    adc_->CR1 &= ~( ( 1 << 23 ) | ( 1 << 6 ) );         // AWDEN, AWDIE
+    adc_->HTR = high;
+    adc_->LTR = low;
+    adc_->CR1 = ( adc_->CR1 & ~0x1f ) | input | ( 1 << 9 ); // AWDCH[4:0], AWDSGL (single channel)
+    adc_->CR1 |= ( 1 << 23 );                           // AWDEN on regular channels
+    return true;
+}
+
+void
+adc::enable_watchdog( bool enable )
+{
+    if ( adc_ ) {
+        adc_->SR &= ~1;                                 // clear AWD (rc_w0)
+        if ( enable )
+            adc_->CR1 |= ( 1 << 6 );                    // AWDIE
+        else
+            adc_->CR1 &= ~( 1 << 6 );
+    }
+}
+
 uint32_t
 adc::cr2() const
 {
@@ -168,6 +507,12 @@ adc::data()
 void
 adc::handle_interrupt()
 {
+    if ( adc_->SR & 01 ) { // analog watchdog
+        adc_->CR1 &= ~( 1 << 6 ); // one shot; enable_watchdog( true ) to re-arm
+        adc_->SR &= ~1;
+        __adc1_capture.trigger();
+    }
+
     scoped_spinlock<> lock( lock_ );     
 
     data_ = adc_->DR;
@@ -4,6 +4,8 @@
 // Contact: toshi.hondo@qtplatz.com
 //
 
+#include "averager.hpp"
+#include "capture.hpp"
 #include <atomic>
 #include <cstdint>
 #include <cstddef>
@@ -14,6 +16,8 @@ namespace stm32f103 {
     enum PERIPHERAL_BASE : uint32_t;
 
     class dma;
+    struct adc_filter_chain;
+    struct adc_calibration;
 
     class adc {
         adc( const adc& ) = delete;
@@ -26,6 +30,20 @@ namespace stm32f103 {
         ~adc();
         void init( PERIPHERAL_BASE );
     public:
+        // ADCCLK = 72MHz/6, 239.5 + 12.5 cycles per conversion, 6 conversions per scan
+        // scan sequence: IN0, IN1, IN2, IN3, temperature sensor (IN16), Vrefint (IN17)
+        static constexpr uint32_t adc_clock = 72'000'000 / 6;
+        static constexpr uint32_t conversion_cycles = 252;
+        static constexpr size_t number_of_inputs = 4;
+        static constexpr size_t temperature_channel = 4; // index in scan sequence
+        static constexpr size_t vrefint_channel = 5;     // index in scan sequence
+        static constexpr size_t number_of_channels = 6;
+        static constexpr uint8_t scan_sequence[ number_of_channels ] = { 0, 1, 2, 3, 16, 17 }; // ADC input number of each index
+        static constexpr uint32_t sampling_rate_mhz = uint32_t( uint64_t( adc_clock ) * 1000 / ( conversion_cycles * number_of_channels ) ); // mHz
+
+        typedef dsp::triggered_capture< uint16_t, 512 > capture_type;
+        typedef dsp::ensemble_averager< 64 > averager_type;     // two 64 word sums resident
+
         void attach( dma& );
         operator bool () const { return adc_; }
 
@@ -37,6 +55,52 @@ namespace stm32f103 {
 
         void enable( bool );
 
+        // copy 'size' consecutive scans of 'channel' from the DMA stream; returns number of samples acquired
+        size_t acquire( uint16_t * data, size_t size, size_t channel, uint32_t timeout_ms = 1000 );
+
+        // block stream of 'channel' (after filter): the DMA callback fills shared pool blocks of 'samples' and
+        // hands each full block over as is.  take_block() passes the block's reference to the caller, who
+        // releases it to shared_buffer_pool(); nullptr if no block is ready within 'timeout_ms'
+        bool start_block_stream( size_t channel, size_t samples );
+        void stop_block_stream();
+        const uint16_t * take_block( uint32_t timeout_ms = 0 );
+        uint32_t block_stream_lost() const; // samples lost to pool exhaustion or a slow consumer
+
+        // filter chains applied in the DMA callback, before acquire and accumulation; up to max_filtered_channels
+        // channels have one.  filter() is the chain of 'channel', nullptr if none; assign_filter() takes a free
+        // chain for it (nullptr if all are taken), release_filter() clears the chain and frees it
+        static constexpr size_t max_filtered_channels = 2;
+        adc_filter_chain * filter( size_t channel );
+        adc_filter_chain * assign_filter( size_t channel );
+        void release_filter( size_t channel );
+
+        // ratiometric/gain/offset calibration; constants are persistent in backup registers
+        adc_calibration& calibration();
+        bool load_calibration();
+        void save_calibration();
+        // f( calibration() ) with the DMA callback, which updates the conversion factors, masked
+        template< typename F > void modify_calibration( F f ) {
+            lock_calibration( true );
+            f( calibration() );
+            lock_calibration( false );
+        }
+        void lock_calibration( bool );
+
+        // triggered capture on a channel, fed from the DMA callback (after filter)
+        capture_type& capture();
+        bool set_capture_channel( size_t channel );
+        size_t capture_channel() const;
+
+        // ensemble averager on a channel, fed from the DMA callback (after filter); time stamps are CPU cycles
+        averager_type& averager();
+        bool set_averager_channel( size_t channel );
+        size_t averager_channel() const;
+
+        // analog watchdog on a single regular channel (index in scan sequence, as capture_channel());
+        // an event triggers capture() and disarms the watchdog
+        bool set_watchdog( size_t channel, uint16_t low, uint16_t high );
+        void enable_watchdog( bool );
+
         void handle_interrupt();
         static void interrupt_handler( adc * _this );
         static adc * instance();
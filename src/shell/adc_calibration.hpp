@@ -0,0 +1,131 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Ratiometric (Vrefint) correction, per channel gain/offset and die temperature.
+// Conversion factors are recomputed by update() when a new Vrefint average is available,
+// so that microvolts()/centidegree() need neither division nor floating point.
+// update() runs in the ADC DMA callback; it publishes the factors under a sequence counter, and readers take a
+// consistent copy with factors().  The persistent constants are changed by the thread only with the callback
+// masked (adc::modify_calibration), so that update() never sees them half written.
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace stm32f103 {
+
+    struct adc_factors {
+        uint32_t vref_raw;                                 // Vrefint in counts (x 1/64)
+        uint32_t lsb_q16;                                  // uV per LSB, Q16 (ratiometric, unity gain)
+        std::array< uint32_t, 4 > scale_q16;               // uV per LSB, Q16, gain applied
+        uint32_t slope_q16;                                // 0.01C per uV, Q16
+    };
+
+    struct adc_calibration {
+        static constexpr size_t number_of_inputs = 4;
+        static constexpr uint16_t unity_gain = 0x8000; // Q15
+        static_assert( sizeof( adc_factors::scale_q16 ) == number_of_inputs * sizeof( uint32_t ), "adc_factors::scale_q16" );
+
+        // persistent constants (DS5319, 5.3.4 and 5.3.19 typical values as default)
+        uint16_t vrefint_dmv;   // Vrefint in 0.1mV, 1.20V typ.
+        uint16_t v25_dmv;       // temperature sensor voltage at 25C in 0.1mV, 1.43V typ.
+        uint16_t slope_uv;      // temperature sensor average slope in uV/C, 4.3mV/C typ.
+        std::array< int16_t, number_of_inputs > offset;   // raw counts, -128..127 (a byte in the backup register)
+        std::array< uint16_t, number_of_inputs > gain;    // Q15
+
+    private:
+        // derived, updated by update()
+        adc_factors factors_;
+        std::atomic< uint32_t > sequence_;                 // odd while update() is writing factors_
+
+    public:
+        constexpr adc_calibration() : vrefint_dmv( 12000 ), v25_dmv( 14300 ), slope_uv( 4300 )
+                                    , offset{ { 0, 0, 0, 0 } }
+                                    , gain{ { unity_gain, unity_gain, unity_gain, unity_gain } }
+                                    , factors_{ 0, 0, {}, 0 }, sequence_( 0 ) {
+        }
+
+        // vref_sum is the sum of 64 Vrefint conversions
+        void update( uint32_t vref_sum ) {
+            if ( vref_sum == 0 )
+                return;
+            const uint32_t sequence = sequence_.load( std::memory_order_relaxed );
+            sequence_.store( sequence + 1, std::memory_order_relaxed );
+            std::atomic_thread_fence( std::memory_order_release );
+            factors_.vref_raw = vref_sum;
+            factors_.lsb_q16 = uint32_t( ( uint64_t( vrefint_dmv ) * 100 << ( 16 + 6 ) ) / vref_sum );
+            for ( size_t i = 0; i < number_of_inputs; ++i )
+                factors_.scale_q16[ i ] = uint32_t( ( uint64_t( factors_.lsb_q16 ) * gain[ i ] ) >> 15 );
+            factors_.slope_q16 = slope_uv ? ( 100u << 16 ) / slope_uv : 0;
+            sequence_.store( sequence + 2, std::memory_order_release );
+        }
+
+        // consistent copy; retried if update() has run meanwhile
+        adc_factors factors() const {
+            adc_factors f;
+            uint32_t sequence;
+            do {
+                while ( ( sequence = sequence_.load( std::memory_order_acquire ) ) & 1 )
+                    ;
+                f = factors_;
+                std::atomic_thread_fence( std::memory_order_acquire );
+            } while ( sequence_.load( std::memory_order_relaxed ) != sequence );
+            return f;
+        }
+
+        // nominal 3.3V supply, used until Vrefint has been sampled
+        void reset() {
+            vrefint_dmv = 12000;
+            v25_dmv = 14300;
+            slope_uv = 4300;
+            offset.fill( 0 );
+            gain.fill( unity_gain );
+            update( uint32_t( ( uint64_t( 12000 ) * 4095 * 64 ) / 33000 ) );
+        }
+
+        inline int32_t microvolts( size_t ch, uint16_t raw ) const {
+            return int32_t( ( int64_t( int32_t( raw ) - offset[ ch ] ) * factors().scale_q16[ ch ] ) >> 16 );
+        }
+
+        inline int32_t supply_microvolts() const {
+            return int32_t( ( uint64_t( factors().lsb_q16 ) * 4095 ) >> 16 );
+        }
+
+        inline int32_t centidegree( uint16_t raw ) const {
+            const auto f = factors();
+            int32_t vsense = int32_t( ( uint64_t( f.lsb_q16 ) * raw ) >> 16 );
+            return 2500 + int32_t( ( int64_t( int32_t( v25_dmv ) * 100 - vsense ) * f.slope_q16 ) >> 16 );
+        }
+
+        // two point fit: raw1 -> uv1, raw2 -> uv2 (raw in counts x 1/64); returns false if degenerated
+        // the callback must be masked (adc::modify_calibration)
+        bool fit( size_t ch, uint32_t raw1, int32_t uv1, uint32_t raw2, int32_t uv2 ) {
+            const auto f = factors();
+            if ( ch >= number_of_inputs || raw1 == raw2 || f.lsb_q16 == 0 )
+                return false;
+            // actual uV/LSB = (uv2 - uv1) * 64 / (raw2 - raw1); gain = actual / lsb
+            int64_t num = int64_t( uv2 - uv1 ) * 64 << ( 16 + 15 );
+            int64_t den = ( int64_t( raw2 ) - int64_t( raw1 ) ) * f.lsb_q16;
+            int64_t g = num / den;
+            if ( g <= 0 || g > 0xffff )
+                return false;
+            const uint32_t scale = uint32_t( ( uint64_t( f.lsb_q16 ) * g ) >> 15 );
+            // offset = raw1 - uv1 / scale
+            int64_t o = ( int64_t( raw1 ) - ( ( int64_t( uv1 ) << ( 16 + 6 ) ) / scale ) + 32 ) >> 6;
+            if ( o < -0x80 || o > 0x7f )
+                return false;
+            gain[ ch ] = uint16_t( g );
+            offset[ ch ] = int16_t( o );
+            update( f.vref_raw );
+            return true;
+        }
+    };
+
+}
@@ -0,0 +1,675 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "adc.hpp"
+#include "adc_calibration.hpp"
+#include "adc_filter.hpp"
+#include "buffer_pool.hpp"
+#include "cycle_counter.hpp"
+#include "dma.hpp"
+#include "exti.hpp"
+#include "fft.hpp"
+#include "filter.hpp"
+#include "gpio_mode.hpp"
+#include "stm32f103.hpp"
+#include "stream.hpp"
+#include "timer.hpp"
+#include "utility.hpp"
+#include <codec/rice.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+
+namespace {
+
+    dsp::trigger_mode __trigger_mode = dsp::trigger_external; // user selected mode; level is handled by the analog watchdog
+    std::atomic_bool __capture_ready;   // set by the capture callback (DMA ISR), reported by the next 'adc' command
+    std::atomic_bool __averager_published; // likewise, by the averager callback
+
+    // fixed point value (x 1/100) in decimal
+    void print_centi( stream&& o, uint32_t v )
+    {
+        o << int32_t( v / 100 ) << "." << ( ( v % 100 ) < 10 ? "0" : "" ) << int32_t( v % 100 );
+    }
+
+}
+
+void
+adc_fft( size_t argc, const char ** argv )
+{
+    // adc fft [channel] [top]
+    constexpr size_t N = 128;   // on the stack, about 1.3KB while the command runs
+    typedef dsp::fft< dsp::q31_t, N > fft_type;
+    typedef dsp::window< dsp::q31_t, N, dsp::hann > window_type;
+
+    size_t channel = 0;
+    size_t top = 5;
+    if ( argc > 1 && std::isdigit( *argv[ 1 ] ) )
+        channel = strtod( argv[ 1 ] );
+    if ( argc > 2 && std::isdigit( *argv[ 2 ] ) )
+        top = std::max( std::min( size_t( strtod( argv[ 2 ] ) ), size_t( 16 ) ), size_t( 1 ) );
+
+    uint16_t samples[ N ];
+    dsp::q31_t re[ N ], im[ N ];
+    auto mag = reinterpret_cast< uint32_t * >( im );  // N/2 lines; mag[ k ] is written after im[ k ] is read
+    dsp::spectral_line lines[ 16 ];
+
+    auto& __adc = *stm32f103::adc::instance();
+    size_t count = __adc.acquire( samples, N, channel );
+    if ( count != N ) {
+        stream() << "adc fft: acquisition failed (" << int( count ) << "/" << int( N ) << "); run 'adc dma' first" << std::endl;
+        return;
+    }
+
+    stm32f103::cycle_counter cycles;
+
+    uint32_t sum = 0;
+    for ( auto& s: samples )
+        sum += s;
+    const int32_t mean = sum / N;
+    for ( size_t i = 0; i < N; ++i ) {
+        re[ i ] = ( int32_t( samples[ i ] ) - mean ) << 18; // |x| < 0.5
+        im[ i ] = 0;
+    }
+    uint32_t t_prep = cycles.lap();
+
+    window_type::apply( re );
+    uint32_t t_window = cycles.lap();
+
+    fft_type::transform( re, im );
+    uint32_t t_fft = cycles.lap();
+
+    dsp::magnitude_spectrum( re, im, mag, N / 2 );
+    uint32_t t_mag = cycles.lap();
+
+    size_t found = dsp::find_peaks( mag, N / 2, lines, top );
+    uint32_t t_peak = cycles.lap();
+
+    constexpr uint32_t fs = stm32f103::adc::sampling_rate_mhz; // mHz
+    stream() << "adc fft ch" << int( channel ) << " N=" << int( N ) << " fs=" << int32_t( fs / 1000 ) << "Hz"
+             << " bin=" << int32_t( fs / N / 1000 ) << "Hz mean=" << mean << std::endl;
+
+    for ( size_t i = 0; i < found; ++i ) {
+        // sine amplitude in ADC counts: |X| = A/2 * coherent_gain, A = |x| << 18
+        uint64_t amp = ( ( uint64_t( lines[ i ].value ) << 14 ) * 100 ) / uint32_t( window_type::coherent_gain() );
+        stream() << "\t[" << int( i ) << "] ";
+        print_centi( stream(), uint32_t( uint64_t( lines[ i ].bin ) * fs / N / 10 ) );
+        stream() << "Hz\tamplitude ";
+        print_centi( stream(), uint32_t( amp ) );
+        stream() << std::endl;
+    }
+
+    stream() << "cycles: prep " << int32_t( t_prep ) << ", window " << int32_t( t_window )
+             << ", fft " << int32_t( t_fft ) << ", magnitude " << int32_t( t_mag )
+             << ", peak " << int32_t( t_peak ) << std::endl;
+}
+
+void
+adc_filter_bench()
+{
+    constexpr size_t N = 64;    // the buffers and filters are on the stack, about 1.6KB while the bench runs
+    dsp::q31_t x31[ N ], y31[ N ];
+    dsp::q15_t x15[ N ], y15[ N ];
+    for ( size_t i = 0; i < N; ++i ) {
+        x31[ i ] = int32_t( ( i * 2654435761u ) >> 2 ) >> 1;
+        x15[ i ] = int16_t( x31[ i ] >> 16 );
+    }
+
+    constexpr auto h31 = dsp::design::lowpass_fir< dsp::q31_t, 32 >( 0.05 );
+    constexpr auto h15 = dsp::design::lowpass_fir< dsp::q15_t, 32 >( 0.05 );
+    constexpr dsp::biquad_coefficients< dsp::q31_t > bq31 = dsp::design::make_biquad< dsp::q31_t >( dsp::design::lowpass, 0.05 );
+    constexpr dsp::biquad_coefficients< dsp::q15_t > bq15 = dsp::design::make_biquad< dsp::q15_t >( dsp::design::lowpass, 0.05 );
+
+    dsp::fir< dsp::q31_t, 32 > fir31;
+    dsp::fir< dsp::q15_t, 32 > fir15;
+    dsp::biquad_cascade< dsp::q31_t, 4 > iir31;
+    dsp::biquad_cascade< dsp::q15_t, 4 > iir15;
+    fir31.set_coefficients( h31.data(), h31.size() );
+    fir15.set_coefficients( h15.data(), h15.size() );
+    iir31.set_coefficients( nullptr, 0 );
+    iir15.set_coefficients( nullptr, 0 );
+    for ( size_t i = 0; i < 4; ++i ) {
+        iir31.push_back( bq31 );
+        iir15.push_back( bq15 );
+    }
+
+    stm32f103::cycle_counter cycles;
+    fir31( x31, y31, N );
+    uint32_t t_fir31 = cycles.lap();
+    fir15( x15, y15, N );
+    uint32_t t_fir15 = cycles.lap();
+    iir31( x31, y31, N );
+    uint32_t t_iir31 = cycles.lap();
+    iir15( x15, y15, N );
+    uint32_t t_iir15 = cycles.lap();
+
+    stream() << "cycles/sample (N=" << int( N ) << ")" << std::endl;
+    stream() << "\tfir 32 taps    Q31: " << int32_t( t_fir31 / N ) << "\tQ15: " << int32_t( t_fir15 / N ) << std::endl;
+    stream() << "\tbiquad 4 stage Q31: " << int32_t( t_iir31 / N ) << "\tQ15: " << int32_t( t_iir15 / N ) << std::endl;
+}
+
+void
+adc_filter( size_t argc, const char ** argv )
+{
+    // adc filter [bench | ch off | ch lp Hz | ch hp Hz | ch notch Hz | ch fir Hz]
+    using stm32f103::adc_filter_chain;
+    auto& __adc = *stm32f103::adc::instance();
+
+    if ( argc == 1 ) {
+        for ( size_t ch = 0; ch < stm32f103::adc::number_of_channels; ++ch ) {
+            auto chain = __adc.filter( ch );
+            stream() << "\tch" << int( ch ) << ( chain && chain->enabled ? " on " : " off" )
+                     << "\tfir taps: " << int( chain ? chain->fir.taps() : 0 )
+                     << "\tbiquad stages: " << int( chain ? chain->iir.stages() : 0 ) << std::endl;
+        }
+        return;
+    }
+
+    if ( strcmp( argv[ 1 ], "bench" ) == 0 )
+        return adc_filter_bench();
+
+    const size_t channel = std::isdigit( *argv[ 1 ] ) ? strtod( argv[ 1 ] ) : stm32f103::adc::number_of_channels;
+    if ( channel >= stm32f103::adc::number_of_channels || argc < 3 ) {
+        stream() << "adc filter: invalid channel/arguments" << std::endl;
+        return;
+    }
+
+    if ( strcmp( argv[ 2 ], "off" ) == 0 ) {
+        __adc.release_filter( channel );
+        return;
+    }
+
+    if ( argc < 4 ) {
+        stream() << "adc filter: frequency (Hz) required" << std::endl;
+        return;
+    }
+
+    // normalized frequency; double arithmetic (soft-float) is used here only, never in the sample path
+    const double fc = double( strtod( argv[ 3 ] ) ) * 1000 / stm32f103::adc::sampling_rate_mhz;
+    if ( fc <= 0 || fc >= 0.5 ) {
+        stream() << "adc filter: frequency out of range" << std::endl;
+        return;
+    }
+
+    adc_filter_chain * chain = __adc.assign_filter( channel );
+    if ( chain == nullptr ) {
+        stream() << "adc filter: all " << int( stm32f103::adc::max_filtered_channels ) << " filter chains are in use" << std::endl;
+        return;
+    }
+
+    chain->enabled = false;
+    bool result = true;
+    if ( strcmp( argv[ 2 ], "lp" ) == 0 ) { // 4th order butterworth
+        result = chain->iir.push_back( dsp::design::make_biquad< dsp::q31_t >( dsp::design::lowpass, fc, 0.54119610 ) )
+            && chain->iir.push_back( dsp::design::make_biquad< dsp::q31_t >( dsp::design::lowpass, fc, 1.30656296 ) );
+    } else if ( strcmp( argv[ 2 ], "hp" ) == 0 ) {
+        result = chain->iir.push_back( dsp::design::make_biquad< dsp::q31_t >( dsp::design::highpass, fc, 0.54119610 ) )
+            && chain->iir.push_back( dsp::design::make_biquad< dsp::q31_t >( dsp::design::highpass, fc, 1.30656296 ) );
+    } else if ( strcmp( argv[ 2 ], "notch" ) == 0 ) {
+        result = chain->iir.push_back( dsp::design::make_biquad< dsp::q31_t >( dsp::design::notch, fc, 5.0 ) );
+    } else if ( strcmp( argv[ 2 ], "fir" ) == 0 ) {
+        auto h = dsp::design::lowpass_fir< dsp::q31_t, adc_filter_chain::max_fir_taps - 1 >( fc );
+        result = chain->fir.set_coefficients( h.data(), h.size() );
+    } else {
+        stream() << "adc filter: unknown type '" << argv[ 2 ] << "'" << std::endl;
+    }
+    if ( !result )
+        stream() << "adc filter: no room for more stages" << std::endl;
+    chain->enabled = chain->fir.taps() || chain->iir.stages();
+}
+
+void
+adc_trigger( size_t argc, const char ** argv )
+{
+    // adc trigger [off | ch level|rising|falling low high [pre] [post] | ch ext [pre] [post]]
+    static const char * modes [] = { "level", "rising", "falling", "ext" };
+    using namespace stm32f103;
+    auto& __adc = *adc::instance();
+    auto& capture = __adc.capture();
+
+    if ( argc == 1 ) {
+        static const char * states [] = { "idle", "armed", "triggered", "ready" };
+        stream() << "\tch" << int( __adc.capture_channel() ) << " " << modes[ __trigger_mode ]
+                 << " pre=" << int( capture.pre() ) << " post=" << int( capture.post() )
+                 << " state: " << states[ capture.state() ] << std::endl;
+        return;
+    }
+
+    if ( strcmp( argv[ 1 ], "off" ) == 0 ) {
+        capture.disarm();
+        __adc.enable_watchdog( false );
+        exti::detach( PB0 );
+        return;
+    }
+
+    if ( argc < 3 || !std::isdigit( *argv[ 1 ] ) || !__adc.set_capture_channel( strtod( argv[ 1 ] ) ) ) {
+        stream() << "adc trigger: invalid channel/arguments" << std::endl;
+        return;
+    }
+
+    auto it = std::find_if( modes, modes + countof( modes ), [&]( auto m ){ return strcmp( m, argv[ 2 ] ) == 0; } );
+    if ( it == modes + countof( modes ) ) {
+        stream() << "adc trigger: unknown mode '" << argv[ 2 ] << "'" << std::endl;
+        return;
+    }
+    const auto mode = dsp::trigger_mode( it - modes );
+
+    argc -= 3;
+    argv += 3;
+    uint16_t low = 0, high = 0x0fff;
+    if ( mode != dsp::trigger_external ) {
+        if ( argc < 2 ) {
+            stream() << "adc trigger: low and high thresholds required" << std::endl;
+            return;
+        }
+        low = strtod( argv[ 0 ] );
+        high = strtod( argv[ 1 ] );
+        argc -= 2;
+        argv += 2;
+    }
+    size_t pre = argc > 0 ? strtod( argv[ 0 ] ) : adc::capture_type::capacity() / 4;
+    size_t post = argc > 1 ? strtod( argv[ 1 ] ) : adc::capture_type::capacity() - pre;
+
+    auto ready = +[]{ __capture_ready = true; };
+
+    // analog watchdog (level) and EXTI (ext) are hardware events; edges are detected in software
+    const auto logic_mode = ( mode == dsp::trigger_level ) ? dsp::trigger_external : mode;
+    if ( !capture.setup( logic_mode, low, high, pre, post, ready ) ) {
+        stream() << "adc trigger: pre + post must be <= " << int( adc::capture_type::capacity() ) << std::endl;
+        return;
+    }
+
+    __adc.enable_watchdog( false );
+    exti::detach( PB0 );
+    __trigger_mode = mode;
+    __capture_ready = false;
+
+    if ( mode == dsp::trigger_level ) {
+        __adc.set_watchdog( __adc.capture_channel(), low, high );
+        capture.arm();
+        __adc.enable_watchdog( true );
+    } else if ( mode == dsp::trigger_external ) {
+        capture.arm();
+        exti::attach( PB0, EXTI_RISING, +[]{ adc::instance()->capture().trigger(); } );
+    } else {
+        capture.arm();
+    }
+    stream() << "adc trigger armed: ch" << int( __adc.capture_channel() ) << " " << *it
+             << " pre=" << int( pre ) << " post=" << int( post ) << std::endl;
+}
+
+void
+adc_capture( size_t argc, const char ** argv )
+{
+    // adc capture [arm]
+    auto& __adc = *stm32f103::adc::instance();
+    auto& capture = __adc.capture();
+
+    if ( argc > 1 && strcmp( argv[ 1 ], "arm" ) == 0 ) {
+        __capture_ready = false;
+        capture.arm();
+        if ( __trigger_mode == dsp::trigger_level )
+            __adc.enable_watchdog( true );
+        return;
+    }
+
+    // the window stays frozen until re-armed; printed a row at a time
+    uint16_t data[ 8 ];
+    if ( capture.read( data, countof( data ) ) == 0 ) {
+        stream() << "adc capture: not ready" << std::endl;
+        return;
+    }
+    const int pre = int( capture.pre() );
+    size_t size;
+    for ( size_t i = 0; ( size = capture.read( data, countof( data ), i ) ); i += size ) {
+        stream() << "\n" << ( int( i ) - pre ) << ":";
+        for ( size_t k = 0; k < size; ++k )
+            stream() << "\t" << int( data[ k ] );
+    }
+    stream() << std::endl;
+}
+
+namespace {
+
+    // sum of 64 consecutive samples on 'channel'; false on acquisition failure (a sum of 0 is valid at 0V)
+    bool adc_sum64( size_t channel, uint32_t& sum )
+    {
+        uint16_t data[ 64 ];
+        if ( stm32f103::adc::instance()->acquire( data, countof( data ), channel ) != countof( data ) )
+            return false;
+        sum = 0;
+        for ( auto& d: data )
+            sum += d;
+        return true;
+    }
+
+    struct calibration_point {
+        bool recorded;
+        uint32_t raw;   // x64
+        int32_t uv;
+    };
+
+}
+
+void
+adc_calibrate( size_t argc, const char ** argv )
+{
+    // adc calibrate [reset | ch mV | vdda mV | temp 0.01C]
+    using stm32f103::adc_calibration;
+    auto& __adc = *stm32f103::adc::instance();
+    auto& c = __adc.calibration();
+    static std::array< calibration_point, adc_calibration::number_of_inputs > points; // first point of the fit
+
+    if ( argc == 1 ) {
+        const auto f = c.factors();
+        stream() << "\tVrefint: " << int32_t( c.vrefint_dmv / 10 ) << "." << int32_t( c.vrefint_dmv % 10 ) << "mV"
+                 << "\tV25: " << int32_t( c.v25_dmv / 10 ) << "." << int32_t( c.v25_dmv % 10 ) << "mV"
+                 << "\tslope: " << int32_t( c.slope_uv ) << "uV/C" << std::endl;
+        stream() << "\tVdda: " << ( c.supply_microvolts() / 1000 ) << "mV\tLSB: " << int32_t( ( f.lsb_q16 * 1000ull ) >> 16 ) << "nV" << std::endl;
+        for ( size_t i = 0; i < c.number_of_inputs; ++i )
+            stream() << "\tch" << int( i ) << " offset: " << int32_t( c.offset[ i ] )
+                     << "\tgain(Q15): " << int32_t( c.gain[ i ] ) << std::endl;
+        uint32_t temp;
+        if ( adc_sum64( stm32f103::adc::temperature_channel, temp ) )
+            stream() << "\tT: " << ( c.centidegree( uint16_t( temp / 64 ) ) / 100 ) << "C" << std::endl;
+        return;
+    }
+
+    if ( strcmp( argv[ 1 ], "reset" ) == 0 ) {
+        __adc.modify_calibration( []( adc_calibration& c ){
+                auto vref = c.factors().vref_raw;
+                c.reset();
+                c.update( vref );
+            } );
+        points = {};
+        __adc.save_calibration();
+        return;
+    }
+
+    if ( argc < 3 ) {
+        stream() << "adc calibrate: value required" << std::endl;
+        return;
+    }
+
+    const int32_t value = strtod( argv[ 2 ] );
+
+    if ( strcmp( argv[ 1 ], "vdda" ) == 0 ) {
+        // Vrefint = Vdda * raw(Vrefint) / 4095
+        uint32_t vref;
+        if ( adc_sum64( stm32f103::adc::vrefint_channel, vref ) && vref ) {
+            __adc.modify_calibration( [&]( adc_calibration& c ){
+                    c.vrefint_dmv = uint16_t( ( uint64_t( value ) * 10 * vref ) / ( 4095 * 64 ) );
+                    c.update( vref );
+                } );
+            __adc.save_calibration();
+        }
+    } else if ( strcmp( argv[ 1 ], "temp" ) == 0 ) {
+        // V25 = Vsense + (T - 25) * slope
+        uint32_t temp;
+        if ( adc_sum64( stm32f103::adc::temperature_channel, temp ) ) {
+            int32_t vsense = int32_t( ( uint64_t( c.factors().lsb_q16 ) * temp ) >> ( 16 + 6 ) );
+            __adc.modify_calibration( [&]( adc_calibration& c ){
+                    c.v25_dmv = uint16_t( ( vsense + ( value - 2500 ) * int32_t( c.slope_uv ) / 100 ) / 100 );
+                } );
+            __adc.save_calibration();
+        }
+    } else if ( std::isdigit( *argv[ 1 ] ) ) {
+        size_t ch = strtod( argv[ 1 ] );
+        uint32_t raw;
+        if ( ch >= c.number_of_inputs || !adc_sum64( ch, raw ) ) {
+            stream() << "adc calibrate: acquisition failed (run 'adc dma' first)" << std::endl;
+            return;
+        }
+        if ( !points[ ch ].recorded ) {
+            points[ ch ] = { true, raw, value * 1000 };
+            stream() << "adc calibrate: ch" << int( ch ) << " point 1 recorded; apply 2nd voltage and repeat" << std::endl;
+            return;
+        }
+        bool fitted = false;
+        __adc.modify_calibration( [&]( adc_calibration& c ){
+                fitted = c.fit( ch, points[ ch ].raw, points[ ch ].uv, raw, value * 1000 );
+            } );
+        if ( fitted ) {
+            __adc.save_calibration();
+            stream() << "adc calibrate: ch" << int( ch ) << " offset " << int32_t( c.offset[ ch ] )
+                     << " gain " << int32_t( c.gain[ ch ] ) << std::endl;
+        } else {
+            stream() << "adc calibrate: fit failed" << std::endl;
+        }
+        points[ ch ] = {};
+    } else {
+        stream() << "adc calibrate: unknown argument '" << argv[ 1 ] << "'" << std::endl;
+    }
+}
+
+void
+adc_average( size_t argc, const char ** argv )
+{
+    // adc average [off | ch N K ext | ch N K tim interval(0.1ms)]
+    using namespace stm32f103;
+    auto& __adc = *adc::instance();
+    auto& averager = __adc.averager();
+
+    auto stop_triggers = []{
+        exti::detach( PB1 );
+        stm32f103::timer_t< TIM3_BASE >::clear_callback();
+    };
+
+    if ( argc == 1 ) {
+        const auto& stat = averager.stat();
+        const uint32_t scan_rate = adc::sampling_rate_mhz / 1000;
+        stream() << "\tch" << int( __adc.averager_channel() ) << " N=" << int( averager.samples() )
+                 << " K=" << int( averager.replicates() ) << ( averager.enabled() ? " enabled" : " disabled" ) << std::endl;
+        stream() << "\ttriggers: " << int32_t( stat.triggers ) << " missed: " << int32_t( stat.missed )
+                 << " published: " << int32_t( stat.published ) << std::endl;
+        if ( stat.triggers ) {
+            // latency is bounded by one scan period since the ADC is free running
+            const uint32_t mean = uint32_t( stat.latency_sum / stat.triggers );
+            stream() << "\tlatency (cycles): min " << int32_t( stat.latency_min ) << " max " << int32_t( stat.latency_max )
+                     << " mean " << int32_t( mean ) << " jitter " << int32_t( stat.latency_max - stat.latency_min )
+                     << " (" << int32_t( ( stat.latency_max - stat.latency_min ) / cycle_counter::cycles_per_us() ) << "us)" << std::endl;
+        }
+        if ( averager.samples() )
+            stream() << "\tmax trigger rate: " << int32_t( scan_rate / ( averager.samples() + 1 ) ) << "Hz" << std::endl;
+        std::array< uint32_t, adc::averager_type::capacity() > data;
+        if ( size_t n = averager.copy( data.data(), data.size() ) ) {
+            for ( size_t i = 0; i < n; ++i ) {
+                if ( ( i % 8 ) == 0 )
+                    stream() << "\n" << int( i ) << ":\t";
+                print_centi( stream(), uint32_t( ( uint64_t( data[ i ] ) * 100 ) / averager.replicates() ) );
+                stream() << "\t";
+            }
+            stream() << std::endl;
+        }
+        return;
+    }
+
+    if ( strcmp( argv[ 1 ], "off" ) == 0 ) {
+        stop_triggers();
+        averager.disable();
+        return;
+    }
+
+    if ( argc < 5 || !std::isdigit( *argv[ 1 ] ) || !__adc.set_averager_channel( strtod( argv[ 1 ] ) ) ) {
+        stream() << "adc average: invalid channel/arguments" << std::endl;
+        return;
+    }
+
+    stop_triggers();
+    cycle_counter::enable();
+
+    auto published = +[]{ __averager_published = true; };
+    __averager_published = false;
+    if ( !averager.setup( strtod( argv[ 2 ] ), strtod( argv[ 3 ] ), published ) ) {
+        stream() << "adc average: N must be 1.." << int( adc::averager_type::capacity() ) << ", K > 0" << std::endl;
+        return;
+    }
+
+    auto trigger = +[]{ adc::instance()->averager().trigger( cycle_counter::now() ); };
+
+    if ( strcmp( argv[ 4 ], "ext" ) == 0 ) {
+        exti::attach( PB1, EXTI_RISING, trigger );
+        stream() << "adc average: PB1 rising edge trigger" << std::endl;
+    } else if ( strcmp( argv[ 4 ], "tim" ) == 0 ) {
+        size_t interval = argc > 5 ? strtod( argv[ 5 ] ) : 100;
+        stm32f103::timer_t< TIM3_BASE > timer;
+        timer.set_interval( interval ); // 10kHz clock
+        timer.set_callback( trigger );
+        stream() << "adc average: TIM3 trigger every " << int( interval ) << " x 0.1ms" << std::endl;
+    } else {
+        averager.disable();
+        stream() << "adc average: trigger source must be 'ext' or 'tim'" << std::endl;
+    }
+}
+
+// compression summary and 'rice N xx ...' dump, which is decoded by src/codec 'rice -d'
+void
+rice_block_print( const uint8_t * block, size_t size, size_t raw_bytes, uint32_t cycles )
+{
+    stream() << "compressed " << int( raw_bytes ) << " -> " << int( size ) << " bytes, ratio ";
+    print_centi( stream(), uint32_t( raw_bytes * 100 / ( size ? size : 1 ) ) );
+    stream() << ", " << int32_t( raw_bytes ? cycles / raw_bytes : 0 ) << " cycles/byte" << std::endl;
+    stream() << "rice " << int( size );
+    for ( size_t i = 0; i < size; ++i ) {
+        if ( ( i % 32 ) == 0 )
+            stream() << "\n";
+        stream() << " " << block[ i ];
+    }
+    stream() << std::endl;
+}
+
+void
+adc_compress( size_t argc, const char ** argv )
+{
+    // adc compress [ch] [N]
+    constexpr size_t max_samples = stm32f103::buffer_pool_type::max_size / sizeof( uint16_t ); // one pool block
+    size_t channel = argc > 1 && std::isdigit( *argv[ 1 ] ) ? strtod( argv[ 1 ] ) : 0;
+    size_t n = argc > 2 && std::isdigit( *argv[ 2 ] ) ? std::min( size_t( strtod( argv[ 2 ] ) ), max_samples ) : max_samples;
+
+    // samples come as a pool block filled by the DMA callback, and are encoded in place into another pool block
+    auto& __adc = *stm32f103::adc::instance();
+    auto& pool = stm32f103::shared_buffer_pool();
+    auto block = pool.allocate( pool.max_size );
+    if ( block == nullptr ) {
+        stream() << "adc compress: buffer pool exhausted" << std::endl;
+        return;
+    }
+
+    const uint16_t * samples = nullptr;
+    if ( n && __adc.start_block_stream( channel, n ) ) {
+        samples = __adc.take_block( 1000 );
+        __adc.stop_block_stream();
+    }
+    if ( samples == nullptr ) {
+        if ( __adc.block_stream_lost() )
+            stream() << "adc compress: buffer pool exhausted" << std::endl;
+        else
+            stream() << "adc compress: acquisition failed; run 'adc dma' first" << std::endl;
+        pool.release( block );
+        return;
+    }
+
+    stm32f103::cycle_counter cycles;
+    size_t size = codec::rice::encode( samples, n, block, pool.capacity( block ) );
+    uint32_t t = cycles.elapsed();
+
+    if ( size )
+        rice_block_print( block, size, n * sizeof( uint16_t ), t );
+    else
+        stream() << "adc compress: encoded block exceeds " << int( pool.capacity( block ) ) << " bytes" << std::endl;
+    pool.release( samples );
+    pool.release( block );
+}
+
+void
+adc_command( size_t argc, const char ** argv )
+{
+    size_t count = 1;
+
+    if ( __capture_ready.exchange( false ) )
+        stream() << "adc capture ready" << std::endl;
+    if ( __averager_published.exchange( false ) )
+        stream() << "adc average published" << std::endl;
+
+    auto it = std::find_if( argv, argv + argc, [](auto a){ return strcmp( a, "help" ) == 0; } );
+    if ( argc < 2 || ( it != (argv + argc ) ) ) { // help
+        stream() << "adc on NN -- enable ADC; start AD conversion by software cpu cycle, NN replicates.\n";
+        stream() << "adc off -- disable ADC.\n";        
+        stream() << "adc dma -- auto (hardware) repeat AD conversion in background (continue until cpu reset).\n";
+        stream() << "adc fft [ch] [top] -- spectrum of 128 scans on channel ch, print top N lines (requires 'adc dma').\n";
+        stream() << "adc filter [ch off|lp Hz|hp Hz|notch Hz|fir Hz] -- append filter to channel ch (2 channels at a time); 'adc filter bench' for cycles/sample.\n";
+        stream() << "adc trigger [off|ch level|rising|falling low high [pre] [post]|ch ext [pre] [post]] -- triggered capture (ext: PB0 rising edge).\n";
+        stream() << "adc capture [arm] -- print captured window (sample index relative to the trigger), or re-arm.\n";
+        stream() << "adc average [off|ch N K ext|ch N K tim interval] -- sum K triggered N sample waveforms (ext: PB1, tim: TIM3 x0.1ms).\n";
+        stream() << "adc compress [ch] [N] -- delta/Rice compress N (up to 128) samples, print ratio, cycles/byte and block dump.\n";
+        stream() << "adc calibrate [reset|ch mV|vdda mV|temp 0.01C] -- two point gain/offset fit per channel, Vrefint and V25 (saved in bkp).\n";
+        return;
+    }
+
+    if ( strcmp( argv[ 1 ], "fft" ) == 0 )
+        return adc_fft( argc - 1, argv + 1 );
+
+    if ( strcmp( argv[ 1 ], "filter" ) == 0 )
+        return adc_filter( argc - 1, argv + 1 );
+
+    if ( strcmp( argv[ 1 ], "trigger" ) == 0 )
+        return adc_trigger( argc - 1, argv + 1 );
+
+    if ( strcmp( argv[ 1 ], "capture" ) == 0 )
+        return adc_capture( argc - 1, argv + 1 );
+
+    if ( strcmp( argv[ 1 ], "average" ) == 0 )
+        return adc_average( argc - 1, argv + 1 );
+
+    if ( strcmp( argv[ 1 ], "compress" ) == 0 )
+        return adc_compress( argc - 1, argv + 1 );
+
+    if ( strcmp( argv[ 1 ], "calibrate" ) == 0 )
+        return adc_calibrate( argc - 1, argv + 1 );
+
+    auto& __adc = *stm32f103::adc::instance();
+
+    if ( !__adc ) {
+        using namespace stm32f103;
+
+        stream() << "adc0 not initialized." << std::endl;
+
+        // it must be initalized in main though, just in case
+        gpio_mode()( stm32f103::PA0, GPIO_CNF_INPUT_ANALOG, GPIO_MODE_INPUT ); // ADC1 (0,0)
+
+        stream() << "adc reset & calibration: status " << (( __adc.cr2() & 0x0c ) == 0 ? " PASS" : " FAIL" )  << std::endl;
+    }
+
+    while ( --argc ) {
+        ++argv;
+        if ( strcmp( argv[0], "off" ) == 0 ) {
+            stream() << "adc.enable( false )" << std::endl;
+            __adc.enable( false );
+        } else if ( strcmp( argv[0], "on" ) == 0 ) {
+            stream() << "adc.enable( true )" << std::endl;
+            __adc.enable( true );
+        } else if ( strcmp( argv[0], "dma" ) == 0 || strcmp( argv[0], "start" ) == 0 ) {
+            stream() << "adc.attach( dma1 )" << std::endl;
+            __adc.attach( *stm32f103::dma_t< stm32f103::DMA1_BASE >::instance() );
+            if ( __adc.start_conversion() ) { // software trigger
+                uint32_t d = __adc.data(); // can't read twince
+                stream() << "adc data= 0x" << d
+                         << "\t" << int(d) << "\t" << ( __adc.calibration().microvolts( 0, d ) / 1000 ) << "(mV)"
+                         << std::endl;
+            }
+        } else if ( std::isdigit( *argv[0] ) ) {
+            count = strtod( *argv );
+            for ( size_t i = 0; i < count; ++i ) {
+                if ( __adc.start_conversion() ) { // software trigger
+                    uint32_t d = __adc.data(); // can't read twince
+                    stream() << "[" << int(i) << "] adc data= 0x" << d
+                             << "\t" << int(d) << "\t" << ( __adc.calibration().microvolts( 0, d ) / 1000 ) << "(mV)"
+                             << std::endl;
+                }
+            }
+        }
+    }
+}
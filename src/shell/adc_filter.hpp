@@ -0,0 +1,44 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "filter.hpp"
+#include <atomic>
+#include <cstdint>
+
+namespace stm32f103 {
+
+    // per ADC channel signal conditioning; raw 12bit -> Q31 -> FIR -> biquad cascade -> 12bit
+    struct adc_filter_chain {
+        static constexpr size_t max_fir_taps = 32;
+        static constexpr size_t max_biquad_stages = 4;
+
+        dsp::fir< dsp::q31_t, max_fir_taps > fir;
+        dsp::biquad_cascade< dsp::q31_t, max_biquad_stages > iir;
+        std::atomic_bool enabled;
+
+        constexpr adc_filter_chain() : enabled( false ) {}
+
+        // caller must disable the chain before touching fir/iir, since operator() is called from DMA ISR
+        void clear() {
+            enabled = false;
+            fir.set_coefficients( nullptr, 0 );
+            iir.set_coefficients( nullptr, 0 );
+        }
+
+        inline uint16_t operator()( uint16_t x ) {
+            dsp::q31_t y = ( int32_t( x ) - 2048 ) << 19;
+            if ( fir.taps() )
+                y = fir( y );
+            if ( iir.stages() )
+                y = iir( y );
+            int32_t r = ( y >> 19 ) + 2048;
+            return r < 0 ? 0 : r > 4095 ? 4095 : uint16_t( r );
+        }
+    };
+
+}
@@ -0,0 +1,144 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Ensemble (signal) averager for repetitive waveforms, as a digitizer does for pulsed experiments.
+// trigger() starts an N sample capture on the next push(); each capture is summed into a 32bit
+// accumulator, and after K captures the sum is published (double buffered) and accumulation restarts.
+// The published buffer becomes the accumulation buffer again on the next publish, so the reader takes a copy
+// with copy(), which is validated by a publish sequence counter.
+// Time stamps are free running counters (CPU cycles on target) used for trigger-to-sample latency.
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace dsp {
+
+    template< size_t MAX_SAMPLES >
+    class ensemble_averager {
+        std::array< std::array< uint32_t, MAX_SAMPLES >, 2 > sum_;
+        std::atomic< size_t > published_;        // index of published sum_
+        std::atomic< uint32_t > sequence_;       // number of publishes
+        std::atomic< bool > enabled_;
+        std::atomic< bool > pending_;            // triggered, waiting for the first sample
+        size_t samples_;
+        size_t replicates_;
+        size_t index_;                           // sample index in current capture, 0 = idle
+        size_t count_;                           // captures in current accumulation
+        uint32_t trigger_time_;
+        void (*callback_)();
+    public:
+        struct statistics {
+            uint32_t triggers;                   // accepted
+            uint32_t missed;                     // arrived while busy
+            uint32_t published;                  // number of published waveforms
+            uint32_t latency_min;
+            uint32_t latency_max;
+            uint64_t latency_sum;
+        };
+    private:
+        statistics stat_;
+    public:
+        constexpr ensemble_averager() : sum_{}, published_( 0 ), sequence_( 0 ), enabled_( false ), pending_( false )
+                                      , samples_( 0 ), replicates_( 0 ), index_( 0 ), count_( 0 ), trigger_time_( 0 )
+                                      , callback_( nullptr ), stat_{} {
+        }
+
+        static constexpr size_t capacity() { return MAX_SAMPLES; }
+
+        bool setup( size_t samples, size_t replicates, void (*callback)() = nullptr ) {
+            if ( samples == 0 || samples > MAX_SAMPLES || replicates == 0 )
+                return false;
+            enabled_ = false;
+            samples_ = samples;
+            replicates_ = replicates;
+            callback_ = callback;
+            index_ = count_ = 0;
+            pending_ = false;
+            sequence_ = 0;
+            stat_ = statistics{ 0, 0, 0, uint32_t( -1 ), 0, 0 };
+            sum_[ 0 ].fill( 0 );
+            sum_[ 1 ].fill( 0 );
+            enabled_ = true;
+            return true;
+        }
+
+        void disable() { enabled_ = false; }
+        bool enabled() const { return enabled_; }
+        size_t samples() const { return samples_; }
+        size_t replicates() const { return replicates_; }
+        const statistics& stat() const { return stat_; }
+
+        // external event (EXTI, timer); returns false if a capture is in progress
+        bool trigger( uint32_t timestamp ) {
+            if ( !enabled_ )
+                return false;
+            if ( pending_ || index_ ) {
+                ++stat_.missed;
+                return false;
+            }
+            trigger_time_ = timestamp;
+            pending_ = true;
+            return true;
+        }
+
+        void push( uint16_t x, uint32_t timestamp ) {
+            if ( !enabled_ )
+                return;
+            if ( index_ == 0 ) {
+                if ( !pending_ )
+                    return;
+                pending_ = false;
+                uint32_t latency = timestamp - trigger_time_;
+                ++stat_.triggers;
+                stat_.latency_sum += latency;
+                if ( latency < stat_.latency_min )
+                    stat_.latency_min = latency;
+                if ( latency > stat_.latency_max )
+                    stat_.latency_max = latency;
+            }
+            auto& sum = sum_[ published_.load() ^ 1 ];
+            if ( count_ == 0 )
+                sum[ index_ ] = x;
+            else
+                sum[ index_ ] += x;
+            if ( ++index_ == samples_ ) {
+                index_ = 0;
+                if ( ++count_ == replicates_ ) {
+                    count_ = 0;
+                    published_ = published_.load() ^ 1;
+                    sequence_ = sequence_.load() + 1;
+                    ++stat_.published;
+                    if ( callback_ )
+                        callback_();
+                }
+            }
+        }
+
+        // copies the published sum of 'replicates()' waveforms into 'data'; returns number of samples copied,
+        // 0 if nothing is published yet or the copy kept overlapping a publish
+        size_t copy( uint32_t * data, size_t size ) const {
+            for ( int retry = 0; retry < 4; ++retry ) {
+                const uint32_t sequence = sequence_.load();
+                if ( sequence == 0 )
+                    return 0;
+                const size_t n = samples_ < size ? samples_ : size;
+                const auto& sum = sum_[ published_.load() ];
+                for ( size_t i = 0; i < n; ++i )
+                    data[ i ] = sum[ i ];
+                std::atomic_thread_fence( std::memory_order_acquire );
+                if ( sequence_.load() == sequence )
+                    return n;
+            }
+            return 0;
+        }
+    };
+
+}
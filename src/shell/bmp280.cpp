@@ -24,6 +24,7 @@
 
 #include "bmp280.hpp"
 #include "i2c.hpp"
+#include "i2c_scheduler.hpp"
 #include "timer.hpp"
 #include "scoped_spinlock.hpp"
 #include "stm32f103.hpp"
@@ -122,7 +123,11 @@ BMP280::~BMP280()
 }
 
 BMP280::BMP280( stm32f103::i2c& t, int address ) : i2c_( &t )
+#if !defined __linux
+                                                 , device_( t.scheduler().register_device( address ) )
+#endif
                                                  , address_( address )
+                                                 , regmap_()
                                                  , has_callback_( false )
                                                  , has_trimming_parameter_( false )
                                                  , dig_T1(0), dig_T2(0), dig_T3(0)
@@ -151,7 +156,7 @@ BMP280::trimming_parameter_readout()
 {
     std::array< uint8_t, 24 > data = { 0 };
     
-    if ( read( 0x88, data.data(), data.size() ) ) {
+    if ( read_registers( 0x88, data.data(), data.size() ) ) {
         has_trimming_parameter_ = true;
         const uint8_t * p = data.data();
         trimming_parameter()( dig_T1, p );
@@ -193,7 +198,7 @@ BMP280::measure()
     // t_sb[7:5] (standby time), filter[4:2], spi3w_en[0]
     constexpr uint8_t config = BMP280_STANDBYTIME_500_MS << 5 | BMP280_FILTER_COEFF_16 << 2;
     
-    if ( write( std::array< uint8_t, 4 >( { 0xf4, ctrl_meas, 0xf5, config } ) ) ) {
+    if ( set_config( ctrl_meas, config ) ) {
         has_callback_ = true;
         stm32f103::timer_t< stm32f103::TIM2_BASE >().set_callback( handle_timer );
     }
@@ -210,7 +215,7 @@ BMP280::single_measure()
     // t_sb[7:5] (standby time), filter[4:2], spi3w_en[0]
     constexpr uint8_t config = BMP280_STANDBYTIME_500_MS << 5 | BMP280_FILTER_COEFF_16 << 2;
     
-    if ( write( std::array< uint8_t, 4 >( { 0xf4, ctrl_meas, 0xf5, config } ) ) ) {
+    if ( set_config( ctrl_meas, config ) ) {
         stm32f103::timer_t< stm32f103::TIM2_BASE >().set_callback( +[]{
                 instance()->readout();
                 stm32f103::timer_t< stm32f103::TIM2_BASE >::clear_callback( true ); // recursive call
@@ -218,6 +223,27 @@ BMP280::single_measure()
     }
 }
 
+bool
+BMP280::read_registers( uint8_t reg, uint8_t * data, size_t size )
+{
+    return regmap_.read( *this, reg, data, size );
+}
+
+bool
+BMP280::set_config( uint8_t meas, uint8_t conf )
+{
+    regmap_.write( ctrl_meas, meas );
+    regmap_.write( config, conf );
+    return regmap_.commit( *this, ctrl_meas, 2 );
+}
+
+bool
+BMP280::soft_reset()
+{
+    regmap_.invalidate();
+    return write( std::array< uint8_t, 2 >( { reset, 0xb6 } ) );
+}
+
 void
 BMP280::stop()
 {
@@ -227,19 +253,22 @@ BMP280::stop()
     }
 }
 
+// Transactions go through the bus scheduler at high priority, so that a readout is not held up
+// behind a long transfer of another device on the same bus.
 bool
 BMP280::write( const uint8_t * data, size_t size ) const
 {
     scoped_spinlock<> lock( __flag );
     bool success( false );
     if ( i2c_ ) {
-        if ( i2c_->has_dma( stm32f103::i2c::DMA_Tx ) ) {
-            success = i2c_->dma_transfer( address_, data, size );
-        } else {
-            success = i2c_->write( address_, data, size );
-        }
+#if defined __linux
+        success = i2c_->write( data, size );
+#else
+        stm32f103::i2c_request r( device_, stm32f103::I2C_PRIORITY_HIGH, address_, data, size );
+        success = i2c_->scheduler().transact( r );
         if ( !success )
-            i2c_->print_result( stream(__FILE__,__LINE__) ) << std::endl;
+            stm32f103::i2c::print_result( stream(__FILE__,__LINE__), r.result() ) << std::endl;
+#endif
     }
     return success;
 }
@@ -250,25 +279,14 @@ BMP280::read(  uint8_t addr, uint8_t * data, size_t size ) const
     bool success( false );
     scoped_spinlock<> lock( __flag );
     if ( i2c_ ) {
-
-        if ( i2c_->has_dma( stm32f103::i2c::DMA_Tx ) ) {
-            success = i2c_->dma_transfer( address_, &addr, 1 );
-        } else {
-            success = i2c_->write( address_, &addr, 1 );
-        }
-        
-        if ( success ) {
-            std::array< uint8_t, 2 > buf = { 0 };
-            
-            if ( i2c_->has_dma( stm32f103::i2c::DMA_Rx ) ) {
-                success = i2c_->dma_receive( address_, data, size );
-            } else {
-                success = i2c_->read( address_, data, size );
-            }
-        }
-
+#if defined __linux
+        success = i2c_->read( addr, data, size );
+#else
+        stm32f103::i2c_request r( device_, stm32f103::I2C_PRIORITY_HIGH, address_, &addr, 1, data, size );
+        success = i2c_->scheduler().transact( r );
         if ( !success )
-            i2c_->print_result( stream(__FILE__,__LINE__) ) << std::endl;        
+            stm32f103::i2c::print_result( stream(__FILE__,__LINE__), r.result() ) << std::endl;
+#endif
     }
     return success;
 }
@@ -277,33 +295,57 @@ std::pair< uint32_t, uint32_t >
 BMP280::readout()
 {
     std::array< uint8_t, 6 > data;
-    if ( read( 0xf7, data.data(), data.size() ) ) {
-        uint32_t adc_P = uint32_t( data[0] ) << 12 | uint32_t( data[1] ) << 4 | data[2] & 0x0f;
-        uint32_t adc_T  = uint32_t( data[3] ) << 12 | uint32_t( data[4] ) << 4 | data[5] & 0x0f;
-        int32_t t_fine = 0;
-        auto temp = compensate_T( adc_T, t_fine );
-        auto press = compensate_P32( adc_P, t_fine );
-
-        auto minor = temp % 100;
-
-        using stm32f103::system_clock;
-        stream() << int( std::chrono::duration_cast< std::chrono::seconds >( system_clock::now() - system_clock::zero ).count() )
-                 << "\t" << int( press ) << " (Pa)"
-                 << "\t" << int( temp / 100 ) << "." << ( minor < 10 ? "0" : "") << minor << " (degC)";
-        
-        stream() << std::endl;
-        
-        return { press, temp };
-    }
+    if ( read( 0xf7, data.data(), data.size() ) )
+        return convert( data.data() );
     return { -1, -1 };
 }
 
+std::pair< uint32_t, uint32_t >
+BMP280::convert( const uint8_t * data ) const
+{
+    uint32_t adc_P = uint32_t( data[0] ) << 12 | uint32_t( data[1] ) << 4 | data[2] & 0x0f;
+    uint32_t adc_T  = uint32_t( data[3] ) << 12 | uint32_t( data[4] ) << 4 | data[5] & 0x0f;
+    int32_t t_fine = 0;
+    auto temp = compensate_T( adc_T, t_fine );
+    auto press = compensate_P32( adc_P, t_fine );
+
+    auto minor = temp % 100;
+
+    using stm32f103::system_clock;
+    stream() << int( std::chrono::duration_cast< std::chrono::seconds >( system_clock::now() - system_clock::zero ).count() )
+             << "\t" << int( press ) << " (Pa)"
+             << "\t" << int( temp / 100 ) << "." << ( minor < 10 ? "0" : "") << minor << " (degC)";
+
+    stream() << std::endl;
+
+    return { press, temp };
+}
+
 //static
 void
 BMP280::handle_timer()
 {
+    // TIM2 interrupt; the readout is queued at realtime priority and converted on completion,
+    // instead of waiting for the bus in the timer interrupt.  A readout still pending skips this tick.
+#if defined __linux
     if ( auto p = instance() )
-        auto pair = p->readout();
+        p->readout();
+#else
+    static uint8_t reg = 0xf7;
+    static std::array< uint8_t, 6 > data;
+    static stm32f103::i2c_request request;
+
+    auto p = instance();
+    if ( p == nullptr || ( request.scheduler_ && !request.done.load() ) )
+        return;
+    new ( &request ) stm32f103::i2c_request( p->device_, stm32f103::I2C_PRIORITY_REALTIME, p->address_
+                                            , &reg, 1, data.data(), data.size(), 100'000 //'
+                                            , +[]( stm32f103::i2c_request& r ){
+                                                if ( r.result() == stm32f103::I2C_RESULT_SUCCESS )
+                                                    instance()->convert( data.data() );
+                                            } );
+    p->i2c_->scheduler().submit( request );
+#endif
 }
 
 /*!
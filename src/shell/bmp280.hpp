@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include "i2c_regmap.hpp"
 #include <array>
 #include <bitset>
 #include <string>
@@ -54,13 +55,32 @@ namespace bmp280 {
         , ULTRA_HIGH_RESOLUTION
     };
 
+    // registers for the register cache (i2c_regmap.hpp), memory map section 4.2.
+    // Calibration and id never change; ctrl_meas and config only when written, as long as forced mode (which
+    // clears mode[1:0] at the end of the conversion) is not used.
+    struct register_map {
+        typedef uint8_t value_type;
+        static constexpr uint8_t first = 0x88;                  // calib00
+        static constexpr size_t size = temp_xlsb - first + 1;
+        static constexpr bool burst_read = true;                // auto-increment, section 5.2.2
+        static constexpr stm32f103::I2C_REGMAP_WRITE write_mode = stm32f103::I2C_REGMAP_WRITE_PAIRS; // section 5.2.1
+        static constexpr uint8_t read_pointer( uint8_t reg ) { return reg; }
+        static constexpr uint8_t write_pointer( uint8_t reg ) { return reg; }
+        static constexpr stm32f103::I2C_REGISTER_KIND kind( uint8_t reg ) {
+            return ( reg <= 0xa1 || reg == id || reg == ctrl_meas || reg == config )
+                ? stm32f103::I2C_REGISTER_CACHED : stm32f103::I2C_REGISTER_VOLATILE;
+        }
+    };
+
     class BMP280 {
 #if defined __linux        
         std::unique_ptr< i2c_linux::i2c > i2c_;
 #else
         stm32f103::i2c * i2c_;
+        uint8_t device_;      // i2c scheduler device id
 #endif
         const int address_;
+        stm32f103::i2c_regmap< register_map > regmap_;
         bool has_callback_;
         bool has_trimming_parameter_;
         uint16_t dig_T1;
@@ -84,6 +104,13 @@ namespace bmp280 {
         bool read( uint8_t addr, uint8_t *, size_t size ) const;
 
         template< size_t N > bool write ( std::array< uint8_t, N >&& a ) const { return write( a.data(), a.size() ); }
+
+        // through the register cache; calibration, id, ctrl_meas and config are read from the bus only once
+        bool read_registers( uint8_t reg, uint8_t *, size_t size );
+        // ctrl_meas and config in one transaction; not sent if the sensor has them already
+        bool set_config( uint8_t ctrl_meas, uint8_t config );
+        bool soft_reset();
+        inline const stm32f103::i2c_regmap_statistics& regmap_statistics() const { return regmap_.stat(); }
         
         void trimming_parameter_readout();
         void single_measure();
@@ -96,6 +123,7 @@ namespace bmp280 {
         uint32_t compensate_P32( uint32_t adc_P, int32_t t_fine ) const;
         uint32_t compensate_P64( uint32_t adc_P, int32_t t_fine ) const;
         int32_t compensate_T( int32_t adc_T, int32_t& t_fine ) const;
+        std::pair< uint32_t, uint32_t > convert( const uint8_t * data ) const;
         static void handle_timer();
     };
     
@@ -5,13 +5,17 @@
 //
 
 #include "bmp280.hpp"
+#include "cycle_counter.hpp"
 #include "i2c.hpp"
 #include "stm32f103.hpp"
 #include "stream.hpp"
 #include "debug_print.hpp"
 #include "utility.hpp"
+#include <codec/rice.hpp>
 
 extern void i2c_command( size_t argc, const char ** argv );
+extern void i2c_hub_update( uint8_t reg, const void * data, size_t size );
+extern void rice_block_print( const uint8_t * block, size_t size, size_t raw_bytes, uint32_t cycles );
 void mdelay( uint32_t );
 
 void
@@ -29,17 +33,24 @@ bmp280_command( size_t argc, const char ** argv )
 
     BMP280& bmp280 = *BMP280::instance();
 
+    // latest values to the sensor hub register file (i2c --slave); HUB_PRESSURE (Pa) at 0x08, then
+    // HUB_TEMPERATURE (0.01 degC), see i2c_command.cpp
+    auto hub_publish = []( const std::pair< uint32_t, uint32_t >& pair ) {
+        if ( pair.first != uint32_t( -1 ) )
+            i2c_hub_update( 0x08, &pair, sizeof( pair ) );
+    };
+
     std::array< uint8_t, 1 > id = { 0 };
     std::array< uint8_t, 3 > status = { 0 }; // status,ctrl_meas,config
     std::array< uint8_t, 6 > values = { 0 };
 
     if ( argc == 1 ) {
-        if ( bmp280.read( 0xd0, id.data(), id.size() ) )
+        if ( bmp280.read_registers( 0xd0, id.data(), id.size() ) )
             array_print( stream(__FILE__,__LINE__), id, id.size(), "bmp280 id : " );
         else
             stream(__FILE__,__LINE__) << "id failed" << std::endl;
         
-        if ( bmp280.read( 0xf3, status.data(), status.size() ) )
+        if ( bmp280.read_registers( 0xf3, status.data(), status.size() ) )
             array_print( stream(__FILE__,__LINE__), status, status.size(), "bmp280 status : " );
         else
             stream(__FILE__,__LINE__) << "status failed" << std::endl;
@@ -50,12 +61,16 @@ bmp280_command( size_t argc, const char ** argv )
             stream(__FILE__,__LINE__) << "values failed" << std::endl;
 
         bmp280.trimming_parameter_readout();
+
+        auto& stat = bmp280.regmap_statistics();
+        stream() << "register cache: hits " << int( stat.hits ) << ", bus reads " << int( stat.reads )
+                 << ", writes " << int( stat.writes ) << ", unchanged " << int( stat.suppressed ) << std::endl;
     }
 
     while ( --argc ) {
         ++argv;
         if ( strcmp( argv[0], "reset" ) == 0 ) {
-            if ( bmp280.write( std::array< uint8_t, 2 >( { 0xe0, 0xb6 } ) ) ) {
+            if ( bmp280.soft_reset() ) {
                 stream(__FILE__,__LINE__) << "reset OK" << std::endl;
             } else {
                 stream(__FILE__,__LINE__) << "reset FAILED" << std::endl;
@@ -68,6 +83,61 @@ bmp280_command( size_t argc, const char ** argv )
             bmp280.measure();
         } else if ( strcmp( argv[0], "stop" ) == 0 ) {
             bmp280.stop();
+        } else if ( strcmp( argv[0], "compress" ) == 0 ) {
+            // read a batch of compensated values, compress pressure and temperature series; ~1KB of stack
+            constexpr size_t max_count = 64;
+            int32_t pressure[ max_count ], temperature[ max_count ];
+            uint8_t block[ codec::rice::max_encoded_size( max_count ) ];
+            size_t count = 32;
+            if ( argc > 1 && std::isdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                count = std::min( size_t( strtod( argv[ 0 ] ) ), max_count );
+            }
+            for ( size_t i = 0; i < count; ++i ) {
+                auto pair = bmp280.readout();
+                pressure[ i ] = pair.first;
+                temperature[ i ] = pair.second;
+                hub_publish( pair );
+            }
+            for ( auto series: { pressure, temperature } ) {
+                stm32f103::cycle_counter cycles;
+                size_t size = codec::rice::encode( series, count, block, sizeof( block ) );
+                uint32_t t = cycles.elapsed();
+                rice_block_print( block, size, count * sizeof( int32_t ), t );
+            }
+        } else if ( strcmp( argv[0], "latency" ) == 0 ) {
+            // per-register-read latency; separate write+read (STOP, START) vs. write_read on repeated START
+            auto& i2cx = *stm32f103::i2c_t< stm32f103::I2C1_BASE >::instance();
+            size_t count = 100;
+            if ( argc > 1 && std::isdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                count = strtod( argv[ 0 ] );
+            }
+            const uint8_t reg = 0xf7;
+            const uint32_t speed = i2cx.speed();
+            const auto speed_mode = i2cx.speed_mode();
+            stream() << int( count ) << " reads of " << int( values.size() ) << " bytes" << std::endl;
+            for ( auto scl: { 100'000, 400'000 } ) { //'
+                if ( !i2cx.set_speed( scl, scl > 100'000 ? stm32f103::I2C_FAST_MODE : stm32f103::I2C_STANDARD_MODE ) ) //'
+                    continue;
+                stream() << "SCL " << int( i2cx.speed() ) << "Hz" << std::endl;
+                for ( int mode = 0; mode < 2; ++mode ) {
+                    size_t errors = 0;
+                    stm32f103::cycle_counter cycles;
+                    for ( size_t i = 0; i < count; ++i ) {
+                        bool success = mode == 0
+                            ? ( i2cx.dma_transfer( 0x76, &reg, 1 ) && i2cx.dma_receive( 0x76, values.data(), values.size() ) )
+                            : i2cx.write_read( 0x76, &reg, 1, values.data(), values.size() );
+                        if ( !success )
+                            ++errors;
+                    }
+                    uint32_t t = cycles.elapsed() / ( count ? count : 1 );
+                    stream() << ( mode == 0 ? "\twrite + read:\t" : "\twrite_read:\t" )
+                             << int( t / 72 ) << "us/read (" << int( t ) << " cycles)"
+                             << ", errors: " << int( errors ) << std::endl;
+                }
+            }
+            i2cx.set_speed( speed, speed_mode );
         } else if ( strcmp( argv[0], "--read" ) == 0 ) {
             size_t count = 10;
             if ( argc >= 1 && std::isdigit( *argv[1] ) ) {
@@ -76,9 +146,10 @@ bmp280_command( size_t argc, const char ** argv )
             }
             constexpr uint8_t meas = 1 << 5 | 1 << 2 | 3;
             constexpr uint8_t config = 1 << 5 | 1 << 2;
-            if ( bmp280.write( std::array< uint8_t, 4 >( { 0xf4, meas, 0xf5, config } ) ) ) {
+            if ( bmp280.set_config( meas, config ) ) {
                 while ( --count ) {
                     auto pair = bmp280.readout();
+                    hub_publish( pair );
                     // mdelay( 500 );
                 }
             }
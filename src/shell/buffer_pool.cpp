@@ -0,0 +1,18 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "buffer_pool.hpp"
+
+namespace {
+    // constant initialized (all zero), no constructor call required
+    stm32f103::buffer_pool_type __buffer_pool;
+}
+
+stm32f103::buffer_pool_type&
+stm32f103::shared_buffer_pool()
+{
+    return __buffer_pool;
+}
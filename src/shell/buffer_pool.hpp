@@ -0,0 +1,204 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Statically allocated fixed-block buffer pool with reference counting.
+// A block is handed from stage to stage (DMA -> filter -> compressor -> UART TX) as a plain pointer;
+// each stage that keeps it calls retain(), and whoever is done with it calls release().  The last
+// release() returns the block to its class.  allocate/retain/release are lock-free (LDREX/STREX on
+// Cortex-M3) and can be called from interrupt handlers.
+// Everything is zero at start-up, so that pools live in .bss without a constructor call.
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace stm32f103 {
+
+    template< size_t SIZE, size_t COUNT >
+    struct block_class {
+        static_assert( COUNT > 0 && COUNT <= 32, "block count must be in 1..32" );
+        static_assert( ( SIZE % 4 ) == 0, "block size must be multiple of 4" );
+        static constexpr size_t size = SIZE;
+        static constexpr size_t count = COUNT;
+    };
+
+    struct pool_statistics {
+        uint32_t allocated;    // successful allocations
+        uint32_t exhausted;    // requests that found no free block in this class
+        uint32_t in_use;
+        uint32_t high_water;   // max. in_use
+    };
+
+    template< size_t SIZE, size_t COUNT >
+    class block_pool {
+        static constexpr uint32_t mask = COUNT == 32 ? 0xffffffff : ( 1u << COUNT ) - 1;
+
+        alignas( 4 ) uint8_t data_[ COUNT ][ SIZE ];
+        std::atomic< uint32_t > used_;                  // bit i := block i is allocated
+        std::atomic< uint32_t > refs_[ COUNT ];
+        std::atomic< uint32_t > allocated_;
+        std::atomic< uint32_t > exhausted_;
+        std::atomic< uint32_t > high_water_;
+
+        static inline uint32_t popcount( uint32_t x ) {
+            uint32_t n = 0;
+            for ( ; x; x &= x - 1 )
+                ++n;
+            return n;
+        }
+
+    public:
+        constexpr block_pool() : data_{}, used_( 0 ), refs_{}, allocated_( 0 ), exhausted_( 0 ), high_water_( 0 ) {}
+
+        uint8_t * allocate() {
+            uint32_t used = used_.load();
+            uint32_t bit;
+            do {
+                uint32_t free = ~used & mask;
+                if ( free == 0 ) {
+                    ++exhausted_;
+                    return nullptr;
+                }
+                bit = free & ( ~free + 1 ); // lowest free block
+            } while ( !used_.compare_exchange_weak( used, used | bit ) );
+
+            size_t idx = 0;
+            while ( !( bit & ( 1u << idx ) ) )
+                ++idx;
+            refs_[ idx ] = 1;
+            ++allocated_;
+
+            uint32_t n = popcount( used | bit );
+            uint32_t hw = high_water_.load();
+            while ( n > hw && !high_water_.compare_exchange_weak( hw, n ) )
+                ;
+            return data_[ idx ];
+        }
+
+        inline bool contains( const void * p ) const {
+            auto q = reinterpret_cast< const uint8_t * >( p );
+            return q >= data_[ 0 ] && q < data_[ 0 ] + SIZE * COUNT;
+        }
+
+        inline size_t index( const void * p ) const {
+            return size_t( reinterpret_cast< const uint8_t * >( p ) - data_[ 0 ] ) / SIZE;
+        }
+
+        inline void retain( const void * p ) { ++refs_[ index( p ) ]; }
+
+        // returns true when the block has been returned to the pool
+        bool release( const void * p ) {
+            size_t idx = index( p );
+            if ( --refs_[ idx ] == 0 ) {
+                used_.fetch_and( ~( 1u << idx ) );
+                return true;
+            }
+            return false;
+        }
+
+        inline uint32_t use_count( const void * p ) const { return refs_[ index( p ) ].load(); }
+
+        pool_statistics stat() const {
+            return { allocated_.load(), exhausted_.load(), popcount( used_.load() ), high_water_.load() };
+        }
+    };
+
+    // Block classes must be given in ascending size; allocate() takes the smallest class that fits,
+    // and falls through to a larger class when that one is exhausted.
+    template< typename... classes > class buffer_pool;
+
+    template<> class buffer_pool<> {
+    public:
+        static constexpr size_t max_size = 0;
+        static constexpr size_t total_size = 0;
+        constexpr buffer_pool() {}
+        uint8_t * allocate( size_t ) { return nullptr; }
+        bool contains( const void * ) const { return false; }
+        size_t capacity( const void * ) const { return 0; }
+        uint32_t use_count( const void * ) const { return 0; }
+        void retain( const void * ) {}
+        bool release( const void * ) { return false; }
+        template< typename F > void for_each( F ) const {}
+    };
+
+    template< typename C, typename... rest >
+    class buffer_pool< C, rest... > {
+        block_pool< C::size, C::count > pool_;
+        buffer_pool< rest... > next_;
+        static_assert( buffer_pool< rest... >::max_size == 0 || C::size < buffer_pool< rest... >::max_size
+                       , "block classes must be in ascending size" );
+    public:
+        static constexpr size_t max_size = buffer_pool< rest... >::max_size ? buffer_pool< rest... >::max_size : C::size;
+        static constexpr size_t total_size = C::size * C::count + buffer_pool< rest... >::total_size; // block bytes
+
+        constexpr buffer_pool() : pool_(), next_() {}
+
+        // returns nullptr if no class that fits has a free block
+        uint8_t * allocate( size_t size ) {
+            if ( size <= C::size ) {
+                if ( auto p = pool_.allocate() )
+                    return p;
+            }
+            return next_.allocate( size );
+        }
+
+        bool contains( const void * p ) const {
+            return pool_.contains( p ) || next_.contains( p );
+        }
+
+        size_t capacity( const void * p ) const {
+            return pool_.contains( p ) ? C::size : next_.capacity( p );
+        }
+
+        uint32_t use_count( const void * p ) const {
+            return pool_.contains( p ) ? pool_.use_count( p ) : next_.use_count( p );
+        }
+
+        void retain( const void * p ) {
+            if ( pool_.contains( p ) )
+                pool_.retain( p );
+            else
+                next_.retain( p );
+        }
+
+        bool release( const void * p ) {
+            return pool_.contains( p ) ? pool_.release( p ) : next_.release( p );
+        }
+
+        // f( block_size, block_count, pool_statistics )
+        template< typename F > void for_each( F f ) const {
+            f( C::size, C::count, pool_.stat() );
+            next_.for_each( f );
+        }
+    };
+
+    // shared pool on target (buffer_pool.cpp); 20KB of SRAM on the C8 holds everything else and the stack as well.
+    // The ADC block stream needs three of the largest blocks: one being filled, one queued and the output of
+    // 'adc compress'; commands borrow blocks while they run.
+    typedef buffer_pool< block_class< 64, 4 >, block_class< 256, 3 > > buffer_pool_type;
+    static_assert( buffer_pool_type::total_size <= 1024, "shared buffer pool exceeds its RAM budget" );
+    buffer_pool_type& shared_buffer_pool();
+
+    // a block of shared_buffer_pool() for the scope of a command; false if the pool has none that fits
+    class scoped_pool_block {
+        uint8_t * p_;
+        scoped_pool_block( const scoped_pool_block& ) = delete;
+        scoped_pool_block& operator = ( const scoped_pool_block& ) = delete;
+    public:
+        explicit scoped_pool_block( size_t size ) : p_( shared_buffer_pool().allocate( size ) ) {}
+        ~scoped_pool_block() {
+            if ( p_ )
+                shared_buffer_pool().release( p_ );
+        }
+        // leave the block allocated, e.g. to a transaction still queued after a timeout
+        inline void detach() { p_ = nullptr; }
+        template< typename T > inline T * get() const { return reinterpret_cast< T * >( p_ ); }
+        inline explicit operator bool () const { return p_; }
+    };
+}
@@ -3,6 +3,7 @@
 #include "bitset.hpp"
 #include "can.hpp"
 #include "condition_wait.hpp"
+#include "cycle_counter.hpp"
 #include "debug_print.hpp"
 #include "stream.hpp"
 #include "stm32f103.hpp"
@@ -187,6 +188,18 @@ namespace stm32f103 {
         }
     };
 
+    // the transmit queue is shared by the thread and the TX and SCE interrupts (of the same priority)
+    struct scoped_tx_lock {
+        scoped_tx_lock() {
+            disable_interrupt( CAN1_TX_IRQn );
+            disable_interrupt( CAN1_SCE_IRQn );
+        }
+        ~scoped_tx_lock() {
+            enable_interrupt( CAN1_SCE_IRQn );
+            enable_interrupt( CAN1_TX_IRQn );
+        }
+    };
+
     struct scoped_can_init {
         volatile CAN& _;
         CAN_STATUS status_;
@@ -210,10 +223,11 @@ namespace stm32f103 {
 using namespace stm32f103;
 
 can::can() : status_( CAN_INIT_FAILED )
-           , rx_head_( 0 )
-           , rx_tail_( 0 )
-           , rx_count_( 0 )
            , active_( 0 )
+           , rx_current_( CAN_FIFO_0 )
+           , rx_stat_{ { 0, 0, 0, 0 }, { 0, 0, 0, 0 } }
+           , tx_state_{ TX_IDLE, TX_IDLE, TX_IDLE }
+           , tx_stat_{ 0, 0, 0, 0, 0, 0 }
 {
     can_active = 0;
 }
@@ -235,8 +249,10 @@ CAN_STATUS
 can::init( stm32f103::CAN_BASE base, uint32_t control )
 {
     status_ = CAN_INIT_FAILED;
-    rx_head_ = rx_tail_ = rx_count_ = rx_lost_ = 0;
-
+    rx_queue_clear();
+    clear_rx_stat();
+    clear_tx_stat();
+    cycle_counter::enable();                    // transmit deadlines
     
     if ( auto CAN = reinterpret_cast< volatile stm32f103::CAN * >( base ) ) {
         can_ = CAN;
@@ -254,7 +270,6 @@ can::init( stm32f103::CAN_BASE base, uint32_t control )
 
         bitset::reset( can_->MCR, CAN_MCR_SLEEP );            // reset CAN sleep mode (default after reset)
         bitset::set( can_->MSR, CAN_MSR_SLAKI );              // clear SLAKI (sleep acknowledge) status
-        bitset::set( can_->MCR, control & CAN_CONTROL_MASK );
 
         do {
             scoped_can_init can_init(*can_);
@@ -263,14 +278,21 @@ can::init( stm32f103::CAN_BASE base, uint32_t control )
                 return status_;                              // error, so return
             }
 
+            // TTCM runs the 16bit bit-time counter that is latched into RDTR[31:16] at SOF of each received frame
+            bitset::set( can_->MCR, control & CAN_CONTROL_MASK );
+
             set_bitrate( 250000 );
 
             // p680 interrupt enable register
             bitset::set( can_->IER,
                          // CAN_IER_WKUIE |   // Wakeup interrupt
                          CAN_IER_FMPIE0 |  // FIFO message pending interrupt enable
+                         CAN_IER_FOVIE0 |  // FIFO overrun interrupt enable
                          CAN_IER_FMPIE1 |  // FIFO message pending interrupt enable FMP[1:0] bits are not 0b00
-                         CAN_IER_TMEIE     // Transmit mailbox empty interrupt enable
+                         CAN_IER_FOVIE1 |
+                         CAN_IER_TMEIE |   // Transmit mailbox empty interrupt enable
+                         CAN_IER_ERRIE |   // Error interrupt; a frame that is not acknowledged raises no TX interrupt
+                         CAN_IER_LECIE     // ERRI on each error code
                 );
         } while ( 0 );
 
@@ -282,6 +304,8 @@ can::init( stm32f103::CAN_BASE base, uint32_t control )
 
         enable_interrupt( stm32f103::CAN1_TX_IRQn );
         enable_interrupt( stm32f103::CAN1_RX0_IRQn );
+        enable_interrupt( stm32f103::CAN1_RX1_IRQn );
+        enable_interrupt( stm32f103::CAN1_SCE_IRQn );
     }
 
     return status_;
@@ -375,54 +399,63 @@ can::filter( uint8_t filter_idx, CAN_FIFO fifo, CAN_FILTER_SCALE scale, CAN_FILT
 	return CAN_OK;
 }
 
-CAN_TX_MBX
-can::transmit( CanMsg * msg )
+void
+can::load( uint8_t mbx, const CanMsg& msg )
 {
-	CAN_TX_MBX mbx;
 	uint32_t data;
 
-	/* Select one empty transmit mailbox */
-	if (can_->TSR & CAN_TSR_TME0) 
-		mbx = CAN_TX_MBX0;
-	else if (can_->TSR & CAN_TSR_TME1)
-		mbx = CAN_TX_MBX1;
-	else if (can_->TSR & CAN_TSR_TME2)
-		mbx = CAN_TX_MBX2;
-	else {
-		status_ = CAN_NO_MB;
-		return CAN_TX_NO_MBX;
-	}
-
-    tx_status_[ mbx ] = 0;
-
     /* Set up the Id */
     // stdid[31:21]; exxid[31:3]
-    if (msg->IDE == CAN_ID_STD)
-		data = ( msg->ID << 21 );             // 10bit standard id
+    if (msg.IDE == CAN_ID_STD)
+		data = ( msg.ID << 21 );             // 10bit standard id
     else
-		data = ( msg->ID << 3 ) | CAN_ID_EXT; // 28bit extended id
+		data = ( msg.ID << 3 ) | CAN_ID_EXT; // 28bit extended id
 
-	data |= msg->RTR;
+	data |= msg.RTR;
 
     // timestamp [31:16], TGT [8], DLC[3:0] = data length code
-    can_->txMailBox[mbx].TDTR = msg->DLC & 0x0F;
+    can_->txMailBox[mbx].TDTR = msg.DLC & 0x0F;
 
     /* Set up the data field */
     can_->txMailBox[mbx].TDLR = 
-		uint32_t( msg->Data[3] ) << 24 | 
-		uint32_t( msg->Data[2] ) << 16 |
-		uint32_t( msg->Data[1] ) << 8 | 
-		uint32_t( msg->Data[0] );
+		uint32_t( msg.Data[3] ) << 24 | 
+		uint32_t( msg.Data[2] ) << 16 |
+		uint32_t( msg.Data[1] ) << 8 | 
+		uint32_t( msg.Data[0] );
 
     can_->txMailBox[mbx].TDHR = 
-		uint32_t( msg->Data[7] ) << 24 |
-		uint32_t( msg->Data[6] ) << 16 |
-		uint32_t( msg->Data[5] ) << 8 |
-		uint32_t( msg->Data[4] );
+		uint32_t( msg.Data[7] ) << 24 |
+		uint32_t( msg.Data[6] ) << 16 |
+		uint32_t( msg.Data[5] ) << 8 |
+		uint32_t( msg.Data[4] );
         
     /* Request transmission */
     can_->txMailBox[mbx].TIR = (data | CAN_TMIDxR_TXRQ);
-    status_ = CAN_OK;
+}
+
+CAN_TX_MBX
+can::transmit( CanMsg * msg )
+{
+	CAN_TX_MBX mbx = CAN_TX_NO_MBX;
+
+    scoped_tx_lock lock;                            // the transmit queue would take the same mailbox
+
+	/* Select one empty transmit mailbox, which the transmit queue does not own */
+    const uint32_t tsr = can_->TSR;
+    for ( uint8_t i = 0; i < 3; ++i ) {
+        if ( ( tsr & ( CAN_TSR_TME0 << i ) ) && tx_state_[ i ] == TX_IDLE ) {
+            mbx = CAN_TX_MBX( i );
+            break;
+        }
+    }
+
+    if ( mbx != CAN_TX_NO_MBX ) {
+        tx_status_[ mbx ] = 0;
+        load( mbx, *msg );
+        status_ = CAN_OK;
+    } else {
+		status_ = CAN_NO_MB;
+    }
 
 	return mbx;
 }
@@ -430,6 +463,9 @@ can::transmit( CanMsg * msg )
 CAN_STATUS
 can::tx_status( CAN_TX_MBX mbx, uint32_t timeout )
 {
+    if ( mbx == CAN_TX_NO_MBX )
+        return status_;
+
 	/* RQCP, TXOK and TME bits */
     if ( condition_wait( timeout )( [&]{ return tx_status_[ mbx ].load(); } ) ) {
 
@@ -451,6 +487,7 @@ can::tx_status( CAN_TX_MBX mbx, uint32_t timeout )
         }
     } else {
         stream(__FILE__,__LINE__,__FUNCTION__) << "timeout : " << tx_status_[ mbx ] << std::endl;
+        cancel( mbx );           // would be retransmitted for ever otherwise
         status_ = CAN_TX_FAILED; // timeout
     }
 	return status_;
@@ -470,50 +507,193 @@ void
 can::cancel( uint8_t mbx )
 {
 	/* abort transmission */
-	switch (mbx) {
-	case 0:
-		can_->TSR |= CAN_TSR_ABRQ0;
-		break;
-	case 1:
-		can_->TSR |= CAN_TSR_ABRQ1;
-		break;
-	case 2:
-		can_->TSR |= CAN_TSR_ABRQ2;
-		break;
-	default:
-		break;
-	}
+    if ( mbx < 3 ) {
+        scoped_tx_lock lock;
+        if ( tx_state_[ mbx ] == TX_BUSY )
+            abort( mbx, TX_ABORT_FAILED );
+        else if ( tx_state_[ mbx ] == TX_IDLE )
+            can_->TSR = CAN_TSR_ABRQ0 << ( 8 * mbx );
+    }
+}
+
+bool
+can::send( const CanMsg& msg, uint32_t timeout_us, uint8_t options )
+{
+    can_tx_frame frame;
+    frame.msg = msg;
+    frame.key = arbitration_key( msg.ID, msg.IDE == CAN_ID_EXT, msg.RTR == CAN_RTR_REMOTE );
+    frame.queued = cycle_counter::now();
+    frame.timeout = timeout_us * cycle_counter::cycles_per_us();
+    frame.options = options;
+
+    scoped_tx_lock lock;
+
+    // a preempted frame comes back to the queue; keep its slot
+    size_t reserved = 0;
+    for ( auto state: tx_state_ )
+        reserved += ( state == TX_ABORT_PREEMPT );
+
+    bool queued = false;
+    if ( tx_queue_.size() + reserved < CAN_TX_QUEUE_SIZE && tx_queue_.push( frame ) ) {
+        queued = true;
+        ++tx_stat_.queued;
+        if ( tx_queue_.size() > tx_stat_.high_water )
+            tx_stat_.high_water = tx_queue_.size();
+        tx_refill();
+    }
+
+    return queued;
+}
+
+size_t
+can::tx_pending() const
+{
+    size_t count = tx_queue_.size();
+    for ( auto state: tx_state_ )
+        count += ( state != TX_IDLE );
+    return count;
+}
+
+void
+can::tx_service()
+{
+    scoped_tx_lock lock;
+    tx_check( cycle_counter::now() );
+    tx_refill();
+}
+
+bool
+can::tx_flush( uint32_t timeout_us )
+{
+    return deadline( timeout_us )( [&]{ tx_service(); return tx_pending() == 0; } );
+}
+
+void
+can::clear_tx_stat()
+{
+    tx_stat_ = can_tx_statistics{ 0, 0, 0, 0, 0, 0 };
+}
+
+// TX interrupt, or thread with the interrupt masked
+void
+can::abort( uint8_t mbx, TX_MAILBOX_STATE state )
+{
+    tx_state_[ mbx ] = state;
+    can_->TSR = CAN_TSR_ABRQ0 << ( 8 * mbx );   // not read-modify-write; RQCPx are cleared by writing 1
+}
+
+void
+can::tx_complete( uint8_t mbx, uint32_t tsr )
+{
+    const auto state = tx_state_[ mbx ];
+    tx_state_[ mbx ] = TX_IDLE;
+
+    if ( tsr & ( CAN_TSR_TXOK0 << ( 8 * mbx ) ) ) {
+        ++tx_stat_.sent;                            // the abort came too late, if any
+    } else if ( state == TX_ABORT_PREEMPT ) {
+        tx_queue_.requeue( tx_mailbox_[ mbx ] );    // slot kept by send()
+        ++tx_stat_.preempted;
+    } else if ( state == TX_ABORT_TIMEOUT ) {
+        ++tx_stat_.timeout;
+    } else {
+        ++tx_stat_.failed;
+    }
+}
+
+// deadlines of the queued frames and of the mailboxes, and one-shot frames that have failed an attempt
+void
+can::tx_check( uint32_t now )
+{
+    tx_stat_.timeout += tx_queue_.erase_if( [&]( const can_tx_frame& f ){
+            return f.timeout && now - f.queued >= f.timeout; } );
+
+    const uint32_t tsr = can_->TSR;
+    for ( uint8_t mbx = 0; mbx < 3; ++mbx ) {
+        if ( tx_state_[ mbx ] != TX_BUSY )
+            continue;
+        const auto& f = tx_mailbox_[ mbx ];
+        if ( f.timeout && now - f.queued >= f.timeout )
+            abort( mbx, TX_ABORT_TIMEOUT );
+        else if ( ( f.options & CAN_TX_ONESHOT ) && ( tsr & ( ( CAN_TSR_ALST0 | CAN_TSR_TERR0 ) << ( 8 * mbx ) ) ) )
+            abort( mbx, TX_ABORT_FAILED );
+    }
+}
+
+// moves frames from the queue to empty mailboxes, highest priority first; if all three are busy and the next
+// frame would win arbitration over one of them, the lowest of them is aborted and requeued (one at a time).
+// With TXFP=0 the mailboxes of equal identifier go out lowest number first, so that a frame is loaded only above
+// the mailboxes holding its key; it waits for them otherwise.
+void
+can::tx_refill()
+{
+    while ( !tx_queue_.empty() ) {
+        const uint32_t tsr = can_->TSR;
+        auto& top = tx_queue_.top();
+
+        int8_t mbx = -1, lowest = -1;
+        for ( uint8_t i = 0; i < 3; ++i ) {
+            if ( tx_state_[ i ] == TX_ABORT_PREEMPT )
+                return;
+            if ( tx_state_[ i ] != TX_IDLE && tx_mailbox_[ i ].key == top.key )
+                mbx = -1;       // the same key in a mailbox at or below the candidate
+            else if ( mbx < 0 && tx_state_[ i ] == TX_IDLE
+                      && ( tsr & ( CAN_TSR_TME0 << i ) ) && !( tsr & ( CAN_TSR_RQCP0 << ( 8 * i ) ) ) )
+                mbx = i;        // empty, and its completion has been taken by the interrupt
+            if ( tx_state_[ i ] == TX_BUSY && ( lowest < 0 || tx_mailbox_[ i ].key >= tx_mailbox_[ lowest ].key ) )
+                lowest = i;     // of equal keys, the later one
+        }
+
+        if ( mbx < 0 ) {
+            if ( lowest >= 0 && tx_mailbox_[ lowest ].key > top.key )
+                abort( lowest, TX_ABORT_PREEMPT );
+            return;
+        }
+
+        tx_mailbox_[ mbx ] = top;
+        tx_state_[ mbx ] = TX_BUSY;
+        load( mbx, top.msg );
+        tx_queue_.pop();
+    }
 }
 
 void
 can::rx_queue_clear()
 {
-	// nvic_irq_disable(NVIC_USB_LP_CAN_RX0);
-	rx_head_ = rx_tail_ = rx_count_ = rx_lost_ = 0;
-	// nvic_irq_enable(NVIC_USB_LP_CAN_RX0);
+    rx_queue_[ CAN_FIFO_0 ].clear();
+    rx_queue_[ CAN_FIFO_1 ].clear();
 }
 
-uint8_t
-can::rx_available(void)
+size_t
+can::rx_available(void) const
 {
-	return rx_count_;
+    return rx_queue_[ CAN_FIFO_0 ].size() + rx_queue_[ CAN_FIFO_1 ].size();
 }
 
 CanMsg *
 can::rx_queue_get(void)
 {
-	if (rx_count_ == 0)
-		return nullptr;
-	return &( rx_queue_[ rx_tail_ ] );
+    auto msg0 = rx_queue_[ CAN_FIFO_0 ].front();
+    auto msg1 = rx_queue_[ CAN_FIFO_1 ].front();
+
+    if ( msg0 && msg1 ) // both pending; the earlier SOF first (16bit timestamp, wraps)
+        rx_current_ = int16_t( msg1->TIME - msg0->TIME ) < 0 ? CAN_FIFO_1 : CAN_FIFO_0;
+    else
+        rx_current_ = msg1 ? CAN_FIFO_1 : CAN_FIFO_0;
+
+    return rx_current_ == CAN_FIFO_1 ? msg1 : msg0;
 }
 
 void
 can::rx_queue_free()
 {
-	if ( rx_count_ > 0 ) {
-		rx_tail_ = ( rx_tail_ == (CAN_RX_QUEUE_SIZE - 1)) ? 0 : (rx_tail_ + 1);
-		--rx_count_;
-	}
+    rx_queue_[ rx_current_ ].pop();
+}
+
+void
+can::clear_rx_stat()
+{
+    rx_stat_[ CAN_FIFO_0 ] = can_rx_statistics{ 0, 0, 0, 0 };
+    rx_stat_[ CAN_FIFO_1 ] = can_rx_statistics{ 0, 0, 0, 0 };
 }
 
 CanMsg*
@@ -533,6 +713,7 @@ can::read( CAN_FIFO fifo, CanMsg* msg )
 	msg->RTR = CAN_RTR_REMOTE & data;
 	msg->DLC = 0x0F & can_->fifoMailBox[fifo].RDTR;
 	msg->FMI = 0xFF & (can_->fifoMailBox[fifo].RDTR >> 8);
+	msg->TIME = 0xFFFF & (can_->fifoMailBox[fifo].RDTR >> 16);
 
 	/* Get the data field */
 	data = can_->fifoMailBox[fifo].RDLR;
@@ -554,42 +735,57 @@ can::read( CAN_FIFO fifo, CanMsg* msg )
 void
 can::rx_release( CAN_FIFO fifo )
 {
+    // not read-modify-write; FULL and FOVR are cleared by writing 1, and FOVR is counted in rx_drain
 	if ( fifo == CAN_FIFO_0 )
-		can_->RF0R |= (CAN_RF0R_RFOM0);	// Release FIFO0
+		can_->RF0R = CAN_RF0R_RFOM0;	// Release FIFO0
 	else
-		can_->RF1R |= (CAN_RF1R_RFOM1);	// Release FIFO1
+		can_->RF1R = CAN_RF1R_RFOM1;	// Release FIFO1
 }
 
+// ISR of the FIFO; takes all pending frames into its queue.  Kept short so that a FIFO of 3 frames does not
+// overrun at 1Mbit/s, where back-to-back frames arrive every ~50us.
 void
-can::rx_read( CAN_FIFO fifo )
+can::rx_drain( CAN_FIFO fifo )
 {
-	if ( rx_count_ < CAN_RX_QUEUE_SIZE ) {	// read the message
-		CanMsg * msg = &rx_queue_[rx_head_];
-		read( fifo, msg);
-		rx_head_ = (rx_head_ == (CAN_RX_QUEUE_SIZE - 1)) ? 0 : (rx_head_ + 1);
-		rx_count_++;
-	} else
-		rx_lost_ = 1;						// no place in queue, ignore package
+    volatile uint32_t& rfr = ( fifo == CAN_FIFO_0 ) ? can_->RF0R : can_->RF1R;
+    auto& queue = rx_queue_[ fifo ];
+    auto& stat = rx_stat_[ fifo ];
+
+    uint32_t status = rfr;
+    if ( status & CAN_RF0R_FOVR0 ) {
+        ++stat.overrun;
+        rfr = CAN_RF0R_FOVR0 | CAN_RF0R_FULL0;  // same bit positions in RF1R
+    }
+
+    while ( status & CAN_RF0R_FMP0 ) {
+        if ( auto msg = queue.reserve() ) {
+            read( fifo, msg );
+            queue.commit();
+        } else {
+            ++stat.dropped;                     // no place in queue, ignore package
+        }
+        ++stat.received;
+        rx_release( fifo );
+        status = rfr;
+    }
 
-	rx_release(fifo);
+    const uint32_t pending = queue.size();
+    if ( pending > stat.high_water )
+        stat.high_water = pending;
 }
 
 void
 can::handle_rx0_interrupt()
 {
-    while (( can_->RF0R & CAN_RF0R_FMP0 ) != 0)
-        can::rx_read( CAN_FIFO_0 );		// message pending FIFO0
-
-    while (( can_->RF1R & CAN_RF1R_FMP1 ) != 0)
-        can::rx_read( CAN_FIFO_1 );		// message pending FIFO1
-
+    rx_drain( CAN_FIFO_0 );
     stm32f103::can_t< CAN1_BASE >::callback();
 }
 
 void
 can::handle_rx1_interrupt()
 {
-    stream(__FILE__,__LINE__,__FUNCTION__) << "\n" << std::endl;
+    rx_drain( CAN_FIFO_1 );
+    stm32f103::can_t< CAN1_BASE >::callback();
 }
 
 void
@@ -597,32 +793,32 @@ can::handle_tx_interrupt()
 {
     auto tsr = can_->TSR;
 
-    if ( tsr & CAN_TSR_RQCP0) {
-        tx_status_[ 0 ] =  tsr & CAN_TSR_RQCP0 ? 4 : 0;
-        tx_status_[ 0 ] |= tsr & CAN_TSR_TXOK0 ? 2 : 0;
-        tx_status_[ 0 ] |= tsr & CAN_TSR_TME0  ? 1 : 0;
-        can_->TSR |= CAN_TSR_RQCP0;		// reset request complete mbx 0
-    }
-
-    if ( tsr & CAN_TSR_RQCP1) {
-        tx_status_[ 1 ] =  tsr & CAN_TSR_RQCP1 ? 4 : 0;
-        tx_status_[ 1 ] |= tsr & CAN_TSR_TXOK1 ? 2 : 0;
-        tx_status_[ 1 ] |= tsr & CAN_TSR_TME1  ? 1 : 0;   
-        can_->TSR |= CAN_TSR_RQCP1;		// reset request complete mbx 1
+    for ( uint8_t mbx = 0; mbx < 3; ++mbx ) {
+        const uint32_t shift = 8 * mbx;
+        if ( tsr & ( CAN_TSR_RQCP0 << shift ) ) {
+            tx_status_[ mbx ] =  tsr & ( CAN_TSR_RQCP0 << shift ) ? 4 : 0;
+            tx_status_[ mbx ] |= tsr & ( CAN_TSR_TXOK0 << shift ) ? 2 : 0;
+            tx_status_[ mbx ] |= tsr & ( CAN_TSR_TME0 << mbx )    ? 1 : 0;
+            can_->TSR = CAN_TSR_RQCP0 << shift;     // reset request complete mbx; TXOK, ALST and TERR as well
+            if ( tx_state_[ mbx ] != TX_IDLE )
+                tx_complete( mbx, tsr );
+        }
     }
 
-    if ( tsr & CAN_TSR_RQCP2) {
-        tx_status_[ 2 ] =  tsr & CAN_TSR_RQCP2 ? 4 : 0;
-        tx_status_[ 2 ] |= tsr & CAN_TSR_TXOK2 ? 2 : 0;
-        tx_status_[ 2 ] |= tsr & CAN_TSR_TME2  ? 1 : 0;   
-        can_->TSR |= CAN_TSR_RQCP2;		// reset request complete mbx 2
+    if ( tx_pending() ) {
+        tx_check( cycle_counter::now() );
+        tx_refill();
     }
 }
 
 void
 can::handle_sce_interrupt()
 {
-    stream(__FILE__,__LINE__,__FUNCTION__) << "\n" << std::endl;
+    can_->MSR = CAN_MSR_ERRI;                       // rc_w1; not read-modify-write, WKUI and SLAKI stay
+    if ( tx_pending() ) {                           // an attempt has failed; one-shot frames and deadlines
+        tx_check( cycle_counter::now() );
+        tx_refill();
+    }
 }
 
 
@@ -3,6 +3,8 @@
 #include <array>
 #include <atomic>
 #include <cstdint>
+#include "can_rx_queue.hpp"
+#include "can_tx_queue.hpp"
 #include "scoped_spinlock.hpp"
 
 //  CAN Master Control Register bits
@@ -59,7 +61,13 @@ struct CanMsg {
 	uint8_t DLC;
 	uint8_t Data[8];
 	uint8_t FMI;
-    CanMsg() : ID(0), IDE(0), RTR(0), DLC(0), Data{ 0 }, FMI(0) {}
+	uint16_t TIME;		// receive timestamp, CAN bit times (RDTR[31:16], time triggered communication mode)
+    CanMsg() : ID(0), IDE(0), RTR(0), DLC(0), Data{ 0 }, FMI(0), TIME(0) {}
+};
+
+enum CAN_TX_OPTION : uint8_t {
+    CAN_TX_DEFAULT   = 0
+    , CAN_TX_ONESHOT = 1   // aborted after the first failed attempt instead of being retransmitted
 };
 
 enum CAN_Identifier : uint32_t {
@@ -76,31 +84,77 @@ namespace stm32f103 {
 
     enum CAN_BASE : uint32_t;
 
-    constexpr int CAN_RX_QUEUE_SIZE = 8;
+    // per receive FIFO; power of 2.  The hardware FIFO holds 3 frames, which is 150us at 1Mbit/s with
+    // shortest frames; this queue gives the thread 16 frames (0.8ms) more before anything is dropped.
+    constexpr size_t CAN_RX_QUEUE_SIZE = 16;
 
     struct CAN;
 
+    struct can_rx_statistics {
+        uint32_t received;         // frames taken from the FIFO
+        uint32_t dropped;          // frames lost as the queue was full
+        uint32_t overrun;          // FOVR; frames lost in the hardware FIFO as the interrupt was late
+        uint32_t high_water;       // largest number of frames waiting in the queue
+    };
+
+    // software transmit queue in front of the 3 mailboxes
+    constexpr size_t CAN_TX_QUEUE_SIZE = 8;
+
+    struct can_tx_frame {
+        CanMsg msg;
+        uint32_t key;              // arbitration_key of msg
+        uint32_t queued;           // cycle_counter at send()
+        uint32_t timeout;          // cycles from 'queued' until aborted; 0 := none
+        uint8_t options;           // CAN_TX_OPTION
+    };
+
+    struct can_tx_statistics {
+        uint32_t queued;           // frames accepted by send()
+        uint32_t sent;             // TXOK
+        uint32_t failed;           // one-shot failures, and aborts by cancel()
+        uint32_t timeout;          // aborted or dropped at their deadline
+        uint32_t preempted;        // taken out of a mailbox for a higher priority frame, and queued again
+        uint32_t high_water;       // largest number of frames waiting in the queue
+    };
+
     class can {
         volatile CAN * can_;
 
         CAN_STATUS status_;
-        uint8_t rx_head_;
-        uint8_t rx_tail_;
-        uint8_t rx_count_;
-        uint8_t rx_lost_;
         uint8_t active_;
+        uint8_t rx_current_;       // FIFO of the frame given by rx_queue_get; thread only
         std::atomic< uint8_t > tx_status_[3];
-        
-        CanMsg rx_queue_[ CAN_RX_QUEUE_SIZE ];
+
+        can_rx_queue< CanMsg, CAN_RX_QUEUE_SIZE > rx_queue_[ 2 ];
+        can_rx_statistics rx_stat_[ 2 ];
+
+        // transmit queue; owned by the TX interrupt, or by the thread with the interrupt masked
+        enum TX_MAILBOX_STATE : uint8_t {
+            TX_IDLE                 // empty, or loaded by transmit()
+            , TX_BUSY               // loaded from the queue
+            , TX_ABORT_PREEMPT      // abort requested; goes back to the queue unless it has been sent
+            , TX_ABORT_TIMEOUT
+            , TX_ABORT_FAILED       // one-shot frame failed an attempt, or cancel()
+        };
+        can_tx_queue< can_tx_frame, CAN_TX_QUEUE_SIZE > tx_queue_;
+        can_tx_frame tx_mailbox_[ 3 ];
+        TX_MAILBOX_STATE tx_state_[ 3 ];
+        can_tx_statistics tx_stat_;
+
         CAN_STATUS init_enter();
         CAN_STATUS init_leave();
         can();        
         template< CAN_BASE > friend struct can_t;
-        CAN_STATUS init( stm32f103::CAN_BASE, uint32_t control = CAN_MCR_NART );
+        CAN_STATUS init( stm32f103::CAN_BASE, uint32_t control = CAN_MCR_TTCM );
 
-        void rx_read( CAN_FIFO fifo );
+        void rx_drain( CAN_FIFO fifo );
         void rx_release( CAN_FIFO fifo );
         CanMsg * read( CAN_FIFO fifo, CanMsg* msg );
+        void load( uint8_t mbx, const CanMsg& msg );
+        void abort( uint8_t mbx, TX_MAILBOX_STATE state );
+        void tx_complete( uint8_t mbx, uint32_t tsr );
+        void tx_check( uint32_t now );
+        void tx_refill();
         bool fifo_ready( CAN_FIFO fifo ) const;
 
     public:
@@ -130,13 +184,33 @@ namespace stm32f103 {
         CAN_TX_MBX transmit( CanMsg* msg );
         CAN_STATUS tx_status( CAN_TX_MBX mbx, uint32_t timeout = 0xffff );
 
+        // Queued transmission; the TX interrupt moves frames to the mailboxes in arbitration order, and a frame
+        // of higher priority than any in the mailboxes takes the place of the lowest one.  'timeout_us' (up to
+        // ~59s) counts from send(); 0 waits for ever.  Returns false if the queue is full.  Thread context.
+        bool send( const CanMsg& msg, uint32_t timeout_us = 0, uint8_t options = CAN_TX_DEFAULT );
+        // frames queued or in a mailbox
+        size_t tx_pending() const;
+        // Deadlines and one-shot failures of the frames in the mailboxes are found at the TX interrupt, at the error
+        // (SCE) interrupt of each failed attempt, or here.  A frame that keeps losing arbitration raises neither, so
+        // that its deadline passes unnoticed until this is called; call it while waiting.
+        void tx_service();
+        // waits until the queue and the mailboxes are empty; false on timeout
+        bool tx_flush( uint32_t timeout_us );
+
+        const can_tx_statistics& tx_stat() const { return tx_stat_; }
+        void clear_tx_stat();
+
         void cancel( uint8_t );
 
-        uint8_t rx_available(void);
+        // Frames of both FIFOs, the older first (by the receive timestamp); thread context.
+        size_t rx_available(void) const;
         void rx_queue_clear();
         void rx_queue_free();
         CanMsg * rx_queue_get();
 
+        const can_rx_statistics& rx_stat( CAN_FIFO fifo ) const { return rx_stat_[ fifo ]; }
+        void clear_rx_stat();
+
         void handle_tx_interrupt();
         void handle_rx0_interrupt();
         void handle_rx1_interrupt();
@@ -150,7 +224,7 @@ namespace stm32f103 {
         static std::atomic_flag once_flag_;
         static std::atomic_flag guard_;
         
-        static void(*callback_)();
+        static void(*callback_)();       // called from the RX0/RX1 interrupts after the FIFO has been drained
 
         static inline can * instance() {
             static can __instance;
@@ -6,15 +6,18 @@
 // stm32f> can [cr]  // register disp
 // stm32f> cansend 0ab#123456789a
 // stm32f> candump [cr]
+// stm32f> can bench [frames]  // loopback frames/s, per-frame wait vs. transmit queue
 
 #include "can.hpp"
 #include "condition_wait.hpp"
+#include "cycle_counter.hpp"
 #include "dma.hpp"
 #include "stm32f103.hpp"
 #include "stream.hpp"
 #include "utility.hpp"
 #include <algorithm>
 #include <bitset>
+#include <cctype>
 
 constexpr const char * __can_status_strings [] = {
     "CAN_OK"
@@ -30,6 +33,9 @@ constexpr const char * __can_status_strings [] = {
 extern void mdelay( uint32_t );
 
 static uint32_t __cansend_repeat;
+static uint32_t __cansend_timeout = 100;   // ms; 0 := retransmit until acknowledged
+static uint8_t __cansend_options = CAN_TX_DEFAULT;
+static bool __can_filter_ready;
 
 void
 cansend( const char * data )
@@ -73,13 +79,18 @@ cansend( const char * data )
     if ( msg.ID ) {
         auto can = stm32f103::can_t< stm32f103::CAN1_BASE >::instance();
         can->filter( 0, CAN_FIFO_0, CAN_FILTER_32BIT, CAN_FILTER_MASK, 0, 0 ); // idx, fifo, scale, mode, fr1, fr2
+        const auto before = can->tx_stat();
         for ( uint32_t i = 0; i < __cansend_repeat; ++i ) {
-            auto mbx = can->transmit( &msg );
-            auto state = can->tx_status( mbx );
-            if ( state != CAN_OK )
-                stream(__FILE__,__LINE__) << __can_status_strings[ state ] << std::endl;
-            mdelay( 100 );
+            while ( ! can->send( msg, __cansend_timeout * 1000, __cansend_options ) )
+                can->tx_service();  // queue full; the TX interrupt is emptying it
         }
+        if ( ! can->tx_flush( ( __cansend_timeout ? __cansend_timeout : 1000 ) * 1000 + 10000 ) )
+            stream(__FILE__,__LINE__) << __can_status_strings[ CAN_TX_PENDING ] << std::endl;
+        const auto& after = can->tx_stat();
+        if ( after.failed != before.failed || after.timeout != before.timeout )
+            stream(__FILE__,__LINE__) << __can_status_strings[ CAN_TX_FAILED ]
+                                      << " failed: " << int( after.failed - before.failed )
+                                      << " timeout: " << int( after.timeout - before.timeout ) << std::endl;
     }
 }
 
@@ -95,7 +106,7 @@ candump()
     while ( auto rx = can->rx_queue_get() ) {
         // stream() << "\nCAN Recv:\tID: " << rx->ID << ", RTR: " << rx->RTR
         //                                        << ", DLC: " << rx->DLC << ", FMI: " << rx->FMI << "\tdata: \t";
-        stream() << "\nCAN Recv:\tID: " << rx->ID << "\tdata:\t";
+        stream() << "\nCAN Recv:\tID: " << rx->ID << "\tTIME: " << int( rx->TIME ) << "\tdata:\t";
 
         for ( int i = 0; i < sizeof( rx->Data ); ++i )
             stream() << rx->Data[ i ] << ", ";
@@ -106,12 +117,122 @@ candump()
     }
 }
 
+static void
+can_stat( stm32f103::can * cbus )
+{
+    for ( auto fifo: { CAN_FIFO_0, CAN_FIFO_1 } ) {
+        auto& stat = cbus->rx_stat( fifo );
+        stream() << "FIFO" << int( fifo )
+                 << "\treceived: " << int( stat.received )
+                 << "\tdropped: " << int( stat.dropped )
+                 << "\toverrun: " << int( stat.overrun )
+                 << "\thigh-water: " << int( stat.high_water ) << "/" << int( stm32f103::CAN_RX_QUEUE_SIZE )
+                 << std::endl;
+    }
+    stream() << "pending: " << int( cbus->rx_available() ) << std::endl;
+
+    auto& tx = cbus->tx_stat();
+    stream() << "TX\tqueued: " << int( tx.queued )
+             << "\tsent: " << int( tx.sent )
+             << "\tfailed: " << int( tx.failed )
+             << "\ttimeout: " << int( tx.timeout )
+             << "\tpreempted: " << int( tx.preempted )
+             << "\thigh-water: " << int( tx.high_water ) << "/" << int( stm32f103::CAN_TX_QUEUE_SIZE )
+             << std::endl;
+}
+
+static size_t
+can_drain( stm32f103::can * cbus )
+{
+    size_t count = 0;
+    while ( cbus->rx_queue_get() ) {
+        cbus->rx_queue_free();
+        ++count;
+    }
+    return count;
+}
+
+static void
+can_bench_result( const char * name, uint32_t frames, uint32_t cycles, size_t received )
+{
+    const uint32_t us = cycles / stm32f103::cycle_counter::cycles_per_us();
+    stream() << name << "\t" << int( frames ) << " frames in " << int( us ) << "us\t"
+             << int( us ? uint64_t( frames ) * 1'000'000 / us : 0 ) << " frames/s\treceived: " << int( received ) //';
+             << std::endl;
+}
+
+// Loopback throughput: the per-frame wait that cansend used (transmit, tx_status, mdelay(100)), the same without
+// the delay, and the transmit queue.  Frames are received back into FIFO0 and counted.
+static void
+can_bench( stm32f103::can * cbus, uint32_t count )
+{
+    const bool loopback = cbus->loopback_mode();
+    if ( ! loopback )
+        cbus->set_loopback_mode( true );
+    can_drain( cbus );
+    cbus->clear_tx_stat();
+
+    CanMsg msg;
+    msg.IDE = CAN_ID_STD;
+    msg.RTR = CAN_RTR_DATA;
+    msg.DLC = 8;
+
+    do {
+        const uint32_t frames = 10;
+        size_t received = 0;
+        stm32f103::cycle_counter cc;
+        for ( uint32_t i = 0; i < frames; ++i ) {
+            msg.ID = 0x041;
+            cbus->tx_status( cbus->transmit( &msg ) );
+            mdelay( 100 );
+            received += can_drain( cbus );
+        }
+        can_bench_result( "wait+mdelay", frames, cc.elapsed(), received );
+    } while ( 0 );
+
+    do {
+        size_t received = 0;
+        stm32f103::cycle_counter cc;
+        for ( uint32_t i = 0; i < count; ++i ) {
+            msg.ID = 0x041;
+            cbus->tx_status( cbus->transmit( &msg ) );
+            received += can_drain( cbus );
+        }
+        can_bench_result( "wait", count, cc.elapsed(), received );
+    } while ( 0 );
+
+    do {
+        size_t received = 0;
+        stm32f103::cycle_counter cc;
+        for ( uint32_t i = 0; i < count; ++i ) {
+            msg.ID = 0x040 + ( i & 7 );     // mixed priorities
+            msg.Data[ 0 ] = uint8_t( i );
+            while ( ! cbus->send( msg, 100'000 ) ) { //';
+                cbus->tx_service();
+                received += can_drain( cbus );
+            }
+            received += can_drain( cbus );
+        }
+        cbus->tx_flush( 100'000 ); //';
+        const uint32_t cycles = cc.elapsed();
+        received += can_drain( cbus );
+        can_bench_result( "queue", count, cycles, received );
+    } while ( 0 );
+
+    can_stat( cbus );
+
+    if ( ! loopback )
+        cbus->set_loopback_mode( false );
+}
+
 void
 can_command( size_t argc, const char ** argv )
 {
-    if ( ! stm32f103::can_t< stm32f103::CAN1_BASE >::callback_ ) {
-        stm32f103::can_t< stm32f103::CAN1_BASE >::set_callback( &candump );
+    // received frames are printed by 'candump' from the thread; printing from the RX interrupt (as a callback)
+    // would hold it long enough for the hardware FIFO to overrun under load
+    if ( ! __can_filter_ready ) {
         stm32f103::can_t< stm32f103::CAN1_BASE >::instance()->filter( 0, CAN_FIFO_0, CAN_FILTER_32BIT, CAN_FILTER_MASK, 0, 0 );
+        __can_filter_ready = true;
     }
 
     if ( strcmp( argv[ 0 ], "can" ) == 0 ) {
@@ -152,16 +273,49 @@ can_command( size_t argc, const char ** argv )
                 } else {
                     stream() << "\tcan bitrate {125|250|500|1000}";
                 }
+            } else if ( strcmp( argv[ 0 ], "stat" ) == 0 ) {
+                can_stat( cbus );
+                if ( argc > 1 && strcmp( argv[ 1 ], "clear" ) == 0 ) {
+                    cbus->clear_rx_stat();
+                    cbus->clear_tx_stat();
+                    ++argv; --argc;
+                }
             } else if ( strcmp( argv[ 0 ], "repeat" ) == 0 ) {
                 if ( argc ) {
                     __cansend_repeat = strtod( argv[ 1 ] );
                     ++argv; --argc;                    
                 }
+            } else if ( strcmp( argv[ 0 ], "timeout" ) == 0 ) {
+                if ( argc > 1 ) {
+                    __cansend_timeout = strtod( argv[ 1 ] );
+                    ++argv; --argc;
+                }
+                stream() << "cansend timeout " << int( __cansend_timeout ) << "ms" << std::endl;
+            } else if ( strcmp( argv[ 0 ], "oneshot" ) == 0 ) {
+                if ( argc > 1 ) {
+                    if ( strcmp( argv[ 1 ], "off" ) == 0 )
+                        __cansend_options &= ~CAN_TX_ONESHOT;
+                    else if ( strcmp( argv[ 1 ], "on" ) == 0 )
+                        __cansend_options |= CAN_TX_ONESHOT;
+                    ++argv; --argc;
+                }
+                stream() << "cansend oneshot " << ( __cansend_options & CAN_TX_ONESHOT ? "on" : "off" ) << std::endl;
+            } else if ( strcmp( argv[ 0 ], "bench" ) == 0 ) {
+                uint32_t count = 1000;
+                if ( argc > 1 && std::isdigit( *argv[ 1 ] ) ) {
+                    count = strtod( argv[ 1 ] );
+                    ++argv; --argc;
+                }
+                can_bench( cbus, count );
             } else {
                 stream() << "unknown option: " << argv[ 0 ] << std::endl;
                 stream() << "usage:\n\tcan loopback {on|off}" << std::endl;
                 stream() << "\tcan silent {on|off}" << std::endl;
                 stream() << "\tcan bitrate {125|250|500|1000}" << std::endl;
+                stream() << "\tcan stat [clear]" << std::endl;
+                stream() << "\tcan timeout <ms>\t(cansend; 0 := no timeout)" << std::endl;
+                stream() << "\tcan oneshot {on|off}\t(cansend)" << std::endl;
+                stream() << "\tcan bench [frames]\t(loopback frames/s)" << std::endl;
                 return;
             }
         }
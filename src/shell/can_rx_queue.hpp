@@ -0,0 +1,67 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Receive queue between a CAN FIFO interrupt (producer) and the thread (consumer).
+// The interrupt fills the slot given by reserve() and publishes it with commit(); the thread reads front()
+// and releases it with pop().  tail_ is written by the interrupt only and head_ by the thread only, so that
+// neither side has to disable interrupts.  One queue per receive FIFO, since the FIFO0 and FIFO1 interrupts
+// may run at different priorities.
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace stm32f103 {
+
+    template< typename T, size_t N >
+    class can_rx_queue {
+        static_assert( N && ( N & ( N - 1 ) ) == 0, "queue depth must be a power of 2" );
+
+        std::array< T, N > queue_;
+        std::atomic< uint32_t > head_;       // next to take; thread only
+        std::atomic< uint32_t > tail_;       // next free slot; ISR only
+
+    public:
+        static constexpr size_t depth = N;
+
+        can_rx_queue() : queue_{}, head_( 0 ), tail_( 0 ) {
+        }
+
+        // ISR; the slot to be filled, nullptr if the queue is full
+        inline T * reserve() {
+            const uint32_t tail = tail_.load();
+            if ( tail - head_.load() >= N )
+                return nullptr;
+            return &queue_[ tail % N ];
+        }
+
+        // ISR; publish the slot given by reserve()
+        inline void commit() { tail_ = tail_.load() + 1; }
+
+        inline size_t size() const { return tail_.load() - head_.load(); }
+
+        // thread; the oldest entry, nullptr if empty
+        inline T * front() {
+            const uint32_t head = head_.load();
+            return head != tail_.load() ? &queue_[ head % N ] : nullptr;
+        }
+
+        // thread
+        inline void pop() {
+            const uint32_t head = head_.load();
+            if ( head != tail_.load() )
+                head_ = head + 1;
+        }
+
+        // thread; drops what has been received so far
+        inline void clear() { head_ = tail_.load(); }
+    };
+
+}
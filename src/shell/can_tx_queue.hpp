@@ -0,0 +1,92 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// Transmit queue ordered by CAN arbitration priority.
+// T has a 'key' member from arbitration_key(); the smallest key is the frame that would win arbitration on the
+// bus, and goes to a mailbox first.  Frames of equal key keep the order they were pushed in; requeue() puts a frame
+// back ahead of them, as it was sent to a mailbox before any of them.  The array is
+// kept in descending key order so that the next frame is taken from the back without moving anything.
+// Not reentrant; the driver serializes the thread and the TX interrupt by masking the interrupt.
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace stm32f103 {
+
+    // Arbitration field as the bus sees it, dominant (0) bits first: base id[10:0], RTR (standard) or SRR
+    // (extended, recessive), IDE, extended id[17:0], RTR (extended).  A standard frame wins over an extended
+    // one of the same base id, and a data frame over a remote frame.
+    constexpr uint32_t
+    arbitration_key( uint32_t id, bool extended, bool remote )
+    {
+        return extended
+            ? ( ( id >> 18 ) & 0x7ff ) << 21 | 1 << 20 | 1 << 19 | ( id & 0x3ffff ) << 1 | uint32_t( remote )
+            : ( id & 0x7ff ) << 21 | uint32_t( remote ) << 20;
+    }
+
+    template< typename T, size_t N >
+    class can_tx_queue {
+        std::array< T, N > queue_;   // descending key; back() is the highest priority
+        size_t size_;
+
+    public:
+        static constexpr size_t depth = N;
+
+        can_tx_queue() : queue_{}, size_( 0 ) {
+        }
+
+        inline size_t size() const { return size_; }
+        inline bool empty() const { return size_ == 0; }
+        inline bool full() const { return size_ == N; }
+
+        bool push( const T& t ) {
+            if ( size_ == N )
+                return false;
+            size_t i = size_++;
+            while ( i > 0 && queue_[ i - 1 ].key <= t.key ) {  // ahead of higher or equal priority
+                queue_[ i ] = queue_[ i - 1 ];
+                --i;
+            }
+            queue_[ i ] = t;
+            return true;
+        }
+
+        // a frame taken back from a mailbox; ahead of the frames of equal key
+        bool requeue( const T& t ) {
+            if ( size_ == N )
+                return false;
+            size_t i = size_++;
+            while ( i > 0 && queue_[ i - 1 ].key < t.key ) {
+                queue_[ i ] = queue_[ i - 1 ];
+                --i;
+            }
+            queue_[ i ] = t;
+            return true;
+        }
+
+        // the highest priority; the queue must not be empty
+        inline T& top() { return queue_[ size_ - 1 ]; }
+        inline void pop() { if ( size_ ) --size_; }
+
+        // removes the frames for which pred( T& ) is true; returns the number removed
+        template< typename Pred > size_t erase_if( Pred pred ) {
+            size_t n = 0;
+            for ( size_t i = 0; i < size_; ++i ) {
+                if ( pred( queue_[ i ] ) )
+                    ++n;
+                else if ( n )
+                    queue_[ i - n ] = queue_[ i ];
+            }
+            size_ -= n;
+            return n;
+        }
+    };
+
+}
@@ -0,0 +1,154 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Oscilloscope style pre/post trigger capture on a sample stream.
+// push() is called for every sample (DMA callback on target, recorded stream on host);
+// trigger() is an external event (EXTI, ADC analog watchdog).
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace dsp {
+
+    enum trigger_mode {
+        trigger_level          // sample outside of [low, high], same as ADC analog watchdog
+        , trigger_rising       // sample >= high after it has been <= low (low..high is hysteresis)
+        , trigger_falling      // sample <= low after it has been >= high
+        , trigger_external     // trigger() only
+    };
+
+    enum capture_state {
+        capture_idle
+        , capture_armed
+        , capture_triggered
+        , capture_ready
+    };
+
+    template< typename T, size_t N >
+    class triggered_capture {
+        std::array< T, N > data_;
+        std::atomic< capture_state > state_;
+        trigger_mode mode_;
+        T low_;
+        T high_;
+        size_t pre_;
+        size_t post_;
+        size_t pos_;       // next write position
+        size_t filled_;    // number of valid samples, up to N
+        size_t remain_;    // samples to be taken after trigger
+        size_t trigger_pos_;
+        bool edge_ready_;
+        void (*callback_)();
+    public:
+        constexpr triggered_capture() : data_{}, state_( capture_idle ), mode_( trigger_level ), low_( 0 ), high_( 0 )
+                                      , pre_( 0 ), post_( 0 ), pos_( 0 ), filled_( 0 ), remain_( 0 ), trigger_pos_( 0 )
+                                      , edge_ready_( false ), callback_( nullptr ) {
+        }
+
+        static constexpr size_t capacity() { return N; }
+
+        // 'post' includes the trigger sample itself
+        bool setup( trigger_mode mode, T low, T high, size_t pre, size_t post, void (*callback)() = nullptr ) {
+            if ( pre + post > N || post == 0 )
+                return false;
+            state_ = capture_idle;
+            mode_ = mode;
+            low_ = low;
+            high_ = high;
+            pre_ = pre;
+            post_ = post;
+            callback_ = callback;
+            return true;
+        }
+
+        void arm() {
+            state_ = capture_idle;
+            pos_ = filled_ = remain_ = 0;
+            edge_ready_ = false;
+            state_ = capture_armed;
+        }
+
+        void disarm() { state_ = capture_idle; }
+
+        capture_state state() const { return state_.load(); }
+        trigger_mode mode() const { return mode_; }
+        size_t pre() const { return pre_; }
+        size_t post() const { return post_; }
+        size_t size() const { return pre_ + post_; }
+
+        // external trigger; accepted when pre-trigger window has been filled
+        bool trigger() {
+            if ( state_.load() != capture_armed || filled_ < pre_ )
+                return false;
+            trigger_pos_ = pos_; // next sample is the trigger point
+            remain_ = post_;
+            state_ = capture_triggered;
+            return true;
+        }
+
+        capture_state push( T x ) {
+            auto state = state_.load();
+            if ( state == capture_armed && mode_ != trigger_external ) {
+                bool fire = false;
+                switch ( mode_ ) {
+                case trigger_level:
+                    fire = x < low_ || x > high_;
+                    break;
+                case trigger_rising:
+                    fire = edge_ready_ && x >= high_;
+                    if ( x <= low_ )
+                        edge_ready_ = true;
+                    break;
+                case trigger_falling:
+                    fire = edge_ready_ && x <= low_;
+                    if ( x >= high_ )
+                        edge_ready_ = true;
+                    break;
+                default:
+                    break;
+                }
+                if ( fire ) {
+                    edge_ready_ = false; // an edge is consumed even if pre-trigger window is not filled yet
+                    if ( trigger() )
+                        state = capture_triggered;
+                }
+            }
+
+            if ( state == capture_armed || state == capture_triggered ) {
+                data_[ pos_ ] = x;
+                pos_ = ( pos_ + 1 ) % N;
+                if ( filled_ < N )
+                    ++filled_;
+                if ( state == capture_triggered && --remain_ == 0 ) {
+                    state_ = capture_ready; // freeze
+                    if ( callback_ )
+                        callback_();
+                    return capture_ready;
+                }
+            }
+            return state;
+        }
+
+        // copy captured window (pre + post samples, oldest first) from sample 'offset' on; returns number of samples
+        size_t read( T * out, size_t size, size_t offset = 0 ) const {
+            if ( state_.load() != capture_ready || offset >= pre_ + post_ )
+                return 0;
+            size_t n = pre_ + post_ - offset;
+            if ( size < n )
+                n = size;
+            size_t p = ( trigger_pos_ + N - pre_ + offset ) % N;
+            for ( size_t i = 0; i < n; ++i )
+                out[ i ] = data_[ ( p + i ) % N ];
+            return n;
+        }
+    };
+
+}
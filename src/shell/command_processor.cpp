@@ -7,14 +7,18 @@
 #include "command_processor.hpp"
 #include "adc.hpp"
 #include "bkp.hpp"
+#include "buffer_pool.hpp"
 #include "condition_wait.hpp"
+#include "cycle_counter.hpp"
 #include "dma.hpp"
 #include "dma_channel.hpp"
 #include "gpio.hpp"
 #include "gpio_mode.hpp"
 #include "i2c.hpp"
+#include "mem2mem.hpp"
 #include "rtc.hpp"
 #include "spi.hpp"
+#include "spi_link.hpp"
 #include "stream.hpp"
 #include "stm32f103.hpp"
 #include "system_clock.hpp"
@@ -28,6 +32,12 @@
 extern std::atomic< uint32_t > atomic_jiffies;
 extern void mdelay( uint32_t ms );
 
+extern "C" {
+    void * memset( void * ptr, int value, size_t num );
+    void * memcpy( void * dest, const void * src, size_t num );
+}
+
+void adc_command( size_t argc, const char ** argv );
 void can_command( size_t argc, const char ** argv );
 void i2c_command( size_t argc, const char ** argv );
 void i2cdetect( size_t argc, const char ** argv );
@@ -149,6 +159,346 @@ bkp_command( size_t argc, const char ** argv )
     stm32f103::bkp::print_registers();
 }
 
+// back-to-back DMA block transfers at the maximum clock; sustained rate including the per-block setup
+static void
+spi_bench( stm32f103::spi& spix, size_t count )
+{
+    using namespace stm32f103;
+    uint16_t txd[ 128 ], rxd[ 128 ];        // on the stack; 256 byte blocks
+    constexpr size_t block = sizeof( txd ); // bytes
+
+    if ( !spix.has_dma() && !spix.attach( *dma_t< DMA1_BASE >::instance() ) ) {
+        stream() << "\tspi bench: DMA channels are in use" << std::endl;
+        return;
+    }
+    for ( size_t i = 0; i < block / 2; ++i )
+        txd[ i ] = uint16_t( i );
+
+    const size_t frame_size = spix.frame_size();
+    const uint32_t clock = spix.set_speed();
+    stream() << "\tSCK " << int( clock / 1000 ) << " kHz, " << int( count ) << " x " << int( block ) << " bytes" << std::endl;
+
+    for ( auto bits: { 8, 16 } ) {
+        spix.set_frame_size( bits );
+        const size_t frames = bits == 8 ? block : block / 2;
+        for ( int mode = 0; mode < 3; ++mode ) {
+            const void * tx = mode == 2 ? nullptr : txd;
+            void * rx = mode == 1 ? nullptr : rxd;
+            size_t errors = 0;
+            cycle_counter cycles;
+            for ( size_t n = 0; n < count; ++n ) {
+                if ( !spix.transfer( tx, rx, frames ) || !deadline( 10'000 )( [&]{ return !spix.busy(); } ) ) { //'
+                    stream() << "\tspi bench: transfer timeout" << std::endl;
+                    return;
+                }
+                if ( spix.dma_status() & 0x08 ) // TEIF
+                    ++errors;
+            }
+            const uint32_t elapsed = cycles.elapsed();
+            // bits per us := Mbit/s; x100 for two decimal places
+            const uint32_t mbps = uint32_t( uint64_t( count ) * block * 8 * cycle_counter::cycles_per_us() * 100 / ( elapsed ? elapsed : 1 ) );
+            stream() << "\t" << int( bits ) << "bit "
+                     << ( mode == 0 ? "full-duplex: " : mode == 1 ? "tx-only:     " : "rx-only:     " )
+                     << int( mbps / 100 ) << "." << char( '0' + mbps / 10 % 10 ) << char( '0' + mbps % 10 ) << " Mbit/s"
+                     << ", errors: " << int( errors ) << std::endl;
+        }
+    }
+    spix.set_frame_size( frame_size );
+}
+
+// two devices of different mode, frame size and clock, interleaved on the bus queue
+static void
+spi_devices( stm32f103::spi& spix, size_t count )
+{
+    using namespace stm32f103;
+    static const spi_device devices[] = {
+        { 'A', PA8, SPI_MODE3, 16, spi_max_clock }
+        , { 'B', PB0, SPI_MODE0, 8, 1'000'000 } //'
+    };
+    static spi_transaction transactions[ spi_bus< spi >::queue_depth ];
+    static uint16_t txd[ spi_bus< spi >::queue_depth ][ 16 ];
+
+    if ( !spix.has_dma() && !spix.attach( *dma_t< DMA1_BASE >::instance() ) ) {
+        stream() << "\tspi devices: DMA channels are in use" << std::endl;
+        return;
+    }
+    stm32f103::gpio< GPIOA_PIN >( stm32f103::PA8 ) = true;
+    stm32f103::gpio< GPIOB_PIN >( stm32f103::PB0 ) = true;
+    gpio_mode()( stm32f103::PA8, stm32f103::GPIO_CNF_OUTPUT_PUSH_PULL, stm32f103::GPIO_MODE_OUTPUT_50M ); // CS of device 0
+    gpio_mode()( stm32f103::PB0, stm32f103::GPIO_CNF_OUTPUT_PUSH_PULL, stm32f103::GPIO_MODE_OUTPUT_50M ); // CS of device 1
+
+    auto& bus = spix.bus();
+    bus.clear_stat();
+    cycle_counter cycles;
+    for ( size_t n = 0; n < count; ++n ) {
+        auto& t = transactions[ n % spi_bus< spi >::queue_depth ];
+        if ( n >= spi_bus< spi >::queue_depth && !deadline( 10'000 )( [&]{ return t.done.load(); } ) ) { //'
+            stream() << "\tspi devices: transaction timeout" << std::endl;
+            return;
+        }
+        auto& d = devices[ n & 1 ];
+        auto tx = txd[ n % spi_bus< spi >::queue_depth ];
+        for ( size_t i = 0; i < 16; ++i )
+            tx[ i ] = uint16_t( n + i );
+        t.device = &d;
+        t.tx = tx;
+        t.rx = nullptr;
+        t.count = d.frame_size == 16 ? 16 : 32; // 32 bytes either way
+        if ( !bus.submit( t ) ) {
+            stream() << "\tspi devices: submit failed" << std::endl;
+            return;
+        }
+    }
+    deadline( 10'000 )( [&]{ return !bus.busy() && bus.pending() == 0; } ); //'
+    const uint32_t elapsed = cycles.elapsed();
+    const auto& stat = bus.stat();
+    stream() << "\tspi devices: " << int( stat.transactions ) << " transactions, failed: " << int( stat.failed )
+             << ", reconfigured: " << int( stat.reconfigured )
+             << ", " << int( uint64_t( stat.transactions ) * cycle_counter::cycles_per_us() * 1'000'000 / ( elapsed ? elapsed : 1 ) ) //'
+             << " transactions/s" << std::endl;
+}
+
+// SPI1 as the master with ~SS on PA4 by GPIO, SPI2 listening (SPI1 and SPI2 pins wired back to back)
+static bool
+spi_loopback( stm32f103::spi& master, stm32f103::spi& spi2, uint16_t * ring, size_t size, const char * name )
+{
+    using namespace stm32f103;
+    auto dma = dma_t< DMA1_BASE >::instance();
+
+    if ( ( !master.has_dma() && !master.attach( *dma ) ) || ( !spi2.has_dma() && !spi2.attach( *dma ) ) ) {
+        stream() << "\tspi " << name << ": DMA channels are in use" << std::endl;
+        return false;
+    }
+
+    stm32f103::gpio< GPIOA_PIN >( stm32f103::PA4 ) = true;
+    gpio_mode()( stm32f103::PA4, stm32f103::GPIO_CNF_OUTPUT_PUSH_PULL,     stm32f103::GPIO_MODE_OUTPUT_50M ); // ~SS by GPIO
+    gpio_mode()( stm32f103::PA5, stm32f103::GPIO_CNF_ALT_OUTPUT_PUSH_PULL, stm32f103::GPIO_MODE_OUTPUT_50M ); // SCLK
+    gpio_mode()( stm32f103::PA6, stm32f103::GPIO_CNF_INPUT_FLOATING,       stm32f103::GPIO_MODE_INPUT );      // MISO
+    gpio_mode()( stm32f103::PA7, stm32f103::GPIO_CNF_ALT_OUTPUT_PUSH_PULL, stm32f103::GPIO_MODE_OUTPUT_50M ); // MOSI
+    master.setup( 'A', PA4 );
+
+    gpio_mode()( stm32f103::PB13, stm32f103::GPIO_CNF_INPUT_FLOATING,       stm32f103::GPIO_MODE_INPUT );      // SCLK
+    gpio_mode()( stm32f103::PB14, stm32f103::GPIO_CNF_ALT_OUTPUT_PUSH_PULL, stm32f103::GPIO_MODE_OUTPUT_50M ); // MISO
+    gpio_mode()( stm32f103::PB15, stm32f103::GPIO_CNF_INPUT_FLOATING,       stm32f103::GPIO_MODE_INPUT );      // MOSI
+    if ( !spi2.listen( ring, size, SPI_MODE3, 16 ) ) { // NSS (PB12) by EXTI
+        stream() << "\tspi " << name << ": SPI2 is busy" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// SPI2 slave stream fed by SPI1 as the master; the slave preloads each reply, the master checks it
+static void
+spi_listen( size_t count )
+{
+    using namespace stm32f103;
+    constexpr size_t block = 32; // data frames
+    constexpr size_t ring_size = 4 * block;
+    static const spi_device slave = { 'A', PA4, SPI_MODE3, 16, spi_max_clock };
+    static spi_transaction t;
+
+    // buffers are borrowed from the shared pool while the command runs
+    scoped_pool_block ring_block( ring_size * sizeof( uint16_t ) ), reply_block( 2 * block * sizeof( uint16_t ) );
+    scoped_pool_block txd_block( block * sizeof( uint16_t ) ), rxd_block( block * sizeof( uint16_t ) );
+    scoped_pool_block data_block( block * sizeof( uint16_t ) );
+    if ( !ring_block || !reply_block || !txd_block || !rxd_block || !data_block ) {
+        stream() << "\tspi listen: buffer pool exhausted" << std::endl;
+        return;
+    }
+    auto ring = ring_block.get< uint16_t >();
+    auto reply = reinterpret_cast< uint16_t (*)[ block ] >( reply_block.get< uint16_t >() );
+    auto txd = txd_block.get< uint16_t >(), rxd = rxd_block.get< uint16_t >(), data = data_block.get< uint16_t >();
+
+    auto& master = *spi_t< SPI1_BASE >::instance();
+    auto& spi2 = *spi_t< SPI2_BASE >::instance();
+
+    if ( !spi_loopback( master, spi2, ring, ring_size, "listen" ) )
+        return;
+
+    size_t errors = 0, mismatch = 0, received = 0;
+    uint32_t active = 0;
+    cycle_counter cycles;
+    for ( size_t n = 0; n < count; ++n ) {
+        for ( size_t i = 0; i < block; ++i ) {
+            txd[ i ] = uint16_t( n * block + i );
+            reply[ n & 1 ][ i ] = uint16_t( ~( n * block + i ) );
+        }
+        spi2.preload( reply[ n & 1 ], block );
+        deadline::delay( 5 ); // NSS high time, for the slave's EXTI to close the previous block
+
+        t.device = &slave;
+        t.tx = txd;
+        t.rx = rxd;
+        t.count = block;
+        uint32_t tp = cycle_counter::now();
+        const bool submitted = master.bus().submit( t );
+        if ( !submitted || !deadline( 10'000 )( [&]{ return t.done.load(); } ) ) { //'
+            stream() << "\tspi listen: master timeout" << std::endl;
+            if ( submitted ) {  // still queued; its buffers must outlive this command
+                txd_block.detach();
+                rxd_block.detach();
+            }
+            break;
+        }
+        active += cycle_counter::now() - tp;
+        if ( t.failed() )
+            ++errors;
+        for ( size_t i = 0; i < block; ++i ) {
+            if ( rxd[ i ] != reply[ n & 1 ][ i ] ) {
+                ++mismatch;
+                break;
+            }
+        }
+
+        spi_frame f;
+        if ( deadline( 1'000 )( [&]{ return spi2.slave().pending() > 0; } ) && spi2.slave().receive( f ) ) { //'
+            const size_t c = spi2.slave().copy( f, data, block );
+            if ( c != block )
+                ++errors;
+            for ( size_t i = 0; i < c; ++i ) {
+                if ( data[ i ] != txd[ i ] ) {
+                    ++mismatch;
+                    break;
+                }
+            }
+            received += c;
+        }
+    }
+    const uint32_t elapsed = cycles.elapsed();
+    spi2.listen( nullptr, 0 );
+
+    const auto& stat = spi2.slave().stat();
+    stream() << "\tspi listen: " << int( stat.frames ) << " blocks, " << int( received ) << " frames"
+             << ", overrun: " << int( stat.overrun ) << ", dropped: " << int( stat.dropped )
+             << ", OVR: " << int( stat.spi_overrun ) << ", underrun: " << int( stat.underrun )
+             << ", errors: " << int( errors ) << ", mismatch: " << int( mismatch ) << std::endl;
+    // bits per us := Mbit/s; x100 for two decimal places
+    stream() << "\tSCK " << int( master.speed() / 1000 ) << " kHz, "
+             << int( uint64_t( received ) * 16 * cycle_counter::cycles_per_us() / ( elapsed ? elapsed : 1 ) ) << " Mbit/s overall, "
+             << int( uint64_t( received ) * 16 * cycle_counter::cycles_per_us() / ( active ? active : 1 ) ) << " Mbit/s within blocks"
+             << std::endl;
+}
+
+// framed link (spi_link.hpp) between SPI1 as the master and SPI2 as the slave, data both ways; 'inject'
+// flips a bit in every 'inject'th frame of each direction
+static void
+spi_link_bench( size_t count, size_t inject )
+{
+    using namespace stm32f103;
+    constexpr size_t words = spi_link::frame_size / 2;
+    constexpr size_t ring_size = 4 * words;
+    static const spi_device slave = { 'A', PA4, SPI_MODE3, 16, spi_max_clock };
+    static spi_transaction t;
+    uint8_t payload[ spi_link::max_payload ];
+    spi_link a, b; // master, slave end
+
+    // frame buffers are borrowed from the shared pool while the command runs
+    scoped_pool_block ring_block( ring_size * sizeof( uint16_t ) ), slave_tx_block( 2 * spi_link::frame_size );
+    scoped_pool_block master_tx_block( spi_link::frame_size ), master_rx_block( spi_link::frame_size );
+    scoped_pool_block slave_rx_block( spi_link::frame_size );
+    if ( !ring_block || !slave_tx_block || !master_tx_block || !master_rx_block || !slave_rx_block ) {
+        stream() << "\tspi link: buffer pool exhausted" << std::endl;
+        return;
+    }
+    auto ring = ring_block.get< uint16_t >();
+    auto slave_tx = reinterpret_cast< uint16_t (*)[ words ] >( slave_tx_block.get< uint16_t >() );
+    auto master_tx = master_tx_block.get< uint16_t >(), master_rx = master_rx_block.get< uint16_t >();
+    auto slave_rx = slave_rx_block.get< uint16_t >();
+
+    auto& master = *spi_t< SPI1_BASE >::instance();
+    auto& spi2 = *spi_t< SPI2_BASE >::instance();
+
+    if ( !spi_loopback( master, spi2, ring, ring_size, "link" ) )
+        return;
+
+    a.reset();
+    b.reset();
+    uint32_t sent[ 2 ] = { 0, 0 }, taken[ 2 ] = { 0, 0 }, mismatch = 0, lost = 0;
+    auto fill = [&]( uint32_t seq, uint8_t salt ) {
+        const size_t size = 1 + ( seq * 61 ) % spi_link::max_payload;
+        for ( size_t i = 0; i < size; ++i )
+            payload[ i ] = uint8_t( seq + i + salt );
+        return size;
+    };
+    auto check = [&]( spi_link& end, uint32_t& seq, uint8_t salt ) {
+        size_t size;
+        while ( ( size = end.receive( payload, sizeof( payload ) ) ) ) {
+            const size_t expected = 1 + ( seq * 61 ) % spi_link::max_payload;
+            bool ok = size == expected;
+            for ( size_t i = 0; ok && i < size; ++i )
+                ok = payload[ i ] == uint8_t( seq + i + salt );
+            if ( !ok )
+                ++mismatch;
+            ++seq;
+        }
+    };
+
+    b.build( slave_tx[ 0 ] );
+    cycle_counter cycles;
+    for ( size_t n = 0; n < count; ++n ) {
+        while ( a.send( payload, fill( sent[ 0 ], 0 ) ) )
+            ++sent[ 0 ];
+        while ( b.send( payload, fill( sent[ 1 ], 0x5a ) ) )
+            ++sent[ 1 ];
+
+        auto reply = slave_tx[ n & 1 ];
+        spi2.preload( reply, words );
+        a.build( master_tx );
+        if ( inject && ( n % inject ) == inject - 1 ) {
+            reinterpret_cast< uint8_t * >( master_tx )[ n % spi_link::frame_size ] ^= 0x10;
+            reinterpret_cast< uint8_t * >( reply )[ ( n * 7 ) % spi_link::frame_size ] ^= 0x01;
+        }
+        deadline::delay( 5 ); // NSS high time, for the slave's EXTI to close the previous block
+
+        t.device = &slave;
+        t.tx = master_tx;
+        t.rx = master_rx;
+        t.count = words;
+        const bool submitted = master.bus().submit( t );
+        if ( !submitted || !deadline( 10'000 )( [&]{ return t.done.load(); } ) ) { //'
+            stream() << "\tspi link: master timeout" << std::endl;
+            if ( submitted ) {  // still queued; its buffers must outlive this command
+                master_tx_block.detach();
+                master_rx_block.detach();
+            }
+            break;
+        }
+        a.parse( master_rx );
+
+        spi_frame f;
+        if ( deadline( 1'000 )( [&]{ return spi2.slave().pending() > 0; } ) && spi2.slave().receive( f ) //'
+             && spi2.slave().copy( f, slave_rx, words ) == words ) {
+            b.parse( slave_rx );
+        } else {
+            ++lost;
+        }
+        b.build( slave_tx[ ( n + 1 ) & 1 ] );
+
+        check( b, taken[ 0 ], 0 );
+        check( a, taken[ 1 ], 0x5a );
+    }
+    const uint32_t elapsed = cycles.elapsed();
+    spi2.listen( nullptr, 0 );
+
+    const auto& sa = a.stat();
+    const auto& sb = b.stat();
+    const uint32_t bytes = sa.bytes + sb.bytes;
+    stream() << "\tspi link: " << int( sa.exchanges ) << " exchanges, SCK " << int( master.speed() / 1000 ) << " kHz" << std::endl;
+    stream() << "\tmaster->slave: " << int( sb.received ) << " frames, " << int( sb.bytes ) << " bytes"
+             << ", crc errors: " << int( sb.crc_errors ) << ", out of sequence: " << int( sb.out_of_sequence )
+             << ", retransmits: " << int( sa.retransmits ) << ", no credit: " << int( sa.no_credit ) << std::endl;
+    stream() << "\tslave->master: " << int( sa.received ) << " frames, " << int( sa.bytes ) << " bytes"
+             << ", crc errors: " << int( sa.crc_errors ) << ", out of sequence: " << int( sa.out_of_sequence )
+             << ", retransmits: " << int( sb.retransmits ) << ", no credit: " << int( sb.no_credit ) << std::endl;
+    // bits per us := Mbit/s; x100 for two decimal places
+    const uint32_t goodput = uint32_t( uint64_t( bytes ) * 8 * cycle_counter::cycles_per_us() * 100 / ( elapsed ? elapsed : 1 ) );
+    // frame errors per 10^4 frames
+    const uint32_t error_rate = uint32_t( uint64_t( sa.crc_errors + sb.crc_errors ) * 10000 / ( sa.exchanges + sb.exchanges ? sa.exchanges + sb.exchanges : 1 ) );
+    stream() << "\tgoodput " << int( goodput / 100 ) << "." << char( '0' + goodput / 10 % 10 ) << char( '0' + goodput % 10 ) << " Mbit/s"
+             << ", frame error rate " << int( error_rate ) << "/10000"
+             << ", payload mismatch: " << int( mismatch ) << ", blocks lost: " << int( lost ) << std::endl;
+}
+
 void
 spi_command( size_t argc, const char ** argv )
 {
@@ -160,6 +510,11 @@ spi_command( size_t argc, const char ** argv )
     size_t count = 1024;
     bool spi_read( false );
     bool spi_ss_soft = false;
+    bool spi_bench_( false );
+    bool spi_devices_( false );
+    bool spi_listen_( false );
+    bool spi_link_( false );
+    size_t inject = 0;
 
     while ( --argc ) {
         ++argv;
@@ -171,9 +526,30 @@ spi_command( size_t argc, const char ** argv )
             spi_ss_soft = true;
         } else if ( *argv[0] == 'r' ) {
             spi_read = true;
+        } else if ( strcmp( argv[0], "bench" ) == 0 ) {
+            spi_bench_ = true;
+        } else if ( strcmp( argv[0], "devices" ) == 0 ) {
+            spi_devices_ = true;
+        } else if ( strcmp( argv[0], "listen" ) == 0 ) {
+            spi_listen_ = true;
+        } else if ( strcmp( argv[0], "link" ) == 0 ) {
+            spi_link_ = true;
+        } else if ( strcmp( argv[0], "inject" ) == 0 && argc > 1 ) {
+            inject = strtod( *++argv );
+            --argc;
         }
     }
 
+    if ( spi_listen_ ) {
+        spi_listen( count );
+        return;
+    }
+
+    if ( spi_link_ ) {
+        spi_link_bench( count, inject );
+        return;
+    }
+
     if ( ! spix ) {
         using namespace stm32f103;
 
@@ -203,15 +579,28 @@ spi_command( size_t argc, const char ** argv )
             else
                 spi_t< SPI1_BASE >::instance()->setup( 0, 0 );
 
-            gpio_mode()( stm32f103::PB12, stm32f103::GPIO_CNF_INPUT_FLOATING,       stm32f103::GPIO_MODE_INPUT ); // ~SS
-            gpio_mode()( stm32f103::PB13, stm32f103::GPIO_CNF_INPUT_FLOATING,       stm32f103::GPIO_MODE_INPUT ); // SCLK
-            gpio_mode()( stm32f103::PB14, stm32f103::GPIO_CNF_ALT_OUTPUT_PUSH_PULL, stm32f103::GPIO_MODE_OUTPUT_50M ); // MISO
-            gpio_mode()( stm32f103::PB15, stm32f103::GPIO_CNF_INPUT_FLOATING,       stm32f103::GPIO_MODE_INPUT ); // MOSI
+            if ( !spi_bench_ && !spi_devices_ ) {
+                // slave pins; the slave by interrupts would not keep up with the bench
+                gpio_mode()( stm32f103::PB12, stm32f103::GPIO_CNF_INPUT_FLOATING,       stm32f103::GPIO_MODE_INPUT ); // ~SS
+                gpio_mode()( stm32f103::PB13, stm32f103::GPIO_CNF_INPUT_FLOATING,       stm32f103::GPIO_MODE_INPUT ); // SCLK
+                gpio_mode()( stm32f103::PB14, stm32f103::GPIO_CNF_ALT_OUTPUT_PUSH_PULL, stm32f103::GPIO_MODE_OUTPUT_50M ); // MISO
+                gpio_mode()( stm32f103::PB15, stm32f103::GPIO_CNF_INPUT_FLOATING,       stm32f103::GPIO_MODE_INPUT ); // MOSI
 
-            spi_t< SPI1_BASE >::instance()->slave_setup();
+                spi_t< SPI1_BASE >::instance()->slave_setup();
+            }
         }
     }
 
+    if ( spi_bench_ ) {
+        spi_bench( spix, count );
+        return;
+    }
+
+    if ( spi_devices_ ) {
+        spi_devices( spix, count );
+        return;
+    }
+
     if ( spi_read ) {
         uint16_t rxd;
         while ( count-- ) {
@@ -259,59 +648,50 @@ alt_test( size_t argc, const char ** argv )
     }
 }
 
-void
-adc_command( size_t argc, const char ** argv )
-{
-    size_t count = 1;
-
-    auto it = std::find_if( argv, argv + argc, [](auto a){ return strcmp( a, "help" ) == 0; } );
-    if ( argc < 2 || ( it != (argv + argc ) ) ) { // help
-        stream() << "adc on NN -- enable ADC; start AD conversion by software cpu cycle, NN replicates.\n";
-        stream() << "adc off -- disable ADC.\n";        
-        stream() << "adc dma -- auto (hardware) repeat AD conversion in background (continue until cpu reset).\n";
-        return;
-    }
-
-    auto& __adc = *stm32f103::adc::instance();
-
-    if ( !__adc ) {
-        using namespace stm32f103;
-
-        stream() << "adc0 not initialized." << std::endl;
-
-        // it must be initalized in main though, just in case
-        gpio_mode()( stm32f103::PA0, GPIO_CNF_INPUT_ANALOG, GPIO_MODE_INPUT ); // ADC1 (0,0)
-
-        stream() << "adc reset & calibration: status " << (( __adc.cr2() & 0x0c ) == 0 ? " PASS" : " FAIL" )  << std::endl;
+namespace {
+    // reference, the byte-at-a-time loop that memset used to be
+    __attribute__(( noinline, optimize( "no-tree-loop-distribute-patterns" ) ))
+    void byte_copy( uint8_t * d, const uint8_t * s, size_t n ) {
+        while ( n-- )
+            *d++ = *s++;
     }
+}
 
-    while ( --argc ) {
-        ++argv;
-        if ( strcmp( argv[0], "off" ) == 0 ) {
-            stream() << "adc.enable( false )" << std::endl;
-            __adc.enable( false );
-        } else if ( strcmp( argv[0], "on" ) == 0 ) {
-            stream() << "adc.enable( true )" << std::endl;
-            __adc.enable( true );
-        } else if ( strcmp( argv[0], "dma" ) == 0 || strcmp( argv[0], "start" ) == 0 ) {
-            stream() << "adc.attach( dma1 )" << std::endl;
-            __adc.attach( *stm32f103::dma_t< stm32f103::DMA1_BASE >::instance() );
-            if ( __adc.start_conversion() ) { // software trigger
-                uint32_t d = __adc.data(); // can't read twince
-                stream() << "adc data= 0x" << d
-                         << "\t" << int(d) << "(mV)"
-                         << std::endl;
-            }
-        } else if ( std::isdigit( *argv[0] ) ) {
-            count = strtod( *argv );
-            for ( size_t i = 0; i < count; ++i ) {
-                if ( __adc.start_conversion() ) { // software trigger
-                    uint32_t d = __adc.data(); // can't read twince
-                    stream() << "[" << int(i) << "] adc data= 0x" << d
-                             << "\t" << int(d) << "(mV)"
-                             << std::endl;
-                }
-            }
+void
+dma_bench( uint32_t channel )
+{
+    using namespace stm32f103;
+    alignas( 4 ) uint8_t src[ 256 + 4 ], dst[ 256 + 4 ];   // on the stack
+    static std::atomic< bool > done;
+    constexpr static uint8_t offsets[][ 2 ] = { { 0, 0 }, { 1, 1 }, { 2, 0 }, { 0, 1 } }; // dst, src
+
+    for ( size_t i = 0; i < sizeof( src ); ++i )
+        src[ i ] = uint8_t( i );
+
+    mem2mem m2m( *dma_t< DMA1_BASE >::instance(), channel );
+
+    stream() << "cycles\nsize\td/s\tbyte\tmemcpy\tmemset\tdma" << std::endl;
+    for ( size_t size: { 16, 64, 256 } ) {
+        for ( auto& o: offsets ) {
+            uint8_t * d = dst + o[ 0 ];
+            const uint8_t * s = src + o[ 1 ];
+            cycle_counter cycles;
+            byte_copy( d, s, size );
+            uint32_t t_byte = cycles.lap();
+            memcpy( d, s, size );
+            uint32_t t_memcpy = cycles.lap();
+            memset( d, 0, size );
+            uint32_t t_memset = cycles.lap();
+            done = false;
+            bool success = m2m.dma_copy( d, s, size, []( uint32_t, void * ){ done = true; } )
+                && condition_wait()( [&]{ return done.load(); } );
+            uint32_t t_dma = cycles.lap();
+            stream() << int( size ) << "\t" << int( o[ 0 ] ) << "/" << int( o[ 1 ] )
+                     << "\t" << int( t_byte ) << "\t" << int( t_memcpy ) << "\t" << int( t_memset ) << "\t";
+            if ( success )
+                stream() << int( t_dma ) << ( std::equal( s, s + size, d ) ? "" : " mismatch" ) << std::endl;
+            else
+                stream() << "failed" << std::endl;
         }
     }
 }
@@ -326,6 +706,24 @@ dma_command( size_t argc, const char ** argv )
         channel = **it - '0';
     }
 
+    using namespace stm32f103;
+    auto dma = dma_t< DMA1_BASE >::instance();
+
+    if ( argc > 1 && strcmp( argv[ 1 ], "owners" ) == 0 ) {
+        for ( uint32_t ch = 0; ch < dma->channels(); ++ch )
+            stream() << "DMA1 #" << int( ch ) << "\towner: " << dma->owner( ch ) << "\tpriority: " << int( dma->priority( ch ) ) << std::endl;
+        return;
+    }
+
+    scoped_dma_owner owner( *dma, channel, DMA_OWNER_MEM2MEM, DMA_PL_LOW );
+    if ( ! owner ) {
+        stream() << "\tdma #" << int( channel ) << " is owned by " << dma->owner( channel ) << std::endl;
+        return;
+    }
+
+    if ( argc > 1 && strcmp( argv[ 1 ], "bench" ) == 0 )
+        return dma_bench( channel );
+
     constexpr static uint32_t src [] = { 0x1a2b3c4d, uint32_t(-2), uint32_t(-3), 4, 5, 6, 7, 8 };
     uint32_t dst [ countof( src ) ] = { 0 };
 
@@ -333,15 +731,38 @@ dma_command( size_t argc, const char ** argv )
     for ( auto& s: src )
         stream() << s << " -> " << dst[ i++ ] << std::endl;
 
-    using namespace stm32f103;
+    if ( argc > 1 && strcmp( argv[ 1 ], "chain" ) == 0 ) {
+        // four descriptors on one channel, each copies a quarter; next one is started from the TC irq
+        constexpr uint32_t ccr32 = MEM2MEM | PL_High | 2 << 10 | 2 << 8 | MINC | PINC;
+        static std::atomic< uint32_t > done;
+        dma->init_channel( DMA_CHANNEL(channel), 0, nullptr, 0, ccr32, DMA_OWNER_MEM2MEM );
+        done = 0;
+        cycle_counter cycles;
+        for ( size_t i = 0; i < 4; ++i ) {
+            dma_job job = { reinterpret_cast< uint32_t >( dst + i * 2 ), 2
+                            , reinterpret_cast< uint32_t >( src + i * 2 ), ccr32
+                            , []( uint32_t status, void * ){ if ( status & 0x02 ) ++done; }, nullptr };
+            if ( ! dma->submit( channel, job ) )
+                stream() << "\tdma submit failed at job " << int( i ) << std::endl;
+        }
+        bool success = condition_wait()( [&]{ return done.load() == 4; } );
+        uint32_t t = cycles.elapsed();
+        stream() << "dma chain: " << int( done.load() ) << "/4 jobs " << ( success ? "complete" : "timeout" )
+                 << ", " << int( t ) << " cycles" << std::endl;
+        i = 0;
+        for ( auto& s: src )
+            stream() << s << " == " << dst[ i++ ] << std::endl;
+        return;
+    }
+
     //constexpr uint32_t ccr = MEM2MEM | PL_High | 2 << 10 | 2 << 8 | MINC | PINC;  // [11:10], [1:0] size {0,1,3} = {8,16,32 bits}
     constexpr uint32_t ccr = MEM2MEM | PL_High | 0 << 10 | 0 << 8 | MINC | PINC;  // [11:10], [1:0] size {0,1,3} = {8,16,32 bits}
 
-    dma_t< DMA1_BASE >::instance()->init_channel( DMA_CHANNEL(channel), reinterpret_cast< uint32_t >( src ), reinterpret_cast< uint8_t * >( dst ), 5, ccr );
+    dma->init_channel( DMA_CHANNEL(channel), reinterpret_cast< uint32_t >( src ), reinterpret_cast< uint8_t * >( dst ), 5, ccr, DMA_OWNER_MEM2MEM );
 
-    stm32f103::scoped_dma_channel_enable<stm32f103::dma> enable_dma_channel( *dma_t< DMA1_BASE >::instance(), channel );
+    stm32f103::scoped_dma_channel_enable<stm32f103::dma> enable_dma_channel( *dma, channel );
 
-    if ( ! condition_wait()([&]{ return dma_t< DMA1_BASE >::instance()->transfer_complete( DMA_CHANNEL(channel) ); } ) ) {
+    if ( ! condition_wait()([&]{ return dma->transfer_complete( DMA_CHANNEL(channel) ); } ) ) {
         stream() << "\tdma timeout\n";
         return;
     }
@@ -375,6 +796,16 @@ rtc_status( size_t argc, const char ** argv )
     }
 }
 
+void
+pool_command( size_t argc, const char ** argv )
+{
+    stream() << "size\tblocks\tin use\tpeak\talloc\texhausted" << std::endl;
+    stm32f103::shared_buffer_pool().for_each( []( size_t size, size_t count, const stm32f103::pool_statistics& st ){
+            stream() << int( size ) << "\t" << int( count ) << "\t" << int( st.in_use ) << "\t" << int( st.high_water )
+                     << "\t" << int( st.allocated ) << "\t" << int( st.exhausted ) << std::endl;
+        });
+}
+
 ///////////////////////////////////////////////////////
 
 command_processor::command_processor()
@@ -395,23 +826,24 @@ static const primitive command_table [] = {
     , { "alt",       alt_test,        " spi [remap]" }
     , { "bkp",       bkp_command,     " backup registers" }
     , { "bmp",       bmp280_command,  " start|stop" }
-    , { "can",       can_command,     " can" }
+    , { "can",       can_command,     " can [loopback|silent|bitrate|stat|timeout|oneshot|bench [N]]" }
     , { "candump",   can_command,     " candump" }
     , { "cansend",   can_command,     " cansend 01a#11223333aabbccdd" }
     , { "date",      date_command,    " show current date time; date --set 'iso format date'" }
     , { "disable",   rcc_enable,      " reg1 [reg2...] Disable clock for specified peripheral." }
-    , { "dma",       dma_command,     " ram to ram dma copy teset" }
+    , { "dma",       dma_command,     " ram to ram dma copy teset [chain|bench|owners] [ch]" }
     , { "enable",    rcc_enable,      " reg1 [reg2...] Enable clock for specified peripheral." }
     , { "gpio",      gpio_command,    " pin# (toggle PA# as GPIO, where # is 0..12)" }
     , { "hwclock",   hwclock_command, "" }
     , { "i2c",       i2c_command,     " I2C-1 test" }
     , { "i2c2",      i2c_command,     " I2C-2 test" }
-    , { "i2cdetect", i2cdetect,       " i2cdetect [0|1]" }
+    , { "i2cdetect", i2cdetect,       " i2cdetect [0|1] (both buses concurrently if omitted)" }
+    , { "pool",      pool_command,    " shared buffer pool statistics" }
     , { "rcc",       rcc_status,      " RCC clock enable register list" }
     , { "reset",     system_reset,    "" }
     , { "rtc",       rtc_status,      " RTC register print" }
-    , { "spi",       spi_command,     " spi [replicates]" }
-    , { "spi2",      spi_command,     " spi2 [replicates]" }
+    , { "spi",       spi_command,     " spi [replicates] [bench|devices|listen|link [inject N]]" }
+    , { "spi2",      spi_command,     " spi2 [replicates] [bench|devices]" }
     , { "timer",     timer_command,   "" }
     , { "help",      help, "" }
     , { "?", help, "" }
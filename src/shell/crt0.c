@@ -25,6 +25,13 @@ extern int main();
 
 
 extern void __adc1_handler(void);
+extern void __exti0_handler(void);
+extern void __exti1_handler(void);
+extern void __exti2_handler(void);
+extern void __exti3_handler(void);
+extern void __exti4_handler(void);
+extern void __exti9_5_handler(void);
+extern void __exti15_10_handler(void);
 extern void __can1_tx_handler(void);
 extern void __can1_rx0_handler(void);
 extern void __can1_rx1_handler(void);
@@ -89,11 +96,11 @@ void ( * const vector_table [] )() __attribute__ ((section(".vect"))) = {
 	__rtc_handler,                  /* 0x04C RTC global                      */
 	0,                              /* 0x050 FLASH global                    */
 	__rcc_handler,                  /* 0x054 RCC global                      */
-	0,                              /* 0x058 EXTI Line0                      */
-	0,                              /* 0x05C EXTI Line1                      */
-	0,                              /* 0x060 EXTI Line2                      */
-	0,                              /* 0x064 EXTI Line3                      */
-	0,                              /* 0x068 EXTI Line4                      */
+	__exti0_handler,                /* 0x058 EXTI Line0                      */
+	__exti1_handler,                /* 0x05C EXTI Line1                      */
+	__exti2_handler,                /* 0x060 EXTI Line2                      */
+	__exti3_handler,                /* 0x064 EXTI Line3                      */
+	__exti4_handler,                /* 0x068 EXTI Line4                      */
 	__dma1_ch1_handler,             /* 0x06C DMA1_Ch1                        */
 	__dma1_ch2_handler,             /* 0x070 DMA1_Ch2                        */
 	__dma1_ch3_handler,             /* 0x074 DMA1_Ch3                        */
@@ -106,7 +113,7 @@ void ( * const vector_table [] )() __attribute__ ((section(".vect"))) = {
 	__can1_rx0_handler,             /* 0x090 CAN1_RX0                        */
 	__can1_rx1_handler,             /* 0x094 CAN1_RX1                        */
 	__can1_sce_handler,             /* 0x098 CAN1_SCE                        */
-	0,                              /* 0x09C EXTI Lines 9:5                  */
+	__exti9_5_handler,              /* 0x09C EXTI Lines 9:5                  */
 	0,                              /* 0x0A0 TIM1 Break                      */
 	0,                              /* 0x0A4 TIM1 Update                     */
 	0,                              /* 0x0A8 TIM1 Trigger and Communication  */
@@ -117,13 +124,13 @@ void ( * const vector_table [] )() __attribute__ ((section(".vect"))) = {
 	__i2c1_event_handler,           /* 0x0BC I2C1 event                      */
 	__i2c1_error_handler,           /* 0x0C0 I2C1 error                      */
 	__i2c2_event_handler,           /* 0x0C4 I2C2 event                      */
-	__i2c2_event_handler,           /* 0x0C8 I2C2 error                      */
+	__i2c2_error_handler,           /* 0x0C8 I2C2 error                      */
 	__spi1_handler,                 /* 0x0CC SPI1                            */
 	__spi2_handler,                 /* 0x0D0 SPI2                            */
 	__usart1_handler,               /* 0x0D4 USART1                          */
 	0,                              /* 0x0D8 USART2                          */
 	0,                              /* 0x0DC USART3                          */
-	0,                              /* 0x0E0 EXTI Lines 15:10                */
+	__exti15_10_handler,            /* 0x0E0 EXTI Lines 15:10                */
 	0,                              /* 0x0E4 RTC alarm through EXTI line     */
 	0,                              /* 49  USB OTG FS Wakeup through EXTI  */
 	0,                              /* -   Reserved                        */
@@ -0,0 +1,85 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "stm32f103.hpp"
+#include <cstdint>
+
+extern uint32_t __system_clock;
+
+namespace stm32f103 {
+
+    // ARMv7-M ARM, C1.8.7 DWT register summary (only first two words are used)
+    struct DWT {
+        uint32_t CTRL;
+        uint32_t CYCCNT;
+    };
+
+    // CPU cycle counter (72MHz), wraps every 59.6 seconds
+    struct cycle_counter {
+        uint32_t tp_;
+
+        cycle_counter() {
+            enable();
+            tp_ = now();
+        }
+
+        inline uint32_t elapsed() const { return now() - tp_; }
+
+        inline uint32_t lap() {
+            uint32_t t = now(), d = t - tp_;
+            tp_ = t;
+            return d;
+        }
+
+        static inline void enable() {
+            auto DEMCR = reinterpret_cast< volatile uint32_t * >( DEMCR_BASE );
+            auto DWT = reinterpret_cast< volatile stm32f103::DWT * >( DWT_BASE );
+            if ( !( DWT->CTRL & 1 ) ) {
+                *DEMCR |= ( 1 << 24 ); // TRCENA
+                DWT->CYCCNT = 0;
+                DWT->CTRL |= 1;        // CYCCNTENA
+            }
+        }
+
+        static inline uint32_t now() {
+            return reinterpret_cast< volatile stm32f103::DWT * >( DWT_BASE )->CYCCNT;
+        }
+
+        static inline uint32_t cycles_per_us() { return __system_clock / 1'000'000; } //';
+    };
+
+    // Time based wait; unlike condition_wait, the timeout does not depend on the CPU clock or
+    // on how the loop has been compiled.  Up to ~59 seconds at 72MHz.
+    struct deadline {
+        uint32_t tp_;
+        uint32_t limit_;
+
+        deadline( uint32_t microseconds ) : limit_( microseconds * cycle_counter::cycles_per_us() ) {
+            cycle_counter::enable();
+            tp_ = cycle_counter::now();
+        }
+
+        inline bool expired() const { return cycle_counter::now() - tp_ >= limit_; }
+
+        // true if the condition has been met before the deadline
+        template< typename functor > inline bool operator()( functor condition ) const {
+            while ( !condition() ) {
+                if ( expired() )
+                    return condition();
+            }
+            return true;
+        }
+
+        static inline void delay( uint32_t microseconds ) {
+            deadline d( microseconds );
+            while ( !d.expired() )
+                ;
+        }
+    };
+
+}
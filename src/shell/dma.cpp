@@ -9,6 +9,7 @@
 #include <array>
 #include <atomic>
 #include <mutex>
+#include "scoped_spinlock.hpp"
 #include "stm32f103.hpp"
 #include "stream.hpp"
 
@@ -41,7 +42,7 @@ namespace stm32f103 {
 
 using namespace stm32f103;
 
-dma::dma() : dma_( 0 )
+dma::dma() : dma_( 0 ), channels_( 0 )
 {
 }
 
@@ -49,20 +50,71 @@ void
 dma::init( stm32f103::DMA_BASE addr )
 {
     lock_.clear();
-    interrupt_status_ = 0;
+    for ( auto& owner: owners_ ) {
+        owner.id = DMA_OWNER_NONE;
+        owner.priority = 0;
+        owner.revoke = nullptr;
+    }
+    for ( auto& status: status_ )
+        status = 0;
+    for ( auto& q: queues_ ) {
+        q.head = q.tail = 0;
+        q.busy = false;
+    }
 
     if ( auto DMA = reinterpret_cast< volatile stm32f103::DMA * >( addr ) ) {
         dma_ = DMA;
+        channels_ = ( addr == DMA2_BASE ) ? dma_number_of_channels< DMA2_BASE >::value : dma_number_of_channels< DMA1_BASE >::value;
+    }
+}
+
+bool
+dma::acquire( uint32_t channel, uint32_t owner, uint32_t priority, void (*revoke)( uint32_t ) )
+{
+    if ( channel >= channels_ || owner == DMA_OWNER_NONE )
+        return false;
+
+    void (*revoked)( uint32_t ) = nullptr;
+    {
+        scoped_spinlock<> lock( lock_ );
+        auto& o = owners_[ channel ];
+        uint32_t current = o.id.load();
+        if ( current != DMA_OWNER_NONE && current != owner ) {
+            if ( priority <= o.priority || busy( channel ) || ( dma_->channels[ channel ].CCR & EN ) )
+                return false;
+            revoked = o.revoke; // idle, lower priority; take it over
+            dma_->channels[ channel ].CCR = 0;
+            callbacks_[ channel ] = nullptr;
+        }
+        o.priority = priority;
+        o.revoke = revoke;
+        o.id = owner;
+    }
+
+    if ( revoked )
+        revoked( channel );
+    return true;
+}
+
+void
+dma::release( uint32_t channel, uint32_t owner )
+{
+    if ( channel >= channels_ )
+        return;
+    scoped_spinlock<> lock( lock_ );
+    auto& o = owners_[ channel ];
+    if ( o.id.load() == owner ) {
+        callbacks_[ channel ] = nullptr;
+        o.revoke = nullptr;
+        o.priority = 0;
+        o.id = DMA_OWNER_NONE;
     }
 }
 
 void
 dma::clear_callback( uint32_t channel )
 {
-    while ( lock_.test_and_set( std::memory_order_acquire ) )
-        ;
-    callbacks_[ channel ] = nullptr;
-    lock_.clear();
+    callbacks_.at( channel ) = nullptr; // single word store
 }
 
 constexpr static const DMAChannel readOnlyChannel = { 0 }; // allocated on .data (ROM)
@@ -70,11 +122,7 @@ constexpr static const DMAChannel readOnlyChannel = { 0 }; // allocated on .data
 volatile DMAChannel&
 dma::dmaChannel( uint32_t channel )
 {
-    auto number_of_channels = dma_number_of_channels< DMA1_BASE >::value;
-    if ( dma_ == reinterpret_cast< volatile stm32f103::DMA * >( DMA1_BASE ) )
-        dma_number_of_channels< stm32f103::DMA2_BASE >::value;
-
-    if ( channel < number_of_channels )
+    if ( channel < channels_ )
         return dma_->channels[ channel ];
 
     // error return
@@ -86,8 +134,16 @@ dma::init_channel( DMA_CHANNEL channel_number
                    , uint32_t peripheral_data_addr
                    , uint8_t * buffer_addr
                    , uint32_t buffer_size
-                   , uint32_t dma_ccr )
+                   , uint32_t dma_ccr
+                   , uint32_t owner )
 {
+    if ( channel_number >= channels_ )
+        return false;
+
+    uint32_t current = owners_[ channel_number ].id.load();
+    if ( current != DMA_OWNER_NONE && current != owner )
+        return false;
+
     auto& channel = dmaChannel( channel_number );
 
     // p277
@@ -102,6 +158,8 @@ dma::init_channel( DMA_CHANNEL channel_number
         enable_interrupt( IRQn( DMA1_Channel1_IRQn + channel_number ) );
     } else {
         enable_interrupt( IRQn( DMA2_Channel1_IRQn + channel_number ) );
+        if ( channel_number == 4 )
+            enable_interrupt( DMA2_Channel4_IRQn ); // high-density devices share 'Channel4_5' irq
     }
 
     return true;
@@ -111,10 +169,8 @@ void
 dma::enable( uint32_t channel_number, bool enable )
 {
     if ( enable ) {
-        while ( lock_.test_and_set( std::memory_order_acquire ) )
-            ;
-        interrupt_status_ &= ~( 0x0f << channel_number );
-        lock_.clear();
+        dma_->IFCR = 0x0f << ( channel_number * 4 );
+        status_[ channel_number ] = 0;
         dmaChannel( channel_number ).CCR |= EN | TCIE | TEIE; // channel enable, transfer complete interrupt enable, error irq
     } else {
         dmaChannel( channel_number ).CCR &= ~( EN | TCIE );
@@ -154,38 +210,105 @@ dma::set_receive_buffer( uint32_t channel_number, uint8_t * buffer, size_t size
 bool
 dma::transfer_complete( uint32_t channel )
 {
-    uint32_t isr(0);
+    // either the ISR has already recorded it, or irq is not (yet) taken
+    return ( status_[ channel ].load() | ( dma_->ISR >> ( channel * 4 ) ) ) & TCIF;
+}
 
-    while ( lock_.test_and_set( std::memory_order_acquire ) )
-        ;
-    isr = interrupt_status_.load();
-    interrupt_status_ = dma_->ISR;
-    lock_.clear();
+bool
+dma::submit( uint32_t channel, const dma_job& job )
+{
+    if ( channel >= channels_ )
+        return false;
+    auto& q = queues_[ channel ];
+    uint32_t tail = q.tail.load();
+    if ( tail - q.head.load() >= queue_depth )
+        return false;
+    q.jobs[ tail % queue_depth ] = job;
+    q.tail = tail + 1;  // publish
+    kick( channel );
+    return true;
+}
 
-    return ( ( isr >> (channel * 4) ) & TCIF );
+void
+dma::cancel( uint32_t channel )
+{
+    if ( channel >= channels_ )
+        return;
+    dmaChannel( channel ).CCR &= ~( EN | TCIE | HTIE | TEIE ); // no further request, nor interrupt
+    dma_->IFCR = 0x0f << ( channel * 4 );                      // an irq already pending finds nothing to do
+    auto& q = queues_[ channel ];
+    q.head = q.tail.load();
+    q.busy = false;
 }
 
+// start the job at head if the channel is free; called from both thread (submit) and ISR (completion)
+void
+dma::kick( uint32_t channel )
+{
+    auto& q = queues_[ channel ];
+    while ( q.head.load() != q.tail.load() ) {
+        bool expected = false;
+        if ( !q.busy.compare_exchange_strong( expected, true ) )
+            return; // running job's ISR will pick it up
+        if ( q.head.load() != q.tail.load() ) {
+            start( channel );
+            return;
+        }
+        q.busy = false; // drained between the check and the claim
+    }
+}
 
 void
-dma::handle_interrupt( uint32_t channel )
+dma::start( uint32_t channel )
 {
-    while ( lock_.test_and_set( std::memory_order_acquire ) )
-        ;
-    uint32_t flag = dma_->ISR;
-    interrupt_status_ = flag;
-    lock_.clear();
+    auto& q = queues_[ channel ];
+    const auto& job = q.jobs[ q.head.load() % queue_depth ];
+    auto& ch = dmaChannel( channel );
 
-    dma_->IFCR |= (0x0f << (channel * 4)) & flag;
+    ch.CCR &= ~EN;  // CPAR, CMAR, CNDTR are writable only while disabled
+    uint32_t ccr = job.ccr ? job.ccr : ch.CCR & ~( EN | TCIE | HTIE | TEIE );
+    if ( job.peripheral )
+        ch.CPAR = job.peripheral;
+    ch.CMAR = job.memory;
+    ch.CNDTR = job.size;
+    status_[ channel ] = 0;
+    ch.CCR = ccr;
+    ch.CCR = ccr | TCIE | TEIE | EN;
+}
 
-    auto x = flag >> ( channel * 4 );
+void
+dma::handle_interrupt( uint32_t channel )
+{
+    const uint32_t shift = channel * 4;
+    uint32_t x = ( dma_->ISR >> shift ) & 0x0f;
+    if ( x == 0 )
+        return;  // shared irq (DMA2 channel 4/5)
+    dma_->IFCR = x << shift; // write only; zero bits have no effect
+    status_[ channel ].fetch_or( x );
+
+    auto& q = queues_[ channel ];
+    if ( q.busy.load() ) {
+        if ( x & ( TCIF | TEIF ) ) {
+            dmaChannel( channel ).CCR &= ~( EN | TCIE | HTIE | TEIE );
+            const auto& job = q.jobs[ q.head.load() % queue_depth ];
+            auto completion = job.completion;
+            auto context = job.context;
+            q.head = q.head.load() + 1; // release the slot
+            q.busy = false;
+            kick( channel );            // next descriptor goes first, then notify
+            if ( completion )
+                completion( x, context );
+        }
+        return;
+    }
 
     if ( callbacks_.at( channel ) )
         callbacks_[ channel ]( x );
-    else if ( x & 0x08 )
-        stream() << "\tDMA: handle_interrupt: transfer error at channel# " << channel << " ISR=" << flag << std::endl;
+    else if ( x & TEIF )
+        stream() << "\tDMA: handle_interrupt: transfer error at channel# " << channel << " ISR=" << x << std::endl;
 #if 1
     if ( callbacks_.at( channel ) == nullptr ) {
-        stream() << "\tDMA: handle_interrupt: " << channel << " ISR=" << flag << " "
+        stream() << "\tDMA: handle_interrupt: " << channel << " ISR=" << x << " "
                  << ((x & 0x8) ? "transfer error, " : "")
                  << ((x & 0x4) ? "half transfer, " : "")
                  << ((x & 0x2) ? "transfer complete, " : "")
@@ -34,12 +34,56 @@ namespace stm32f103 {
     enum DMA_CHANNEL : uint32_t;
     enum DMA_DIR : uint32_t;
 
+    // channel owner id; peripherals use their base address (e.g. I2C2_BASE)
+    enum DMA_OWNER : uint32_t {
+        DMA_OWNER_NONE = 0
+        , DMA_OWNER_MEM2MEM = 1
+    };
+
+    // Transfer descriptor for software scatter-gather.  Jobs queued on a channel are started
+    // back-to-back from the transfer complete interrupt; 'completion' is called in the ISR context
+    // with the channel's ISR bits (TCIF|TEIF) after the channel has been disabled.
+    struct dma_job {
+        uint32_t memory;        // CMAR
+        uint32_t size;          // CNDTR (number of data items)
+        uint32_t peripheral;    // CPAR, 0 := leave as initialized by init_channel
+        uint32_t ccr;           // CCR w/o EN and irq enables, 0 := leave as initialized
+        void (*completion)( uint32_t status, void * context );
+        void * context;
+    };
+
     class dma {
+    public:
+        static constexpr size_t number_of_channels = 7;
+        static constexpr size_t queue_depth = 4;   // power of 2
+    private:
         volatile DMA * dma_;
+        uint32_t channels_;      // 7 on DMA1, 5 on DMA2
 
+        // ownership; modified in thread context only
         std::atomic_flag lock_;
-        std::atomic< uint32_t  > interrupt_status_;
-        std::array< void(*)( uint32_t ), 7 > callbacks_;
+        struct channel_owner {
+            std::atomic< uint32_t > id;
+            uint32_t priority;                   // DMA_PRIORITY
+            void (*revoke)( uint32_t channel );  // called when a higher priority owner takes the channel over
+        };
+        std::array< channel_owner, number_of_channels > owners_;
+
+        // per channel, lock-free; status_ holds ISR bits accumulated since the last enable/submit
+        std::array< std::atomic< uint32_t >, number_of_channels > status_;
+        std::array< void(*)( uint32_t ), number_of_channels > callbacks_;
+
+        // per channel job ring; submit() is the only producer, handle_interrupt() the only consumer
+        struct job_queue {
+            std::array< dma_job, queue_depth > jobs;
+            std::atomic< uint32_t > head;  // current (running) job
+            std::atomic< uint32_t > tail;  // next free slot
+            std::atomic< bool > busy;      // a job owns the channel
+        };
+        std::array< job_queue, number_of_channels > queues_;
+
+        void start( uint32_t channel );
+        void kick( uint32_t channel );
 
         dma();
         dma( const dma& ) = delete;
@@ -50,12 +94,29 @@ namespace stm32f103 {
 
         volatile DMAChannel& dmaChannel( uint32_t );
 
+        inline uint32_t channels() const { return channels_; }
+
+        // Grant 'channel' to 'owner'.  A free channel, or one already held by 'owner', is granted; an idle channel held
+        // at lower priority is taken over, and the previous owner's revoke() is called so that it can fall back to
+        // interrupt mode.  Returns false if the channel is held at the same or higher priority, or is active.
+        bool acquire( uint32_t channel, uint32_t owner, uint32_t priority, void (*revoke)( uint32_t channel ) = nullptr );
+        void release( uint32_t channel, uint32_t owner );
+
+        inline uint32_t owner( uint32_t channel ) const {
+            return channel < channels_ ? owners_[ channel ].id.load() : DMA_OWNER_NONE;
+        }
+        inline uint32_t priority( uint32_t channel ) const {
+            return channel < channels_ ? owners_[ channel ].priority : 0;
+        }
+
+        // fails if the channel is owned by other than 'owner'
         bool init_channel( DMA_CHANNEL channel_number
                            , uint32_t peripheral_base_addr
                            , uint8_t * buffer_addr
                            , uint32_t buffer_size
-                           , uint32_t dma_ccr );
-        
+                           , uint32_t dma_ccr
+                           , uint32_t owner = DMA_OWNER_NONE );
+
         inline operator bool () const { return dma_; };
 
         void enable( uint32_t channel, bool );
@@ -75,6 +136,21 @@ namespace stm32f103 {
 
         bool transfer_complete( uint32_t channel );
 
+        // CNDTR; items not yet transferred by the (running or stopped) channel
+        inline uint32_t remaining( uint32_t channel ) const { return dma_->channels[ channel ].CNDTR; }
+
+        // accumulated ISR bits of the channel (TEIF|HTIF|TCIF|GIF)
+        inline uint32_t status( uint32_t channel ) const { return status_[ channel ].load(); }
+
+        // queue a job; returns false if the queue is full.  The channel must have been initialized by init_channel.
+        bool submit( uint32_t channel, const dma_job& );
+        // stop the running job and drop the queued ones of 'channel'; their completions are not called
+        void cancel( uint32_t channel );
+        bool busy( uint32_t channel ) const { return queues_[ channel ].busy.load(); }
+        size_t pending( uint32_t channel ) const {
+            return queues_[ channel ].tail.load() - queues_[ channel ].head.load();
+        }
+
         void set_callback( uint32_t channel, void(*callback)( uint32_t ) ) {
             callbacks_.at( channel ) = callback;
         }
@@ -26,8 +26,8 @@ namespace stm32f103 {
         DMA_ADC1 = 0
         , DMA_SPI1_RX = 1
         , DMA_SPI1_TX = 2
-        //, DMA_SPI2_RX = 4
-        //, DMA_SPI2_TX = 5
+        , DMA_SPI2_RX = 3        // same channels as I2C2; no peripheral_address<> for these
+        , DMA_SPI2_TX = 4
         , DMA_I2C2_TX = 3
         , DMA_I2C2_RX = 4        
         , DMA_I2C1_TX = 5
@@ -128,12 +128,29 @@ namespace stm32f103 {
         }
     };
 
+    // dma::acquire() for the scope; released on every exit path if it has been granted
+    class scoped_dma_owner {
+        dma& dma_;
+        uint32_t channel_;
+        uint32_t owner_;
+        bool acquired_;
+    public:
+        scoped_dma_owner( dma& dma, uint32_t channel, uint32_t owner, uint32_t priority )
+            : dma_( dma ), channel_( channel ), owner_( owner ), acquired_( dma.acquire( channel, owner, priority ) ) {
+        }
+        ~scoped_dma_owner() {
+            if ( acquired_ )
+                dma_.release( channel_, owner_ );
+        }
+        inline operator bool () const { return acquired_; }
+    };
+
     template< DMA_CHANNEL channel >
     class dma_channel_t {
         dma& dma_;
     public:
-        dma_channel_t( dma& dma, uint8_t * data, uint16_t size ) : dma_( dma ) {
-            dma.init_channel( channel, peripheral_address, data, size, dma_ccr );
+        dma_channel_t( dma& dma, uint8_t * data, uint16_t size, uint32_t owner = DMA_OWNER_NONE ) : dma_( dma ) {
+            dma.init_channel( channel, peripheral_address, data, size, dma_ccr, owner );
         }
 
         inline void enable( bool enable ) {
@@ -154,6 +171,18 @@ namespace stm32f103 {
             return dma_.transfer_complete( channel );
         }
 
+        inline uint32_t remaining() const {
+            return dma_.remaining( channel );
+        }
+
+        inline bool submit( const dma_job& job ) {
+            return dma_.submit( channel, job );
+        }
+
+        inline bool busy() const {
+            return dma_.busy( channel );
+        }
+
         inline void set_callback( void(*callback)( uint32_t ) ) {
             dma_.set_callback( channel, callback );
         }
@@ -0,0 +1,154 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "exti.hpp"
+#include "gpio_mode.hpp"
+#include "stm32f103.hpp"
+#include <array>
+#include <atomic>
+
+extern "C" {
+    void __exti0_handler();
+    void __exti1_handler();
+    void __exti2_handler();
+    void __exti3_handler();
+    void __exti4_handler();
+    void __exti9_5_handler();
+    void __exti15_10_handler();
+    void enable_interrupt( stm32f103::IRQn_type IRQn );
+    void disable_interrupt( stm32f103::IRQn_type IRQn );
+}
+
+namespace stm32f103 {
+
+    static std::array< std::atomic< void (*)() >, 16 > __exti_callbacks;
+
+    static constexpr IRQn_type exti_irq( uint32_t line ) {
+        return line < 5 ? IRQn_type( EXTI0_IRQn + line ) : line < 10 ? EXTI9_5_IRQn : EXTI15_10_IRQn;
+    }
+
+    template<> bool exti::attach( GPIOA_PIN pin, EXTI_EDGE edge, void (*callback)() ) {
+        gpio_mode()( pin, GPIO_CNF_INPUT_FLOATING, GPIO_MODE_INPUT );
+        return attach( 0, pin, edge, callback );
+    }
+
+    template<> bool exti::attach( GPIOB_PIN pin, EXTI_EDGE edge, void (*callback)() ) {
+        gpio_mode()( pin, GPIO_CNF_INPUT_FLOATING, GPIO_MODE_INPUT );
+        return attach( 1, pin, edge, callback );
+    }
+
+    template<> bool exti::attach( GPIOC_PIN pin, EXTI_EDGE edge, void (*callback)() ) {
+        gpio_mode()( pin, GPIO_CNF_INPUT_FLOATING, GPIO_MODE_INPUT );
+        return attach( 2, pin, edge, callback );
+    }
+}
+
+using namespace stm32f103;
+
+bool
+exti::attach( uint32_t port, uint32_t line, EXTI_EDGE edge, void (*callback)() )
+{
+    if ( line >= __exti_callbacks.size() )
+        return false;
+
+    auto AFIO = reinterpret_cast< volatile stm32f103::AFIO * >( AFIO_BASE );
+    auto EXTI = reinterpret_cast< volatile stm32f103::EXTI * >( EXTI_BASE );
+
+    EXTI->IMR &= ~( 1 << line );
+
+    // AFIO_EXTICRx, 4bits per line (p191)
+    volatile uint32_t * exticr = &AFIO->EXTICR1 + ( line / 4 );
+    const uint32_t shift = ( line % 4 ) * 4;
+    *exticr = ( *exticr & ~( 0x0f << shift ) ) | ( port << shift );
+
+    if ( edge & EXTI_RISING )
+        EXTI->RTSR |= ( 1 << line );
+    else
+        EXTI->RTSR &= ~( 1 << line );
+
+    if ( edge & EXTI_FALLING )
+        EXTI->FTSR |= ( 1 << line );
+    else
+        EXTI->FTSR &= ~( 1 << line );
+
+    __exti_callbacks[ line ] = callback;
+
+    EXTI->PR = ( 1 << line ); // clear pending (rc_w1)
+    EXTI->IMR |= ( 1 << line );
+
+    enable_interrupt( exti_irq( line ) );
+
+    return true;
+}
+
+void
+exti::detach( uint32_t line )
+{
+    if ( line >= __exti_callbacks.size() )
+        return;
+
+    auto EXTI = reinterpret_cast< volatile stm32f103::EXTI * >( EXTI_BASE );
+    EXTI->IMR &= ~( 1 << line );
+    EXTI->RTSR &= ~( 1 << line );
+    EXTI->FTSR &= ~( 1 << line );
+    __exti_callbacks[ line ] = nullptr;
+}
+
+void
+exti::handle_interrupt( uint32_t first, uint32_t last )
+{
+    auto EXTI = reinterpret_cast< volatile stm32f103::EXTI * >( EXTI_BASE );
+    uint32_t pr = EXTI->PR;
+    for ( uint32_t line = first; line <= last; ++line ) {
+        if ( pr & ( 1 << line ) ) {
+            EXTI->PR = ( 1 << line );
+            if ( auto callback = __exti_callbacks[ line ].load() )
+                callback();
+        }
+    }
+}
+
+void
+__exti0_handler()
+{
+    exti::handle_interrupt( 0, 0 );
+}
+
+void
+__exti1_handler()
+{
+    exti::handle_interrupt( 1, 1 );
+}
+
+void
+__exti2_handler()
+{
+    exti::handle_interrupt( 2, 2 );
+}
+
+void
+__exti3_handler()
+{
+    exti::handle_interrupt( 3, 3 );
+}
+
+void
+__exti4_handler()
+{
+    exti::handle_interrupt( 4, 4 );
+}
+
+void
+__exti9_5_handler()
+{
+    exti::handle_interrupt( 5, 9 );
+}
+
+void
+__exti15_10_handler()
+{
+    exti::handle_interrupt( 10, 15 );
+}
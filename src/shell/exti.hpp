@@ -0,0 +1,33 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace stm32f103 {
+
+    enum EXTI_EDGE {
+        EXTI_RISING     = 01
+        , EXTI_FALLING  = 02
+        , EXTI_BOTH     = 03
+    };
+
+    // External interrupt lines 0..15 (RM0008, 10.2, p207)
+    // a line is shared by PAx, PBx, PCx; only one port can be attached to a line at a time.
+    class exti {
+        static bool attach( uint32_t port, uint32_t line, EXTI_EDGE, void (*callback)() );
+    public:
+        template< typename GPIO_PIN_type >
+        static bool attach( GPIO_PIN_type pin, EXTI_EDGE edge, void (*callback)() );
+
+        static void detach( uint32_t line );
+
+        static void handle_interrupt( uint32_t first, uint32_t last );
+    };
+
+}
@@ -0,0 +1,155 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "fixed_point.hpp"
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// In-place radix-2 decimation-in-time FFT on Q15/Q31 data.
+// Each stage scales by 1/2 so that the result is DFT(x)/N, which never overflows
+// as long as the input magnitude is less than 0.5 (i.e. 12bit ADC data << 19 for Q31).
+// The twiddle multiply uses mul_half(), for Q31 that is just the high word of SMULL.
+
+namespace dsp {
+
+    template< size_t N > struct log2_t {
+        static_assert( N && ( ( N & ( N - 1 ) ) == 0 ), "N must be power of 2" );
+        static constexpr size_t value = 1 + log2_t< N / 2 >::value;
+    };
+    template<> struct log2_t< 1 > { static constexpr size_t value = 0; };
+
+    template< typename T, size_t N > struct twiddle_table {
+        std::array< T, N / 2 > cos;
+        std::array< T, N / 2 > sin;
+        constexpr twiddle_table() : cos{}, sin{} {
+            for ( size_t k = 0; k < N / 2; ++k ) {
+                cos[ k ] = to_q< T >( dsp::cos( 2 * pi * k / N ) );
+                sin[ k ] = to_q< T >( dsp::sin( 2 * pi * k / N ) );
+            }
+        }
+    };
+
+    enum window_type { rectangular, hann, hamming };
+
+    template< typename T, size_t N, window_type W > struct window_table {
+        std::array< T, N > w;
+        constexpr window_table() : w{} {
+            for ( size_t n = 0; n < N; ++n ) {
+                double c = dsp::cos( 2 * pi * n / N );
+                w[ n ] = to_q< T >( W == hann ? 0.5 - 0.5 * c : W == hamming ? 0.54 - 0.46 * c : 1.0 );
+            }
+        }
+    };
+
+    template< typename T, size_t N >
+    class fft {
+        static constexpr twiddle_table< T, N > twiddle_{};
+    public:
+        typedef T value_type;
+        static constexpr size_t size = N;
+        static constexpr size_t stages = log2_t< N >::value;
+
+        // bit reverse reordering
+        static void reorder( T * re, T * im ) {
+            for ( size_t i = 1, j = 0; i < N; ++i ) {
+                size_t bit = N >> 1;
+                for ( ; j & bit; bit >>= 1 )
+                    j ^= bit;
+                j ^= bit;
+                if ( i < j ) {
+                    T t = re[ i ]; re[ i ] = re[ j ]; re[ j ] = t;
+                    t = im[ i ]; im[ i ] = im[ j ]; im[ j ] = t;
+                }
+            }
+        }
+
+        // forward transform, in-place; result is DFT(x)/N
+        static void transform( T * re, T * im ) {
+            reorder( re, im );
+            for ( size_t half = 1, step = N / 2; half < N; half <<= 1, step >>= 1 ) {
+                for ( size_t k = 0; k < half; ++k ) {
+                    const T wr = twiddle_.cos[ k * step ];
+                    const T wi = twiddle_.sin[ k * step ]; // e^{-j2pi k/N} = wr - j*wi
+                    for ( size_t i = k; i < N; i += half << 1 ) {
+                        const size_t j = i + half;
+                        // (t_re + j*t_im) = w * x[j] / 2
+                        T t_re = mul_half( re[ j ], wr ) + mul_half( im[ j ], wi );
+                        T t_im = mul_half( im[ j ], wr ) - mul_half( re[ j ], wi );
+                        T a_re = re[ i ] >> 1;
+                        T a_im = im[ i ] >> 1;
+                        re[ i ] = a_re + t_re;
+                        im[ i ] = a_im + t_im;
+                        re[ j ] = a_re - t_re;
+                        im[ j ] = a_im - t_im;
+                    }
+                }
+            }
+        }
+    };
+
+    template< typename T, size_t N, window_type W >
+    struct window {
+        static constexpr window_table< T, N, W > table_{};
+        static void apply( T * x ) {
+            for ( size_t n = 0; n < N; ++n )
+                x[ n ] = mul( x[ n ], table_.w[ n ] );
+        }
+        // coherent gain in Q format, used to normalize line amplitude
+        static constexpr T coherent_gain() {
+            return W == hann ? to_q< T >( 0.5 ) : W == hamming ? to_q< T >( 0.54 ) : q_traits< T >::max();
+        }
+    };
+
+    // |X|^2, first n bins
+    template< typename T >
+    void power_spectrum( const T * re, const T * im, uint64_t * power, size_t n ) {
+        typedef typename q_traits< T >::acc_type acc_type;
+        for ( size_t k = 0; k < n; ++k )
+            power[ k ] = uint64_t( acc_type( re[ k ] ) * re[ k ] ) + uint64_t( acc_type( im[ k ] ) * im[ k ] );
+    }
+
+    // |X|, first n bins
+    template< typename T >
+    void magnitude_spectrum( const T * re, const T * im, uint32_t * mag, size_t n ) {
+        typedef typename q_traits< T >::acc_type acc_type;
+        for ( size_t k = 0; k < n; ++k )
+            mag[ k ] = isqrt( uint64_t( acc_type( re[ k ] ) * re[ k ] ) + uint64_t( acc_type( im[ k ] ) * im[ k ] ) );
+    }
+
+    struct spectral_line {
+        uint16_t bin;
+        uint32_t value;
+    };
+
+    // find the 'count' largest local maxima in spectrum[first, n); returns number of lines found.
+    // lines are sorted in descending order of value.  32bit magnitudes only (magnitude_spectrum);
+    // a power spectrum would not fit in spectral_line::value.
+    template< typename V >
+    size_t find_peaks( const V * spectrum, size_t n, spectral_line * lines, size_t count, size_t first = 1 ) {
+        static_assert( sizeof( V ) <= sizeof( spectral_line::value ), "find_peaks takes 32bit magnitudes" );
+        size_t found = 0;
+        if ( count == 0 )
+            return 0;
+        for ( size_t k = first; k < n; ++k ) {
+            const V v = spectrum[ k ];
+            if ( ( k > 0 && spectrum[ k - 1 ] >= v ) || ( k + 1 < n && spectrum[ k + 1 ] > v ) )
+                continue;
+            if ( found == count && lines[ found - 1 ].value >= v )
+                continue;
+            size_t i = ( found < count ) ? found++ : found - 1;
+            while ( i > 0 && lines[ i - 1 ].value < v ) {
+                lines[ i ] = lines[ i - 1 ];
+                --i;
+            }
+            lines[ i ] = { uint16_t( k ), uint32_t( v ) };
+        }
+        return found;
+    }
+
+}
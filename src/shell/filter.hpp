@@ -0,0 +1,194 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "fixed_point.hpp"
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// Q15/Q31 FIR and biquad cascade (direct form I) filters.
+// Products are accumulated in 64bit ('SMLAL' on Cortex-M3), saturated once on output.
+// For Q31 the accumulator has one bit of headroom: keep sum |h| of a FIR below 2 (a unity gain low pass is 1).
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace dsp {
+
+    //////////////////////////// FIR ////////////////////////////
+    template< typename T, size_t MAX_TAPS >
+    class fir {
+        static_assert( ( MAX_TAPS % 4 ) == 0, "MAX_TAPS must be multiple of 4" );
+        std::array< T, MAX_TAPS > coeffs_;      // h[0..taps), zero padded to multiple of 4
+        std::array< T, MAX_TAPS * 2 > state_;   // delay line, mirrored so that no modulo in the inner loop
+        size_t taps_;
+        size_t pos_;
+    public:
+        typedef T value_type;
+
+        constexpr fir() : coeffs_{}, state_{}, taps_( 0 ), pos_( 0 ) {}
+
+        template< size_t N > fir( const std::array< T, N >& h ) : fir() { set_coefficients( h.data(), N ); }
+
+        bool set_coefficients( const T * h, size_t n ) {
+            if ( n > MAX_TAPS )
+                return false;
+            taps_ = ( n + 3 ) & ~size_t( 3 );
+            for ( size_t i = 0; i < taps_; ++i )
+                coeffs_[ i ] = i < n ? h[ i ] : T( 0 );
+            reset();
+            return true;
+        }
+
+        void reset() {
+            state_.fill( 0 );
+            pos_ = 0;
+        }
+
+        size_t taps() const { return taps_; }
+
+        T operator()( T x ) {
+            typedef int64_t acc_type;
+            if ( pos_ == 0 )
+                pos_ = taps_;
+            --pos_;
+            state_[ pos_ ] = state_[ pos_ + taps_ ] = x;
+
+            // y = sum h[k] * x[n-k]; x[n-k] is at state_[pos_ + k]
+            const T * s = &state_[ pos_ ];
+            const T * h = coeffs_.data();
+            acc_type acc = 0;
+            for ( size_t k = taps_ >> 2; k; --k ) {
+                acc += acc_type( h[ 0 ] ) * s[ 0 ];
+                acc += acc_type( h[ 1 ] ) * s[ 1 ];
+                acc += acc_type( h[ 2 ] ) * s[ 2 ];
+                acc += acc_type( h[ 3 ] ) * s[ 3 ];
+                h += 4;
+                s += 4;
+            }
+            return saturate< T >( acc >> q_traits< T >::fraction_bits );
+        }
+
+        void operator()( const T * x, T * y, size_t n ) {
+            while ( n-- )
+                *y++ = ( *this )( *x++ );
+        }
+    };
+
+    //////////////////////////// biquad ////////////////////////////
+    // coefficients are in Q(fraction_bits - 1), i.e. range [-2.0, 2.0); a1, a2 are stored with sign as
+    // y[n] = b0 x[n] + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+    template< typename T > struct biquad_coefficients {
+        T b0, b1, b2, a1, a2;
+    };
+
+    template< typename T, size_t MAX_STAGES >
+    class biquad_cascade {
+        struct state_type { T x1, x2, y1, y2; };
+        std::array< biquad_coefficients< T >, MAX_STAGES > coeffs_;
+        std::array< state_type, MAX_STAGES > state_;
+        size_t stages_;
+    public:
+        typedef T value_type;
+        static constexpr int coeff_shift = q_traits< T >::fraction_bits - 1;
+
+        constexpr biquad_cascade() : coeffs_{}, state_{}, stages_( 0 ) {}
+
+        bool set_coefficients( const biquad_coefficients< T > * c, size_t n ) {
+            if ( n > MAX_STAGES )
+                return false;
+            for ( size_t i = 0; i < n; ++i )
+                coeffs_[ i ] = c[ i ];
+            stages_ = n;
+            reset();
+            return true;
+        }
+
+        bool push_back( const biquad_coefficients< T >& c ) {
+            if ( stages_ >= MAX_STAGES )
+                return false;
+            coeffs_[ stages_ ] = c;
+            state_[ stages_++ ] = {};
+            return true;
+        }
+
+        void reset() {
+            for ( auto& s: state_ )
+                s = {};
+        }
+
+        size_t stages() const { return stages_; }
+
+        T operator()( T x ) {
+            typedef int64_t acc_type;
+            const biquad_coefficients< T > * c = coeffs_.data();
+            state_type * s = state_.data();
+            for ( size_t i = stages_; i; --i, ++c, ++s ) {
+                acc_type acc = acc_type( c->b0 ) * x;
+                acc += acc_type( c->b1 ) * s->x1;
+                acc += acc_type( c->b2 ) * s->x2;
+                acc -= acc_type( c->a1 ) * s->y1;
+                acc -= acc_type( c->a2 ) * s->y2;
+                T y = saturate< T >( acc >> coeff_shift );
+                s->x2 = s->x1;
+                s->x1 = x;
+                s->y2 = s->y1;
+                s->y1 = y;
+                x = y;
+            }
+            return x;
+        }
+
+        void operator()( const T * x, T * y, size_t n ) {
+            while ( n-- )
+                *y++ = ( *this )( *x++ );
+        }
+    };
+
+    //////////////////////////// design helpers ////////////////////////////
+    // All helpers are constexpr; use them in constant expressions to keep double arithmetic off the target.
+    // Frequencies are normalized to the sampling rate (0 < fc < 0.5).
+    namespace design {
+
+        // windowed-sinc (Hamming) low pass, unity DC gain
+        template< typename T, size_t TAPS >
+        constexpr std::array< T, TAPS > lowpass_fir( double fc ) {
+            double h[ TAPS ] = {};
+            double sum = 0;
+            for ( size_t n = 0; n < TAPS; ++n ) {
+                double m = double( n ) - double( TAPS - 1 ) / 2;
+                double sinc = ( m == 0 ) ? 2 * fc : dsp::sin( 2 * pi * fc * m ) / ( pi * m );
+                double w = TAPS > 1 ? 0.54 - 0.46 * dsp::cos( 2 * pi * n / ( TAPS - 1 ) ) : 1.0;
+                h[ n ] = sinc * w;
+                sum += h[ n ];
+            }
+            std::array< T, TAPS > q{};
+            for ( size_t n = 0; n < TAPS; ++n )
+                q[ n ] = to_q< T >( h[ n ] / sum );
+            return q;
+        }
+
+        enum biquad_type { lowpass, highpass, notch };
+
+        // RBJ audio-EQ-cookbook biquad, coefficients in Q(fraction_bits - 1)
+        template< typename T >
+        constexpr biquad_coefficients< T > make_biquad( biquad_type type, double fc, double q = 0.70710678118654752 ) {
+            double w0 = 2 * pi * fc;
+            double cs = dsp::cos( w0 );
+            double alpha = dsp::sin( w0 ) / ( 2 * q );
+            double a0 = 1 + alpha;
+            double b0 = 0, b1 = 0, b2 = 0;
+            switch ( type ) {
+            case lowpass:  b0 = ( 1 - cs ) / 2; b1 = 1 - cs;    b2 = b0; break;
+            case highpass: b0 = ( 1 + cs ) / 2; b1 = -1 - cs;   b2 = b0; break;
+            case notch:    b0 = 1;              b1 = -2 * cs;   b2 = 1;  break;
+            }
+            return { to_q< T >( b0 / a0 / 2 ), to_q< T >( b1 / a0 / 2 ), to_q< T >( b2 / a0 / 2 )
+                    , to_q< T >( -2 * cs / a0 / 2 ), to_q< T >( ( 1 - alpha ) / a0 / 2 ) };
+        }
+    }
+
+}
@@ -0,0 +1,104 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// Q15/Q31 fixed point primitives for Cortex-M3 (no DSP extension; SMULL/SMLAL only)
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace dsp {
+
+    typedef int16_t q15_t;
+    typedef int32_t q31_t;
+
+    template< typename T > struct q_traits;
+
+    template<> struct q_traits< q15_t > {
+        typedef int32_t acc_type;
+        static constexpr int fraction_bits = 15;
+        static constexpr q15_t max() { return 0x7fff; }
+        static constexpr q15_t min() { return -0x7fff - 1; }
+    };
+
+    template<> struct q_traits< q31_t > {
+        typedef int64_t acc_type;    // 32x32->64 multiply, 'SMULL' on Cortex-M3
+        static constexpr int fraction_bits = 31;
+        static constexpr q31_t max() { return 0x7fffffff; }
+        static constexpr q31_t min() { return -0x7fffffff - 1; }
+    };
+
+    template< typename T > constexpr T saturate( typename q_traits< T >::acc_type a ) {
+        return a > q_traits< T >::max() ? q_traits< T >::max() : a < q_traits< T >::min() ? q_traits< T >::min() : T( a );
+    }
+
+    // convert real number [-1.0, 1.0) to Q format, compile time use only (no FPU on target)
+    template< typename T > constexpr T to_q( double x ) {
+        double v = x * double( typename q_traits< T >::acc_type( 1 ) << q_traits< T >::fraction_bits );
+        v += ( v < 0 ) ? -0.5 : 0.5;
+        return v >= double( q_traits< T >::max() ) ? q_traits< T >::max()
+            : v <= double( q_traits< T >::min() ) ? q_traits< T >::min() : T( typename q_traits< T >::acc_type( v ) );
+    }
+
+    // a * b in Q format
+    template< typename T > inline T mul( T a, T b ) {
+        typedef typename q_traits< T >::acc_type acc_type;
+        return T( ( acc_type( a ) * b ) >> q_traits< T >::fraction_bits );
+    }
+
+    // (a * b) / 2; for Q31 this is the high word of SMULL, no shift instruction required.
+    template< typename T > inline T mul_half( T a, T b ) {
+        typedef typename q_traits< T >::acc_type acc_type;
+        return T( ( acc_type( a ) * b ) >> ( q_traits< T >::fraction_bits + 1 ) );
+    }
+
+    ///////////////// compile time trigonometric /////////////////
+    constexpr double pi = 3.14159265358979323846;
+
+    constexpr double __sin_taylor( double x ) {
+        double term = x, sum = x;
+        for ( int n = 1; n < 12; ++n ) {
+            term *= -x * x / ( ( 2 * n ) * ( 2 * n + 1 ) );
+            sum += term;
+        }
+        return sum;
+    }
+
+    constexpr double sin( double x ) {
+        while ( x > pi )
+            x -= 2 * pi;
+        while ( x < -pi )
+            x += 2 * pi;
+        if ( x > pi / 2 )
+            x = pi - x;
+        else if ( x < -pi / 2 )
+            x = -pi - x;
+        return __sin_taylor( x );
+    }
+
+    constexpr double cos( double x ) { return sin( x + pi / 2 ); }
+
+    ///////////////// integer square root /////////////////
+    inline uint32_t isqrt( uint64_t x ) {
+        uint64_t r = 0;
+        uint64_t bit = uint64_t( 1 ) << 62;
+        while ( bit > x )
+            bit >>= 2;
+        while ( bit ) {
+            if ( x >= r + bit ) {
+                x -= r + bit;
+                r = ( r >> 1 ) + bit;
+            } else {
+                r >>= 1;
+            }
+            bit >>= 2;
+        }
+        return uint32_t( r );
+    }
+
+}
@@ -6,9 +6,14 @@
 
 #include "bitset.hpp"
 #include "dma.hpp"
-#include "condition_wait.hpp"
+#include "cycle_counter.hpp"
 #include "dma_channel.hpp"
+#include "gpio.hpp"
+#include "gpio_mode.hpp"
 #include "i2c.hpp"
+#include "i2c_master.hpp"
+#include "i2c_scheduler.hpp"
+#include "i2c_slave.hpp"
 #include "i2c_string.hpp"
 #include "scoped_spinlock.hpp"
 #include "stream.hpp"
@@ -23,12 +28,14 @@ extern void mdelay( uint32_t );
 extern "C" {
     void i2c1_handler();
     void enable_interrupt( stm32f103::IRQn_type IRQn );
+    void disable_interrupt( stm32f103::IRQn_type IRQn );
 }
 
 // bits in the status register
 namespace stm32f103 {
 
-    constexpr uint32_t i2c_clock_speed = 100'000; //'; //100kHz
+    constexpr uint32_t i2c_clock_speed = 100'000; //'; //100kHz, default
+    static_assert( i2c_timing_t< i2c_pclk1, i2c_clock_speed >::value.error == I2C_TIMING_OK, "I2C timing" );
 
     enum I2C_CR1_MASK {
         SWRST          = 1 << 15  // Software reset (0 := not under reset, 0 := under reset state
@@ -88,6 +95,43 @@ namespace stm32f103 {
 
     constexpr uint32_t error_condition = SMB_ALART | TIME_OUT | PEC_ERR | OVR | AF | ARLO | BERR;
 
+    // Deadline for a bus wait, derived from the programmed SCL: 'bytes' on the bus, doubled for
+    // clock stretching, plus 1ms.  A missing or hung device costs a bounded, known time.
+    inline uint32_t i2c_timeout_us( volatile I2C& _, size_t bytes ) {
+        const uint32_t scl = i2c_timing::scl_frequency( __pclk1, _.CCR );
+        return 1'000 + ( scl ? uint32_t( bytes * 18'000'000ULL / scl ) : 0 ); //'
+    }
+
+    inline deadline i2c_deadline( volatile I2C& _, size_t bytes = 1 ) {
+        return deadline( i2c_timeout_us( _, bytes ) );
+    }
+
+    // errors seen by the polling and dma paths; the transaction engine keeps its own
+    static i2c_error_counters __i2c1_errors, __i2c2_errors;
+
+    inline i2c_error_counters& error_counters_of( volatile I2C& _ ) {
+        return reinterpret_cast< uint32_t >( const_cast< I2C * >( &_ ) ) == I2C2_BASE ? __i2c2_errors : __i2c1_errors;
+    }
+
+    // counts a polling/dma path timeout when the method returns
+    struct scoped_timeout_count {
+        volatile I2C& _;
+        const I2C_RESULT_CODE& rc;
+        scoped_timeout_count( volatile I2C& t, const I2C_RESULT_CODE& code ) : _( t ), rc( code ) {}
+        ~scoped_timeout_count() {
+            switch ( rc ) {
+            case I2C_DMA_MASTER_RECEIVER_RECV_TIMEOUT:
+            case I2C_DMA_MASTER_TRANSMITTER_SEND_TIMEOUT:
+            case I2C_POLLING_MASTER_RECEIVER_RECV_TIMEOUT:
+            case I2C_POLLING_MASTER_TRANSMITTER_SEND_TIMEOUT:
+                ++error_counters_of( _ ).timeout;
+                break;
+            default:
+                break;
+            }
+        }
+    };
+
     struct i2c_status {
         volatile I2C& _;
         i2c_status( volatile I2C& t ) : _( t ) {}
@@ -109,10 +153,17 @@ namespace stm32f103 {
     };
 
     struct i2c_reset {
-        bool operator()( volatile I2C& i2c, uint8_t own_addr = 0 ) {
+        bool operator()( volatile I2C& i2c, uint8_t own_addr = 0, const i2c_timing * timing = nullptr ) {
             if ( own_addr == 0 )
                 own_addr = i2c.OAR1 >> 1;
 
+            // keep the current SCL timing across the software reset unless a new one is given
+            i2c_timing t = timing ? *timing : i2c_timing::compute( __pclk1, i2c_clock_speed, I2C_STANDARD_MODE );
+            if ( timing == nullptr && ( i2c.CCR & 0x0fff ) ) {
+                t.ccr = i2c.CCR;
+                t.trise = i2c.TRISE;
+            }
+
             bitset::reset( i2c.CR1, PE );
             bitset::set( i2c.CR1, SWRST );
             while ( i2c.SR1 && i2c.SR2 )
@@ -124,13 +175,11 @@ namespace stm32f103 {
             uint16_t cr2 = freqrange;
             i2c.CR2 |= cr2;
 
-            // p784,
-            i2c.TRISE = freqrange + 1;
+            // p784, CCR and TRISE can only be written while PE = 0
+            i2c.TRISE = t.trise;
             i2c.OAR1 = own_addr << 1;
             i2c.OAR2 = 0;
-
-            uint16_t ccr = __pclk1 / ( i2c_clock_speed * 2 );  // ratio make it 5us for 10us interval clock
-            i2c.CCR = ccr;  // Sm mode
+            i2c.CCR = t.ccr;
 
             return true;
         }
@@ -146,7 +195,7 @@ namespace stm32f103 {
 
         inline bool operator()() const {
             bitset::set( _.CR1, START );
-            return condition_wait()( [&]{ return _.SR1 & SB; } );
+            return i2c_deadline( _ )( [&]{ return _.SR1 & SB; } );
         }
     };
 
@@ -169,12 +218,16 @@ namespace stm32f103 {
             auto status = _.SR1 | ( _.SR2 << 16 ); // clear ADDR
             if ( success ) {
                 bitset::set( _.CR1, STOP );
-                condition_wait()( [&]{ return !bitset::test(_.SR2, BUSY); } );
+                i2c_deadline( _ )( [&]{ return !bitset::test(_.SR2, BUSY); } );
             }
 
             bitset::reset( _.CR2, LAST );
 
             if ( _.SR1 & error_condition ) {
+                auto& errors = error_counters_of( _ );
+                errors.nack += ( _.SR1 & AF ) ? 1 : 0;
+                errors.arbitration_lost += ( _.SR1 & ARLO ) ? 1 : 0;
+                errors.bus_error += ( _.SR1 & BERR ) ? 1 : 0;
                 // following condition may happens when i2cdetect attempt data read for device not on the bus
                 if (( _.SR1 & AF ) && ( _.SR2 & ( BUSY | MSL ) ) ) // this error cannot recover by PE=0
                     i2c_reset()( _ );
@@ -196,7 +249,7 @@ namespace stm32f103 {
         inline bool operator()( volatile I2C& _, uint8_t address ) {
 
             _.DR = ( address << 1 );
-            return condition_wait()( [&]{ return _.SR1 & ADDR; } );
+            return i2c_deadline( _ )( [&]{ return _.SR1 & ADDR; } );
         }
 
         void static clear( volatile I2C& _ ) {
@@ -206,7 +259,7 @@ namespace stm32f103 {
 
     template<> inline bool i2c_address<Receiver>::operator()( volatile I2C& _, uint8_t address ) {
         _.DR = (address << 1) | 1;
-        return condition_wait()( [&](){ return _.SR1 & ADDR; } );
+        return i2c_deadline( _ )( [&](){ return _.SR1 & ADDR; } );
     }
 
     template<> void i2c_address<Receiver>::clear( volatile I2C& _ ) {
@@ -227,9 +280,9 @@ namespace stm32f103 {
             if ( start() ) {
                 if ( i2c_address< Receiver >()( _, address ) ) {
                     i2c_address<Receiver>().clear( _ );
-                    condition_wait()( [&](){ return !_.SR1 & ADDR; } );
+                    i2c_deadline( _ )( [&](){ return !_.SR1 & ADDR; } );
                     while ( size >= 3 ) {
-                        if ( condition_wait()( [&](){ return _.SR1 & (RxNE|BTF); } ) ) {
+                        if ( i2c_deadline( _ )( [&](){ return _.SR1 & (RxNE|BTF); } ) ) {
                             if ( _.SR1 & RxNE ) {
                                 *data++ = _.DR;
                                 --size;
@@ -238,7 +291,7 @@ namespace stm32f103 {
                             return I2C_POLLING_MASTER_RECEIVER_RECV_TIMEOUT;
                         }
                     }
-                    if ( condition_wait()( [&](){ return _.SR1 & BTF; } ) ) {
+                    if ( i2c_deadline( _ )( [&](){ return _.SR1 & BTF; } ) ) {
                         bitset::reset( _.CR1, ACK );
                         bitset::set( _.CR1, STOP );
                         *data++ = _.DR;  // Data N-1
@@ -246,7 +299,7 @@ namespace stm32f103 {
                     } else {
                         return I2C_POLLING_MASTER_RECEIVER_RECV_TIMEOUT;
                     }
-                    if ( condition_wait()( [&](){ return _.SR1 & RxNE; } ) ) {
+                    if ( i2c_deadline( _ )( [&](){ return _.SR1 & RxNE; } ) ) {
                         *data++ = _.DR;
                         --size;
                         return I2C_RESULT_SUCCESS;
@@ -269,14 +322,14 @@ namespace stm32f103 {
                 bitset::set( _.CR1, POS );
                 i2c_address<Receiver>().clear( _ );
                 bitset::reset( _.CR1, ACK );
-                if ( condition_wait()( [&](){ return _.SR1 & BTF; } ) ) {
+                if ( i2c_deadline( _ )( [&](){ return _.SR1 & BTF; } ) ) {
                     bitset::set( _.CR1, STOP );
                     *data++ = _.DR;
                     --size;
-                    if ( condition_wait()( [&](){ return _.SR1 & (RxNE|BTF); } ) ) {
+                    if ( i2c_deadline( _ )( [&](){ return _.SR1 & (RxNE|BTF); } ) ) {
                         *data++ = _.DR;
                         --size;
-                        if ( condition_wait()( [&](){ return !bitset::test(_.SR2, BUSY); } ) ) {
+                        if ( i2c_deadline( _ )( [&](){ return !bitset::test(_.SR2, BUSY); } ) ) {
                             bitset::reset( _.CR1, POS );
                         }
                     }
@@ -294,7 +347,7 @@ namespace stm32f103 {
                 bitset::reset( _.CR1, ACK );           // ACK = 0
                 i2c_address<Receiver>().clear( _ );    // Clear ADDR
                 bitset::set( _.CR1, STOP );            // STOP = 1
-                if ( condition_wait()( [&](){ return _.SR1 & RxNE; } ) ) {  // Wait until RxNE = 1
+                if ( i2c_deadline( _ )( [&](){ return _.SR1 & RxNE; } ) ) {  // Wait until RxNE = 1
                     *data++ = _.DR;                    // Read the data
                     --size;
                 }
@@ -313,7 +366,7 @@ namespace stm32f103 {
 
         inline bool operator << ( uint8_t data ) {
             _.DR = data;
-            return condition_wait()( [&](){ return _.SR1 & TxE|BTF; } );
+            return i2c_deadline( _ )( [&](){ return _.SR1 & TxE|BTF; } );
         }
     };
 
@@ -332,7 +385,7 @@ namespace stm32f103 {
                     return I2C_DEVICE_ERROR_CONDITION;
             }
 
-            if ( ! condition_wait()( [&](){ return !st.busy(); } ) ) {
+            if ( ! i2c_deadline( _, 16 )( [&](){ return !st.busy(); } ) ) {
                 if ( ( _.SR1 & error_condition ) && ( _.SR2 & (BUSY| MSL) ) )
                     i2c_reset()( _, own_addr_ );  // Reset i2c chip
             }
@@ -365,7 +418,7 @@ namespace stm32f103 {
                 if ( i2c_address< Transmitter >()( _, address ) ) {
                     i2c_address< Transmitter >().clear( _ );
 
-                    if ( condition_wait()( [&]{ return dma_channel.transfer_complete(); } ) )
+                    if ( i2c_deadline( _, size )( [&]{ return dma_channel.transfer_complete(); } ) )
                         return I2C_RESULT_SUCCESS;
                     else
                         return I2C_DMA_MASTER_TRANSMITTER_SEND_TIMEOUT;
@@ -396,7 +449,7 @@ namespace stm32f103 {
             if ( start() ) { // generate start condition (master start)
                 if ( i2c_address< Receiver >()( _, address ) ) {
                     i2c_address< Receiver >::clear(_);
-                    if ( condition_wait()( [&](){ return dma_channel.transfer_complete(); } ) ) {
+                    if ( i2c_deadline( _, size )( [&](){ return dma_channel.transfer_complete(); } ) ) {
                         return I2C_RESULT_SUCCESS;
                     } else
                         return I2C_DMA_MASTER_RECEIVER_RECV_TIMEOUT;
@@ -422,7 +475,112 @@ static dma_channel_t< DMA_I2C1_RX > * __dma_i2c1_rx;
 static dma_channel_t< DMA_I2C2_TX > * __dma_i2c2_tx;
 static dma_channel_t< DMA_I2C2_RX > * __dma_i2c2_rx;
 
-i2c::i2c() : i2c_( 0 )
+typedef i2c_master< volatile I2C > i2c_master_type;
+
+static i2c_master_type __i2c1_master; // constexpr constructor, no startup code required
+static i2c_master_type __i2c2_master;
+
+typedef i2c_slave< volatile I2C, i2c_slave_register_size > i2c_slave_type;
+
+static i2c_slave_type __i2c1_slave;
+static i2c_slave_type __i2c2_slave;
+
+static i2c_scheduler< i2c > __i2c1_scheduler;
+static i2c_scheduler< i2c > __i2c2_scheduler;
+
+static constexpr i2c_master_type::dma_port __i2c1_dma_port = {
+    +[]( const uint8_t * data, size_t size ){
+        if ( __dma_i2c1_tx == nullptr )
+            return false;
+        __dma_i2c1_tx->set_transfer_buffer( data, size );
+        __dma_i2c1_tx->enable( true );
+        return true;
+    }
+    , +[]( uint8_t * data, size_t size ){
+        if ( __dma_i2c1_rx == nullptr )
+            return false;
+        __dma_i2c1_rx->set_receive_buffer( data, size );
+        __dma_i2c1_rx->enable( true );
+        return true;
+    }
+    , +[](){
+        if ( __dma_i2c1_tx )
+            __dma_i2c1_tx->enable( false );
+        if ( __dma_i2c1_rx )
+            __dma_i2c1_rx->enable( false );
+    }
+};
+
+static constexpr i2c_master_type::dma_port __i2c2_dma_port = {
+    +[]( const uint8_t * data, size_t size ){
+        if ( __dma_i2c2_tx == nullptr )
+            return false;
+        __dma_i2c2_tx->set_transfer_buffer( data, size );
+        __dma_i2c2_tx->enable( true );
+        return true;
+    }
+    , +[]( uint8_t * data, size_t size ){
+        if ( __dma_i2c2_rx == nullptr )
+            return false;
+        __dma_i2c2_rx->set_receive_buffer( data, size );
+        __dma_i2c2_rx->enable( true );
+        return true;
+    }
+    , +[](){
+        if ( __dma_i2c2_tx )
+            __dma_i2c2_tx->enable( false );
+        if ( __dma_i2c2_rx )
+            __dma_i2c2_rx->enable( false );
+    }
+};
+
+static constexpr i2c_slave_type::dma_port __i2c1_slave_dma_port = {
+    __i2c1_dma_port.transmit
+    , __i2c1_dma_port.receive
+    , +[]() -> size_t {
+        size_t remain = 0;
+        if ( __dma_i2c1_tx && ( __i2c1_slave.state() == i2c_slave_type::st_transmit ) ) {
+            __dma_i2c1_tx->enable( false );
+            remain = __dma_i2c1_tx->remaining();
+        }
+        if ( __dma_i2c1_rx && ( __i2c1_slave.state() == i2c_slave_type::st_receive ) ) {
+            __dma_i2c1_rx->enable( false );
+            remain = __dma_i2c1_rx->remaining();
+        }
+        return remain;
+    }
+};
+
+static constexpr i2c_slave_type::dma_port __i2c2_slave_dma_port = {
+    __i2c2_dma_port.transmit
+    , __i2c2_dma_port.receive
+    , +[]() -> size_t {
+        size_t remain = 0;
+        if ( __dma_i2c2_tx && ( __i2c2_slave.state() == i2c_slave_type::st_transmit ) ) {
+            __dma_i2c2_tx->enable( false );
+            remain = __dma_i2c2_tx->remaining();
+        }
+        if ( __dma_i2c2_rx && ( __i2c2_slave.state() == i2c_slave_type::st_receive ) ) {
+            __dma_i2c2_rx->enable( false );
+            remain = __dma_i2c2_rx->remaining();
+        }
+        return remain;
+    }
+};
+
+static inline i2c_master_type&
+master_engine( volatile I2C * base )
+{
+    return reinterpret_cast< uint32_t >( const_cast< I2C * >( base ) ) == I2C2_BASE ? __i2c2_master : __i2c1_master;
+}
+
+static inline i2c_slave_type&
+slave_engine( volatile I2C * base )
+{
+    return reinterpret_cast< uint32_t >( const_cast< I2C * >( base ) ) == I2C2_BASE ? __i2c2_slave : __i2c1_slave;
+}
+
+i2c::i2c() : i2c_( 0 ), listening_( false ), timing_{}
 {
 }
 
@@ -433,35 +591,49 @@ i2c::attach( dma& dma, DMA_Direction dir )
 
     if ( addr == I2C1_BASE ) {
         if ( dir == DMA_Rx || dir == DMA_Both ) {
-            if ( __dma_i2c1_rx = new (&__i2c1_rx_dma) dma_channel_t< DMA_I2C1_RX >( dma, 0, 0 ) ) {
+            if ( dma.acquire( DMA_I2C1_RX, I2C1_BASE, DMA_PL_VERYHIGH, +[]( uint32_t ){ __dma_i2c1_rx = nullptr; } ) &&
+                 ( __dma_i2c1_rx = new (&__i2c1_rx_dma) dma_channel_t< DMA_I2C1_RX >( dma, 0, 0, I2C1_BASE ) ) ) {
                 __dma_i2c1_rx->set_callback( +[]( uint32_t flag ){
-                        // stream() << "\n\tI2C-1 Rx irq: " << flag << std::endl;
+                        __dma_i2c1_rx->enable( false );
+                        __i2c1_master.dma_complete( flag & 0x08 ); // TEIF
+                        __i2c1_slave.dma_complete();
                     });
             }
         }
         if ( dir == DMA_Tx || dir == DMA_Both ) {
-            if ( __dma_i2c1_tx = new (&__i2c1_tx_dma) dma_channel_t< DMA_I2C1_TX >( dma, 0, 0 ) ) {
+            if ( dma.acquire( DMA_I2C1_TX, I2C1_BASE, DMA_PL_HIGH, +[]( uint32_t ){ __dma_i2c1_tx = nullptr; } ) &&
+                 ( __dma_i2c1_tx = new (&__i2c1_tx_dma) dma_channel_t< DMA_I2C1_TX >( dma, 0, 0, I2C1_BASE ) ) ) {
                 __dma_i2c1_tx->set_callback( +[]( uint32_t flag ){
-                        // stream() << "\n\tI2C-1 Tx irq: " << flag << std::endl;
+                        __dma_i2c1_tx->enable( false );
+                        __i2c1_master.dma_complete( flag & 0x08 ); // TEIF
+                        __i2c1_slave.dma_complete();
                     });
             }
         }
     } else if ( addr == I2C2_BASE ) {
         if ( dir == DMA_Rx || dir == DMA_Both ) {
-            if ( __dma_i2c2_rx = new (&__i2c2_rx_dma) dma_channel_t< DMA_I2C2_RX >( dma, 0, 0 ) ) {
+            if ( dma.acquire( DMA_I2C2_RX, I2C2_BASE, DMA_PL_VERYHIGH, +[]( uint32_t ){ __dma_i2c2_rx = nullptr; } ) &&
+                 ( __dma_i2c2_rx = new (&__i2c2_rx_dma) dma_channel_t< DMA_I2C2_RX >( dma, 0, 0, I2C2_BASE ) ) ) {
                 __dma_i2c2_rx->set_callback( +[]( uint32_t flag ){
-                        // stream() << "\n\tI2C-2 Rx irq: " << flag << std::endl;
+                        __dma_i2c2_rx->enable( false );
+                        __i2c2_master.dma_complete( flag & 0x08 ); // TEIF
+                        __i2c2_slave.dma_complete();
                     });
             }
         }
         if ( dir == DMA_Tx || dir == DMA_Both ) {
-            if ( __dma_i2c2_tx = new (&__i2c2_tx_dma) dma_channel_t< DMA_I2C2_TX >( dma, 0, 0 ) ) {
+            if ( dma.acquire( DMA_I2C2_TX, I2C2_BASE, DMA_PL_HIGH, +[]( uint32_t ){ __dma_i2c2_tx = nullptr; } ) &&
+                 ( __dma_i2c2_tx = new (&__i2c2_tx_dma) dma_channel_t< DMA_I2C2_TX >( dma, 0, 0, I2C2_BASE ) ) ) {
                 __dma_i2c2_tx->set_callback( +[]( uint32_t flag ){
-                        // stream() << "\n\tI2C-2 Tx irq: " << flag << std::endl;
+                        __dma_i2c2_tx->enable( false );
+                        __i2c2_master.dma_complete( flag & 0x08 ); // TEIF
+                        __i2c2_slave.dma_complete();
                     });
             }
         }
     }
+    master_engine( i2c_ ).set_dma( addr == I2C2_BASE ? &__i2c2_dma_port : &__i2c1_dma_port );
+    slave_engine( i2c_ ).set_dma( addr == I2C2_BASE ? &__i2c2_slave_dma_port : &__i2c1_slave_dma_port );
 }
 
 void
@@ -472,8 +644,12 @@ i2c::init( stm32f103::I2C_BASE addr )
 
     if ( auto I2C = reinterpret_cast< volatile stm32f103::I2C * >( addr ) ) {
         i2c_ = I2C;
+        timing_ = i2c_timing::compute( __pclk1, i2c_clock_speed, I2C_STANDARD_MODE );
 
         reset();
+        master_engine( i2c_ ).init( i2c_ );
+        master_engine( i2c_ ).set_clock( &cycle_counter::now, cycle_counter::cycles_per_us() );
+        scheduler().init( this, &cycle_counter::now, cycle_counter::cycles_per_us() );
 
         switch ( addr ) {
         case I2C1_BASE:
@@ -492,11 +668,21 @@ i2c::init( stm32f103::I2C_BASE addr )
 bool
 i2c::listen( uint8_t addr )
 {
-    own_addr_ = addr;
+    scoped_spinlock<> lock( lock_ );
+    if ( master_engine( i2c_ ).busy() )
+        return false;
+
+    if ( addr == 0 ) {
+        listening_ = false;
+        own_addr_ = ( reinterpret_cast< uint32_t >( const_cast< I2C * >( i2c_ ) ) == I2C1_BASE ) ? 0x03 : 0x04;
+        i2c_reset()( *i2c_, own_addr_, &timing_ );
+        return true;
+    }
 
+    own_addr_ = addr;
     i2c_->OAR1 = own_addr_ << 1;
-    bitset::set( i2c_->CR1, ACK );
-    bitset::set( i2c_->CR2, ITEVTEN | ITERREN );
+    slave_engine( i2c_ ).init( i2c_ );
+    listening_ = true;
 
     return true;
 }
@@ -504,7 +690,39 @@ i2c::listen( uint8_t addr )
 void
 i2c::reset()
 {
-    i2c_reset()( *i2c_, own_addr_ );
+    i2c_reset()( *i2c_, own_addr_, &timing_ );
+    if ( listening_ )
+        slave_engine( i2c_ ).init( i2c_ );
+}
+
+bool
+i2c::set_speed( uint32_t speed, I2C_SPEED_MODE mode )
+{
+    auto timing = i2c_timing::compute( __pclk1, speed, mode );
+    if ( timing.error != I2C_TIMING_OK )
+        return false;
+
+    scoped_spinlock<> lock( lock_ );
+    if ( master_engine( i2c_ ).busy() || ( i2c_->SR2 & BUSY ) )
+        return false;
+
+    timing_ = timing;
+    i2c_reset()( *i2c_, own_addr_, &timing_ );
+    if ( listening_ )
+        slave_engine( i2c_ ).init( i2c_ );
+    return true;
+}
+
+uint32_t
+i2c::speed() const
+{
+    return i2c_timing::scl_frequency( __pclk1, i2c_->CCR );
+}
+
+I2C_SPEED_MODE
+i2c::speed_mode() const
+{
+    return ( i2c_->CCR & I2C_FAST_MODE ) ? I2C_SPEED_MODE( i2c_->CCR & I2C_FAST_MODE_DUTY16_9 ) : I2C_STANDARD_MODE;
 }
 
 bool
@@ -541,7 +759,12 @@ i2c::result_code() const
 stream&
 i2c::print_result( stream&& o ) const
 {
-    auto code = result_code();
+    return print_result( std::move( o ), result_code() );
+}
+
+stream&
+i2c::print_result( stream&& o, I2C_RESULT_CODE code )
+{
     switch( code ) {
     case I2C_RESULT_SUCCESS:
         o << "success"; break;
@@ -563,6 +786,16 @@ i2c::print_result( stream&& o ) const
         o << "i2c dma master transmitter address failed"; break;
     case I2C_DMA_MASTER_TRANSMITTER_SEND_TIMEOUT:
         o << "i2c dma master transmitter send timeout"; break;
+    case I2C_TRANSACTION_NACK:
+        o << "i2c transaction nack"; break;
+    case I2C_TRANSACTION_ARBITRATION_LOST:
+        o << "i2c transaction arbitration lost"; break;
+    case I2C_TRANSACTION_BUS_ERROR:
+        o << "i2c transaction bus error"; break;
+    case I2C_TRANSACTION_TIMEOUT:
+        o << "i2c transaction timeout"; break;
+    case I2C_TRANSACTION_QUEUE_FULL:
+        o << "i2c transaction queue full"; break;
     default:
         o << "error code: " << code << "\t";
         break;
@@ -596,8 +829,9 @@ bool
 i2c::read( uint8_t address, uint8_t * data, size_t size )
 {
     scoped_spinlock<> lock( lock_ );
+    scoped_timeout_count count( *i2c_, result_code_ );
 
-    if ( ( result_code_ = i2c_ready_wait( *i2c_, own_addr_ )() ) != I2C_RESULT_SUCCESS )
+    if ( ( result_code_ = ready() ) != I2C_RESULT_SUCCESS )
         return false;
 
     if ( size > 3 )
@@ -613,10 +847,11 @@ bool
 i2c::write( uint8_t address, const uint8_t * data, size_t size )
 {
     scoped_spinlock<> lock( lock_ );
+    scoped_timeout_count count( *i2c_, result_code_ );
 
     bitset::set( i2c_->CR1, ACK | PE );
 
-    if ( ( result_code_ = i2c_ready_wait( *i2c_, own_addr_ )() ) != I2C_RESULT_SUCCESS )
+    if ( ( result_code_ = ready() ) != I2C_RESULT_SUCCESS )
         return false;
 
     scoped_i2c_start start( *i2c_ );
@@ -649,6 +884,7 @@ bool
 i2c::dma_transfer( uint8_t address, const uint8_t * data, size_t size )
 {
     scoped_spinlock<> lock( lock_ );
+    scoped_timeout_count count( *i2c_, result_code_ );
 
     const auto base_addr = reinterpret_cast< uint32_t >( const_cast< I2C * >(i2c_) );
     if ( base_addr == I2C1_BASE && __dma_i2c1_tx == nullptr ) {
@@ -659,7 +895,7 @@ i2c::dma_transfer( uint8_t address, const uint8_t * data, size_t size )
         return false;
     }
 
-    if ( ( result_code_ = i2c_ready_wait( *i2c_, own_addr_ )() ) != I2C_RESULT_SUCCESS )
+    if ( ( result_code_ = ready() ) != I2C_RESULT_SUCCESS )
         return false;
 
 
@@ -682,6 +918,7 @@ bool
 i2c::dma_receive( uint8_t address, uint8_t * data, size_t size )
 {
     scoped_spinlock<> lock( lock_ );
+    scoped_timeout_count count( *i2c_, result_code_ );
 
     const auto base_addr = reinterpret_cast< uint32_t >( const_cast< I2C * >(i2c_) );
 
@@ -693,12 +930,13 @@ i2c::dma_receive( uint8_t address, uint8_t * data, size_t size )
         return false;
     }
 
-    if ( ( result_code_ = i2c_ready_wait( *i2c_, own_addr_ )() ) != I2C_RESULT_SUCCESS )
+    if ( ( result_code_ = ready() ) != I2C_RESULT_SUCCESS )
         return false;
 
     if ( size == 1 ) {
         // See AN2824, p10, "master reception of a single byte is not supported."
-        return polling_master_receiver< 1 >( *i2c_ )( address, data, size );
+        result_code_ = polling_master_receiver< 1 >( *i2c_ )( address, data, size );
+        return result_code_ == I2C_RESULT_SUCCESS;
     }
 
     if ( base_addr == I2C1_BASE ) {
@@ -712,15 +950,219 @@ i2c::dma_receive( uint8_t address, uint8_t * data, size_t size )
     return false;
 }
 
+bool
+i2c::submit( i2c_transaction& t )
+{
+    if ( t.timeout_us == 0 )
+        t.timeout_us = i2c_timeout_us( *i2c_, t.tx_size + t.rx_size + 2 );
+    return master_engine( i2c_ ).submit( t );
+}
+
+namespace stm32f103 {
+    struct scoped_i2c_irq_mask {
+        const bool i2c2;
+        scoped_i2c_irq_mask( volatile I2C * _ ) : i2c2( reinterpret_cast< uint32_t >( const_cast< I2C * >( _ ) ) == I2C2_BASE ) {
+            disable_interrupt( i2c2 ? I2C2_EV_IRQn : I2C1_EV_IRQn );
+            disable_interrupt( i2c2 ? I2C2_ER_IRQn : I2C1_ER_IRQn );
+        }
+        ~scoped_i2c_irq_mask() {
+            enable_interrupt( i2c2 ? I2C2_EV_IRQn : I2C1_EV_IRQn );
+            enable_interrupt( i2c2 ? I2C2_ER_IRQn : I2C1_ER_IRQn );
+        }
+    };
+}
+
+bool
+i2c::transact( i2c_transaction& t )
+{
+    scoped_spinlock<> lock( lock_ );
+
+    if ( ! submit( t ) ) {
+        result_code_ = I2C_TRANSACTION_QUEUE_FULL;
+        return false;
+    }
+
+    // 't' lives on the caller's stack; it must leave the queue before return.  Transactions queued
+    // ahead of it are bounded by their own deadlines.
+    // A transaction waiting for the previous STOP is started by poll() as soon as it is seen.
+    auto& engine = master_engine( i2c_ );
+    while ( ! deadline( 100 )( [&]{ return t.done.load() || engine.state() == i2c_master_type::st_stop_wait; } ) || !t.done.load() )
+        poll();
+
+    if ( t.result == I2C_TRANSACTION_TIMEOUT ) {
+        if ( ! i2c_deadline( *i2c_ )( [&]{ return !( i2c_->SR2 & BUSY ); } ) )
+            recover();
+    }
+
+    result_code_ = t.result;
+    return result_code_ == I2C_RESULT_SUCCESS;
+}
+
+bool
+i2c::poll()
+{
+    auto& engine = master_engine( i2c_ );
+    scoped_i2c_irq_mask mask( i2c_ );
+    engine.resume();
+    if ( engine.expired() )
+        engine.abort( I2C_TRANSACTION_TIMEOUT );
+    return engine.busy() || engine.pending();
+}
+
+//static
+void
+i2c::resume_deferred()
+{
+    if ( __i2c1_master.state() == i2c_master_type::st_stop_wait ) {
+        scoped_i2c_irq_mask mask( reinterpret_cast< volatile I2C * >( I2C1_BASE ) );
+        __i2c1_master.resume();
+    }
+    if ( __i2c2_master.state() == i2c_master_type::st_stop_wait ) {
+        scoped_i2c_irq_mask mask( reinterpret_cast< volatile I2C * >( I2C2_BASE ) );
+        __i2c2_master.resume();
+    }
+}
+
+I2C_RESULT_CODE
+i2c::ready()
+{
+    auto rc = i2c_ready_wait( *i2c_, own_addr_ )();
+    if ( rc == I2C_BUS_BUSY && master_engine( i2c_ ).state() == i2c_master_type::st_idle ) {
+        recover();
+        rc = i2c_ready_wait( *i2c_, own_addr_ )();
+    }
+    return rc;
+}
+
+bool
+i2c::recover()
+{
+    // A slave reset or interrupted in the middle of a read keeps driving SDA low until it has
+    // clocked out the rest of its byte; SR2.BUSY stays set and no START can be generated.
+    const bool i2c2 = reinterpret_cast< uint32_t >( const_cast< I2C * >( i2c_ ) ) == I2C2_BASE;
+    const bool remap = !i2c2 && ( reinterpret_cast< volatile AFIO * >( AFIO_BASE )->MAPR & 0x02 ); // I2C1_REMAP
+    const GPIOB_PIN scl = i2c2 ? PB10 : remap ? PB8 : PB6;
+    const GPIOB_PIN sda = i2c2 ? PB11 : remap ? PB9 : PB7;
+    auto port = reinterpret_cast< volatile GPIO * >( GPIOB_BASE );
+    const uint32_t half_period = 5; // us, 100kHz
+
+    gpio< GPIOB_PIN > scl_pin( scl ), sda_pin( sda );
+
+    bitset::reset( i2c_->CR1, PE );
+    scl_pin = true;
+    sda_pin = true;
+    gpio_mode()( scl, GPIO_CNF_OUTPUT_ODRAIN, GPIO_MODE_OUTPUT_2M );
+    gpio_mode()( sda, GPIO_CNF_OUTPUT_ODRAIN, GPIO_MODE_OUTPUT_2M );
+
+    for ( int i = 0; i < 9 && !( port->IDR & ( 1 << sda ) ); ++i ) {
+        scl_pin = false;
+        deadline::delay( half_period );
+        scl_pin = true;
+        deadline::delay( half_period );
+    }
+
+    // STOP condition; SDA rises while SCL is high
+    scl_pin = false;
+    deadline::delay( half_period );
+    sda_pin = false;
+    deadline::delay( half_period );
+    scl_pin = true;
+    deadline::delay( half_period );
+    sda_pin = true;
+    deadline::delay( half_period );
+
+    const bool released = ( port->IDR & ( 1 << sda ) ) && ( port->IDR & ( 1 << scl ) );
+
+    gpio_mode()( scl, GPIO_CNF_ALT_OUTPUT_ODRAIN, GPIO_MODE_OUTPUT_2M );
+    gpio_mode()( sda, GPIO_CNF_ALT_OUTPUT_ODRAIN, GPIO_MODE_OUTPUT_2M );
+
+    reset(); // SWRST also clears a BUSY flag latched by the GPIO activity
+    ++error_counters_of( *i2c_ ).recovery;
+    return released;
+}
+
+i2c_error_counters
+i2c::error_counters() const
+{
+    auto counters = error_counters_of( *i2c_ );
+    const auto& engine = master_engine( i2c_ ).errors();
+    counters.nack += engine.nack;
+    counters.arbitration_lost += engine.arbitration_lost;
+    counters.bus_error += engine.bus_error;
+    counters.timeout += engine.timeout;
+    return counters;
+}
+
+i2c_scheduler< i2c >&
+i2c::scheduler()
+{
+    return reinterpret_cast< uint32_t >( const_cast< I2C * >( i2c_ ) ) == I2C2_BASE ? __i2c2_scheduler : __i2c1_scheduler;
+}
+
+bool
+i2c::write_read( uint8_t address, const uint8_t * tx, size_t txlen, uint8_t * rx, size_t rxlen )
+{
+    // no STOP/START and bus-idle wait between the phases; the engine chains TX and RX DMA when attached
+    i2c_transaction t( address, tx, txlen, rx, rxlen );
+    return transact( t );
+}
+
+void
+i2c::set_writable( uint8_t reg, size_t count, bool writable )
+{
+    scoped_i2c_irq_mask mask( i2c_ );
+    slave_engine( i2c_ ).set_writable( reg, count, writable );
+}
+
+void
+i2c::set_write_callback( void (*callback)( uint8_t, size_t, void * ), void * context )
+{
+    scoped_i2c_irq_mask mask( i2c_ );
+    slave_engine( i2c_ ).set_callback( callback, context );
+}
+
+size_t
+i2c::update_registers( uint8_t reg, const uint8_t * data, size_t size )
+{
+    // a read in progress sends the snapshot taken at its address match
+    scoped_i2c_irq_mask mask( i2c_ );
+    return slave_engine( i2c_ ).update( reg, data, size );
+}
+
+size_t
+i2c::read_registers( uint8_t reg, uint8_t * data, size_t size ) const
+{
+    scoped_i2c_irq_mask mask( i2c_ );
+    return slave_engine( i2c_ ).read( reg, data, size );
+}
+
+i2c_slave_statistics
+i2c::slave_statistics() const
+{
+    return slave_engine( i2c_ ).stat();
+}
+
 void
 i2c::handle_event_interrupt()
 {
+    auto& engine = master_engine( i2c_ );
+    if ( engine.state() != i2c_master_type::st_idle || !listening_ )
+        engine.handle_event();
+    else
+        slave_engine( i2c_ ).handle_event();
 }
 
 void
 i2c::handle_error_interrupt()
 {
     // stream() << "ERROR irq: " << status32_to_string( i2c_status( *i2c_ )() ) << std::endl;
-    constexpr uint32_t error_condition = SMB_ALART | TIME_OUT | PEC_ERR | OVR | AF | ARLO | BERR;
-    i2c_->SR1 &= ~error_condition;
+    auto& engine = master_engine( i2c_ );
+    if ( engine.state() != i2c_master_type::st_idle ) {
+        engine.handle_error();
+    } else if ( listening_ ) {
+        slave_engine( i2c_ ).handle_error();
+    } else {
+        constexpr uint32_t error_condition = SMB_ALART | TIME_OUT | PEC_ERR | OVR | AF | ARLO | BERR;
+        i2c_->SR1 &= ~error_condition;
+    }
 }
@@ -6,15 +6,20 @@
 
 #pragma once
 
+#include "i2c_timing.hpp"
 #include <array>
 #include <atomic>
 #include <cstdint>
+#include <cstddef>
 
 class stream;
 
 namespace stm32f103 {
 
     class dma;
+    class i2c;
+    struct i2c_transaction;
+    template< typename BUS > class i2c_scheduler;
 
     /* Section 26.6.10 I^2C register map, p785 RM0008
      */
@@ -48,10 +53,36 @@ namespace stm32f103 {
         , I2C_POLLING_MASTER_TRANSMITTER_ADDRESS_FAILED
         , I2C_POLLING_MASTER_TRANSMITTER_SEND_TIMEOUT
         , I2C_DEVICE_ERROR_CONDITION
+        , I2C_TRANSACTION_NACK
+        , I2C_TRANSACTION_ARBITRATION_LOST
+        , I2C_TRANSACTION_BUS_ERROR
+        , I2C_TRANSACTION_TIMEOUT
+        , I2C_TRANSACTION_QUEUE_FULL
     };
 
+    struct i2c_error_counters {
+        uint32_t nack;
+        uint32_t arbitration_lost;
+        uint32_t bus_error;
+        uint32_t timeout;
+        uint32_t recovery;    // stuck bus cleared by clocking SCL
+    };
+
+    struct i2c_slave_statistics {
+        uint32_t reads;           // read bursts
+        uint32_t writes;          // write bursts with data
+        uint32_t bytes_read;      // handed to DR; one more than the master took when it NACKs a preloaded byte
+        uint32_t bytes_written;   // applied to the register file
+        uint32_t dropped;         // read-only, out of range or overrun
+        uint32_t errors;          // bus error, overrun
+    };
+
+    constexpr size_t i2c_slave_register_size = 64;  // register file exposed by listen()
+
     // I^2C 26.5, p773 RM0008
-    
+
+    constexpr uint32_t i2c_pclk1 = 36'000'000; //'; APB1 clock at 72MHz system clock, for compile time timing check
+
     enum I2C_BASE : uint32_t;
     
     struct I2C;
@@ -60,7 +91,11 @@ namespace stm32f103 {
         volatile I2C * i2c_;
         std::atomic_flag lock_;
         uint8_t own_addr_;
+        bool listening_;
         I2C_RESULT_CODE result_code_;
+        i2c_timing timing_;
+
+        I2C_RESULT_CODE ready();
 
         i2c( const i2c& ) = delete;
         i2c& operator = ( const i2c& ) = delete;
@@ -77,7 +112,32 @@ namespace stm32f103 {
 
         void reset();
 
+        // SCL clock; the bus must be idle.  The setting is kept across reset()
+        bool set_speed( uint32_t speed, I2C_SPEED_MODE mode = I2C_STANDARD_MODE );
+
+        template< uint32_t speed, I2C_SPEED_MODE mode = I2C_STANDARD_MODE > bool set_speed() {
+            static_assert( i2c_timing_t< i2c_pclk1, speed, mode >::value.error == I2C_TIMING_OK, "I2C timing" );
+            return set_speed( speed, mode );
+        }
+
+        uint32_t speed() const;            // SCL frequency as programmed in CCR
+        I2C_SPEED_MODE speed_mode() const;
+
+        // Release a slave holding SDA low by clocking up to 9 SCL pulses through GPIO, then STOP and
+        // reinitialize.  Done automatically when the bus stays busy or a transaction times out.
+        bool recover();
+        i2c_error_counters error_counters() const;
+
+        // slave mode (i2c_slave.hpp): the master reads and writes a register file of i2c_slave_register_size
+        // bytes at 'own_addr'; all registers are read-only until set_writable().  listen( 0 ) leaves slave mode.
         bool listen( uint8_t own_addr );
+        inline bool listening() const { return listening_; }
+        void set_writable( uint8_t reg, size_t count, bool writable = true );
+        // called from the ISR when a write burst from the master has been applied
+        void set_write_callback( void (*)( uint8_t reg, size_t count, void * context ), void * context = nullptr );
+        size_t update_registers( uint8_t reg, const uint8_t * data, size_t );
+        size_t read_registers( uint8_t reg, uint8_t * data, size_t ) const;
+        i2c_slave_statistics slave_statistics() const;
         
         inline operator bool () const { return i2c_; };
 
@@ -88,6 +148,25 @@ namespace stm32f103 {
 
         bool dma_transfer( uint8_t address, const uint8_t *, size_t );
         bool dma_receive( uint8_t address, uint8_t * data, size_t );
+
+        // interrupt driven transactions (i2c_master.hpp); submit() returns immediately,
+        // transact() waits for completion, or the transaction deadline, and leaves the result in result_code()
+        bool submit( i2c_transaction& );
+        bool transact( i2c_transaction& );
+
+        // aborts the running transaction if it is past its deadline; call it while waiting on submit()ed
+        // transactions.  Returns false when the engine has nothing left to do.
+        bool poll();
+
+        // starts master transactions deferred behind a pending STOP on either bus (i2c_master.hpp), for
+        // those nobody poll()s for; from the SysTick handler
+        static void resume_deferred();
+
+        // shared bus scheduler (i2c_scheduler.hpp) for device drivers
+        i2c_scheduler< i2c >& scheduler();
+
+        // register read: write 'tx' then read 'rx' on repeated START, as one transaction
+        bool write_read( uint8_t address, const uint8_t * tx, size_t txlen, uint8_t * rx, size_t rxlen );
         uint32_t status() const;
         bool start();
         bool stop();
@@ -99,6 +178,7 @@ namespace stm32f103 {
 
         I2C_RESULT_CODE result_code() const;
         stream& print_result( stream&& ) const;
+        static stream& print_result( stream&&, I2C_RESULT_CODE );
         stream& print_status( stream&& ) const;
 
         void handle_event_interrupt();
@@ -4,7 +4,12 @@
 // Contact: toshi.hondo@qtplatz.com
 //
 
+#include "adc.hpp"
+#include "averager.hpp"
+#include "cycle_counter.hpp"
 #include "i2c.hpp"
+#include "i2c_master.hpp"
+#include "i2c_scheduler.hpp"
 #include "dma.hpp"
 #include "i2c_string.hpp"
 #include "gpio_mode.hpp"
@@ -12,52 +17,431 @@
 #include "stm32f103.hpp"
 #include "utility.hpp"
 #include <algorithm>
+#include <bitset>
 
 void i2c_command( size_t argc, const char ** argv );
+void i2c_hub_update( uint8_t reg, const void * data, size_t size );
 
+extern std::atomic< uint32_t > atomic_seconds;
+
+namespace {
+
+    // i2cdetect through the interrupt driven engine: address-only probes (START, address, STOP), up to
+    // queue_depth of them in flight, each with a deadline of a few bit times.  An empty address costs
+    // one address byte on the bus, and both buses can be scanned at the same time.
+    struct i2c_scanner {
+        static constexpr uint8_t first = 0x03;
+        static constexpr uint8_t last = 0x77;
+        static constexpr size_t depth = stm32f103::i2c_master< volatile stm32f103::I2C >::queue_depth;
+
+        stm32f103::i2c * i2c_;
+        std::array< stm32f103::i2c_transaction, depth > slots_;
+        std::array< uint16_t, last + 1 > elapsed_;  // 0.1us from START to ACK+STOP, or NACK; saturated
+        std::bitset< last + 1 > found_;
+        uint8_t next_;
+        uint32_t timeout_us_;
+        uint32_t errors_;
+        stm32f103::cycle_counter cycles_;
+        uint32_t total_;
+
+        void begin( stm32f103::i2c& bus ) {
+            i2c_ = &bus;
+            elapsed_ = {};
+            found_.reset();
+            next_ = first;
+            errors_ = 0;
+            for ( auto& t: slots_ )
+                t.address = 0;  // free slot
+            // START + address + ACK + STOP is about 11 SCL periods; allow 4 times of it for clock stretching
+            const uint32_t scl = bus.speed();
+            timeout_us_ = 50 + ( scl ? 44'000'000 / scl : 1'000 ); //'
+            cycles_ = stm32f103::cycle_counter();
+            total_ = 0;
+        }
+
+        // collects finished probes and refills the queue; returns false when the scan is complete
+        bool run() {
+            using namespace stm32f103;
+            bool active = false;
+            for ( auto& t: slots_ ) {
+                if ( t.address && t.done.load() ) {
+                    found_[ t.address ] = t.result == I2C_RESULT_SUCCESS;
+                    if ( t.result != I2C_RESULT_SUCCESS && t.result != I2C_TRANSACTION_NACK )
+                        ++errors_;
+                    const uint32_t ns100 = t.elapsed * 10 / cycle_counter::cycles_per_us();
+                    elapsed_[ t.address ] = uint16_t( ns100 < 0xffff ? ns100 : 0xffff );
+                    t.address = 0;
+                }
+                if ( t.address == 0 && next_ <= last ) {
+                    t.address = next_;
+                    t.tx_size = t.rx_size = 0;
+                    t.timeout_us = timeout_us_;
+                    if ( i2c_->submit( t ) )
+                        ++next_;
+                    else
+                        t.address = 0;
+                }
+                active |= t.address != 0;
+            }
+            if ( i2c_->poll() )
+                active = true;
+            if ( !active && total_ == 0 ) {
+                total_ = cycles_.elapsed();
+                if ( errors_ )
+                    i2c_->recover(); // a probe timed out; the bus may be held by a confused slave
+            }
+            return active;
+        }
+
+        static void print_us( stream&& o, uint32_t ns100 ) {
+            o << int( ns100 / 10 ) << "." << int( ns100 % 10 ) << "us";
+        }
+
+        void print( const char * name ) const {
+            stream() << name << ", SCL " << int( i2c_->speed() ) << "Hz" << std::endl;
+            stream() << "\t 0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f" << std::endl;
+            stream() << "00:\t         ";
+            for ( uint8_t addr = first; addr <= last; ++addr ) {
+                if ( ( addr % 16 ) == 0 )
+                    stream() << std::endl << addr << ":\t";
+                if ( found_[ addr ] )
+                    stream() << addr << " ";
+                else
+                    stream() << "-- ";
+            }
+            stream() << std::endl;
+            for ( uint8_t addr = first; addr <= last; ++addr ) {
+                if ( found_[ addr ] ) {
+                    stream() << "\t" << addr << " ACK ";
+                    print_us( stream(), elapsed_[ addr ] );
+                    stream() << std::endl;
+                }
+            }
+            stream() << "\tscan ";
+            print_us( stream(), total_ * 10 / stm32f103::cycle_counter::cycles_per_us() );
+            stream() << ", errors: " << int( errors_ ) << std::endl;
+        }
+    };
+}
+
+namespace {
+
+    // repeated register reads through the interrupt driven engine, up to 'depth' transactions in flight;
+    // the data phase goes by DMA when the bus has it attached.  I2C1 and I2C2 have separate engines, DMA
+    // channels and interrupts, so that a reader on each bus runs concurrently with the other.
+    struct i2c_reader {
+        static constexpr size_t depth = 4;
+        static constexpr size_t max_bytes = 16;
+
+        stm32f103::i2c * i2c_;
+        std::array< stm32f103::i2c_transaction, depth > slots_;
+        std::array< std::array< uint8_t, max_bytes >, depth > data_;
+        uint8_t address_;
+        uint8_t reg_;
+        size_t bytes_;
+        size_t count_;
+        size_t submitted_;
+        size_t completed_;
+        size_t errors_;
+        stm32f103::cycle_counter cycles_;
+        uint32_t total_;
+
+        void begin( stm32f103::i2c& bus, uint8_t address, uint8_t reg, size_t bytes, size_t count ) {
+            i2c_ = &bus;
+            address_ = address;
+            reg_ = reg;
+            bytes_ = bytes < max_bytes ? bytes : max_bytes;
+            count_ = count;
+            submitted_ = completed_ = errors_ = 0;
+            for ( auto& t: slots_ )
+                t.address = 0;  // free slot
+            cycles_ = stm32f103::cycle_counter();
+            total_ = 0;
+        }
+
+        // collects finished reads and refills the queue; returns false when all 'count' are done
+        bool run() {
+            using namespace stm32f103;
+            bool active = false;
+            for ( size_t i = 0; i < depth; ++i ) {
+                auto& t = slots_[ i ];
+                if ( t.address && t.done.load() ) {
+                    if ( t.result != I2C_RESULT_SUCCESS )
+                        ++errors_;
+                    ++completed_;
+                    t.address = 0;
+                }
+                if ( t.address == 0 && submitted_ < count_ ) {
+                    new ( &t ) i2c_transaction( address_, &reg_, 1, data_[ i ].data(), bytes_ );
+                    if ( i2c_->submit( t ) )
+                        ++submitted_;
+                    else
+                        t.address = 0;
+                }
+                active |= t.address != 0;
+            }
+            if ( i2c_->poll() )
+                active = true;
+            if ( !active && total_ == 0 ) {
+                total_ = cycles_.elapsed();
+                if ( errors_ )
+                    i2c_->recover();
+            }
+            return active;
+        }
+
+        uint32_t bytes_per_second() const {
+            return total_ ? uint32_t( uint64_t( completed_ - errors_ ) * bytes_ * stm32f103::cycle_counter::cycles_per_us() * 1'000'000 / total_ ) : 0; //'
+        }
+    };
+}
+
+// scan I2C1 and/or I2C2; both are run concurrently
 static void
-i2c_probe( int id )
+i2c_probe( bool i2c1, bool i2c2 )
 {
-    stm32f103::I2C_BASE addr = ( id == 0 ) ? stm32f103::I2C1_BASE : stm32f103::I2C2_BASE;    
-    auto& i2cx = ( addr == stm32f103::I2C1_BASE )
-        ? *stm32f103::i2c_t< stm32f103::I2C1_BASE >::instance() : *stm32f103::i2c_t< stm32f103::I2C2_BASE >::instance();
+    using namespace stm32f103;
+    i2c_scanner scanners[ 2 ];  // the scan runs until no probe is in flight
+    i2c * buses[ 2 ] = { i2c_t< I2C1_BASE >::instance(), i2c_t< I2C2_BASE >::instance() };
+    const bool use[ 2 ] = { i2c1 && *buses[ 0 ], i2c2 && *buses[ 1 ] };
 
-    if ( !i2cx ) {
-        const char * argv [] = { id == 0 ? "i2c" : "i2c2", nullptr };
-        i2c_command( 1, argv );
+    for ( int i = 0; i < 2; ++i ) {
+        if ( use[ i ] )
+            scanners[ i ].begin( *buses[ i ] );
+        else if ( i == 0 ? i2c1 : i2c2 )
+            stream() << ( i == 0 ? "i2c" : "i2c2" ) << " not initalized" << std::endl;
     }
 
-    if ( i2cx ) {
+    for ( bool active = true; active; ) {
+        bool a = use[ 0 ] && scanners[ 0 ].run();
+        bool b = use[ 1 ] && scanners[ 1 ].run();
+        active = a || b;
+    }
 
-        stream() << "\t 0  1  2  3  4  5  6  7  8  9  a  b  c  d  e  f" << std::endl;
-        stream() << "00:\t         ";
+    for ( int i = 0; i < 2; ++i ) {
+        if ( use[ i ] )
+            scanners[ i ].print( i == 0 ? "I2C1" : "I2C2" );
+    }
+}
 
-        for ( uint8_t addr = 3; addr <= 0x77; ++addr ) {
+namespace {
 
-            if ( ( addr % 16 ) == 0 )
-                stream() << std::endl << addr << ":\t";
-            
-            uint8_t data;
-            if ( i2cx.read( addr, &data, 1 ) ) {
-                stream() << addr << " ";
-            } else {
-                stream() << "-- ";
-            }
+    // Sensor hub register map, exposed on I2C2 by 'i2c --slave [addr]'; multi-byte values are little endian.
+    // An upstream controller gets everything in one burst read from HUB_SEQUENCE.
+    enum I2C_HUB_REGISTER : uint8_t {
+        HUB_WHO_AM_I         = 0x00   // 0xa5
+        , HUB_VERSION        = 0x01
+        , HUB_SEQUENCE       = 0x02   // u16, incremented on every update
+        , HUB_UPTIME         = 0x04   // u32, seconds
+        , HUB_PRESSURE       = 0x08   // u32, BMP280 (Pa)
+        , HUB_TEMPERATURE    = 0x0c   // i32, BMP280 (0.01 degC)
+        , HUB_ADC_TRIGGERS   = 0x10   // u32, ADC averager triggers
+        , HUB_ADC_LATENCY    = 0x14   // u32, mean trigger latency (cycles)
+        , HUB_ADC_JITTER     = 0x18   // u32, max - min trigger latency (cycles)
+        , HUB_CONTROL        = 0x20   // 16 bytes, read/write
+        , HUB_SCRATCH        = 0x30   // 16 bytes, read/write
+    };
+
+    uint8_t __hub_addr;
+    uint16_t __hub_sequence;
+    std::atomic< uint32_t > __hub_control_writes;
+}
+
+// publish a value into the hub register file; no-op unless I2C2 is listening
+void
+i2c_hub_update( uint8_t reg, const void * data, size_t size )
+{
+    auto& hub = *stm32f103::i2c_t< stm32f103::I2C2_BASE >::instance();
+    if ( !hub.listening() )
+        return;
+    hub.update_registers( reg, reinterpret_cast< const uint8_t * >( data ), size );
+    ++__hub_sequence;
+    hub.update_registers( HUB_SEQUENCE, reinterpret_cast< const uint8_t * >( &__hub_sequence ), sizeof( __hub_sequence ) );
+}
+
+static void
+i2c_hub_refresh()
+{
+    const uint32_t uptime = atomic_seconds.load();
+    i2c_hub_update( HUB_UPTIME, &uptime, sizeof( uptime ) );
+
+    const auto& stat = stm32f103::adc::instance()->averager().stat();
+    const uint32_t adc[ 3 ] = { stat.triggers
+                                , stat.triggers ? uint32_t( stat.latency_sum / stat.triggers ) : 0
+                                , stat.triggers ? stat.latency_max - stat.latency_min : 0 };
+    i2c_hub_update( HUB_ADC_TRIGGERS, adc, sizeof( adc ) );
+}
+
+static void
+i2c_hub_listen( uint8_t own_addr )
+{
+    using namespace stm32f103;
+    auto& hub = *i2c_t< I2C2_BASE >::instance();
+
+    if ( !hub.has_dma( i2c::DMA_Both ) )
+        hub.attach( *dma_t< DMA1_BASE >::instance(), i2c::DMA_Both );
+
+    if ( !hub.listen( own_addr ) ) {
+        stream() << "i2c2 busy" << std::endl;
+        return;
+    }
+    __hub_addr = own_addr;
+
+    const uint8_t id[] = { 0xa5, 0x01 };
+    hub.update_registers( HUB_WHO_AM_I, id, sizeof( id ) );
+    hub.set_writable( HUB_CONTROL, 32 );
+    hub.set_write_callback( +[]( uint8_t, size_t, void * ){ ++__hub_control_writes; } );
+    i2c_hub_refresh();
+
+    stream() << "i2c2 listening at " << own_addr << ", " << int( i2c_slave_register_size ) << " byte register file" << std::endl;
+}
+
+// refresh and print the hub register file; from i2c (I2C1), read it back through the bus as an upstream controller would
+static void
+i2c_hub_print( int id )
+{
+    using namespace stm32f103;
+    auto& hub = *i2c_t< I2C2_BASE >::instance();
+    std::array< uint8_t, i2c_slave_register_size > regs = { 0 };
+
+    if ( !hub.listening() ) {
+        stream() << "i2c2 is not listening; i2c --slave [addr]" << std::endl;
+        return;
+    }
+    i2c_hub_refresh();
+
+    if ( id == 0 ) {
+        auto& i2cx = *i2c_t< I2C1_BASE >::instance();
+        const uint8_t reg = HUB_WHO_AM_I;
+        if ( !i2cx.write_read( __hub_addr, &reg, 1, regs.data(), regs.size() ) ) {
+            i2cx.print_result( stream() ) << std::endl;
+            return;
         }
+        stream() << "i2c hub " << __hub_addr << " read through I2C1:" << std::endl;
     } else {
-        stream() << "i2c not initalized" << std::endl;
+        hub.read_registers( 0, regs.data(), regs.size() );
+    }
+
+    for ( size_t i = 0; i < regs.size(); ++i ) {
+        if ( ( i % 16 ) == 0 )
+            stream() << ( i ? "\n" : "" ) << uint8_t( i ) << ":\t";
+        stream() << regs[ i ] << " ";
+    }
+    stream() << std::endl;
+
+    auto stat = hub.slave_statistics();
+    stream() << "\treads: " << int( stat.reads ) << " (" << int( stat.bytes_read ) << " bytes), writes: " << int( stat.writes )
+             << " (" << int( stat.bytes_written ) << " bytes), dropped: " << int( stat.dropped ) << ", errors: " << int( stat.errors )
+             << ", control writes: " << int( __hub_control_writes.load() ) << std::endl;
+}
+
+// per-device latency through the bus scheduler, in us
+static void
+i2c_scheduler_print( stm32f103::i2c& i2cx, bool clear )
+{
+    auto& sched = i2cx.scheduler();
+    const uint32_t cycles_per_us = stm32f103::cycle_counter::cycles_per_us();
+    for ( size_t i = 0; i < sched.devices(); ++i ) {
+        const auto& st = sched.stat( uint8_t( i ) );
+        stream() << "\t" << st.address << "\trequests: " << int( st.requests ) << ", failed: " << int( st.failed )
+                 << ", deadline missed: " << int( st.deadline_missed )
+                 << ", wait max: " << int( st.wait_max / cycles_per_us ) << "us"
+                 << ", latency min/mean/max: " << int( st.latency_min / cycles_per_us )
+                 << "/" << int( st.completed ? st.latency_sum / st.completed / cycles_per_us : 0 )
+                 << "/" << int( st.latency_max / cycles_per_us ) << "us" << std::endl;
+    }
+    if ( sched.devices() == 0 )
+        stream() << "\tno device registered" << std::endl;
+    if ( clear )
+        sched.clear_stat();
+}
+
+// read throughput of 'count' x rxdata-size transactions from 'chipaddr' in each bus speed mode
+static void
+i2c_bench( stm32f103::i2c& i2cx, uint8_t chipaddr, size_t count )
+{
+    using namespace stm32f103;
+
+    constexpr static std::pair< uint32_t, I2C_SPEED_MODE > modes [] = {
+        { 100'000, I2C_STANDARD_MODE }, { 400'000, I2C_FAST_MODE }, { 400'000, I2C_FAST_MODE_DUTY16_9 } //'
+    };
+    const uint32_t speed = i2cx.speed();
+    const I2C_SPEED_MODE mode = i2cx.speed_mode();
+    std::array< uint8_t, 16 > rxdata;
+
+    for ( const auto& m: modes ) {
+        if ( !i2cx.set_speed( m.first, m.second ) ) {
+            stream() << "\tspeed " << int( m.first ) << "Hz not accepted" << std::endl;
+            continue;
+        }
+        size_t errors = 0;
+        cycle_counter cycles;
+        for ( size_t i = 0; i < count; ++i ) {
+            i2c_transaction t( chipaddr, nullptr, 0, rxdata.data(), rxdata.size() );
+            if ( !i2cx.transact( t ) )
+                ++errors;
+        }
+        uint32_t t = cycles.elapsed();
+        uint64_t bytes = uint64_t( count - errors ) * rxdata.size();
+        stream() << "\tSCL " << int( i2cx.speed() ) << "Hz"
+                 << ( m.second == I2C_STANDARD_MODE ? " Sm     " : m.second == I2C_FAST_MODE ? " Fm     " : " Fm 16/9" )
+                 << "\t" << int( t ? bytes * 72'000'000 / t : 0 ) << " bytes/s" //'
+                 << "\t(" << int( count ) << " x " << int( rxdata.size() ) << " bytes, errors: " << int( errors ) << ")" << std::endl;
+    }
+    i2cx.set_speed( speed, mode );
+}
+
+// register reads of 'bytes' from address[ bus ], each bus alone then both at once; the aggregate should be
+// about the sum of the two as long as the CPU keeps up with both interrupt streams
+static void
+i2c_dual( const uint8_t * address, uint8_t reg, size_t bytes, size_t count )
+{
+    using namespace stm32f103;
+    i2c_reader readers[ 2 ];  // each pass runs until no read is in flight
+    i2c * buses[ 2 ] = { i2c_t< I2C1_BASE >::instance(), i2c_t< I2C2_BASE >::instance() };
+
+    for ( auto bus: buses ) {
+        if ( !bus->has_dma( i2c::DMA_Both ) )
+            bus->attach( *dma_t< DMA1_BASE >::instance(), i2c::DMA_Both );
+    }
+    if ( buses[ 1 ]->listening() ) {
+        stream() << "i2c2 is listening as a slave; i2c2 --slave 0 first" << std::endl;
+        return;
+    }
+
+    for ( int pass = 0; pass < 3; ++pass ) {
+        const bool use[ 2 ] = { pass != 1, pass != 0 };
+        for ( int i = 0; i < 2; ++i ) {
+            if ( use[ i ] )
+                readers[ i ].begin( *buses[ i ], address[ i ], reg, bytes, count );
+        }
+        for ( bool active = true; active; ) {
+            bool a = use[ 0 ] && readers[ 0 ].run();
+            bool b = use[ 1 ] && readers[ 1 ].run();
+            active = a || b;
+        }
+        uint32_t sum = 0;
+        stream() << ( pass == 0 ? "	I2C1 alone " : pass == 1 ? "	I2C2 alone " : "	concurrent " );
+        for ( int i = 0; i < 2; ++i ) {
+            if ( use[ i ] ) {
+                sum += readers[ i ].bytes_per_second();
+                stream() << "	" << ( i == 0 ? "I2C1 " : "I2C2 " ) << readers[ i ].address_ << ": "
+                         << int( readers[ i ].bytes_per_second() ) << " bytes/s, errors: " << int( readers[ i ].errors_ );
+            }
+        }
+        if ( pass == 2 )
+            stream() << "	total " << int( sum ) << " bytes/s";
+        stream() << std::endl;
     }
 }
 
 void
 i2cdetect( size_t argc, const char ** argv )
 {
-    int id = 0;
-    if ( argc > 2 ) {
-        if ( *argv[1] == '1' )
-            id = 1;
-    }
-    i2c_probe( id );
+    if ( argc >= 2 )
+        i2c_probe( *argv[1] == '0', *argv[1] == '1' );
+    else
+        i2c_probe( true, true );
 }
 
 void
@@ -74,9 +458,13 @@ i2c_command( size_t argc, const char ** argv )
     if ( !i2cx.has_dma( i2c::DMA_Both ) )
         i2cx.attach( *dma_t< DMA1_BASE >::instance(), i2c::DMA_Both );
 
-    static uint32_t replicates;
-    static uint8_t chipaddr;
-    static uint32_t txd;
+    // per bus; 'i2c' and 'i2c2' keep their own target
+    static uint32_t __replicates[ 2 ];
+    static uint8_t __chipaddr[ 2 ];
+    static uint32_t __txd[ 2 ];
+    auto& replicates = __replicates[ id ];
+    auto& chipaddr = __chipaddr[ id ];
+    auto& txd = __txd[ id ];
     
     std::array< uint8_t, 32 > rxdata = { 0 };
     std::array< uint8_t, 8 > txdata = { 0x71, 0 };
@@ -88,6 +476,7 @@ i2c_command( size_t argc, const char ** argv )
         replicates = 1;
     
     bool use_dma( true );
+    bool use_irq( false );
 
     constexpr static std::pair< const char *, size_t > rcmds [] = {
         { "r", 1 }, {"rb", 1 }, {"r2", 2 }, {"r3", 3 }, {"r4", 4}, {"--read", 0 }
@@ -119,9 +508,17 @@ i2c_command( size_t argc, const char ** argv )
             "i2c --addr <chip-addr>  // i2c chip address\n"
             "i2c <hex value> [w|w2|w3|w4]   // write <hex value> as byte|2,3 or 4 bytes words\n"
             "i2c r[2|3|4]   // read n-word data from i2c device\n"
+            "i2c irq r[2|3|4]|w[2..5]   // interrupt driven transaction\n"
             "i2c --read <numbuer>   // read number-byte adrray data i2c device\n"
+            "i2c --speed <kHz> [16/9]   // SCL clock; Fm above 100kHz, optional 16/9 duty\n"
+            "i2c bench [N]   // read throughput in Sm 100kHz, Fm 400kHz and Fm 400kHz 16/9 duty\n"
+            "i2c <reg> dual [N]   // read 6 bytes from <reg> on both buses at once (i2c --addr, i2c2 --addr)\n"
             "i2c probe\n"
+            "i2c --slave [addr]   // I2C2 becomes a sensor hub register file at addr (20)\n"
+            "i2c hub   // read the hub register file through I2C1 (wire I2C1 to I2C2); i2c2 hub prints it locally\n"
             "i2c reset\n"
+            "i2c recover   // clock out a stuck slave (9 SCL pulses) and reinitialize\n"
+            "i2c sched [clear]   // per-device latency through the bus scheduler\n"
             "i2c status\n"
                  << std::endl;
         i2c_string::print_registers( stream(), i2cx.base_addr() );
@@ -131,18 +528,39 @@ i2c_command( size_t argc, const char ** argv )
         ++argv;
         if ( strcmp( argv[0], "status" ) == 0 ) {
             i2cx.print_status( stream() );
+            auto errors = i2cx.error_counters();
+            stream() << "\tnack: " << int( errors.nack ) << ", arbitration lost: " << int( errors.arbitration_lost )
+                     << ", bus error: " << int( errors.bus_error ) << ", timeout: " << int( errors.timeout )
+                     << ", recovery: " << int( errors.recovery ) << std::endl;
+        } else if ( strcmp( argv[0], "recover" ) == 0 ) {
+            stream() << "i2c recover: " << ( i2cx.recover() ? "bus released" : "SDA/SCL still low" ) << std::endl;
+        } else if ( strcmp( argv[0], "sched" ) == 0 ) {
+            bool clear = argc > 1 && strcmp( argv[1], "clear" ) == 0;
+            if ( clear ) {
+                --argc; ++argv;
+            }
+            i2c_scheduler_print( i2cx, clear );
         } else if ( strcmp( argv[0], "reset" ) == 0 ) {
             i2cx.reset();
         } else if ( strcmp( argv[0], "probe" ) == 0 ) {
-            i2c_probe( id );
+            i2c_probe( id == 0, id == 1 );
         } else if ( strcmp( argv[0], "--slave" ) == 0 ) {
-            stm32f103::i2c_t< stm32f103::I2C2_BASE >::instance()->listen( 0x20 ); // make it 'slave'
+            uint8_t own_addr = 0x20;
+            if ( argc > 1 && std::isxdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                own_addr = strtox( argv[0] );
+            }
+            i2c_hub_listen( own_addr ); // make I2C2 'slave'
+        } else if ( strcmp( argv[0], "hub" ) == 0 ) {
+            i2c_hub_print( id );
         } else if ( std::isdigit( *argv[0] ) ) {
             txd = strtox( argv[0] );
         } else if ( strcmp( argv[0], "dma" ) == 0 ) {
             use_dma = true;
         } else if ( strcmp( argv[0], "-dma" ) == 0 ) {
             use_dma = false;
+        } else if ( strcmp( argv[0], "irq" ) == 0 ) {
+            use_irq = true;
         } else if ( std::find_if( rcmds, rcmds_end, [&](auto& a){ return strcmp( argv[0], a.first ) == 0; } ) != rcmds_end ) {
             auto it = std::find_if( rcmds, rcmds_end, [&](auto& a){ return strcmp( argv[0], a.first ) == 0; } );
             size_t read_counts = it->second;
@@ -153,15 +571,22 @@ i2c_command( size_t argc, const char ** argv )
             read_counts = read_counts == 0 ? 1 : (read_counts < rxdata.size() ? read_counts : rxdata.size() );
             
             rxdata = { 0 };
-            if ( use_dma ) {
-                if ( stm32f103::i2c_t< stm32f103::I2C1_BASE >::instance()->dma_receive(chipaddr, rxdata.data(), read_counts ) ) {
-                    rx_print( stream(__FILE__,__LINE__), read_counts, stm32f103::i2c_t< stm32f103::I2C1_BASE >::instance()->status() );
+            if ( use_irq ) {
+                stm32f103::i2c_transaction t( chipaddr, nullptr, 0, rxdata.data(), read_counts );
+                if ( i2cx.transact( t ) ) {
+                    rx_print( stream(__FILE__,__LINE__), read_counts, 0 );
+                } else {
+                    i2cx.print_result( stream(__FILE__,__LINE__) ) << "\tirq read from " << chipaddr << " failed.\n";
+                }
+            } else if ( use_dma ) {
+                if ( i2cx.dma_receive( chipaddr, rxdata.data(), read_counts ) ) {
+                    rx_print( stream(__FILE__,__LINE__), read_counts, i2cx.status() );
                 } else {
-                    stream(__FILE__,__LINE__) << "i2c -- dma read failed. addr=" << chipaddr << std::endl;
+                    i2cx.print_result( stream(__FILE__,__LINE__) ) << "\tdma read from " << chipaddr << " failed.\n";
                 }
             } else {
                 if ( i2cx.read( chipaddr, rxdata.data(), read_counts ) ) {
-                    rx_print( stream(__FILE__,__LINE__), read_counts, stm32f103::i2c_t< stm32f103::I2C1_BASE >::instance()->status() );
+                    rx_print( stream(__FILE__,__LINE__), read_counts, i2cx.status() );
                 } else {
                     stream(__FILE__,__LINE__) << "i2c -- polling read failed. addr=" << chipaddr << std::endl;
                 }
@@ -180,18 +605,27 @@ i2c_command( size_t argc, const char ** argv )
             
             tx_print( stream(__FILE__,__LINE__), write_counts );
 
-            if ( use_dma ) {
+            if ( use_irq ) {
+                for ( size_t i = 0; i < replicates; ++i ) {
+                    stm32f103::i2c_transaction t( chipaddr, txdata.data(), write_counts );
+                    if ( i2cx.transact( t ) ) {
+                        stream() << "\tOK(irq)\n";
+                    } else {
+                        i2cx.print_result( stream(__FILE__,__LINE__) ) << "\tirq transfer to " << chipaddr << " failed.\n";
+                        break;
+                    }
+                }
+            } else if ( use_dma ) {
                 for ( size_t i = 0; i < replicates; ++i ) {
-                    if ( stm32f103::i2c_t< stm32f103::I2C1_BASE >::instance()->dma_transfer(chipaddr, txdata.data(), write_counts ) ) {
-                        if ( auto st = stm32f103::i2c_t< stm32f103::I2C1_BASE >::instance()->status() ) {
+                    if ( i2cx.dma_transfer( chipaddr, txdata.data(), write_counts ) ) {
+                        if ( auto st = i2cx.status() ) {
                             i2c_string::status32( stream(), st, i2cx.base_addr() );
                             break;
                         } else {
                             stream() << "\tOK(dma)\n";
                         }
                     } else {
-                        stm32f103::i2c_t< stm32f103::I2C1_BASE >::instance()->print_result( stream(__FILE__,__LINE__) )
-                            << "\tdma transfer to " << chipaddr << " failed.\n";
+                        i2cx.print_result( stream(__FILE__,__LINE__) ) << "\tdma transfer to " << chipaddr << " failed.\n";
                     }
                 }
             } else {
@@ -210,6 +644,39 @@ i2c_command( size_t argc, const char ** argv )
                 --argc; ++argv;
             }
             stream() << "i2c replicates: " << replicates << std::endl;            
+        } else if ( strcmp( argv[0], "--speed" ) == 0 ) {
+            if ( argc > 1 && std::isdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                uint32_t speed = strtod( argv[ 0 ] ) * 1000;
+                I2C_SPEED_MODE mode = speed > 100'000 ? I2C_FAST_MODE : I2C_STANDARD_MODE; //';
+                if ( argc > 1 && strcmp( argv[1], "16/9" ) == 0 ) {
+                    --argc; ++argv;
+                    mode = I2C_FAST_MODE_DUTY16_9;
+                }
+                if ( !i2cx.set_speed( speed, mode ) )
+                    stream() << "i2c speed " << int( speed ) << "Hz not accepted (range, or bus busy)" << std::endl;
+            }
+            stream() << "i2c SCL " << int( i2cx.speed() ) << "Hz"
+                     << ( i2cx.speed_mode() == I2C_STANDARD_MODE ? " Sm" : i2cx.speed_mode() == I2C_FAST_MODE ? " Fm" : " Fm 16/9" )
+                     << ", CCR " << i2cx.base_addr()->CCR << ", TRISE " << i2cx.base_addr()->TRISE << std::endl;
+        } else if ( strcmp( argv[0], "bench" ) == 0 ) {
+            size_t count = 100;
+            if ( argc > 1 && std::isdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                count = strtod( argv[ 0 ] );
+            }
+            i2c_bench( i2cx, chipaddr, count );
+        } else if ( strcmp( argv[0], "dual" ) == 0 ) {
+            size_t count = 100;
+            if ( argc > 1 && std::isdigit( *argv[1] ) ) {
+                --argc; ++argv;
+                count = strtod( argv[ 0 ] );
+            }
+            for ( int i = 0; i < 2; ++i ) {
+                if ( __chipaddr[ i ] == 0 )
+                    __chipaddr[ i ] = 0x10;
+            }
+            i2c_dual( __chipaddr, uint8_t( txd ), 6, count );
         } else if ( strcmp( argv[0], "--addr" ) == 0 ) {
             if ( argc && std::isdigit( *argv[1] ) ) {
                 chipaddr = strtox( argv[ 1 ] );
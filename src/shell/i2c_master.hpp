@@ -0,0 +1,430 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "i2c.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Interrupt (and optionally DMA) driven I2C master, RM0008 26.3.3 and AN2824.
+// Transactions are queued and run back-to-back from the event/error interrupts; a transaction
+// is a write phase, a read phase, or a write phase followed by a read phase on repeated START.
+// A transaction with neither phase is an address-only probe (quick write, START/address/STOP);
+// a NACK on it just means nobody is at that address, and is not counted as an error.
+// The register block is a template parameter, so that the state machine can run on host
+// against a scripted register model; on target it is 'volatile I2C'.
+// CR1 must not be written while a STOP is pending (RM0008 26.6.1), and a master STOP raises no event;
+// finish() polls CR1.STOP for up to stop_poll reads when another transaction is queued, so that its START
+// follows the STOP at once.  A STOP still pending after that leaves the next transaction in st_stop_wait
+// until resume() (i2c::poll, SysTick) or the next event finds the STOP on the bus.
+
+namespace stm32f103 {
+
+    struct i2c_transaction {
+        uint8_t address;                              // 7bit
+        const uint8_t * tx;
+        size_t tx_size;
+        uint8_t * rx;
+        size_t rx_size;
+        void (*completion)( i2c_transaction& );       // called from ISR, before 'done' is set
+        void * context;
+        uint32_t timeout_us;                          // from START to completion; 0 := derived from length and SCL
+        uint32_t elapsed;                             // clock ticks from START to completion
+        I2C_RESULT_CODE result;
+        std::atomic< bool > done;
+
+        constexpr i2c_transaction( uint8_t _address = 0
+                                   , const uint8_t * _tx = nullptr, size_t _tx_size = 0
+                                   , uint8_t * _rx = nullptr, size_t _rx_size = 0
+                                   , void (*_completion)( i2c_transaction& ) = nullptr, void * _context = nullptr )
+            : address( _address ), tx( _tx ), tx_size( _tx_size ), rx( _rx ), rx_size( _rx_size )
+            , completion( _completion ), context( _context ), timeout_us( 0 ), elapsed( 0 ), result( I2C_RESULT_SUCCESS ), done( false ) {
+        }
+    };
+
+    template< typename REGS >
+    class i2c_master {
+    public:
+        static constexpr size_t queue_depth = 8;  // power of 2
+        static constexpr size_t stop_poll = 64;   // CR1 reads for a pending STOP, ~100 ns each on APB1; ~6 us
+
+        // optional DMA for data phases; transmit/receive return false if no channel is available, and
+        // dma_complete() must be called from the DMA ISR when the channel is done
+        struct dma_port {
+            bool (*transmit)( const uint8_t *, size_t );
+            bool (*receive)( uint8_t *, size_t );
+            void (*abort)();
+        };
+
+        // RM0008 26.6
+        enum : uint32_t {
+            CR1_PE          = 1
+            , CR1_START     = 1 << 8
+            , CR1_STOP      = 1 << 9
+            , CR1_ACK       = 1 << 10
+            , CR1_POS       = 1 << 11
+            , CR2_ITERREN   = 1 << 8
+            , CR2_ITEVTEN   = 1 << 9
+            , CR2_ITBUFEN   = 1 << 10
+            , CR2_DMAEN     = 1 << 11
+            , CR2_LAST      = 1 << 12
+            , SR1_SB        = 1
+            , SR1_ADDR      = 1 << 1
+            , SR1_BTF       = 1 << 2
+            , SR1_RxNE      = 1 << 6
+            , SR1_TxE       = 1 << 7
+            , SR1_BERR      = 1 << 8
+            , SR1_ARLO      = 1 << 9
+            , SR1_AF        = 1 << 10
+            , SR1_OVR       = 1 << 11
+            , SR1_TIMEOUT   = 1 << 14
+            , SR1_ERRORS    = SR1_BERR | SR1_ARLO | SR1_AF | SR1_OVR | SR1_TIMEOUT
+        };
+
+        struct error_counts {
+            uint32_t nack;
+            uint32_t arbitration_lost;
+            uint32_t bus_error;
+            uint32_t timeout;
+        };
+
+        enum state_type {
+            st_idle
+            , st_stop_wait // previous STOP still pending, START deferred
+            , st_start     // START requested, waiting SB
+            , st_address   // address sent, waiting ADDR
+            , st_transmit  // data phase (TxE by irq, or DMA) then BTF
+            , st_receive   // data phase (RxNE/BTF by irq, or DMA)
+        };
+
+    private:
+        REGS * _;
+        const dma_port * dma_;
+        std::array< i2c_transaction *, queue_depth > queue_;
+        std::atomic< uint32_t > head_;
+        std::atomic< uint32_t > tail_;
+        std::atomic< bool > busy_;
+        state_type state_;
+        bool receiving_;     // current phase
+        bool dma_active_;
+        bool dma_done_;
+        size_t index_;       // bytes done in current phase
+        uint32_t completed_;
+        uint32_t failed_;
+        error_counts errors_;
+        uint32_t (*clock_)();   // free running tick counter for deadlines (DWT CYCCNT on target)
+        uint32_t ticks_per_us_;
+        uint32_t started_;      // clock at START of the running transaction
+
+        inline i2c_transaction& current() { return *queue_[ head_.load() % queue_depth ]; }
+        inline size_t phase_size() { return receiving_ ? current().rx_size : current().tx_size; }
+
+        void kick() {
+            while ( head_.load() != tail_.load() ) {
+                bool expected = false;
+                if ( !busy_.compare_exchange_strong( expected, true ) )
+                    return;
+                if ( head_.load() != tail_.load() ) {
+                    begin();
+                    return;
+                }
+                busy_ = false;
+            }
+        }
+
+        void begin() {
+            auto& t = current();
+            receiving_ = ( t.tx_size == 0 && t.rx_size != 0 );
+            started_ = clock_ ? clock_() : 0;
+            if ( _->CR1 & CR1_STOP ) {
+                state_ = st_stop_wait;          // ~ half SCL period; no busy wait in the ISR
+                return;
+            }
+            _->CR1 |= CR1_PE | CR1_ACK;
+            _->CR2 |= CR2_ITEVTEN | CR2_ITERREN;
+            start_phase();
+        }
+
+        void start_phase() {
+            index_ = 0;
+            dma_active_ = dma_done_ = false;
+            state_ = st_start;
+            _->CR1 |= CR1_START;
+        }
+
+        void on_address() {
+            auto& t = current();
+            const size_t n = phase_size();
+
+            if ( !receiving_ && n == 0 ) {       // probe, slave has ACKed its address
+                clear_addr();
+                _->CR1 |= CR1_STOP;
+                finish( I2C_RESULT_SUCCESS );
+                return;
+            }
+
+            if ( !receiving_ ) {
+                dma_active_ = n > 1 && dma_ && dma_->transmit && dma_->transmit( t.tx, n );
+                if ( dma_active_ )
+                    _->CR2 |= CR2_DMAEN;
+                clear_addr();
+                state_ = st_transmit;
+                if ( !dma_active_ ) {
+                    _->DR = t.tx[ index_++ ];
+                    if ( index_ < n )
+                        _->CR2 |= CR2_ITBUFEN;
+                }
+                return;
+            }
+
+            state_ = st_receive;
+            dma_active_ = n >= 2 && dma_ && dma_->receive && dma_->receive( t.rx, n );
+            if ( dma_active_ ) {
+                _->CR1 |= CR1_ACK;
+                _->CR2 |= CR2_DMAEN | CR2_LAST;  // NACK on last byte
+                clear_addr();
+            } else if ( n == 1 ) {
+                _->CR1 &= ~CR1_ACK;
+                clear_addr();
+                _->CR1 |= CR1_STOP;
+                _->CR2 |= CR2_ITBUFEN;
+            } else if ( n == 2 ) {
+                _->CR1 &= ~CR1_ACK;
+                _->CR1 |= CR1_POS;              // NACK applies to the 2nd byte
+                clear_addr();                    // then BTF
+            } else {
+                _->CR1 |= CR1_ACK;
+                clear_addr();
+                if ( n > 3 )
+                    _->CR2 |= CR2_ITBUFEN;       // RxNE until 3 bytes left, then BTF
+            }
+        }
+
+        inline void clear_addr() {
+            uint32_t sr2 = _->SR2; // SR1 has been read by the caller
+            (void)sr2;
+        }
+
+        void on_transmit( uint32_t sr1 ) {
+            auto& t = current();
+            const size_t n = t.tx_size;
+            if ( !dma_active_ && ( sr1 & SR1_TxE ) && index_ < n ) {
+                _->DR = t.tx[ index_++ ];
+                if ( index_ == n )
+                    _->CR2 &= ~CR2_ITBUFEN;      // wait BTF
+                return;
+            }
+            if ( ( sr1 & SR1_BTF ) && ( dma_active_ ? dma_done_ : index_ == n ) ) {
+                _->CR2 &= ~CR2_DMAEN;
+                if ( t.rx_size ) {               // repeated START for the read phase
+                    receiving_ = true;
+                    start_phase();
+                } else {
+                    _->CR1 |= CR1_STOP;
+                    finish( I2C_RESULT_SUCCESS );
+                }
+            }
+        }
+
+        void on_receive( uint32_t sr1 ) {
+            if ( dma_active_ )
+                return;                          // see dma_complete
+            auto& t = current();
+            const size_t n = t.rx_size;
+            size_t remain = n - index_;
+
+            if ( remain == 1 ) {
+                if ( sr1 & SR1_RxNE ) {
+                    t.rx[ index_++ ] = uint8_t( _->DR );
+                    finish( I2C_RESULT_SUCCESS );
+                }
+            } else if ( remain == 2 ) {
+                if ( sr1 & SR1_BTF ) {           // N-1 in DR, N in shift register
+                    _->CR1 |= CR1_STOP;
+                    t.rx[ index_++ ] = uint8_t( _->DR );
+                    t.rx[ index_++ ] = uint8_t( _->DR );
+                    finish( I2C_RESULT_SUCCESS );
+                }
+            } else if ( remain == 3 ) {
+                if ( sr1 & SR1_BTF ) {           // N-2 in DR, N-1 in shift register
+                    _->CR1 &= ~CR1_ACK;
+                    t.rx[ index_++ ] = uint8_t( _->DR );
+                }
+            } else if ( sr1 & SR1_RxNE ) {
+                t.rx[ index_++ ] = uint8_t( _->DR );
+                if ( n - index_ == 3 )
+                    _->CR2 &= ~CR2_ITBUFEN;
+            }
+        }
+
+        void finish( I2C_RESULT_CODE result ) {
+            _->CR2 &= ~( CR2_ITEVTEN | CR2_ITERREN | CR2_ITBUFEN | CR2_DMAEN | CR2_LAST );
+            _->CR1 &= ~CR1_POS;
+            _->CR1 |= CR1_ACK;
+
+            auto& t = current();
+            t.result = result;
+            t.elapsed = clock_ ? clock_() - started_ : 0;
+            if ( result == I2C_TRANSACTION_NACK && t.tx_size == 0 && t.rx_size == 0 )
+                result = I2C_RESULT_SUCCESS;     // probe of an empty address
+            switch ( result ) {
+            case I2C_RESULT_SUCCESS: ++completed_; break;
+            case I2C_TRANSACTION_NACK: ++errors_.nack; break;
+            case I2C_TRANSACTION_ARBITRATION_LOST: ++errors_.arbitration_lost; break;
+            case I2C_TRANSACTION_BUS_ERROR: ++errors_.bus_error; break;
+            case I2C_TRANSACTION_TIMEOUT: ++errors_.timeout; break;
+            default: break;
+            }
+            if ( result != I2C_RESULT_SUCCESS )
+                ++failed_;
+
+            state_ = st_idle;
+            head_ = head_.load() + 1;
+            if ( head_.load() != tail_.load() ) {  // half SCL period for the STOP to go out, bounded
+                for ( size_t i = 0; i < stop_poll && ( _->CR1 & CR1_STOP ); ++i )
+                    ;
+            }
+            busy_ = false;
+            kick();                              // next transaction goes first, then notify
+            if ( t.completion )
+                t.completion( t );
+            t.done = true;
+        }
+
+    public:
+        constexpr i2c_master() : _( nullptr ), dma_( nullptr ), queue_{}, head_( 0 ), tail_( 0 ), busy_( false )
+                               , state_( st_idle ), receiving_( false ), dma_active_( false ), dma_done_( false )
+                               , index_( 0 ), completed_( 0 ), failed_( 0 ), errors_{ 0, 0, 0, 0 }
+                               , clock_( nullptr ), ticks_per_us_( 0 ), started_( 0 ) {
+        }
+
+        void init( REGS * regs ) { _ = regs; }
+        void set_dma( const dma_port * port ) { dma_ = port; }
+        void set_clock( uint32_t (*clock)(), uint32_t ticks_per_us ) { clock_ = clock; ticks_per_us_ = ticks_per_us; }
+
+        state_type state() const { return state_; }
+        bool busy() const { return busy_.load(); }
+        size_t pending() const { return tail_.load() - head_.load(); }
+        uint32_t completed() const { return completed_; }
+        uint32_t failed() const { return failed_; }
+        const error_counts& errors() const { return errors_; }
+
+        // the running transaction has passed its deadline; call with the bus irqs masked, then abort()
+        bool expired() const {
+            if ( state_ == st_idle || clock_ == nullptr || queue_[ head_.load() % queue_depth ]->timeout_us == 0 )
+                return false;
+            return clock_() - started_ >= queue_[ head_.load() % queue_depth ]->timeout_us * ticks_per_us_;
+        }
+
+        // 't' must stay alive until t.done; returns false if the queue is full
+        bool submit( i2c_transaction& t ) {
+            if ( _ == nullptr )
+                return false;
+            if ( ( t.tx_size && t.tx == nullptr ) || ( t.rx_size && t.rx == nullptr ) )
+                return false;
+            uint32_t tail = tail_.load();
+            if ( tail - head_.load() >= queue_depth )
+                return false;
+            t.done = false;
+            t.result = I2C_RESULT_SUCCESS;
+            queue_[ tail % queue_depth ] = &t;
+            tail_ = tail + 1;
+            kick();
+            return true;
+        }
+
+        // starts a transaction deferred by a pending STOP; call with the bus irqs masked
+        void resume() {
+            if ( state_ == st_stop_wait && !( _->CR1 & CR1_STOP ) )
+                begin();
+        }
+
+        // event interrupt
+        void handle_event() {
+            if ( state_ == st_idle )
+                return;
+            uint32_t sr1 = _->SR1;
+            switch ( state_ ) {
+            case st_stop_wait:
+                resume();
+                break;
+            case st_start:
+                if ( sr1 & SR1_SB ) {
+                    _->DR = ( current().address << 1 ) | ( receiving_ ? 1 : 0 );
+                    state_ = st_address;
+                }
+                break;
+            case st_address:
+                if ( sr1 & SR1_ADDR )
+                    on_address();
+                break;
+            case st_transmit:
+                on_transmit( sr1 );
+                break;
+            case st_receive:
+                on_receive( sr1 );
+                break;
+            default:
+                break;
+            }
+        }
+
+        // error interrupt; returns the error bits found
+        uint32_t handle_error() {
+            uint32_t sr1 = _->SR1 & SR1_ERRORS;
+            _->SR1 &= ~sr1; // rc_w0
+            if ( state_ == st_idle || sr1 == 0 )
+                return sr1;
+
+            if ( dma_active_ && dma_ && dma_->abort )
+                dma_->abort();
+
+            I2C_RESULT_CODE result = I2C_TRANSACTION_BUS_ERROR;
+            if ( sr1 & SR1_AF ) {
+                result = I2C_TRANSACTION_NACK;
+                _->CR1 |= CR1_STOP;
+            } else if ( sr1 & SR1_ARLO ) {
+                result = I2C_TRANSACTION_ARBITRATION_LOST; // no longer master, no STOP
+            } else {
+                _->CR1 |= CR1_STOP;
+            }
+            finish( result );
+            return sr1;
+        }
+
+        // gives up the running transaction (e.g. a slave holding SCL low); call with the bus irqs masked
+        void abort( I2C_RESULT_CODE result = I2C_TRANSACTION_TIMEOUT ) {
+            if ( state_ == st_idle )
+                return;
+            if ( dma_active_ && dma_ && dma_->abort )
+                dma_->abort();
+            if ( state_ != st_stop_wait )       // nothing started on the bus yet
+                _->CR1 |= CR1_STOP;
+            finish( result );
+        }
+
+        // DMA transfer complete (or transfer error) of the running data phase
+        void dma_complete( bool error = false ) {
+            if ( !dma_active_ )
+                return;
+            if ( error ) {
+                _->CR1 |= CR1_STOP;
+                finish( I2C_TRANSACTION_BUS_ERROR );
+            } else if ( state_ == st_transmit ) {
+                dma_done_ = true;                // then BTF
+            } else if ( state_ == st_receive ) {
+                dma_done_ = true;
+                _->CR1 |= CR1_STOP;
+                index_ = current().rx_size;
+                finish( I2C_RESULT_SUCCESS );
+            }
+        }
+    };
+
+}
@@ -0,0 +1,277 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// Register cache for I2C device drivers.
+// Cached registers are read from the bus once, then served from memory.  A write goes to memory and marks the
+// register dirty (a write of the value already held is dropped), and commit() sends the dirty registers in as
+// few transactions as the device allows.  Volatile registers are read from the bus every time.
+// The device is described by a MAP class:
+//   value_type                  register width; MSB first on the bus
+//   first, size                 register address range covered
+//   kind( reg )                 I2C_REGISTER_VOLATILE or I2C_REGISTER_CACHED
+//   read_pointer( reg )         pointer byte that reads 'reg' on repeated START
+//   write_pointer( reg )        pointer byte that writes 'reg'
+//   burst_read                  the pointer auto-increments on read, so that adjacent registers come in one read
+//   write_mode                  how dirty registers are packed into a write (I2C_REGMAP_WRITE)
+// IO is the driver, with bool read( uint8_t pointer, uint8_t *, size_t ) and bool write( const uint8_t *, size_t ),
+// as AD5593 and BMP280 have.  Not reentrant; the driver serializes access.
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace stm32f103 {
+
+    enum I2C_REGISTER_KIND : uint8_t {
+        I2C_REGISTER_VOLATILE        // changed by the device (status, data), reserved or write-only; never cached
+        , I2C_REGISTER_CACHED        // changed only by writes (configuration), or never (calibration, id)
+    };
+
+    enum I2C_REGMAP_WRITE : uint8_t {
+        I2C_REGMAP_WRITE_SINGLE      // pointer, value; one register per transaction
+        , I2C_REGMAP_WRITE_PAIRS     // pointer, value, pointer, value...; any registers in one transaction
+        , I2C_REGMAP_WRITE_INCREMENT // pointer, value, value...; adjacent registers in one transaction
+    };
+
+    struct i2c_regmap_statistics {
+        uint32_t hits;            // registers served from the cache
+        uint32_t misses;          // registers read from the bus
+        uint32_t reads;           // read transactions
+        uint32_t writes;          // write transactions
+        uint32_t written;         // registers written
+        uint32_t suppressed;      // writes of the value already held
+    };
+
+    template< typename MAP >
+    class i2c_regmap {
+    public:
+        typedef typename MAP::value_type value_type;
+        static constexpr size_t size = MAP::size;
+        static constexpr size_t width = sizeof( value_type );
+        static constexpr size_t max_transfer = 32;     // data bytes per transaction
+        static_assert( size > 0 && size_t( MAP::first ) + size <= 256, "register range must fit the pointer byte" );
+        static_assert( width <= 4 && 1 + width <= max_transfer, "register width" );
+
+    private:
+        std::array< value_type, size > values_;
+        std::array< uint8_t, ( size + 7 ) / 8 > valid_;
+        std::array< uint8_t, ( size + 7 ) / 8 > dirty_;
+        i2c_regmap_statistics stat_;
+
+        typedef std::array< uint8_t, ( size + 7 ) / 8 > bitmap_type;
+
+        static inline bool test( const bitmap_type& bits, size_t i ) { return bits[ i / 8 ] & ( 1 << ( i % 8 ) ); }
+        static inline void set( bitmap_type& bits, size_t i ) { bits[ i / 8 ] |= 1 << ( i % 8 ); }
+        static inline void clear( bitmap_type& bits, size_t i ) { bits[ i / 8 ] &= ~( 1 << ( i % 8 ) ); }
+
+        static inline size_t index( uint8_t reg ) { return size_t( reg - MAP::first ); }
+
+        static inline bool cached( uint8_t reg ) {
+            return reg >= MAP::first && index( reg ) < size && MAP::kind( reg ) == I2C_REGISTER_CACHED;
+        }
+
+        // has to come from the bus
+        inline bool stale( uint8_t reg ) const {
+            return !cached( reg ) || !test( valid_, index( reg ) );
+        }
+
+        inline bool is_dirty( uint8_t reg ) const {
+            return cached( reg ) && test( dirty_, index( reg ) );
+        }
+
+        static value_type decode( const uint8_t * p ) {
+            uint32_t v = 0;
+            for ( size_t i = 0; i < width; ++i )
+                v = v << 8 | p[ i ];
+            return value_type( v );
+        }
+
+        static uint8_t * encode( value_type value, uint8_t * p ) {
+            uint32_t v = value;
+            for ( size_t i = width; i--; v >>= 8 )
+                p[ i ] = uint8_t( v );
+            return p + width;
+        }
+
+        // a value from the bus; a dirty one in the cache is newer than the device's
+        void store( uint8_t reg, value_type v ) {
+            if ( !cached( reg ) || test( dirty_, index( reg ) ) )
+                return;
+            values_[ index( reg ) ] = v;
+            set( valid_, index( reg ) );
+        }
+
+        template< typename IO > bool send( IO& io, const uint8_t * data, size_t size, uint8_t from, uint8_t to ) {
+            if ( !io.write( data, size ) )
+                return false;                               // left dirty, for the next commit
+            ++stat_.writes;
+            for ( size_t reg = from; reg <= to; ++reg ) {
+                if ( is_dirty( uint8_t( reg ) ) ) {
+                    clear( dirty_, index( uint8_t( reg ) ) );
+                    ++stat_.written;
+                }
+            }
+            return true;
+        }
+
+    public:
+        constexpr i2c_regmap() : values_{}, valid_{}, dirty_{}, stat_{ 0, 0, 0, 0, 0, 0 } {
+        }
+
+        // registers 'reg'..'reg + count - 1'; cached ones that are held are not read again, adjacent ones
+        // that are not come in one transaction if the device allows
+        template< typename IO > bool read( IO& io, uint8_t reg, value_type * values, size_t count ) {
+            size_t i = 0;
+            while ( i < count ) {
+                const uint8_t r = uint8_t( reg + i );
+                if ( !stale( r ) ) {
+                    values[ i++ ] = values_[ index( r ) ];
+                    ++stat_.hits;
+                    continue;
+                }
+                // up to the last stale one within a transaction; held ones on the way are read along
+                size_t n = 1;
+                if ( MAP::burst_read ) {
+                    for ( size_t j = 1; i + j < count && ( j + 1 ) * width <= max_transfer; ++j ) {
+                        if ( stale( uint8_t( r + j ) ) )
+                            n = j + 1;
+                    }
+                }
+                std::array< uint8_t, max_transfer > data;
+                if ( !io.read( MAP::read_pointer( r ), data.data(), n * width ) )
+                    return false;
+                ++stat_.reads;
+                for ( size_t j = 0; j < n; ++j ) {
+                    const uint8_t x = uint8_t( r + j );
+                    const value_type v = decode( data.data() + j * width );
+                    store( x, v );
+                    values[ i + j ] = stale( x ) ? v : values_[ index( x ) ];
+                    ++stat_.misses;
+                }
+                i += n;
+            }
+            return true;
+        }
+
+        template< typename IO > bool read( IO& io, uint8_t reg, value_type& value ) {
+            return read( io, reg, &value, 1 );
+        }
+
+        // cached registers only; the bus is not touched until commit()
+        bool write( uint8_t reg, value_type value ) {
+            if ( !cached( reg ) )
+                return false;
+            const size_t i = index( reg );
+            if ( test( valid_, i ) && values_[ i ] == value ) {
+                ++stat_.suppressed;
+                return true;
+            }
+            values_[ i ] = value;
+            set( valid_, i );
+            set( dirty_, i );
+            return true;
+        }
+
+        // dirty registers in 'reg'..'reg + count - 1' to the device
+        template< typename IO > bool commit( IO& io, uint8_t reg = MAP::first, size_t count = size ) {
+            std::array< uint8_t, 1 + max_transfer > data;
+            uint8_t * p = data.data();
+            uint8_t from = 0;
+            if ( count == 0 )
+                return true;
+            const size_t last = size_t( reg ) + count - 1;
+
+            for ( size_t x = reg; x <= last; ++x ) {
+                const uint8_t r = uint8_t( x );
+                if ( !is_dirty( r ) )
+                    continue;
+
+                switch ( MAP::write_mode ) {
+                case I2C_REGMAP_WRITE_SINGLE:
+                    data[ 0 ] = MAP::write_pointer( r );
+                    if ( !send( io, data.data(), size_t( encode( values_[ index( r ) ], data.data() + 1 ) - data.data() ), r, r ) )
+                        return false;
+                    break;
+
+                case I2C_REGMAP_WRITE_PAIRS:
+                    if ( p == data.data() )
+                        from = r;
+                    *p++ = MAP::write_pointer( r );
+                    p = encode( values_[ index( r ) ], p );
+                    if ( p + 1 + width > data.data() + data.size() ) {
+                        if ( !send( io, data.data(), size_t( p - data.data() ), from, r ) )
+                            return false;
+                        p = data.data();
+                    }
+                    break;
+
+                case I2C_REGMAP_WRITE_INCREMENT: {
+                    // a run of dirty registers; a single held one between two dirty ones is written again, as that
+                    // costs less than the address, pointer and STOP of another transaction
+                    size_t y = x;
+                    p = data.data();
+                    *p++ = MAP::write_pointer( r );
+                    p = encode( values_[ index( r ) ], p );
+                    while ( y < last ) {
+                        const size_t room = size_t( data.data() + data.size() - p );
+                        if ( is_dirty( uint8_t( y + 1 ) ) && room >= width ) {
+                            p = encode( values_[ index( uint8_t( y + 1 ) ) ], p );
+                            y += 1;
+                        } else if ( width <= 2 && y + 2 <= last && !stale( uint8_t( y + 1 ) )
+                                    && is_dirty( uint8_t( y + 2 ) ) && room >= 2 * width ) {
+                            p = encode( values_[ index( uint8_t( y + 1 ) ) ], p );
+                            p = encode( values_[ index( uint8_t( y + 2 ) ) ], p );
+                            y += 2;
+                        } else {
+                            break;
+                        }
+                    }
+                    if ( !send( io, data.data(), size_t( p - data.data() ), r, uint8_t( y ) ) )
+                        return false;
+                    x = y;
+                    p = data.data();
+                    break;
+                }
+                }
+            }
+            if ( p != data.data() )
+                return send( io, data.data(), size_t( p - data.data() ), from, uint8_t( last ) );
+            return true;
+        }
+
+        // a value the driver read by itself; ignored for volatile and dirty registers
+        void fill( uint8_t reg, value_type value ) {
+            store( reg, value );
+            ++stat_.misses;
+        }
+
+        // the register is held, so that read() will not touch the bus
+        inline bool valid( uint8_t reg ) const { return !stale( reg ); }
+
+        // value held; 0 if not
+        inline value_type value( uint8_t reg ) const { return stale( reg ) ? value_type( 0 ) : values_[ index( reg ) ]; }
+
+        bool dirty() const {
+            for ( auto bits: dirty_ )
+                if ( bits )
+                    return true;
+            return false;
+        }
+
+        // the device was reset, or changed behind the cache; dirty values are lost
+        void invalidate() {
+            valid_ = {};
+            dirty_ = {};
+        }
+
+        const i2c_regmap_statistics& stat() const { return stat_; }
+        void clear_stat() { stat_ = i2c_regmap_statistics{}; }
+    };
+
+}
@@ -0,0 +1,348 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "i2c_master.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Shared bus scheduler on top of the transaction engine (i2c_master.hpp).
+// Device drivers submit requests with a priority and an optional deadline, from thread or interrupt context.
+// The scheduler hands the bus to one device at a time, as a batch of up to batch_limit of its requests that
+// run back-to-back in the engine queue, and picks the next batch when the previous one is done:
+//   - highest effective priority first; a request waiting longer than aging_us goes up one level per aging_us,
+//     so that a busy high priority device cannot starve the others
+//   - then earliest deadline, then a device other than the one that just had the bus, then oldest
+// A request still waiting at its deadline is completed with I2C_TRANSACTION_TIMEOUT without touching the bus.
+// The engine's completion (ISR) only queues the request; its statistics and completion callback are done by
+// the dispatcher, which runs in one context at a time, so that the statistics have a single writer.
+// BUS provides submit( i2c_transaction& ) and poll(), as stm32f103::i2c does.
+
+namespace stm32f103 {
+
+    enum I2C_PRIORITY : uint8_t {
+        I2C_PRIORITY_LOW
+        , I2C_PRIORITY_NORMAL
+        , I2C_PRIORITY_HIGH
+        , I2C_PRIORITY_REALTIME
+    };
+
+    struct i2c_request {
+        i2c_transaction transaction;                  // completion and context are used by the scheduler
+        uint8_t device;                               // id from register_device()
+        I2C_PRIORITY priority;
+        uint32_t deadline_us;                         // from submit to completion; 0 := none
+        void (*completion)( i2c_request& );           // called by the dispatcher (ISR or thread), before 'done' is set
+        void * context;
+        std::atomic< bool > done;
+
+        // scheduler private
+        void * scheduler_;
+        i2c_request * next_;
+        uint32_t submitted_;
+        uint32_t started_;
+        uint32_t finished_;
+
+        constexpr i2c_request( uint8_t _device = 0, I2C_PRIORITY _priority = I2C_PRIORITY_NORMAL
+                               , uint8_t address = 0
+                               , const uint8_t * tx = nullptr, size_t tx_size = 0
+                               , uint8_t * rx = nullptr, size_t rx_size = 0
+                               , uint32_t _deadline_us = 0
+                               , void (*_completion)( i2c_request& ) = nullptr, void * _context = nullptr )
+            : transaction( address, tx, tx_size, rx, rx_size ), device( _device ), priority( _priority )
+            , deadline_us( _deadline_us ), completion( _completion ), context( _context ), done( false )
+            , scheduler_( nullptr ), next_( nullptr ), submitted_( 0 ), started_( 0 ), finished_( 0 ) {
+        }
+
+        inline I2C_RESULT_CODE result() const { return transaction.result; }
+    };
+
+    struct i2c_device_statistics {
+        uint8_t address;
+        uint32_t requests;
+        uint32_t failed;
+        uint32_t deadline_missed;     // dropped at, or completed after, the deadline
+        uint32_t wait_max;            // clock ticks from submit to start
+        uint32_t latency_min;         // clock ticks from submit to completion
+        uint32_t latency_max;
+        uint64_t latency_sum;
+        uint32_t completed;           // latency samples
+    };
+
+    template< typename BUS >
+    class i2c_scheduler {
+    public:
+        static constexpr size_t max_devices = 8;
+        static constexpr size_t batch_limit = 4;        // requests of one device per turn
+        static constexpr uint32_t aging_us = 5'000;     //'
+
+    private:
+        BUS * bus_;
+        uint32_t (*clock_)();
+        uint32_t ticks_per_us_;
+        std::atomic< i2c_request * > incoming_;         // LIFO, pushed from any context
+        std::atomic< i2c_request * > completed_;        // LIFO, pushed from the engine's completion
+        i2c_request * ready_;                           // FIFO; dispatcher only
+        std::atomic< bool > dispatching_;
+        std::atomic< bool > again_;
+        std::atomic< bool > clear_;                     // clear_stat() requested
+        std::atomic< uint32_t > in_flight_;
+        uint32_t last_device_;
+        size_t devices_;
+        std::array< i2c_device_statistics, max_devices > stat_;
+
+        inline uint32_t now() const { return clock_ ? clock_() : 0; }
+
+        inline uint32_t effective_priority( const i2c_request& r, uint32_t t ) const {
+            uint32_t level = r.priority;
+            if ( ticks_per_us_ )
+                level += ( t - r.submitted_ ) / ( aging_us * ticks_per_us_ );
+            return level > I2C_PRIORITY_REALTIME ? uint32_t( I2C_PRIORITY_REALTIME ) : level;
+        }
+
+        inline bool expired( const i2c_request& r, uint32_t t ) const {
+            return r.deadline_us && ticks_per_us_ && ( t - r.submitted_ ) >= r.deadline_us * ticks_per_us_;
+        }
+
+        // ticks left to the deadline; no deadline sorts last
+        inline uint32_t slack( const i2c_request& r, uint32_t t ) const {
+            return r.deadline_us ? r.deadline_us * ticks_per_us_ - ( t - r.submitted_ ) : 0xffffffff;
+        }
+
+        // true if 'a' goes before 'b'
+        bool precedes( const i2c_request& a, const i2c_request& b, uint32_t t ) const {
+            uint32_t pa = effective_priority( a, t ), pb = effective_priority( b, t );
+            if ( pa != pb )
+                return pa > pb;
+            uint32_t sa = slack( a, t ), sb = slack( b, t );
+            if ( sa != sb )
+                return sa < sb;
+            bool la = a.device == last_device_, lb = b.device == last_device_;
+            if ( la != lb )
+                return lb;
+            return int32_t( a.submitted_ - b.submitted_ ) < 0;
+        }
+
+        static void push( std::atomic< i2c_request * >& list, i2c_request& r ) {
+            r.next_ = list.load();
+            while ( !list.compare_exchange_weak( r.next_, &r ) )
+                ;
+        }
+
+        // takes the whole list, in the order pushed
+        static i2c_request * take( std::atomic< i2c_request * >& list ) {
+            i2c_request * p = list.exchange( nullptr );
+            i2c_request * fifo = nullptr;
+            while ( p ) {
+                auto next = p->next_;
+                p->next_ = fifo;
+                fifo = p;
+                p = next;
+            }
+            return fifo;
+        }
+
+        void drain() {
+            i2c_request * fifo = take( incoming_ );
+            for ( auto r = fifo; r; r = r->next_ ) {
+                if ( r->device < devices_ )
+                    ++stat_[ r->device ].requests;
+            }
+            i2c_request ** tail = &ready_;
+            while ( *tail )
+                tail = &( *tail )->next_;
+            *tail = fifo;
+        }
+
+        void unlink( i2c_request * r ) {
+            for ( i2c_request ** p = &ready_; *p; p = &( *p )->next_ ) {
+                if ( *p == r ) {
+                    *p = r->next_;
+                    r->next_ = nullptr;
+                    return;
+                }
+            }
+        }
+
+        void complete( i2c_request& r, uint32_t t ) {
+            auto& s = stat_[ r.device < devices_ ? r.device : 0 ];
+            const uint32_t latency = t - r.submitted_;
+            if ( r.transaction.result != I2C_RESULT_SUCCESS )
+                ++s.failed;
+            if ( r.deadline_us && latency >= r.deadline_us * ticks_per_us_ )
+                ++s.deadline_missed;
+            if ( r.started_ ) {
+                if ( r.started_ - r.submitted_ > s.wait_max )
+                    s.wait_max = r.started_ - r.submitted_;
+                if ( s.completed == 0 || latency < s.latency_min )
+                    s.latency_min = latency;
+                if ( latency > s.latency_max )
+                    s.latency_max = latency;
+                s.latency_sum += latency;
+                ++s.completed;
+            }
+            if ( r.completion )
+                r.completion( r );
+            r.done = true;
+        }
+
+        // drops expired requests, then submits the next batch to the bus
+        void start_batch() {
+            const uint32_t t = now();
+
+            for ( i2c_request ** p = &ready_; *p; ) {
+                i2c_request * r = *p;
+                if ( expired( *r, t ) ) {
+                    *p = r->next_;
+                    r->transaction.result = I2C_TRANSACTION_TIMEOUT;
+                    r->started_ = 0;
+                    complete( *r, t );
+                } else {
+                    p = &r->next_;
+                }
+            }
+
+            for ( size_t n = 0; n < batch_limit && ready_; ++n ) {
+                i2c_request * best = nullptr;
+                for ( auto r = ready_; r; r = r->next_ ) {
+                    if ( n > 0 && r->device != last_device_ )
+                        continue;                       // a batch is one device
+                    if ( best == nullptr || precedes( *r, *best, t ) )
+                        best = r;
+                }
+                if ( best == nullptr )
+                    break;
+                if ( n > 0 && precedes_other( *best, t ) )
+                    break;                              // someone more urgent than the rest of the batch
+                unlink( best );
+                best->started_ = t ? t : 1;
+                last_device_ = best->device;
+                ++in_flight_;
+                if ( !bus_->submit( best->transaction ) ) {
+                    --in_flight_;                       // engine queue full; retried on poll()
+                    best->next_ = ready_;
+                    ready_ = best;
+                    break;
+                }
+            }
+        }
+
+        // a waiting request of another device has a higher effective priority than 'r'
+        bool precedes_other( const i2c_request& r, uint32_t t ) const {
+            const uint32_t level = effective_priority( r, t );
+            for ( auto x = ready_; x; x = x->next_ ) {
+                if ( x->device != r.device && effective_priority( *x, t ) > level )
+                    return true;
+            }
+            return false;
+        }
+
+        static void on_complete( i2c_transaction& t ) {
+            auto& r = *reinterpret_cast< i2c_request * >( t.context );
+            auto& self = *reinterpret_cast< i2c_scheduler * >( r.scheduler_ );
+            r.finished_ = self.now();
+            push( self.completed_, r );
+            --self.in_flight_;
+            self.dispatch();
+        }
+
+        // any context; only one runs at a time, a concurrent caller leaves the work to the one running
+        void dispatch() {
+            again_ = true;
+            while ( again_.load() ) {
+                bool expected = false;
+                if ( !dispatching_.compare_exchange_strong( expected, true ) )
+                    return;
+                again_ = false;
+                if ( clear_.exchange( false ) ) {
+                    for ( size_t i = 0; i < devices_; ++i ) {
+                        uint8_t address = stat_[ i ].address;
+                        stat_[ i ] = i2c_device_statistics{};
+                        stat_[ i ].address = address;
+                    }
+                }
+                for ( auto r = take( completed_ ); r; ) {
+                    auto next = r->next_;           // 'r' belongs to its owner again once done
+                    complete( *r, r->finished_ );
+                    r = next;
+                }
+                drain();
+                if ( in_flight_.load() == 0 )
+                    start_batch();
+                dispatching_ = false;
+            }
+        }
+
+    public:
+        constexpr i2c_scheduler() : bus_( nullptr ), clock_( nullptr ), ticks_per_us_( 0 ), incoming_( nullptr ), completed_( nullptr )
+                                  , ready_( nullptr ), dispatching_( false ), again_( false ), clear_( false ), in_flight_( 0 ), last_device_( 0xff ), devices_( 0 )
+                                  , stat_{} {
+        }
+
+        void init( BUS * bus, uint32_t (*clock)(), uint32_t ticks_per_us ) {
+            bus_ = bus;
+            clock_ = clock;
+            ticks_per_us_ = ticks_per_us;
+        }
+
+        // returns the device id for requests; the same address gets the same id
+        uint8_t register_device( uint8_t address ) {
+            for ( size_t i = 0; i < devices_; ++i ) {
+                if ( stat_[ i ].address == address )
+                    return uint8_t( i );
+            }
+            if ( devices_ >= max_devices )
+                return uint8_t( max_devices - 1 );      // shares the last slot
+            stat_[ devices_ ] = i2c_device_statistics{};
+            stat_[ devices_ ].address = address;
+            return uint8_t( devices_++ );
+        }
+
+        size_t devices() const { return devices_; }
+        const i2c_device_statistics& stat( uint8_t device ) const { return stat_[ device ]; }
+        void clear_stat() {
+            clear_ = true;                              // by the dispatcher, the only writer of stat_
+            dispatch();
+        }
+
+        uint32_t in_flight() const { return in_flight_.load(); }
+
+        // 'r' must stay alive until r.done; any context
+        bool submit( i2c_request& r ) {
+            if ( bus_ == nullptr )
+                return false;
+            r.done = false;
+            r.scheduler_ = this;
+            r.started_ = 0;
+            r.submitted_ = now();
+            r.transaction.completion = &on_complete;
+            r.transaction.context = &r;
+            push( incoming_, r );
+            dispatch();
+            return true;
+        }
+
+        // transaction deadlines (BUS::poll) and requests the engine could not take; call while waiting
+        void poll() {
+            bus_->poll();
+            dispatch();
+        }
+
+        bool wait( i2c_request& r ) {
+            while ( !r.done.load() )
+                poll();
+            return r.transaction.result == I2C_RESULT_SUCCESS;
+        }
+
+        bool transact( i2c_request& r ) {
+            return submit( r ) && wait( r );
+        }
+    };
+
+}
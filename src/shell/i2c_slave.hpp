@@ -0,0 +1,260 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "i2c.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Interrupt (and optionally DMA) driven I2C slave exposing a register file, RM0008 26.3.2.
+// The usual sensor protocol:
+//   S addr+W reg [data...] P       sets the register pointer; data are written from there, auto-increment
+//   S addr+R data... P             reads from the register pointer, auto-increment (typically after
+//                                  'S addr+W reg' on repeated START)
+// Reads past the end of the file return 0xff; writes to read-only registers, or past the end, are dropped.
+// A write burst is applied to the file when it ends (STOP or repeated START), then on_write( reg, count )
+// is called from the ISR.  A read burst sends a snapshot taken at the address match, so that a multi-byte
+// value updated by update() is never seen half written.  update()/read() must be called with the bus irqs
+// masked on target.
+// The register block is a template parameter, so that the state machine can run on host against a scripted
+// register model; on target it is 'volatile I2C'.
+
+namespace stm32f103 {
+
+    template< typename REGS, size_t SIZE >
+    class i2c_slave {
+        static_assert( SIZE > 0 && SIZE <= 256, "register file must be 1..256 bytes" );
+    public:
+        static constexpr size_t size = SIZE;
+
+        // optional DMA for the data phase; stop() disables the running channel and returns the number of
+        // items it did not transfer (CNDTR).  dma_complete() must be called from the DMA ISR.
+        struct dma_port {
+            bool (*transmit)( const uint8_t *, size_t );
+            bool (*receive)( uint8_t *, size_t );
+            size_t (*stop)();
+        };
+
+        typedef i2c_slave_statistics statistics;
+
+        // RM0008 26.6
+        enum : uint32_t {
+            CR1_PE          = 1
+            , CR1_ACK       = 1 << 10
+            , CR2_ITERREN   = 1 << 8
+            , CR2_ITEVTEN   = 1 << 9
+            , CR2_ITBUFEN   = 1 << 10
+            , CR2_DMAEN     = 1 << 11
+            , SR1_ADDR      = 1 << 1
+            , SR1_STOPF     = 1 << 4
+            , SR1_RxNE      = 1 << 6
+            , SR1_TxE       = 1 << 7
+            , SR1_BERR      = 1 << 8
+            , SR1_ARLO      = 1 << 9
+            , SR1_AF        = 1 << 10
+            , SR1_OVR       = 1 << 11
+            , SR1_ERRORS    = SR1_BERR | SR1_ARLO | SR1_AF | SR1_OVR
+            , SR2_TRA       = 1 << 2
+        };
+
+        enum state_type {
+            st_idle
+            , st_receive    // master writes
+            , st_transmit   // master reads
+        };
+
+    private:
+        REGS * _;
+        const dma_port * dma_;
+        std::array< uint8_t, SIZE > regs_;
+        std::array< uint8_t, ( SIZE + 7 ) / 8 > writable_;
+        std::array< uint8_t, SIZE + 1 > rx_;     // register pointer + data
+        std::array< uint8_t, SIZE > tx_;         // snapshot from the register pointer
+        state_type state_;
+        bool dma_active_;
+        size_t index_;                           // bytes done by irq in current burst
+        size_t tx_size_;
+        uint8_t pointer_;
+        void (*on_write_)( uint8_t reg, size_t count, void * context );
+        void * context_;
+        statistics stat_;
+
+        inline bool is_writable( size_t reg ) const {
+            return reg < SIZE && ( writable_[ reg / 8 ] & ( 1 << ( reg % 8 ) ) );
+        }
+
+        void begin_receive() {
+            state_ = st_receive;
+            index_ = 0;
+            dma_active_ = dma_ && dma_->receive && dma_->receive( rx_.data(), rx_.size() );
+            if ( dma_active_ )
+                _->CR2 |= CR2_DMAEN;
+            else
+                _->CR2 |= CR2_ITBUFEN;
+        }
+
+        void begin_transmit() {
+            state_ = st_transmit;
+            index_ = 0;
+            tx_size_ = pointer_ < SIZE ? SIZE - pointer_ : 0;
+            for ( size_t i = 0; i < tx_size_; ++i )
+                tx_[ i ] = regs_[ pointer_ + i ];
+            ++stat_.reads;
+            dma_active_ = tx_size_ && dma_ && dma_->transmit && dma_->transmit( tx_.data(), tx_size_ );
+            if ( dma_active_ )
+                _->CR2 |= CR2_DMAEN;
+            else
+                _->CR2 |= CR2_ITBUFEN;
+        }
+
+        // end of a burst, by STOP, repeated START or NACK from the master
+        void end() {
+            size_t count = index_;
+            if ( dma_active_ ) {
+                size_t remain = dma_->stop ? dma_->stop() : 0;
+                count = ( state_ == st_receive ? rx_.size() : tx_size_ ) - remain;
+            }
+            _->CR2 &= ~( CR2_DMAEN | CR2_ITBUFEN );
+            dma_active_ = false;
+
+            if ( state_ == st_receive )
+                commit( count );
+            else if ( state_ == st_transmit )
+                stat_.bytes_read += count;
+            state_ = st_idle;
+        }
+
+        void commit( size_t count ) {
+            if ( count == 0 )
+                return;
+            pointer_ = rx_[ 0 ];
+            const size_t n = count - 1;
+            if ( n == 0 )
+                return;                          // register pointer only
+            ++stat_.writes;
+            for ( size_t i = 0; i < n; ++i ) {
+                const size_t reg = pointer_ + i;
+                if ( is_writable( reg ) ) {
+                    regs_[ reg ] = rx_[ 1 + i ];
+                    ++stat_.bytes_written;
+                } else {
+                    ++stat_.dropped;
+                }
+            }
+            if ( on_write_ && pointer_ < SIZE )
+                on_write_( pointer_, pointer_ + n > SIZE ? SIZE - pointer_ : n, context_ );
+        }
+
+    public:
+        constexpr i2c_slave() : _( nullptr ), dma_( nullptr ), regs_{}, writable_{}, rx_{}, tx_{}
+                              , state_( st_idle ), dma_active_( false ), index_( 0 ), tx_size_( 0 ), pointer_( 0 )
+                              , on_write_( nullptr ), context_( nullptr ), stat_{ 0, 0, 0, 0, 0, 0 } {
+        }
+
+        // the own address is in OAR1; enables ACK and the event/error interrupts
+        void init( REGS * regs ) {
+            _ = regs;
+            state_ = st_idle;
+            _->CR1 |= CR1_PE | CR1_ACK;
+            _->CR2 |= CR2_ITEVTEN | CR2_ITERREN;
+        }
+
+        void set_dma( const dma_port * port ) { dma_ = port; }
+        void set_callback( void (*on_write)( uint8_t, size_t, void * ), void * context = nullptr ) {
+            on_write_ = on_write;
+            context_ = context;
+        }
+
+        // registers 'reg'..'reg + count - 1' become writable (or read-only) by the master
+        void set_writable( size_t reg, size_t count, bool writable = true ) {
+            for ( size_t i = reg; i < reg + count && i < SIZE; ++i ) {
+                if ( writable )
+                    writable_[ i / 8 ] |= 1 << ( i % 8 );
+                else
+                    writable_[ i / 8 ] &= ~( 1 << ( i % 8 ) );
+            }
+        }
+
+        // local side access; irqs must be masked
+        size_t update( size_t reg, const uint8_t * data, size_t count ) {
+            size_t n = 0;
+            for ( ; n < count && reg + n < SIZE; ++n )
+                regs_[ reg + n ] = data[ n ];
+            return n;
+        }
+
+        size_t read( size_t reg, uint8_t * data, size_t count ) const {
+            size_t n = 0;
+            for ( ; n < count && reg + n < SIZE; ++n )
+                data[ n ] = regs_[ reg + n ];
+            return n;
+        }
+
+        state_type state() const { return state_; }
+        uint8_t pointer() const { return pointer_; }
+        const statistics& stat() const { return stat_; }
+
+        // event interrupt
+        void handle_event() {
+            uint32_t sr1 = _->SR1;
+            if ( sr1 & SR1_ADDR ) {
+                uint32_t sr2 = _->SR2;           // clears ADDR
+                end();                           // repeated START after a write
+                if ( sr2 & SR2_TRA )
+                    begin_transmit();
+                else
+                    begin_receive();
+                return;
+            }
+            if ( state_ == st_receive && !dma_active_ && ( sr1 & SR1_RxNE ) ) {
+                uint8_t data = uint8_t( _->DR );
+                if ( index_ < rx_.size() )
+                    rx_[ index_++ ] = data;
+                else
+                    ++stat_.dropped;
+            }
+            if ( state_ == st_transmit && !dma_active_ && ( sr1 & SR1_TxE ) ) {
+                _->DR = index_ < tx_size_ ? tx_[ index_ ] : 0xff;
+                ++index_;
+            }
+            if ( sr1 & SR1_STOPF ) {
+                _->CR1 |= 0;                     // SR1 read then CR1 write clears STOPF
+                end();
+            }
+        }
+
+        // error interrupt; returns the error bits found
+        uint32_t handle_error() {
+            uint32_t sr1 = _->SR1 & SR1_ERRORS;
+            _->SR1 &= ~sr1; // rc_w0
+            if ( ( sr1 & SR1_AF ) && state_ == st_transmit ) {
+                end();                           // master NACK, end of read
+                // DR may hold a byte the master did not take; PE=0 drops it so that the next read starts clean
+                _->CR1 &= ~CR1_PE;
+                _->CR1 |= CR1_PE | CR1_ACK;
+            }
+            if ( sr1 & ( SR1_BERR | SR1_OVR ) ) {
+                ++stat_.errors;
+                end();
+            }
+            return sr1;
+        }
+
+        // DMA transfer complete; a master that keeps going is served by irq from here (dropped, or 0xff)
+        void dma_complete() {
+            if ( !dma_active_ )
+                return;
+            dma_active_ = false;
+            index_ = state_ == st_receive ? rx_.size() : tx_size_;
+            _->CR2 &= ~CR2_DMAEN;
+            _->CR2 |= CR2_ITBUFEN;
+        }
+    };
+
+}
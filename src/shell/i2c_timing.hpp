@@ -0,0 +1,75 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstdint>
+
+// I2C SCL timing, RM0008 26.6.2 (CR2.FREQ), 26.6.8 (CCR) and 26.6.9 (TRISE)
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace stm32f103 {
+
+    // CCR bits F/S[15] and DUTY[14]
+    enum I2C_SPEED_MODE : uint32_t {
+        I2C_STANDARD_MODE          = 0           // Sm, Thigh = Tlow = CCR * Tpclk1
+        , I2C_FAST_MODE            = 1 << 15     // Fm, Tlow/Thigh = 2
+        , I2C_FAST_MODE_DUTY16_9   = 3 << 14     // Fm, Tlow/Thigh = 16/9 (Thigh = 9 * CCR * Tpclk1)
+    };
+
+    enum I2C_TIMING_ERROR {
+        I2C_TIMING_OK
+        , I2C_TIMING_PCLK1_RANGE        // FREQ must be 2..36 MHz (4 MHz for Fm)
+        , I2C_TIMING_SPEED_RANGE        // Sm up to 100 kHz, Fm up to 400 kHz
+        , I2C_TIMING_CCR_RANGE          // CCR >= 4 in Sm, >= 1 in Fm, and 12 bits
+    };
+
+    struct i2c_timing {
+        uint32_t freq;    // CR2.FREQ, pclk1 in MHz
+        uint32_t ccr;     // CCR register value including F/S and DUTY
+        uint32_t trise;   // TRISE register value
+        uint32_t scl;     // resulting SCL frequency (Hz), never above the requested speed
+        I2C_TIMING_ERROR error;
+
+        static constexpr uint32_t divisor( I2C_SPEED_MODE mode ) {
+            return mode == I2C_STANDARD_MODE ? 2 : mode == I2C_FAST_MODE ? 3 : 25;
+        }
+
+        static constexpr i2c_timing compute( uint32_t pclk1, uint32_t speed, I2C_SPEED_MODE mode ) {
+            const uint32_t freq = pclk1 / 1'000'000;
+            const uint32_t div = divisor( mode );
+            const uint32_t ccr = speed ? ( pclk1 + div * speed - 1 ) / ( div * speed ) : 0; // round up
+            // maximum SCL rise time is 1000ns in Sm and 300ns in Fm; TRISE = t_r / Tpclk1 + 1
+            const uint32_t trise = ( mode == I2C_STANDARD_MODE ? freq : ( freq * 300 ) / 1000 ) + 1;
+
+            I2C_TIMING_ERROR error = I2C_TIMING_OK;
+            if ( freq < ( mode == I2C_STANDARD_MODE ? 2 : 4 ) || freq > 36 )
+                error = I2C_TIMING_PCLK1_RANGE;
+            else if ( speed == 0 || speed > ( mode == I2C_STANDARD_MODE ? 100'000 : 400'000 ) )
+                error = I2C_TIMING_SPEED_RANGE;
+            else if ( ccr < ( mode == I2C_STANDARD_MODE ? 4 : 1 ) || ccr > 0x0fff )
+                error = I2C_TIMING_CCR_RANGE;
+
+            return { freq, ccr | mode, trise, ccr ? pclk1 / ( div * ccr ) : 0, error };
+        }
+
+        // decode SCL frequency from a CCR register value
+        static constexpr uint32_t scl_frequency( uint32_t pclk1, uint32_t ccr_register ) {
+            return ( ccr_register & 0x0fff )
+                ? pclk1 / ( divisor( I2C_SPEED_MODE( ( ccr_register & I2C_FAST_MODE ) ? ccr_register & ( 3 << 14 ) : 0 ) )
+                            * ( ccr_register & 0x0fff ) ) : 0;
+        }
+    };
+
+    // compile time validated timing for a constant pclk1 and speed
+    template< uint32_t pclk1, uint32_t speed, I2C_SPEED_MODE mode = I2C_STANDARD_MODE >
+    struct i2c_timing_t {
+        static constexpr i2c_timing value = i2c_timing::compute( pclk1, speed, mode );
+        static_assert( value.error != I2C_TIMING_PCLK1_RANGE, "I2C: pclk1 out of range (2..36MHz, 4MHz min. for Fm)" );
+        static_assert( value.error != I2C_TIMING_SPEED_RANGE, "I2C: SCL speed out of range (Sm <= 100kHz, Fm <= 400kHz)" );
+        static_assert( value.error != I2C_TIMING_CCR_RANGE, "I2C: CCR out of range" );
+    };
+}
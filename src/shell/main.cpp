@@ -132,7 +132,7 @@ init_systick( uint32_t s, bool en )
 int
 main()
 {
-    memset( &__bss_start, 0, reinterpret_cast< const char * >(&__bss_end) - reinterpret_cast< const char * >(&__bss_start) + 1);
+    memset( &__bss_start, 0, reinterpret_cast< const char * >(&__bss_end) - reinterpret_cast< const char * >(&__bss_start) );
 
     if ( auto RCC = reinterpret_cast< volatile stm32f103::RCC * >( stm32f103::RCC_BASE ) ) {
         // clock/pll setup -->
@@ -320,6 +320,8 @@ systick_handler()
     if ( ( tp % 10 * 250 ) == 0 )
         ++atomic_250_milliseconds;
 
+    stm32f103::i2c::resume_deferred();
+
     // systick (100us)
     // stm32f103::gpio< decltype( stm32f103::PB12 ) >( stm32f103::PB12 ) = bool( tp & 01 );
 
@@ -467,6 +469,7 @@ void
 __dma2_ch4_handler( void )
 {
     stm32f103::dma_t< stm32f103::DMA2_BASE >::instance()->handle_interrupt( 3 );
+    stm32f103::dma_t< stm32f103::DMA2_BASE >::instance()->handle_interrupt( 4 ); // high-density: shared Channel4_5 irq
 }
 
 void
@@ -0,0 +1,56 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#include "mem2mem.hpp"
+#include "dma.hpp"
+#include "dma_channel.hpp"
+#include <cstring>
+
+using namespace stm32f103;
+
+mem2mem::mem2mem( dma& dma, uint32_t channel ) : dma_( dma ), channel_( channel )
+{
+    // lowest priority; a peripheral may take the channel over while idle, then copies fall back to CPU
+    if ( dma_.acquire( channel_, DMA_OWNER_MEM2MEM, DMA_PL_LOW ) )
+        dma_.init_channel( DMA_CHANNEL( channel_ ), 0, nullptr, 0, MEM2MEM | PL_Medium | MINC | PINC, DMA_OWNER_MEM2MEM );
+}
+
+bool
+mem2mem::copy( void * dst, const void * src, size_t size, completion_type completion, void * context )
+{
+    if ( size >= dma_threshold && dma_copy( dst, src, size, completion, context ) )
+        return true;
+
+    // small, or DMA queue full
+    memcpy( dst, src, size );
+    if ( completion )
+        completion( 0x02, context );
+    return true;
+}
+
+bool
+mem2mem::dma_copy( void * dst, const void * src, size_t size, completion_type completion, void * context )
+{
+    if ( dma_.owner( channel_ ) != DMA_OWNER_MEM2MEM )
+        return false;
+
+    uint32_t d = reinterpret_cast< uint32_t >( dst );
+    uint32_t s = reinterpret_cast< uint32_t >( src );
+
+    // PSIZE/MSIZE 0:8bit, 1:16bit, 2:32bit
+    uint32_t width = ( ( d | s ) & 3 ) == 0 ? 2 : ( ( d | s ) & 1 ) == 0 ? 1 : 0;
+    size_t count = size >> width;
+    if ( count == 0 || count > 0xffff )
+        return false;
+
+    // the tail goes first, so that the completion sees the whole copy
+    if ( size_t remain = size - ( count << width ) )
+        memcpy( reinterpret_cast< uint8_t * >( dst ) + ( count << width )
+                , reinterpret_cast< const uint8_t * >( src ) + ( count << width ), remain );
+
+    dma_job job = { d, count, s, MEM2MEM | PL_Medium | width << 10 | width << 8 | MINC | PINC, completion, context };
+    return dma_.submit( channel_, job );
+}
@@ -0,0 +1,35 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace stm32f103 {
+
+    class dma;
+
+    // Memory to memory copy on a DMA channel (RM0008 13.3.3, p278), completion is notified from the DMA ISR.
+    // copy() selects the path by size: below dma_threshold the CPU (LDM/STM memcpy) finishes before the DMA
+    // would even be set up, so it copies synchronously and calls the completion from the caller's context.
+    class mem2mem {
+        dma& dma_;
+        uint32_t channel_;
+    public:
+        typedef void (*completion_type)( uint32_t status, void * context ); // status: DMA ISR bits, TCIF (0x02) on success
+
+        static constexpr size_t dma_threshold = 256; // bytes, see 'dma bench'
+
+        mem2mem( dma&, uint32_t channel );
+
+        bool copy( void * dst, const void * src, size_t size, completion_type, void * context = nullptr );
+
+        // always by DMA; transfer width follows the common alignment of dst and src, the remainder (< 4 bytes) is copied by CPU
+        bool dma_copy( void * dst, const void * src, size_t size, completion_type, void * context = nullptr );
+    };
+
+}
@@ -0,0 +1,133 @@
+/* memcpy.c
+ * Copyright (C) MS-Cheminformatics LLC
+ * Author: Toshinobu Hondo, Ph.D.,
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+    void * memcpy( void * dest, const void * src, size_t num );
+    void * memmove( void * dest, const void * src, size_t num );
+
+#ifdef __cplusplus
+}
+#endif
+
+// Cortex-M3 copies with LDM/STM bursts when source and destination are mutually word aligned.
+// Otherwise the destination is aligned and the source is read by unaligned LDR (allowed on normal
+// memory unless CCR.UNALIGN_TRP is set), which is still ~3x faster than a byte loop.
+
+namespace {
+
+    struct __attribute__(( packed )) unaligned_word { uint32_t value; };
+
+    // copy 'blocks' x 32 bytes, both pointers word aligned
+    inline void
+    copy_blocks( uint32_t *& d, const uint32_t *& s, size_t blocks )
+    {
+#if defined __arm__
+        __asm__ volatile ( "1:\n\t"
+                           "ldmia %[s]!, {r3-r6}\n\t"
+                           "stmia %[d]!, {r3-r6}\n\t"
+                           "ldmia %[s]!, {r3-r6}\n\t"
+                           "stmia %[d]!, {r3-r6}\n\t"
+                           "subs %[n], %[n], #1\n\t"
+                           "bne 1b\n"
+                           : [d] "+r" ( d ), [s] "+r" ( s ), [n] "+r" ( blocks )
+                           :
+                           : "r3", "r4", "r5", "r6", "cc", "memory" );
+#else
+        while ( blocks-- ) {
+            for ( int i = 0; i < 8; ++i )
+                d[ i ] = s[ i ];
+            d += 8;
+            s += 8;
+        }
+#endif
+    }
+}
+
+__attribute__(( optimize( "no-tree-loop-distribute-patterns" ) ))
+void *
+memcpy( void * dest, const void * src, size_t num )
+{
+    uint8_t * d = reinterpret_cast< uint8_t * >( dest );
+    const uint8_t * s = reinterpret_cast< const uint8_t * >( src );
+
+    if ( num >= 16 ) {
+        while ( reinterpret_cast< uintptr_t >( d ) & 3 ) {
+            *d++ = *s++;
+            --num;
+        }
+        uint32_t * wd = reinterpret_cast< uint32_t * >( d );
+
+        if ( ( reinterpret_cast< uintptr_t >( s ) & 3 ) == 0 ) {
+            const uint32_t * ws = reinterpret_cast< const uint32_t * >( s );
+            if ( size_t blocks = num / 32 ) {
+                copy_blocks( wd, ws, blocks );
+                num &= 31;
+            }
+            while ( num >= 4 ) {
+                *wd++ = *ws++;
+                num -= 4;
+            }
+            s = reinterpret_cast< const uint8_t * >( ws );
+        } else {
+            auto us = reinterpret_cast< const unaligned_word * >( s );
+            while ( num >= 16 ) {
+                wd[ 0 ] = us[ 0 ].value;
+                wd[ 1 ] = us[ 1 ].value;
+                wd[ 2 ] = us[ 2 ].value;
+                wd[ 3 ] = us[ 3 ].value;
+                wd += 4;
+                us += 4;
+                num -= 16;
+            }
+            while ( num >= 4 ) {
+                *wd++ = ( us++ )->value;
+                num -= 4;
+            }
+            s = reinterpret_cast< const uint8_t * >( us );
+        }
+        d = reinterpret_cast< uint8_t * >( wd );
+    }
+
+    while ( num-- )
+        *d++ = *s++;
+    return dest;
+}
+
+__attribute__(( optimize( "no-tree-loop-distribute-patterns" ) ))
+void *
+memmove( void * dest, const void * src, size_t num )
+{
+    uint8_t * d = reinterpret_cast< uint8_t * >( dest );
+    const uint8_t * s = reinterpret_cast< const uint8_t * >( src );
+
+    // forward copy is safe unless destination overlaps the tail of source
+    if ( d <= s || d >= s + num )
+        return memcpy( dest, src, num );
+
+    d += num;
+    s += num;
+    if ( num >= 16 && ( ( reinterpret_cast< uintptr_t >( d ) ^ reinterpret_cast< uintptr_t >( s ) ) & 3 ) == 0 ) {
+        while ( reinterpret_cast< uintptr_t >( d ) & 3 ) {
+            *--d = *--s;
+            --num;
+        }
+        uint32_t * wd = reinterpret_cast< uint32_t * >( d );
+        const uint32_t * ws = reinterpret_cast< const uint32_t * >( s );
+        while ( num >= 4 ) {
+            *--wd = *--ws;
+            num -= 4;
+        }
+        d = reinterpret_cast< uint8_t * >( wd );
+        s = reinterpret_cast< const uint8_t * >( ws );
+    }
+    while ( num-- )
+        *--d = *--s;
+    return dest;
+}
@@ -1,23 +1,66 @@
 /* memset.c
  * Copyright (C) MS-Cheminformatics LLC
- * Author: Toshinobu Hondo, Ph.D., 
+ * Author: Toshinobu Hondo, Ph.D.,
  */
 
 #include <cstddef>
+#include <cstdint>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
     void * memset( void * dest, int value, size_t num );
-    
+
 #ifdef __cplusplus
 }
 #endif
 
+// This is called to clear .bss before anything is initialized; must not depend on static data.
+// Loop distribution is disabled so that gcc will not turn the byte loops back into a call to memset.
+
+__attribute__(( optimize( "no-tree-loop-distribute-patterns" ) ))
 void *
 memset( void * dest, int value, size_t num )
 {
-    char * p = reinterpret_cast< char * >( dest );
+    uint8_t * p = reinterpret_cast< uint8_t * >( dest );
+
+    if ( num >= 16 ) {
+        while ( reinterpret_cast< uintptr_t >( p ) & 3 ) {
+            *p++ = value;
+            --num;
+        }
+        uint32_t w = uint32_t( value & 0xff ) * 0x01010101;
+        uint32_t * wp = reinterpret_cast< uint32_t * >( p );
+
+        if ( size_t blocks = num / 32 ) { // 2 x STM of 4 registers per iteration
+#if defined __arm__
+            __asm__ volatile ( "mov r3, %[w]\n\t"
+                               "mov r4, %[w]\n\t"
+                               "mov r5, %[w]\n\t"
+                               "mov r6, %[w]\n"
+                               "1:\n\t"
+                               "stmia %[p]!, {r3-r6}\n\t"
+                               "stmia %[p]!, {r3-r6}\n\t"
+                               "subs %[n], %[n], #1\n\t"
+                               "bne 1b\n"
+                               : [p] "+r" ( wp ), [n] "+r" ( blocks )
+                               : [w] "r" ( w )
+                               : "r3", "r4", "r5", "r6", "cc", "memory" );
+#else
+            while ( blocks-- ) {
+                wp[ 0 ] = wp[ 1 ] = wp[ 2 ] = wp[ 3 ] = wp[ 4 ] = wp[ 5 ] = wp[ 6 ] = wp[ 7 ] = w;
+                wp += 8;
+            }
+#endif
+            num &= 31;
+        }
+        while ( num >= 4 ) {
+            *wp++ = w;
+            num -= 4;
+        }
+        p = reinterpret_cast< uint8_t * >( wp );
+    }
+
     while ( num-- )
         *p++ = value;
     return dest;
@@ -2,6 +2,7 @@
 
 #include "dma.hpp"
 #include "dma_channel.hpp"
+#include "exti.hpp"
 #include "gpio.hpp"
 #include "spi.hpp"
 #include "stm32f103.hpp"
@@ -9,6 +10,8 @@
 #include "spinlock.hpp"
 #include <atomic>
 
+extern uint32_t __pclk1, __pclk2;
+
 extern "C" {
     void spi1_handler();
     void enable_interrupt( stm32f103::IRQn_type IRQn );
@@ -37,7 +40,19 @@ namespace stm32f103 {
     };
 
     enum SPI_CR2 {
-        SSOE         = 04 //(01 << 2) // SS output enable
+        TXEIE        = (01 << 7) // Tx buffer empty interrupt enable
+        , RXNEIE     = (01 << 6) // Rx buffer not empty interrupt enable
+        , ERRIE      = (01 << 5) // Error interrupt enable
+        , SSOE       = 04 //(01 << 2) // SS output enable
+        , TXDMAEN    = (01 << 1) // Tx buffer DMA enable
+        , RXDMAEN    = 01        // Rx buffer DMA enable
+    };
+
+    enum SPI_SR {
+        BSY          = (01 << 7)
+        , OVR        = (01 << 6)
+        , TXE        = (01 << 1)
+        , RXNE       = 01
     };
 
     constexpr uint32_t fclk = 04;
@@ -54,6 +69,36 @@ namespace stm32f103 {
 
 using namespace stm32f103;
 
+namespace {
+    // SPI1, SPI2 holding their DMA channels
+    stm32f103::spi * __dma_spi[ 2 ];
+
+    stm32f103::spi_bus< stm32f103::spi > __spi1_bus, __spi2_bus;
+    stm32f103::spi_slave_stream __spi1_slave, __spi2_slave;
+
+    void chip_select( uint8_t port, uint32_t pin, bool level ) {
+        switch( port ) {
+        case 'A':
+            stm32f103::gpio< GPIOA_PIN >( static_cast< GPIOA_PIN >( pin ) ) = level;
+            break;
+        case 'B':
+            stm32f103::gpio< GPIOB_PIN >( static_cast< GPIOB_PIN >( pin ) ) = level;
+            break;
+        case 'C':
+            stm32f103::gpio< GPIOC_PIN >( static_cast< GPIOC_PIN >( pin ) ) = level;
+            break;
+        }
+    }
+
+    // BR[2:0]; the fastest fPCLK/2^(BR+1) not above 'hz' and spi_max_clock
+    uint32_t prescaler( uint32_t pclk, uint32_t hz ) {
+        uint32_t br = 0;
+        while ( br < 7 && ( ( pclk >> ( br + 1 ) ) > hz || ( pclk >> ( br + 1 ) ) > spi_max_clock ) )
+            ++br;
+        return br;
+    }
+}
+
 void
 spi::init( stm32f103::SPI_BASE base, uint8_t gpio, uint32_t ss_n )
 {
@@ -88,6 +133,7 @@ spi::init( stm32f103::SPI_BASE base, uint8_t gpio, uint32_t ss_n )
             break;
         }
         cr1_ = spi_->CR1;
+        bus().init( this );
     }
     (*this) = true;  // ~SS -> H
 }
@@ -146,18 +192,8 @@ spi::operator = ( bool flag ) {
     // else
     //     spi_->CR1 |= SSI;
     uint32_t flags = spi_->CR1;
-    if ( ( flags & MSTR ) && ( flags & SSM ) ) {
-#if 0
-        switch( gpio_ ) {
-        case 'A':
-            stm32f103::gpio< GPIOA_PIN >( static_cast< GPIOA_PIN >( ss_n_ ) ) = flag;
-            break;
-        case 'B':
-            stm32f103::gpio< GPIOB_PIN >( static_cast< GPIOB_PIN >( ss_n_ ) ) = flag;
-            break;
-        }
-#endif
-    }
+    if ( ( flags & MSTR ) && ( flags & SSM ) )
+        chip_select( gpio_, ss_n_, flag );
 
 }
 
@@ -204,14 +240,20 @@ spi::operator << ( uint16_t d )
 void
 spi::handle_interrupt()
 {
+    if ( spi_ && streaming_ ) {
+        if ( spi_->SR & OVR ) {    // DR then SR read clears it
+            (void)spi_->DATA;
+            (void)spi_->SR;
+            slave().spi_overrun();
+        }
+        return;
+    }
+
     if ( spi_ ) {
-        if ( spi_->SR & 01 ) { // RX not empty
+        if ( ( spi_->SR & 01 ) && !( spi_->CR2 & RXDMAEN ) ) { // RX not empty, not taken by DMA
             rxd_ = spi_->DATA | 0x80000000;
             (*this) = true;        // ~SS = 'H'
             // spi_->CR1 |= BIDIOE;   // switch to write-only mode
-            scoped_spinlock<> lock( lock_ );
-            if ( spi_ == reinterpret_cast< volatile stm32f103::SPI * >( SPI2_BASE ) )
-                stream() << "SPI2 got : " << ( rxd_.load() & 0xffff ) << std::endl;
         }
 
         if ( spi_->SR & 02 ) { // Tx empty
@@ -251,6 +293,319 @@ spi::handle_interrupt()
     }
 }
 
+// CR1 settings that are not to be changed while the SPI is enabled (BR, DFF, CPOL, CPHA...)
+void
+spi::reconfigure( uint32_t cr1 )
+{
+    if ( ( spi_->CR1 & ~SPE ) == ( cr1 & ~SPE ) )
+        return;
+    while ( ( spi_->SR & ( TXE | BSY ) ) != TXE ) // last frame has been sent
+        ;
+    spi_->CR1 = cr1 & ~SPE;
+    spi_->CR1 = cr1;
+    cr1_ = spi_->CR1;
+}
+
+uint32_t
+spi::set_speed( uint32_t hz )
+{
+    if ( !spi_ )
+        return 0;
+    const uint32_t pclk = ( spi_ == reinterpret_cast< volatile stm32f103::SPI * >( SPI1_BASE ) ) ? __pclk2 : __pclk1;
+    reconfigure( ( spi_->CR1 & ~BR ) | ( prescaler( pclk, hz ) << 3 ) );
+    return speed();
+}
+
+uint32_t
+spi::speed() const
+{
+    if ( !spi_ )
+        return 0;
+    const uint32_t pclk = ( spi_ == reinterpret_cast< volatile stm32f103::SPI * >( SPI1_BASE ) ) ? __pclk2 : __pclk1;
+    return pclk >> ( ( ( spi_->CR1 & BR ) >> 3 ) + 1 );
+}
+
+bool
+spi::set_frame_size( size_t bits )
+{
+    if ( !spi_ || ( bits != 8 && bits != 16 ) || dma_busy_ )
+        return false;
+    reconfigure( bits == 16 ? ( spi_->CR1 | DFF ) : ( spi_->CR1 & ~DFF ) );
+    return true;
+}
+
+bool
+spi::configure( const spi_device& device )
+{
+    if ( !spi_ )
+        return false;
+    const uint32_t pclk = ( spi_ == reinterpret_cast< volatile stm32f103::SPI * >( SPI1_BASE ) ) ? __pclk2 : __pclk1;
+    const uint32_t cr1 = ( spi_->CR1 & ~( BR | DFF | CPOL | CPHA ) )
+        | ( prescaler( pclk, device.speed ) << 3 )
+        | ( device.frame_size == 16 ? DFF : 0 )
+        | ( device.mode & ( CPOL | CPHA ) );
+    if ( cr1 == spi_->CR1 )
+        return false;
+    reconfigure( cr1 );
+    return true;
+}
+
+void
+spi::select( const spi_device& device, bool asserted )
+{
+    chip_select( device.cs_port, device.cs_pin, !asserted );
+}
+
+spi_bus< spi >&
+spi::bus()
+{
+    return ( spi_ == reinterpret_cast< volatile stm32f103::SPI * >( SPI2_BASE ) ) ? __spi2_bus : __spi1_bus;
+}
+
+spi_slave_stream&
+spi::slave()
+{
+    return ( spi_ == reinterpret_cast< volatile stm32f103::SPI * >( SPI2_BASE ) ) ? __spi2_slave : __spi1_slave;
+}
+
+bool
+spi::attach( dma& dma )
+{
+    const uint32_t addr = reinterpret_cast< uint32_t >( const_cast< SPI * >( spi_ ) );
+    if ( addr != SPI1_BASE && addr != SPI2_BASE )
+        return dma_;
+    const bool spi1 = addr == SPI1_BASE;
+
+    // DMA_SPI2_RX/TX share their numbers with DMA_I2C2_TX/RX, so that the peripheral address
+    // and CCR are given by each dma_job rather than by dma_channel_t
+    const DMA_CHANNEL rx = spi1 ? DMA_SPI1_RX : DMA_SPI2_RX;
+    const DMA_CHANNEL tx = spi1 ? DMA_SPI1_TX : DMA_SPI2_TX;
+    auto revoke = spi1
+        ? +[]( uint32_t channel ){ if ( __dma_spi[ 0 ] ) __dma_spi[ 0 ]->dma_revoked( channel ); }
+        : +[]( uint32_t channel ){ if ( __dma_spi[ 1 ] ) __dma_spi[ 1 ]->dma_revoked( channel ); };
+
+    if ( dma.acquire( rx, addr, DMA_PL_VERYHIGH, revoke ) ) {
+        if ( dma.acquire( tx, addr, DMA_PL_HIGH, revoke ) &&
+             dma.init_channel( rx, addr + offsetof( SPI, DATA ), nullptr, 0, 0, addr ) &&
+             dma.init_channel( tx, addr + offsetof( SPI, DATA ), nullptr, 0, 0, addr ) ) {
+            __dma_spi[ spi1 ? 0 : 1 ] = this;
+            dma_channel_ = rx;
+            dma_ = &dma;
+        } else {
+            dma.release( tx, addr );  // no effect unless it has been granted
+            dma.release( rx, addr );
+            dma_ = nullptr;
+        }
+    }
+    return dma_;
+}
+
+// One channel of the pair has been taken over by dma::acquire; the other one is given up as well, and
+// the port falls back to interrupt mode.
+void
+spi::dma_revoked( uint32_t channel )
+{
+    if ( auto dma = dma_ ) {
+        dma_ = nullptr;
+        dma->release( channel == dma_channel_ ? dma_channel_ + 1 : dma_channel_
+                      , reinterpret_cast< uint32_t >( const_cast< SPI * >( spi_ ) ) );
+    }
+}
+
+bool
+spi::transfer( const void * tx, void * rx, size_t count, void (*completion)( void * ), void * context )
+{
+    if ( !dma_ || count == 0 || count > 0xffff )
+        return false;
+
+    bool expected = false;
+    if ( !dma_busy_.compare_exchange_strong( expected, true ) )
+        return false;
+
+    const uint32_t data = reinterpret_cast< uint32_t >( &spi_->DATA );
+    const uint32_t size = ( spi_->CR1 & DFF ) ? ( 1 << 10 | 1 << 8 ) : 0; // MSIZE, PSIZE := 16bit
+    dummy_ = 0xffff;
+    dma_status_ = 0;
+    completion_ = completion;
+    context_ = context;
+
+    // the receive channel paces the transfer and tells its completion, as the last frame has been
+    // shifted in only when it is read; a transmit-only transfer receives into the dummy word
+    const dma_job rxjob = { rx ? reinterpret_cast< uint32_t >( rx ) : reinterpret_cast< uint32_t >( &dummy_ )
+                            , uint32_t( count ), data
+                            , PL_VeryHigh | DMA_ReadFromPeripheral | size | ( rx ? uint32_t( MINC ) : 0u )
+                            , &spi::dma_complete, this };
+    const dma_job txjob = { tx ? reinterpret_cast< uint32_t >( tx ) : reinterpret_cast< uint32_t >( &dummy_ )
+                            , uint32_t( count ), data
+                            , PL_High | DMA_ReadFromMemory | size | ( tx ? uint32_t( MINC ) : 0u )
+                            , nullptr, nullptr };
+
+    while ( spi_->SR & RXNE )        // stale frame; DR then SR read clears OVR as well
+        (void)spi_->DATA;
+    (void)spi_->SR;
+
+    // RM0008 25.3.9, RXDMAEN, then the channels, then TXDMAEN; the RXNE and TXE interrupts are
+    // off until completion, otherwise the ISR would take the frames
+    cr2_ = spi_->CR2;
+    spi_->CR2 = ( cr2_ & ~( TXEIE | RXNEIE ) ) | RXDMAEN;
+    if ( !dma_->submit( dma_channel_, rxjob ) ) {
+        spi_->CR2 = cr2_;
+        dma_busy_ = false;
+        return false;
+    }
+    if ( !dma_->submit( dma_channel_ + 1, txjob ) ) {
+        spi_->CR2 = cr2_;
+        dma_->cancel( dma_channel_ ); // no clock without TX; the RX job would never complete
+        dma_busy_ = false;
+        return false;
+    }
+    spi_->CR2 |= TXDMAEN;
+    return true;
+}
+
+// DMA interrupt context
+void
+spi::dma_complete( uint32_t status, void * context )
+{
+    auto _this = reinterpret_cast< spi * >( context );
+    _this->spi_->CR2 = _this->cr2_ & ~( TXEIE | TXDMAEN | RXDMAEN );
+    _this->dma_status_ = status;
+    auto completion = _this->completion_;
+    auto ctx = _this->context_;
+    _this->dma_busy_ = false;  // the completion may start the next transfer
+    if ( completion )
+        completion( ctx );
+}
+
+bool
+spi::listen( void * ring, size_t count, SPI_MODE mode, size_t frame_size )
+{
+    const uint32_t addr = reinterpret_cast< uint32_t >( const_cast< SPI * >( spi_ ) );
+    const bool spi1 = addr == SPI1_BASE;
+
+    if ( ring == nullptr || count == 0 ) {
+        if ( streaming_ ) {
+            exti::detach( spi1 ? uint32_t( PA4 ) : uint32_t( PB12 ) );
+            spi_->CR1 &= ~SPE;
+            spi_->CR2 = RXNEIE | ERRIE;
+            dma_->enable( dma_channel_, false );
+            dma_->enable( dma_channel_ + 1, false );
+            dma_->clear_callback( dma_channel_ );
+            dma_->clear_callback( dma_channel_ + 1 );
+            streaming_ = false;
+            dma_busy_ = false;
+        }
+        return true;
+    }
+
+    if ( !dma_ || ( addr != SPI1_BASE && addr != SPI2_BASE ) || count > 0xffff || ( frame_size != 8 && frame_size != 16 ) )
+        return false;
+
+    bool expected = false;
+    if ( !dma_busy_.compare_exchange_strong( expected, true ) )
+        return false;  // a transfer is running; the channels are held by listen() from now on
+
+    const uint32_t data = addr + offsetof( SPI, DATA );
+    const uint32_t size = frame_size == 16 ? ( 1 << 10 | 1 << 8 ) : 0; // MSIZE, PSIZE := 16bit
+
+    slave().init( ring, count, frame_size / 8 );
+    preload_ = nullptr;
+    preloaded_ = 0;
+    streaming_ = true;
+
+    // slave, hardware NSS (SSM = 0)
+    spi_->CR1 = 0;
+    spi_->CR1 = ( mode & ( CPOL | CPHA ) ) | ( frame_size == 16 ? DFF : 0 );
+    cr1_ = spi_->CR1 | SPE;
+    while ( spi_->SR & RXNE )
+        (void)spi_->DATA;
+    (void)spi_->SR;
+    spi_->CR2 = ERRIE | RXDMAEN;
+
+    dma_->init_channel( DMA_CHANNEL( dma_channel_ ), data, reinterpret_cast< uint8_t * >( ring ), count
+                        , PL_VeryHigh | DMA_ReadFromPeripheral | MINC | CIRC | HTIE | size, addr );
+    dma_->init_channel( DMA_CHANNEL( dma_channel_ + 1 ), data, nullptr, 0, PL_High | DMA_ReadFromMemory | MINC | size, addr );
+    if ( spi1 ) {
+        dma_->set_callback( dma_channel_, +[]( uint32_t ){ __dma_spi[ 0 ]->on_rx_dma(); } );
+        dma_->set_callback( dma_channel_ + 1, +[]( uint32_t ){} ); // preload sent
+        exti::attach( PA4, EXTI_RISING, +[]{ __dma_spi[ 0 ]->on_nss(); } );
+    } else {
+        dma_->set_callback( dma_channel_, +[]( uint32_t ){ __dma_spi[ 1 ]->on_rx_dma(); } );
+        dma_->set_callback( dma_channel_ + 1, +[]( uint32_t ){} );
+        exti::attach( PB12, EXTI_RISING, +[]{ __dma_spi[ 1 ]->on_nss(); } );
+    }
+    dma_->enable( dma_channel_, true );
+    spi_->CR1 = cr1_;
+    return true;
+}
+
+bool
+spi::preload( const void * tx, size_t count )
+{
+    if ( !streaming_ || tx == nullptr || count == 0 || count > 0xffff )
+        return false;
+
+    const bool spi1 = spi_ == reinterpret_cast< volatile stm32f103::SPI * >( SPI1_BASE );
+    auto GPIO = reinterpret_cast< volatile stm32f103::GPIO * >( spi1 ? GPIOA_BASE : GPIOB_BASE );
+    const auto irq = spi1 ? EXTI4_IRQn : EXTI15_10_IRQn;
+
+    disable_interrupt( irq );  // on_nss() would take it meanwhile
+    if ( GPIO->IDR & ( 1 << ( spi1 ? uint32_t( PA4 ) : uint32_t( PB12 ) ) ) ) {
+        arm_preload( tx, count );                 // NSS is high; ready for the next block
+    } else {
+        preload_count_ = count;
+        preload_ = tx;                            // the block in progress ends first
+    }
+    enable_interrupt( irq );
+    return true;
+}
+
+// NSS is high.  The SPI holds the last word it has been given in DR, and only a reset empties it, so that the
+// master would read a stale word first; reset, then reconfigure and rearm.  'tx' = nullptr leaves TX idle.
+void
+spi::arm_preload( const void * tx, uint32_t count )
+{
+    auto RCC = reinterpret_cast< volatile stm32f103::RCC * >( RCC_BASE );
+    if ( spi_ == reinterpret_cast< volatile stm32f103::SPI * >( SPI1_BASE ) ) {
+        RCC->APB2RSTR |= ( 1 << 12 );  // SPI1RST
+        RCC->APB2RSTR &= ~( 1 << 12 );
+    } else {
+        RCC->APB1RSTR |= ( 1 << 14 );  // SPI2RST
+        RCC->APB1RSTR &= ~( 1 << 14 );
+    }
+    spi_->CR1 = cr1_ & ~SPE;
+    dma_->enable( dma_channel_ + 1, false );
+    if ( tx ) {
+        dma_->set_transfer_buffer( dma_channel_ + 1, reinterpret_cast< const uint8_t * >( tx ), count );
+        dma_->enable( dma_channel_ + 1, true );
+        spi_->CR2 = ERRIE | RXDMAEN | TXDMAEN;   // DR gets the first word now
+    } else {
+        spi_->CR2 = ERRIE | RXDMAEN;
+    }
+    preloaded_ = tx ? count : 0;
+    spi_->CR1 = cr1_;
+}
+
+// EXTI, NSS rising edge
+void
+spi::on_nss()
+{
+    auto& slave = this->slave();
+    slave.end_of_frame( dma_->remaining( dma_channel_ ), preloaded_ );
+
+    if ( auto tx = preload_.exchange( nullptr ) )
+        arm_preload( tx, preload_count_ );
+    else if ( preloaded_ )
+        arm_preload( nullptr, 0 );               // single shot; the master reads 0 until the next preload
+}
+
+// receive channel half/complete
+void
+spi::on_rx_dma()
+{
+    slave().update( dma_->remaining( dma_channel_ ) );
+}
+
 void
 spi::interrupt_handler( spi * _this )
 {
@@ -1,7 +1,12 @@
 // Copyright (C) 2018 MS-Cheminformatics LLC
 
+#pragma once
+
+#include "spi_bus.hpp"
+#include "spi_slave.hpp"
 #include <atomic>
 #include <cstdint>
+#include <cstddef>
 
 namespace stm32f103 {
 
@@ -12,6 +17,8 @@ namespace stm32f103 {
 
     class dma;
 
+    constexpr uint32_t spi_max_clock = 18'000'000; //'; fSCK upper limit of SPI1 and SPI2 (datasheet)
+
     class spi {
         volatile SPI * spi_;
         std::atomic_flag lock_;
@@ -25,8 +32,29 @@ namespace stm32f103 {
         uint32_t ss_n_;  // PA4|PB
         uint32_t cr1_;
         dma * dma_;
-        uint32_t dma_channel_;
+        uint32_t dma_channel_;  // RX; TX is the next one on DMA1 for both SPI1 and SPI2
+
+        // DMA block transfer in progress
+        std::atomic< bool > dma_busy_;
+        uint32_t dma_status_;
+        uint32_t cr2_;          // restored on completion
+        uint32_t dummy_;        // sent by a receive-only, and sink of a transmit-only transfer
+        void (*completion_)( void * context );
+        void * context_;
+
+        // slave stream
+        bool streaming_;
+        std::atomic< const void * > preload_;  // waiting for NSS to go high
+        uint32_t preload_count_;
+        uint32_t preloaded_;    // data frames ready for the current NSS low period
+
         void init( SPI_BASE, uint8_t gpio = 0, uint32_t ss_n = 0 );
+        void reconfigure( uint32_t cr1 );
+        static void dma_complete( uint32_t status, void * context );
+        void dma_revoked( uint32_t channel );
+        void arm_preload( const void * tx, uint32_t count );
+        void on_nss();
+        void on_rx_dma();
         template< SPI_BASE > friend struct spi_t;
     public:
         // void init( SPI_BASE, dma& );
@@ -34,7 +62,46 @@ namespace stm32f103 {
         void slave_setup();
 
         inline operator bool () const { return spi_; };
-        
+
+        // SCK; the fastest prescaler that gives no more than 'hz' and spi_max_clock.  Returns the clock set.
+        uint32_t set_speed( uint32_t hz = spi_max_clock );
+        uint32_t speed() const;
+
+        // 8 or 16 bit frame
+        bool set_frame_size( size_t bits );
+        inline size_t frame_size() const { return ( cr1_ & ( 1 << 11 ) ) ? 16 : 8; }
+
+        // DMA block transfer (DMA1 channels 2,3 for SPI1, 4,5 for SPI2); false if the channels are held by other
+        bool attach( dma& );
+        inline bool has_dma() const { return dma_; }
+
+        // 'count' frames, full-duplex; tx = nullptr receives only (sends 0xffff), rx = nullptr transmits only.
+        // Buffers are of uint8_t or uint16_t as frame_size() and must stay valid until completion.  Returns
+        // immediately; 'completion' is called in the DMA interrupt context after the last frame has been received.
+        bool transfer( const void * tx, void * rx, size_t count
+                       , void (*completion)( void * context ) = nullptr, void * context = nullptr );
+        inline bool busy() const { return dma_busy_.load(); }
+        inline uint32_t dma_status() const { return dma_status_; } // DMA ISR bits of the last transfer (TEIF=8)
+
+        // mode, frame size and clock of 'device'; CR1 is written only if they differ.  True if it was.
+        bool configure( const spi_device& );
+        // drive the device's CS pin; true := asserted (low)
+        void select( const spi_device&, bool );
+
+        // multi-device transaction queue on the DMA path (spi_bus.hpp)
+        spi_bus< spi >& bus();
+
+        // slave stream (spi_slave.hpp): the master's data goes into 'ring' of 'count' data frames by circular DMA,
+        // and each NSS (PA4 on SPI1, PB12 on SPI2) low period becomes a spi_frame for slave().receive().  Both DMA
+        // channels are held until listen( nullptr, 0 ).  Up to spi_max_clock with 16 bit frames; NSS has to stay
+        // high for a few microseconds between blocks, for its interrupt to mark the boundary.
+        bool listen( void * ring, size_t count, SPI_MODE mode = SPI_MODE3, size_t frame_size = 16 );
+        inline bool listening() const { return streaming_; }
+        spi_slave_stream& slave();
+
+        // data frames that the master reads during its next NSS low period; 'tx' has to stay valid until then
+        bool preload( const void * tx, size_t count );
+
         spi& operator << ( uint16_t );
         spi& operator >> ( uint16_t& );
         
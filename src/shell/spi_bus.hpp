@@ -0,0 +1,153 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Shared SPI bus for several devices, each with its own mode, frame size, clock and chip select.
+// Transactions are queued and run back-to-back on the DMA path; for each one the bus is reconfigured only
+// if the device's settings differ from the current ones, and the device's CS is asserted around the transfer.
+// SPI provides, as stm32f103::spi does:
+//   bool configure( const spi_device& )     CR1 for the device; true if it had to be changed
+//   void select( const spi_device&, bool )  CS asserted (true) or released
+//   bool transfer( tx, rx, count, void (*)( void * ), void * )
+//   uint32_t dma_status()                   DMA ISR bits of the last transfer
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace stm32f103 {
+
+    enum SPI_MODE : uint8_t {
+        SPI_MODE0                    // CPOL = 0, CPHA = 0
+        , SPI_MODE1                  // CPOL = 0, CPHA = 1
+        , SPI_MODE2                  // CPOL = 1, CPHA = 0
+        , SPI_MODE3                  // CPOL = 1, CPHA = 1
+    };
+
+    struct spi_device {
+        uint8_t cs_port;             // 'A', 'B' or 'C', push-pull output, active low; 0 := none (hardware NSS)
+        uint8_t cs_pin;
+        SPI_MODE mode;
+        uint8_t frame_size;          // 8 or 16
+        uint32_t speed;              // SCK upper limit, Hz
+    };
+
+    struct spi_transaction {
+        const spi_device * device;
+        const void * tx;                              // nullptr := receive only
+        void * rx;                                    // nullptr := transmit only
+        size_t count;                                 // frames
+        void (*completion)( spi_transaction& );       // called from ISR, before 'done' is set
+        void * context;
+        uint32_t status;                              // DMA ISR bits; TEIF (0x08) on error, ~0 if not started
+        std::atomic< bool > done;
+
+        constexpr spi_transaction( const spi_device * _device = nullptr
+                                   , const void * _tx = nullptr, void * _rx = nullptr, size_t _count = 0
+                                   , void (*_completion)( spi_transaction& ) = nullptr, void * _context = nullptr )
+            : device( _device ), tx( _tx ), rx( _rx ), count( _count )
+            , completion( _completion ), context( _context ), status( 0 ), done( false ) {
+        }
+
+        inline bool failed() const { return status & 0x08; }
+    };
+
+    struct spi_bus_statistics {
+        uint32_t transactions;
+        uint32_t failed;
+        uint32_t reconfigured;       // CR1 rewritten for a device change
+    };
+
+    template< typename SPI >
+    class spi_bus {
+    public:
+        static constexpr size_t queue_depth = 8;  // power of 2
+
+    private:
+        SPI * spi_;
+        std::array< spi_transaction *, queue_depth > queue_;
+        std::atomic< uint32_t > head_;  // current (running) transaction
+        std::atomic< uint32_t > tail_;  // next free slot
+        std::atomic< bool > busy_;      // a transaction owns the bus
+        spi_bus_statistics stat_;
+
+        inline spi_transaction& current() { return *queue_[ head_.load() % queue_depth ]; }
+
+        void start() {
+            auto& t = current();
+            if ( spi_->configure( *t.device ) )
+                ++stat_.reconfigured;
+            spi_->select( *t.device, true );
+            if ( !spi_->transfer( t.tx, t.rx, t.count, &on_transfer, this ) )
+                finish( ~0u );          // the SPI is in use outside of the bus
+        }
+
+        // start the transaction at head if the bus is free; called from both thread (submit) and ISR (completion)
+        void kick() {
+            while ( head_.load() != tail_.load() ) {
+                bool expected = false;
+                if ( !busy_.compare_exchange_strong( expected, true ) )
+                    return;             // running transaction's completion will pick it up
+                if ( head_.load() != tail_.load() ) {
+                    start();
+                    return;
+                }
+                busy_ = false;          // drained between the check and the claim
+            }
+        }
+
+        void finish( uint32_t status ) {
+            auto& t = current();
+            spi_->select( *t.device, false );
+            t.status = status;
+            ++stat_.transactions;
+            if ( t.failed() )
+                ++stat_.failed;
+            head_ = head_.load() + 1;   // release the slot
+            busy_ = false;
+            kick();                     // next transaction goes first, then notify
+            if ( t.completion )
+                t.completion( t );
+            t.done = true;
+        }
+
+        static void on_transfer( void * context ) {
+            auto& self = *reinterpret_cast< spi_bus * >( context );
+            self.finish( self.spi_->dma_status() );
+        }
+
+    public:
+        constexpr spi_bus() : spi_( nullptr ), queue_{}, head_( 0 ), tail_( 0 ), busy_( false ), stat_{ 0, 0, 0 } {
+        }
+
+        void init( SPI * spi ) { spi_ = spi; }
+
+        // 't' and its buffers must stay alive until t.done; thread context
+        bool submit( spi_transaction& t ) {
+            if ( spi_ == nullptr || t.device == nullptr || t.count == 0 || ( t.tx == nullptr && t.rx == nullptr ) )
+                return false;
+            uint32_t tail = tail_.load();
+            if ( tail - head_.load() >= queue_depth )
+                return false;
+            t.done = false;
+            t.status = 0;
+            queue_[ tail % queue_depth ] = &t;
+            tail_ = tail + 1;  // publish
+            kick();
+            return true;
+        }
+
+        inline bool busy() const { return busy_.load(); }
+        inline size_t pending() const { return tail_.load() - head_.load(); }
+
+        const spi_bus_statistics& stat() const { return stat_; }
+        void clear_stat() { stat_ = spi_bus_statistics{ 0, 0, 0 }; }
+    };
+
+}
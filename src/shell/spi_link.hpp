@@ -0,0 +1,219 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// Framed link between two SPI ends (two boards, or SPI1 and SPI2 of one board wired back to back).
+// Every exchange is one full-duplex transfer of frame_size bytes each way; the master's frame goes out by
+// transfer(), the slave's has been preloaded (spi::preload) and comes back at the same time.  Each end builds
+// its next frame with build() and hands the one it got to parse(); which end is the master does not matter here.
+//
+//   offset  0  magic (0xa5)
+//           1  flags (DATA, NAK)
+//           2  seq      sequence number of the data frame
+//           3  ack      next sequence number expected from the peer; acknowledges all before it
+//           4  credit   frames the sender can take from 'ack' on (free receive buffers)
+//           5  reserved
+//           6  length   payload bytes, little endian
+//           8  payload
+//    8+length  CRC-16/CCITT (0x1021, init 0xffff) of header and payload, little endian
+//
+// A data frame is sent only while the peer has credit for it; otherwise the frame carries ack and credit alone.
+// The receiver takes data frames in sequence only.  A frame failing the CRC is dropped and NAKed; the sender
+// then goes back to the oldest unacknowledged frame, as it does when no ack has come for retransmit_after
+// exchanges (Go-Back-N within the window).
+// Not reentrant; both build() and parse() of an end run in one context.
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace stm32f103 {
+
+    struct spi_link_statistics {
+        uint32_t exchanges;       // frames parsed
+        uint32_t sent;            // data frames sent, retransmissions included
+        uint32_t received;        // data frames taken in sequence
+        uint32_t bytes;           // payload bytes taken in sequence
+        uint32_t crc_errors;      // bad magic, length or CRC
+        uint32_t out_of_sequence; // data frames dropped as duplicate or ahead of a lost one
+        uint32_t retransmits;     // go-back events
+        uint32_t no_credit;       // data waiting while the peer had no room
+    };
+
+    class spi_link {
+    public:
+        static constexpr size_t frame_size = 64;                       // bytes on the wire, either way
+        static constexpr size_t header_size = 8;
+        static constexpr size_t max_payload = frame_size - header_size - 2;
+        static constexpr size_t window = 4;                           // transmit and receive buffers
+        static constexpr size_t retransmit_after = 4;                 // exchanges without progress
+        static constexpr uint8_t magic = 0xa5;
+
+        enum : uint8_t { DATA = 1, NAK = 2 };
+
+    private:
+        struct buffer {
+            uint16_t length;
+            std::array< uint8_t, max_payload > data;
+        };
+
+        // transmit; sequence numbers modulo 256
+        std::array< buffer, window > tx_;
+        uint8_t queued_;          // next sequence number to be given by send()
+        uint8_t next_;            // next sequence number to go on the wire
+        uint8_t acked_;           // oldest unacknowledged
+        uint8_t peer_credit_;
+        uint8_t stall_;
+        // receive
+        std::array< buffer, window > rx_;
+        uint8_t expected_;
+        uint8_t rx_head_;
+        uint8_t rx_tail_;
+        bool nak_;
+        spi_link_statistics stat_;
+
+        static inline void put16( uint8_t * p, uint16_t v ) { p[ 0 ] = uint8_t( v ); p[ 1 ] = uint8_t( v >> 8 ); }
+        static inline uint16_t get16( const uint8_t * p ) { return uint16_t( p[ 0 ] | p[ 1 ] << 8 ); }
+
+        inline uint8_t in_flight() const { return uint8_t( next_ - acked_ ); }
+        inline uint8_t free_buffers() const { return uint8_t( window - uint8_t( rx_tail_ - rx_head_ ) ); }
+
+    public:
+        constexpr spi_link() : tx_{}, queued_( 0 ), next_( 0 ), acked_( 0 ), peer_credit_( 0 ), stall_( 0 )
+                             , rx_{}, expected_( 0 ), rx_head_( 0 ), rx_tail_( 0 ), nak_( false )
+                             , stat_{ 0, 0, 0, 0, 0, 0, 0, 0 } {
+        }
+
+        // both ends have to be reset together
+        void reset() {
+            queued_ = next_ = acked_ = 0;
+            peer_credit_ = stall_ = 0;
+            expected_ = rx_head_ = rx_tail_ = 0;
+            nak_ = false;
+            clear_stat();
+        }
+
+        static uint16_t crc16( const uint8_t * p, size_t size, uint16_t crc = 0xffff ) {
+            while ( size-- ) {
+                crc ^= uint16_t( *p++ ) << 8;
+                for ( int i = 0; i < 8; ++i )
+                    crc = ( crc & 0x8000 ) ? uint16_t( ( crc << 1 ) ^ 0x1021 ) : uint16_t( crc << 1 );
+            }
+            return crc;
+        }
+
+        // queue a payload; false if the window is full or it is too long
+        bool send( const void * data, size_t size ) {
+            if ( size > max_payload || uint8_t( queued_ - acked_ ) >= window )
+                return false;
+            auto& b = tx_[ queued_ % window ];
+            auto src = reinterpret_cast< const uint8_t * >( data );
+            for ( size_t i = 0; i < size; ++i )
+                b.data[ i ] = src[ i ];
+            b.length = uint16_t( size );
+            ++queued_;
+            return true;
+        }
+
+        // payloads queued and not yet acknowledged
+        inline size_t unacknowledged() const { return uint8_t( queued_ - acked_ ); }
+
+        // the oldest payload taken in sequence; returns its length, 0 if none
+        size_t receive( void * data, size_t max ) {
+            if ( rx_head_ == rx_tail_ )
+                return 0;
+            const auto& b = rx_[ rx_head_ % window ];
+            const size_t size = b.length < max ? b.length : max;
+            auto dst = reinterpret_cast< uint8_t * >( data );
+            for ( size_t i = 0; i < size; ++i )
+                dst[ i ] = b.data[ i ];
+            ++rx_head_;
+            return size;
+        }
+
+        // the next frame to go out; frame_size bytes
+        void build( void * frame ) {
+            auto p = reinterpret_cast< uint8_t * >( frame );
+            uint16_t length = 0;
+            p[ 1 ] = nak_ ? NAK : 0;
+            p[ 2 ] = next_;
+            if ( next_ != queued_ ) {
+                if ( in_flight() < peer_credit_ ) {
+                    const auto& b = tx_[ next_ % window ];
+                    length = b.length;
+                    for ( size_t i = 0; i < length; ++i )
+                        p[ header_size + i ] = b.data[ i ];
+                    p[ 1 ] |= DATA;
+                    ++next_;
+                    ++stat_.sent;
+                } else {
+                    ++stat_.no_credit;
+                }
+            }
+            p[ 0 ] = magic;
+            p[ 3 ] = expected_;
+            p[ 4 ] = free_buffers();
+            p[ 5 ] = 0;
+            put16( p + 6, length );
+            put16( p + header_size + length, crc16( p, header_size + length ) );
+            nak_ = false;
+        }
+
+        // the frame that came in; frame_size bytes
+        void parse( const void * frame ) {
+            auto p = reinterpret_cast< const uint8_t * >( frame );
+            ++stat_.exchanges;
+            const uint16_t length = get16( p + 6 );
+            if ( p[ 0 ] != magic || length > max_payload
+                 || get16( p + header_size + length ) != crc16( p, header_size + length ) ) {
+                ++stat_.crc_errors;
+                nak_ = true;
+                return;
+            }
+
+            // acknowledgement and credit
+            const uint8_t ack = p[ 3 ];
+            if ( ack != acked_ && uint8_t( ack - acked_ ) <= unacknowledged() ) {
+                if ( uint8_t( ack - acked_ ) > in_flight() )
+                    next_ = ack;        // acknowledged what had been sent before going back
+                acked_ = ack;
+                stall_ = 0;
+            } else if ( in_flight() && ++stall_ >= retransmit_after ) {
+                next_ = acked_;
+                stall_ = 0;
+                ++stat_.retransmits;
+            }
+            peer_credit_ = p[ 4 ];
+            if ( ( p[ 1 ] & NAK ) && in_flight() ) {
+                next_ = acked_;
+                stall_ = 0;
+                ++stat_.retransmits;
+            }
+
+            // data
+            if ( p[ 1 ] & DATA ) {
+                if ( p[ 2 ] != expected_ || free_buffers() == 0 ) {
+                    ++stat_.out_of_sequence;
+                    return;
+                }
+                auto& b = rx_[ rx_tail_ % window ];
+                for ( size_t i = 0; i < length; ++i )
+                    b.data[ i ] = p[ header_size + i ];
+                b.length = length;
+                ++rx_tail_;
+                ++expected_;
+                ++stat_.received;
+                stat_.bytes += length;
+            }
+        }
+
+        const spi_link_statistics& stat() const { return stat_; }
+        void clear_stat() { stat_ = spi_link_statistics{ 0, 0, 0, 0, 0, 0, 0, 0 }; }
+    };
+
+}
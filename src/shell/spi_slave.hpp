@@ -0,0 +1,147 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// Bookkeeping of the SPI slave stream (spi::listen).
+// The receive DMA channel runs in circular mode over a ring of data frames (8 or 16 bit); the driver calls
+// update() from its half/complete interrupts, and end_of_frame() on the rising edge of NSS, both with the
+// channel's CNDTR.  Each NSS low period becomes a spi_frame in a queue that the thread takes with receive(),
+// and copies out with copy().  Nothing is copied in the interrupt; a frame the master has overwritten before
+// the thread got to it is counted as an overrun and skipped.
+// update() has to be called at least once per half ring, which the half transfer interrupt guarantees.
+// This header has no target dependency, so that it can be compiled on host as well.
+
+namespace stm32f103 {
+
+    struct spi_frame {
+        uint32_t offset;          // data frames received before this one; ring index is offset % size
+        uint32_t count;           // data frames within the NSS low period
+    };
+
+    struct spi_slave_statistics {
+        uint32_t frames;          // NSS framed blocks
+        uint32_t received;        // data frames
+        uint32_t overrun;         // blocks overwritten in the ring before they were taken (thread)
+        uint32_t dropped;         // blocks lost as the frame queue was full (ISR)
+        uint32_t spi_overrun;     // OVR; DR was not read by the DMA in time (ISR)
+        uint32_t underrun;        // the master clocked out more than was preloaded (ISR)
+    };
+
+    class spi_slave_stream {
+    public:
+        static constexpr size_t frame_queue = 16;  // power of 2
+
+    private:
+        const uint8_t * ring_;
+        size_t size_;                              // data frames
+        size_t width_;                             // bytes per data frame
+        uint32_t position_;                        // ring index as of the last update; ISR only
+        uint32_t start_;                           // written_ at the last NSS rising edge; ISR only
+        std::atomic< uint32_t > written_;          // data frames received
+        std::array< spi_frame, frame_queue > frames_;
+        std::atomic< uint32_t > head_;             // next to take; thread only
+        std::atomic< uint32_t > tail_;             // next free slot; ISR only
+        spi_slave_statistics stat_;
+
+        inline bool overwritten( const spi_frame& f ) const { return written_.load() - f.offset > size_; }
+
+    public:
+        constexpr spi_slave_stream() : ring_( nullptr ), size_( 0 ), width_( 1 ), position_( 0 ), start_( 0 ), written_( 0 )
+                                     , frames_{}, head_( 0 ), tail_( 0 ), stat_{ 0, 0, 0, 0, 0, 0 } {
+        }
+
+        void init( const void * ring, size_t size, size_t width ) {
+            ring_ = reinterpret_cast< const uint8_t * >( ring );
+            size_ = size;
+            width_ = width;
+            position_ = 0;
+            start_ = 0;
+            written_ = 0;
+            head_ = 0;
+            tail_ = 0;
+            stat_ = spi_slave_statistics{ 0, 0, 0, 0, 0, 0 };
+        }
+
+        inline size_t size() const { return size_; }
+        inline uint32_t written() const { return written_.load(); }
+
+        // ISR; 'remaining' is CNDTR of the receive channel, which counts down from size to 1 and reloads
+        void update( uint32_t remaining ) {
+            if ( size_ == 0 )
+                return;
+            const uint32_t position = uint32_t( ( size_ - remaining ) % size_ );
+            written_ = written_.load() + uint32_t( ( position + size_ - position_ ) % size_ );
+            position_ = position;
+        }
+
+        // ISR, NSS rising edge; 'preloaded' is the number of data frames made ready for the master to read
+        // during this block, 0 if none
+        void end_of_frame( uint32_t remaining, uint32_t preloaded ) {
+            update( remaining );
+            const uint32_t written = written_.load();
+            const uint32_t count = written - start_;
+            const uint32_t offset = start_;
+            start_ = written;
+            if ( count == 0 )
+                return;                            // NSS toggled with no clock
+            ++stat_.frames;
+            stat_.received += count;
+            if ( preloaded && preloaded < count )
+                ++stat_.underrun;
+            const uint32_t tail = tail_.load();
+            if ( tail - head_.load() >= frame_queue ) {
+                ++stat_.dropped;
+                return;
+            }
+            frames_[ tail % frame_queue ] = spi_frame{ offset, count };
+            tail_ = tail + 1;                      // publish
+        }
+
+        inline void spi_overrun() { ++stat_.spi_overrun; }
+
+        // thread; the oldest block that is still in the ring
+        bool receive( spi_frame& f ) {
+            while ( head_.load() != tail_.load() ) {
+                const uint32_t head = head_.load();
+                f = frames_[ head % frame_queue ];
+                head_ = head + 1;
+                if ( !overwritten( f ) )
+                    return true;
+                ++stat_.overrun;
+            }
+            return false;
+        }
+
+        inline size_t pending() const { return tail_.load() - head_.load(); }
+
+        // thread; copies up to 'max' data frames of 'f' to 'dst'.  Returns the number copied, or 0 if the master
+        // has overwritten them meanwhile.
+        size_t copy( const spi_frame& f, void * dst, size_t max ) {
+            const size_t count = f.count < max ? f.count : max;
+            const size_t index = f.offset % size_;
+            const size_t first = ( index + count <= size_ ) ? count : size_ - index;
+            auto p = reinterpret_cast< uint8_t * >( dst );
+            for ( size_t i = 0; i < first * width_; ++i )
+                *p++ = ring_[ index * width_ + i ];
+            for ( size_t i = 0; i < ( count - first ) * width_; ++i )
+                *p++ = ring_[ i ];
+            if ( overwritten( f ) ) {
+                ++stat_.overrun;
+                return 0;
+            }
+            return count;
+        }
+
+        const spi_slave_statistics& stat() const { return stat_; }
+    };
+
+}
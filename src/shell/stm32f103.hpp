@@ -31,12 +31,15 @@ namespace stm32f103 {  // as known as Blue Pill
         , FLASH_BASE      = 0x40022000 // ( AHBPERIPH_BASE + 0x2000 )  // FLASH base address is 0x40022000
         , APB2PERIPH_BASE = 0x40010000 // ( PERIPH_BASE + 0x10000 )
         , AFIO_BASE       = 0x40010000 // ( APB2PERIPH_BASE + 0x0000 ) //  AFIO base address is 0x40010000
+        , EXTI_BASE       = 0x40010400 // ( APB2PERIPH_BASE + 0x0400 ) //  EXTI base address is 0x40010400
         , BKP_BASE        = 0x40006C00 // Backup registers, p51; Section 6.4.5 on page 84
         , PWR_BASE        = 0x40007000 // Power control; Section 5.4.3 on page 79
         , ADC1_BASE	      = 0x40012400  // Table 3. p50, RM0008, Rev 17
         , ADC2_BASE	      = 0x40012800
         , SYSTICK_BASE	  = 0xe000e010
         , SCB_BASE        = 0xe000ed00  // PM0056 p148 4.4.15
+        , DWT_BASE        = 0xe0001000  // ARMv7-M ARM, C1.8 Data Watchpoint and Trace unit
+        , DEMCR_BASE      = 0xe000edfc  // ARMv7-M ARM, C1.6.5 Debug Exception and Monitor Control Register
         , NVIC_BASE       = 0xe000e100
     };
 
@@ -168,6 +171,16 @@ namespace stm32f103 {  // as known as Blue Pill
         uint32_t MAPR2;     /* Address offset: 0x18 */
     } AFIO_type;
 
+    // p211, RM0008, Table 63 (EXTI register map)
+    typedef struct EXTI {
+        uint32_t IMR;       /* Address offset: 0x00 */
+        uint32_t EMR;       /* Address offset: 0x04 */
+        uint32_t RTSR;      /* Address offset: 0x08 */
+        uint32_t FTSR;      /* Address offset: 0x0C */
+        uint32_t SWIER;     /* Address offset: 0x10 */
+        uint32_t PR;        /* Address offset: 0x14 */
+    } EXTI_type;
+
     // p674, RM0008, p695 Table 181 (register map)
     // p685, CAN_TIxR where x = 0..2
     struct CAN_TxMailBox {
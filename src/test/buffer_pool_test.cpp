@@ -0,0 +1,120 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Stress test of stm32f103::buffer_pool (buffer_pool.hpp) with host threads standing in for interrupt handlers.
+// Each thread allocates blocks of random size, fills them with its own pattern, and either releases them
+// or hands them to the next thread through a mailbox (retain by the producer's reference, release by the
+// consumer).  A block seen by two owners at once shows up as a broken pattern.
+//   buffer_pool_test
+
+#include "buffer_pool.hpp"
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+typedef stm32f103::buffer_pool< stm32f103::block_class< 64, 8 >
+                                , stm32f103::block_class< 256, 4 >
+                                , stm32f103::block_class< 1024, 4 > > pool_type;
+
+static pool_type __pool;
+
+constexpr size_t number_of_threads = 8;
+constexpr size_t iterations = 200000;
+
+struct mailbox {
+    std::atomic< uint8_t * > block;
+    size_t size;
+    uint8_t pattern;
+};
+
+static mailbox __mailbox[ number_of_threads ];
+static std::atomic< uint32_t > __errors;
+
+static bool
+check( const uint8_t * p, size_t size, uint8_t pattern )
+{
+    for ( size_t i = 0; i < size; ++i )
+        if ( p[ i ] != pattern )
+            return false;
+    return true;
+}
+
+static void
+worker( size_t id )
+{
+    std::mt19937 gen( uint32_t( id + 1 ) );
+    auto& inbox = __mailbox[ id ];
+    auto& outbox = __mailbox[ ( id + 1 ) % number_of_threads ];
+    std::vector< std::pair< uint8_t *, size_t > > held;
+
+    for ( size_t i = 0; i < iterations; ++i ) {
+        // take what the previous thread handed over
+        if ( auto p = inbox.block.load( std::memory_order_acquire ) ) {
+            if ( !check( p, inbox.size, inbox.pattern ) )
+                ++__errors;
+            inbox.block.store( nullptr, std::memory_order_release );
+            __pool.release( p );
+        }
+
+        size_t size = 1 + gen() % pool_type::max_size;
+        if ( auto p = __pool.allocate( size ) ) {
+            if ( __pool.capacity( p ) < size || __pool.use_count( p ) != 1 )
+                ++__errors;
+            const uint8_t pattern = uint8_t( id * 31 + i );
+            std::memset( p, pattern, size );
+            held.emplace_back( p, size );
+            if ( !check( p, size, pattern ) )
+                ++__errors;
+
+            if ( gen() & 1 && outbox.block.load( std::memory_order_acquire ) == nullptr ) {
+                __pool.retain( p );      // shared by this thread and the next one
+                outbox.size = size;
+                outbox.pattern = pattern;
+                outbox.block.store( p, std::memory_order_release );
+            }
+        }
+        // release in random order, keeping at most 3 blocks
+        while ( held.size() > ( gen() % 4 ) ) {
+            size_t k = gen() % held.size();
+            __pool.release( held[ k ].first );
+            held[ k ] = held.back();
+            held.pop_back();
+        }
+    }
+    for ( auto& h: held )
+        __pool.release( h.first );
+}
+
+int
+main()
+{
+    std::vector< std::thread > threads;
+    for ( size_t id = 0; id < number_of_threads; ++id )
+        threads.emplace_back( worker, id );
+    for ( auto& t: threads )
+        t.join();
+    for ( auto& m: __mailbox ) {
+        if ( auto p = m.block.load() )
+            __pool.release( p );
+    }
+
+    uint32_t allocated = 0, exhausted = 0;
+    bool leak = false;
+    __pool.for_each( [&]( size_t size, size_t count, const stm32f103::pool_statistics& st ){
+            std::cout << size << "x" << count << "\tallocated: " << st.allocated << "\texhausted: " << st.exhausted
+                      << "\tin use: " << st.in_use << "\thigh water: " << st.high_water << std::endl;
+            allocated += st.allocated;
+            exhausted += st.exhausted;
+            leak |= st.in_use != 0 || st.high_water > count;
+        } );
+
+    const bool ok = __errors == 0 && !leak && allocated > 0 && exhausted > 0;
+    std::cout << "buffer_pool_test: " << __errors.load() << " errors, " << ( leak ? "leak" : "no leak" ) << ": "
+              << ( ok ? "passed" : "FAILED" ) << std::endl;
+    return ok ? 0 : 1;
+}
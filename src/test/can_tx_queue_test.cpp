@@ -0,0 +1,102 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Test of stm32f103::can_tx_queue (can_tx_queue.hpp) against a reference of one FIFO per key: push() appends
+// to the FIFO of its key, requeue() (a frame taken back from a mailbox) goes to its front, and top() is the
+// front of the smallest key.  Random push, pop, requeue and erase_if; the arbitration key ordering is checked
+// on a few frames of known bus priority.
+//   can_tx_queue_test
+
+#include "can_tx_queue.hpp"
+#include <deque>
+#include <iostream>
+#include <map>
+#include <random>
+
+using stm32f103::arbitration_key;
+
+struct frame {
+    uint32_t key;
+    uint32_t seq;
+};
+
+constexpr size_t depth = 16;
+constexpr size_t iterations = 200000;
+
+static uint32_t
+check_keys()
+{
+    uint32_t errors = 0;
+    errors += !( arbitration_key( 0x100, false, false ) < arbitration_key( 0x100, false, true ) );       // data over remote
+    errors += !( arbitration_key( 0x100, false, true ) < arbitration_key( 0x100u << 18, true, false ) ); // standard over extended
+    errors += !( arbitration_key( 0x0ff, false, true ) < arbitration_key( 0x100, false, false ) );       // base id first
+    errors += !( arbitration_key( ( 0x100u << 18 ) | 5, true, false ) < arbitration_key( ( 0x100u << 18 ) | 6, true, false ) );
+    errors += !( arbitration_key( ( 0x0ffu << 18 ) | 0x3ffff, true, true ) < arbitration_key( 0x100, false, false ) );
+    return errors;
+}
+
+int
+main()
+{
+    std::mt19937 gen( 1 );
+    stm32f103::can_tx_queue< frame, depth > queue;
+    std::map< uint32_t, std::deque< uint32_t > > ref;
+    size_t ref_size = 0;
+    uint32_t seq = 0, errors = check_keys(), requeued = 0;
+    frame taken = { 0, 0 };
+    bool holding = false;   // 'taken' stands for a frame in a mailbox
+
+    for ( size_t i = 0; i < iterations; ++i ) {
+        const uint32_t op = gen() % 16;
+        if ( op < 7 ) {
+            frame f = { uint32_t( gen() % 6 ), seq++ };
+            if ( queue.push( f ) ) {
+                ref[ f.key ].push_back( f.seq );
+                ++ref_size;
+            } else if ( ref_size != depth ) {
+                ++errors;
+            }
+        } else if ( op < 13 ) {
+            if ( queue.empty() ) {
+                errors += ref_size != 0;
+                continue;
+            }
+            auto it = ref.begin();
+            if ( queue.top().key != it->first || queue.top().seq != it->second.front() )
+                ++errors;
+            if ( !holding && op == 12 ) {
+                taken = queue.top();
+                holding = true;
+            }
+            queue.pop();
+            it->second.pop_front();
+            if ( it->second.empty() )
+                ref.erase( it );
+            --ref_size;
+        } else if ( op < 15 ) {
+            if ( holding && queue.requeue( taken ) ) {
+                ref[ taken.key ].push_front( taken.seq );
+                ++ref_size;
+                ++requeued;
+                holding = false;
+            }
+        } else {
+            const uint32_t key = gen() % 6;
+            const size_t n = queue.erase_if( [&]( const frame& f ){ return f.key == key; } );
+            auto it = ref.find( key );
+            const size_t m = it == ref.end() ? 0 : it->second.size();
+            if ( it != ref.end() )
+                ref.erase( it );
+            errors += n != m;
+            ref_size -= m;
+        }
+        errors += queue.size() != ref_size;
+    }
+
+    const bool ok = errors == 0 && requeued > 0;
+    std::cout << "can_tx_queue_test: " << requeued << " requeued, " << errors << " errors: "
+              << ( ok ? "passed" : "FAILED" ) << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Trigger logic of dsp::triggered_capture (capture.hpp) on recorded streams
+//   capture_test                                            self test on synthetic and randomized streams
+//   capture_test {level|rising|falling} low high pre post < stream.txt
+//                                                           one sample per line; prints the captured window
+
+#include "capture.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+typedef dsp::triggered_capture< uint16_t, 512 > capture_type;
+
+static int __callbacks;
+
+// index of the trigger sample by the definition in capture.hpp, or -1
+static long
+expected_trigger( const std::vector< uint16_t >& x, dsp::trigger_mode mode, uint16_t low, uint16_t high, size_t pre )
+{
+    bool ready = false;
+    for ( size_t i = 0; i < x.size(); ++i ) {
+        bool fire = false;
+        if ( mode == dsp::trigger_level ) {
+            fire = x[ i ] < low || x[ i ] > high;
+        } else if ( mode == dsp::trigger_rising ) {
+            fire = ready && x[ i ] >= high;
+            if ( x[ i ] <= low )
+                ready = true;
+        } else if ( mode == dsp::trigger_falling ) {
+            fire = ready && x[ i ] <= low;
+            if ( x[ i ] >= high )
+                ready = true;
+        }
+        if ( fire ) {
+            ready = false;
+            if ( i >= pre )     // samples before the trigger fill the pre-trigger window
+                return long( i );
+        }
+    }
+    return -1;
+}
+
+// feeds 'x' until the capture is ready; returns the index of the trigger sample, or -1
+static long
+run( capture_type& capture, const std::vector< uint16_t >& x, std::vector< uint16_t >& window )
+{
+    capture.arm();
+    for ( size_t i = 0; i < x.size(); ++i ) {
+        if ( capture.push( x[ i ] ) == dsp::capture_ready ) {
+            window.resize( capture.size() );
+            capture.read( window.data(), window.size() );
+            return long( i + 1 - capture.post() );
+        }
+    }
+    return -1;
+}
+
+static bool
+check( const char * name, dsp::trigger_mode mode, uint16_t low, uint16_t high, size_t pre, size_t post
+       , const std::vector< uint16_t >& x, bool verbose = false )
+{
+    capture_type capture;
+    capture.setup( mode, low, high, pre, post, +[]{ ++__callbacks; } );
+
+    long expected = expected_trigger( x, mode, low, high, pre );
+    if ( expected >= 0 && size_t( expected ) + post > x.size() )
+        expected = -1;  // stream ends before the post-trigger window is complete
+
+    __callbacks = 0;
+    std::vector< uint16_t > window;
+    const long trigger = run( capture, x, window );
+
+    bool ok = trigger == expected && __callbacks == ( trigger >= 0 ? 1 : 0 );
+    if ( ok && trigger >= 0 )
+        ok = std::equal( window.begin(), window.end(), x.begin() + ( trigger - long( pre ) ) );
+    if ( ok && trigger >= 0 ) {     // the same window a few samples at a time, as 'adc capture' prints it
+        uint16_t row[ 7 ];
+        size_t n, i = 0;
+        for ( ; ok && ( n = capture.read( row, 7, i ) ); i += n )
+            ok = std::equal( row, row + n, window.begin() + long( i ) );
+        ok = ok && i == window.size();
+    }
+    if ( !ok || verbose )
+        std::cout << name << "\ttrigger at " << trigger << " (expected " << expected << ")" << ( ok ? "\tok" : "\tFAILED" ) << std::endl;
+    return ok;
+}
+
+static bool
+self_test()
+{
+    bool ok = true;
+    std::vector< uint16_t > ramp( 2000 );
+    for ( size_t i = 0; i < ramp.size(); ++i )
+        ramp[ i ] = uint16_t( 500 + i );
+    ok &= check( "level ramp", dsp::trigger_level, 100, 1000, 16, 32, ramp, true );
+
+    std::vector< uint16_t > high( 100, 2000 );     // out of range from the first sample; waits for pre samples
+    ok &= check( "level pre", dsp::trigger_level, 100, 1000, 8, 8, high, true );
+
+    // square wave with chatter inside the hysteresis band; one edge per period
+    std::vector< uint16_t > square;
+    for ( int period = 0; period < 8; ++period ) {
+        for ( uint16_t v: { 100, 1050, 1150, 1050, 3000, 3000, 1050, 1150, 1050, 100, 100, 100 } )
+            square.emplace_back( v );
+    }
+    ok &= check( "rising chatter", dsp::trigger_rising, 1000, 1100, 20, 12, square, true );
+    ok &= check( "falling chatter", dsp::trigger_falling, 1000, 1100, 20, 12, square, true );
+
+    // external; accepted only once the pre-trigger window is filled
+    do {
+        capture_type capture;
+        capture.setup( dsp::trigger_external, 0, 0, 10, 5 );
+        capture.arm();
+        bool ext = !capture.trigger();                   // too early
+        for ( uint16_t i = 0; i < 40; ++i ) {
+            if ( i == 30 )
+                ext &= capture.trigger();
+            capture.push( i );
+        }
+        std::vector< uint16_t > window( capture.size() );
+        ext &= capture.state() == dsp::capture_ready && capture.read( window.data(), window.size() ) == 15
+            && window.front() == 20 && window.back() == 34;
+        std::cout << "external" << ( ext ? "\tok" : "\tFAILED" ) << std::endl;
+        ok &= ext;
+    } while ( 0 );
+
+    // randomized recorded streams: random walk with random thresholds and windows
+    std::mt19937 gen( 20180403 );
+    size_t failed = 0;
+    for ( int trial = 0; trial < 10000; ++trial ) {
+        std::vector< uint16_t > x( 1 + gen() % 3000 );
+        int v = gen() % 4096;
+        for ( auto& s: x ) {
+            v = std::min( 4095, std::max( 0, v + int( gen() % 129 ) - 64 ) );
+            s = uint16_t( v );
+        }
+        uint16_t low = gen() % 4096, high = gen() % 4096;
+        if ( low > high )
+            std::swap( low, high );
+        const size_t post = 1 + gen() % 256;
+        const size_t pre = gen() % ( 512 - post + 1 );
+        const auto mode = dsp::trigger_mode( gen() % 3 );
+        failed += !check( "random", mode, low, high, pre, post, x );
+    }
+    std::cout << "randomized streams\t" << ( failed ? "FAILED" : "ok" ) << std::endl;
+    return ok && failed == 0;
+}
+
+int
+main( int argc, char ** argv )
+{
+    if ( argc == 1 )
+        return self_test() ? 0 : 1;
+
+    const char * modes[] = { "level", "rising", "falling" };
+    if ( argc == 6 ) {
+        for ( int m = 0; m < 3; ++m ) {
+            if ( std::strcmp( argv[ 1 ], modes[ m ] ) )
+                continue;
+            std::vector< uint16_t > x;
+            long v;
+            while ( std::cin >> v )
+                x.emplace_back( uint16_t( v ) );
+            const size_t pre = std::strtoul( argv[ 4 ], nullptr, 0 ), post = std::strtoul( argv[ 5 ], nullptr, 0 );
+            capture_type capture;
+            if ( !capture.setup( dsp::trigger_mode( m ), std::atoi( argv[ 2 ] ), std::atoi( argv[ 3 ] ), pre, post ) ) {
+                std::cerr << "pre + post must be <= " << capture_type::capacity() << std::endl;
+                return 1;
+            }
+            std::vector< uint16_t > window;
+            const long trigger = run( capture, x, window );
+            if ( trigger < 0 ) {
+                std::cout << "no trigger" << std::endl;
+                return 1;
+            }
+            for ( size_t i = 0; i < window.size(); ++i )
+                std::cout << long( i ) - long( pre ) + trigger << "\t" << window[ i ] << std::endl;
+            return 0;
+        }
+    }
+    std::cerr << "usage: " << argv[ 0 ] << " [{level|rising|falling} low high pre post < stream.txt]" << std::endl;
+    return 1;
+}
@@ -0,0 +1,85 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Q31/Q15 FFT against a double precision DFT, and find_peaks corner cases
+
+#include "fft.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+template< typename T, size_t N >
+static double
+fft_error( std::mt19937& gen )
+{
+    constexpr double scale = double( typename dsp::q_traits< T >::acc_type( 1 ) << dsp::q_traits< T >::fraction_bits );
+    std::uniform_real_distribution< double > dist( -0.49, 0.49 );   // |x| < 0.5, see fft.hpp
+
+    std::vector< T > re( N ), im( N );
+    std::vector< double > x( N ), y( N );
+    for ( size_t n = 0; n < N; ++n ) {
+        re[ n ] = dsp::to_q< T >( dist( gen ) );
+        im[ n ] = dsp::to_q< T >( dist( gen ) );
+        x[ n ] = re[ n ] / scale;
+        y[ n ] = im[ n ] / scale;
+    }
+
+    dsp::fft< T, N >::transform( re.data(), im.data() );
+
+    double error = 0;
+    for ( size_t k = 0; k < N; ++k ) {
+        double xr = 0, xi = 0;
+        for ( size_t n = 0; n < N; ++n ) {
+            const double w = 2 * M_PI * double( ( k * n ) % N ) / N;
+            xr += x[ n ] * std::cos( w ) + y[ n ] * std::sin( w );
+            xi += y[ n ] * std::cos( w ) - x[ n ] * std::sin( w );
+        }
+        error = std::max( error, std::abs( re[ k ] / scale - xr / N ) );
+        error = std::max( error, std::abs( im[ k ] / scale - xi / N ) );
+    }
+    return error;  // relative to full scale
+}
+
+template< typename T, size_t N >
+static bool
+check_fft( std::mt19937& gen, double limit, const char * name )
+{
+    double error = 0;
+    for ( int i = 0; i < 16; ++i )
+        error = std::max( error, fft_error< T, N >( gen ) );
+    const bool ok = error < limit;
+    std::cout << name << " N=" << N << "\tmax error " << error << " (limit " << limit << ")"
+              << ( ok ? "\tok" : "\tFAILED" ) << std::endl;
+    return ok;
+}
+
+static bool
+check_peaks()
+{
+    const uint32_t spectrum[] = { 0, 5, 1, 9, 2, 7, 3, 3, 8, 0 };
+    dsp::spectral_line lines[ 4 ] = {};
+    bool ok = dsp::find_peaks( spectrum, 10, lines, 0 ) == 0;
+    ok &= dsp::find_peaks( spectrum, 10, lines, 1 ) == 1 && lines[ 0 ].bin == 3;
+    ok &= dsp::find_peaks( spectrum, 10, lines, 4 ) == 4
+        && lines[ 0 ].bin == 3 && lines[ 1 ].bin == 8 && lines[ 2 ].bin == 5 && lines[ 3 ].bin == 1;
+    std::cout << "find_peaks" << ( ok ? "\tok" : "\tFAILED" ) << std::endl;
+    return ok;
+}
+
+int
+main()
+{
+    std::mt19937 gen( 20180401 );
+    bool ok = true;
+    // each of log2(N) stages truncates by 1/2 LSB
+    ok &= check_fft< dsp::q31_t, 64 >( gen, 1e-7, "q31" );
+    ok &= check_fft< dsp::q31_t, 256 >( gen, 1e-7, "q31" );
+    ok &= check_fft< dsp::q31_t, 1024 >( gen, 1e-7, "q31" );
+    ok &= check_fft< dsp::q15_t, 256 >( gen, 5e-4, "q15" );
+    ok &= check_peaks();
+    return ok ? 0 : 1;
+}
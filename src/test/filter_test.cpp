@@ -0,0 +1,168 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Bit exact tests of the Q15/Q31 FIR and biquad cascade (filter.hpp):
+//   golden vectors worked out by hand from the definition, saturation included
+//   randomized input, full scale included, against a plain reference of the same arithmetic
+
+#include "filter.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+template< typename T >
+static T
+reference_saturate( int64_t a )
+{
+    return a > dsp::q_traits< T >::max() ? dsp::q_traits< T >::max()
+        : a < dsp::q_traits< T >::min() ? dsp::q_traits< T >::min() : T( a );
+}
+
+// y[n] = sat( sum h[k] x[n-k] >> fraction_bits )
+template< typename T >
+static std::vector< T >
+reference_fir( const std::vector< T >& h, const std::vector< T >& x )
+{
+    std::vector< T > y( x.size() );
+    for ( size_t n = 0; n < x.size(); ++n ) {
+        int64_t acc = 0;
+        for ( size_t k = 0; k < h.size() && k <= n; ++k )
+            acc += int64_t( h[ k ] ) * x[ n - k ];
+        y[ n ] = reference_saturate< T >( acc >> dsp::q_traits< T >::fraction_bits );
+    }
+    return y;
+}
+
+// direct form I per stage, coefficients in Q(fraction_bits - 1), output of each stage saturated
+template< typename T >
+static std::vector< T >
+reference_biquad( const std::vector< dsp::biquad_coefficients< T > >& c, std::vector< T > x )
+{
+    for ( auto& s: c ) {
+        std::vector< T > y( x.size() );
+        for ( size_t n = 0; n < x.size(); ++n ) {
+            int64_t acc = int64_t( s.b0 ) * x[ n ];
+            if ( n >= 1 ) acc += int64_t( s.b1 ) * x[ n - 1 ] - int64_t( s.a1 ) * y[ n - 1 ];
+            if ( n >= 2 ) acc += int64_t( s.b2 ) * x[ n - 2 ] - int64_t( s.a2 ) * y[ n - 2 ];
+            y[ n ] = reference_saturate< T >( acc >> ( dsp::q_traits< T >::fraction_bits - 1 ) );
+        }
+        x = y;
+    }
+    return x;
+}
+
+template< typename T, size_t MAX_TAPS >
+static std::vector< T >
+run_fir( const std::vector< T >& h, const std::vector< T >& x )
+{
+    dsp::fir< T, MAX_TAPS > f;
+    f.set_coefficients( h.data(), h.size() );
+    std::vector< T > y( x.size() );
+    f( x.data(), y.data(), x.size() );
+    return y;
+}
+
+template< typename T, size_t MAX_STAGES >
+static std::vector< T >
+run_biquad( const std::vector< dsp::biquad_coefficients< T > >& c, const std::vector< T >& x )
+{
+    dsp::biquad_cascade< T, MAX_STAGES > f;
+    f.set_coefficients( c.data(), c.size() );
+    std::vector< T > y( x.size() );
+    f( x.data(), y.data(), x.size() );
+    return y;
+}
+
+template< typename T >
+static bool
+report( const char * name, const std::vector< T >& y, const std::vector< T >& expected )
+{
+    size_t i = 0;
+    while ( i < y.size() && y[ i ] == expected[ i ] )
+        ++i;
+    if ( i == y.size() ) {
+        std::cout << name << "\tok" << std::endl;
+        return true;
+    }
+    std::cout << name << "\tFAILED at " << i << ": " << int64_t( y[ i ] ) << " != " << int64_t( expected[ i ] ) << std::endl;
+    return false;
+}
+
+static bool
+golden()
+{
+    bool ok = true;
+    // Q15 FIR, 5 taps (padded to 8 internally)
+    const std::vector< int16_t > h = { 0x1000, 0x2000, 0x4000, 0x2000, 0x1000 };   // 1/8 1/4 1/2 1/4 1/8
+    const std::vector< int16_t > x = { 0x7fff, 0, 0, 0, 0, 0, -0x8000, -0x8000, -0x8000, -0x8000, -0x8000, 0x4000 };
+    const std::vector< int16_t > fir_expected = {
+        0x0fff, 0x1fff, 0x3fff, 0x1fff, 0x0fff, 0, -0x1000, -0x3000, -0x7000, -0x8000, -0x8000, -0x8000 };
+    ok &= report( "fir q15 golden", run_fir< int16_t, 8 >( h, x ), fir_expected );
+
+    // Q15 biquad, y = 0.5 x + 0.5 y[n-1] (b0 = 0.5, a1 = -0.5 in Q14)
+    const std::vector< dsp::biquad_coefficients< int16_t > > c = { { 0x2000, 0, 0, -0x2000, 0 } };
+    const std::vector< int16_t > step( 8, 0x4000 );
+    const std::vector< int16_t > biquad_expected = { 0x2000, 0x3000, 0x3800, 0x3c00, 0x3e00, 0x3f00, 0x3f80, 0x3fc0 };
+    ok &= report( "biquad q15 golden", run_biquad< int16_t, 1 >( c, step ), biquad_expected );
+
+    // Q31 FIR impulse response of 0.5 is h >> 1
+    const std::vector< int32_t > h31 = { 0x12345678, -0x07654321, 0x7fffffff, -0x7fffffff - 1 };
+    std::vector< int32_t > impulse( 6, 0 );
+    impulse[ 0 ] = 0x40000000;
+    const std::vector< int32_t > impulse_expected = { 0x091a2b3c, -0x03b2a191, 0x3fffffff, -0x40000000, 0, 0 };
+    ok &= report( "fir q31 impulse", run_fir< int32_t, 4 >( h31, impulse ), impulse_expected );
+    return ok;
+}
+
+template< typename T, size_t MAX_TAPS, size_t MAX_STAGES >
+static bool
+randomized( std::mt19937& gen, const char * name )
+{
+    std::uniform_int_distribution< int32_t > full( dsp::q_traits< T >::min(), dsp::q_traits< T >::max() );
+    std::uniform_int_distribution< size_t > taps( 1, MAX_TAPS );
+    bool ok = true;
+    for ( int trial = 0; trial < 100 && ok; ++trial ) {
+        std::vector< T > x( 512 );
+        for ( auto& v: x )
+            v = ( trial % 4 == 0 ) ? ( full( gen ) < 0 ? dsp::q_traits< T >::min() : dsp::q_traits< T >::max() ) : T( full( gen ) );
+
+        std::vector< T > h( taps( gen ) );
+        for ( auto& v: h )
+            v = T( full( gen ) >> ( trial % 3 ) );
+        if ( sizeof( T ) == sizeof( int32_t ) ) {   // Q31 headroom of the 64bit accumulator: sum |h| <= 1
+            int64_t sum = 0;
+            for ( auto& v: h )
+                sum += std::abs( int64_t( v ) );
+            for ( auto& v: h )
+                v = T( int64_t( v ) * dsp::q_traits< T >::max() / std::max( sum, int64_t( dsp::q_traits< T >::max() ) ) );
+        }
+        ok &= run_fir< T, MAX_TAPS >( h, x ) == reference_fir( h, x );
+
+        // stable sections: poles inside the unit circle at radius r, angle w
+        std::vector< dsp::biquad_coefficients< T > > c( 1 + trial % MAX_STAGES );
+        std::uniform_real_distribution< double > radius( 0.1, 0.99 ), angle( 0.01, 3.1 ), gain( -0.5, 0.5 );
+        for ( auto& s: c ) {
+            const double r = radius( gen ), w = angle( gen );
+            s = { dsp::to_q< T >( gain( gen ) ), dsp::to_q< T >( gain( gen ) ), dsp::to_q< T >( gain( gen ) )
+                  , dsp::to_q< T >( -r * std::cos( w ) ), dsp::to_q< T >( r * r / 2 ) };
+        }
+        ok &= run_biquad< T, MAX_STAGES >( c, x ) == reference_biquad( c, x );
+    }
+    std::cout << name << ( ok ? "\tok" : "\tFAILED" ) << std::endl;
+    return ok;
+}
+
+int
+main()
+{
+    std::mt19937 gen( 20180402 );
+    bool ok = golden();
+    ok &= randomized< int16_t, 32, 4 >( gen, "fir/biquad q15 randomized" );
+    ok &= randomized< int32_t, 32, 4 >( gen, "fir/biquad q31 randomized" );
+    return ok ? 0 : 1;
+}
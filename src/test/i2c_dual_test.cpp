@@ -0,0 +1,97 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Two i2c_master engines (I2C1, I2C2) with DMA, each on its own register model (i2c_model.hpp), run one
+// bus after the other and with their interrupts and bus ticks randomly interleaved.  Each engine has to
+// complete its own queue with its own DMA port, whatever the other bus does.
+//   i2c_dual_test
+
+#include "i2c_model.hpp"
+#include <iostream>
+#include <random>
+
+using namespace stm32f103;
+using namespace stm32f103::test;
+
+int
+main()
+{
+    std::mt19937 gen( 7 );
+    int errors = 0, transactions = 0;
+    long sequential = 0, interleaved = 0;
+    const i2c_model_master::dma_port * ports[ 2 ] = { &i2c_model_dma_port< 0 >::port, &i2c_model_dma_port< 1 >::port };
+
+    for ( int trial = 0; trial < 4000; ++trial ) {
+        i2c_model m[ 2 ] = { i2c_model( 0x10 ), i2c_model( 0x76 ) };
+        i2c_model_master e[ 2 ];
+        i2c_model_dma_port< 0 >::model = &m[ 0 ];
+        i2c_model_dma_port< 1 >::model = &m[ 1 ];
+
+        uint8_t tx[ 2 ], rx[ 2 ][ 4 ][ 40 ];
+        i2c_transaction t[ 2 ][ 4 ];
+        size_t rxn[ 2 ][ 4 ];
+        for ( int b = 0; b < 2; ++b ) {
+            e[ b ].init( &m[ b ] );
+            e[ b ].set_dma( ports[ b ] );
+            for ( int i = 0; i < 256; ++i )
+                m[ b ].memory.emplace_back( uint8_t( gen() ) );
+            tx[ b ] = uint8_t( gen() );
+            for ( int k = 0; k < 4; ++k ) {
+                rxn[ b ][ k ] = 2 + gen() % 30;
+                new ( &t[ b ][ k ] ) i2c_transaction( m[ b ].slave_address, &tx[ b ], 1, rx[ b ][ k ], rxn[ b ][ k ] );
+            }
+        }
+
+        if ( trial & 1 ) {
+            for ( int b = 0; b < 2; ++b )
+                for ( int k = 0; k < 4; ++k )
+                    e[ b ].submit( t[ b ][ k ] );
+            bool busy[ 2 ] = { true, true };
+            long n = 0;
+            while ( ( busy[ 0 ] || busy[ 1 ] ) && n++ < 400000 ) {
+                const int b = gen() & 1;
+                busy[ b ] = m[ b ].step( e[ b ] );
+                if ( !busy[ b ^ 1 ] )
+                    busy[ b ^ 1 ] = m[ b ^ 1 ].step( e[ b ^ 1 ] );
+            }
+            interleaved += n;
+        } else {
+            for ( int b = 0; b < 2; ++b ) {
+                for ( int k = 0; k < 4; ++k )
+                    e[ b ].submit( t[ b ][ k ] );
+                long n = 0;
+                while ( m[ b ].step( e[ b ] ) && n < 200000 )
+                    ++n;
+                sequential += n;
+            }
+        }
+
+        for ( int b = 0; b < 2; ++b ) {
+            size_t pointer = 0;
+            std::vector< uint8_t > expected;
+            for ( int k = 0; k < 4; ++k ) {
+                ++transactions;
+                bool ok = t[ b ][ k ].done.load() && t[ b ][ k ].result == I2C_RESULT_SUCCESS;
+                for ( size_t i = 0; ok && i < rxn[ b ][ k ]; ++i )
+                    ok = rx[ b ][ k ][ i ] == m[ b ].memory[ pointer + i ];
+                pointer += rxn[ b ][ k ];
+                if ( !ok ) {
+                    std::cout << "trial " << trial << " bus " << b << " #" << k << ": result " << t[ b ][ k ].result << std::endl;
+                    ++errors;
+                }
+                expected.emplace_back( 0xff );
+                expected.emplace_back( tx[ b ] );
+            }
+            if ( expected != m[ b ].written || m[ b ].cr1_hazards ) {
+                std::cout << "trial " << trial << " bus " << b << ": written bytes differ, or CR1 written while STOP pending" << std::endl;
+                ++errors;
+            }
+        }
+    }
+
+    std::cout << "i2c_dual_test: " << transactions << " transactions, steps sequential " << sequential
+              << " interleaved " << interleaved << ", " << errors << " errors: " << ( errors ? "FAILED" : "passed" ) << std::endl;
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,112 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Transaction engine of stm32f103::i2c_master (i2c_master.hpp) against the register model in i2c_model.hpp.
+// Randomized batches of four queued transactions (write, read, write then read on repeated START, and
+// NACKed addresses), by interrupt and by DMA; checks data, results, START/STOP pairing, and that no
+// START is requested while a STOP is pending.  The STOP takes a random number of CR1 reads; one that goes
+// out within finish()'s poll must not leave the next transaction waiting for resume().
+//   i2c_master_test
+
+#include "i2c_model.hpp"
+#include <iostream>
+#include <random>
+
+using namespace stm32f103;
+using namespace stm32f103::test;
+
+int
+main()
+{
+    std::mt19937 gen( 1 );
+    int errors = 0, transactions = 0, deferred = 0, late = 0;
+
+    for ( int use_dma = 0; use_dma < 2; ++use_dma ) {
+        for ( int trial = 0; trial < 3000; ++trial ) {
+            i2c_model m( 0x50 );
+            i2c_model_master e;
+            i2c_model_dma_port< 0 >::model = &m;
+            e.init( &m );
+            m.stop_reads = int( gen() % ( 2 * i2c_model_master::stop_poll ) ) + 1;
+            const bool polled = size_t( m.stop_reads ) <= i2c_model_master::stop_poll;
+            if ( use_dma )
+                e.set_dma( &i2c_model_dma_port< 0 >::port );
+            for ( int i = 0; i < 256; ++i )
+                m.memory.emplace_back( uint8_t( gen() ) );
+
+            uint8_t tx[ 8 ], rx[ 4 ][ 40 ];
+            for ( auto& b: tx )
+                b = uint8_t( gen() );
+            i2c_transaction t[ 4 ];
+            size_t txn[ 4 ], rxn[ 4 ];
+            bool absent[ 4 ];
+            for ( int k = 0; k < 4; ++k ) {
+                txn[ k ] = gen() % 4;
+                rxn[ k ] = gen() % 3 == 0 ? 0 : gen() % 33;
+                if ( txn[ k ] + rxn[ k ] == 0 )
+                    rxn[ k ] = 1;
+                absent[ k ] = gen() % 10 == 0;
+                new ( &t[ k ] ) i2c_transaction( absent[ k ] ? 0x51 : 0x50, tx, txn[ k ], rx[ k ], rxn[ k ] );
+                if ( !e.submit( t[ k ] ) )
+                    ++errors;
+            }
+
+            int steps = 0, waits = 0;
+            while ( m.step( e ) && steps < 100000 ) {
+                if ( e.state() == i2c_model_master::st_stop_wait )
+                    ++waits;
+                ++steps;
+            }
+            if ( polled && waits ) {
+                std::cout << "dma=" << use_dma << " trial " << trial << ": " << waits << " steps in STOP wait, STOP after "
+                          << m.stop_reads << " CR1 reads" << std::endl;
+                ++errors;
+            }
+            deferred += waits;
+            late += !polled;
+
+            size_t pointer = 0;
+            int restarts = 0;
+            std::vector< uint8_t > expected;
+            for ( int k = 0; k < 4; ++k ) {
+                ++transactions;
+                bool ok = t[ k ].done.load();
+                if ( absent[ k ] ) {
+                    ok = ok && t[ k ].result == I2C_TRANSACTION_NACK;
+                } else {
+                    ok = ok && t[ k ].result == I2C_RESULT_SUCCESS;
+                    for ( size_t i = 0; ok && i < rxn[ k ]; ++i )
+                        ok = rx[ k ][ i ] == m.memory[ pointer + i ];
+                    pointer += rxn[ k ];
+                    if ( txn[ k ] ) {
+                        expected.emplace_back( 0xff );
+                        expected.insert( expected.end(), tx, tx + txn[ k ] );
+                        restarts += rxn[ k ] != 0;
+                    }
+                }
+                if ( !ok ) {
+                    std::cout << "dma=" << use_dma << " trial " << trial << " #" << k << " tx=" << txn[ k ] << " rx=" << rxn[ k ]
+                              << ( absent[ k ] ? " absent" : "" ) << ": done=" << t[ k ].done.load() << " result=" << t[ k ].result << std::endl;
+                    ++errors;
+                    break;
+                }
+            }
+            if ( expected != m.written ) {
+                std::cout << "dma=" << use_dma << " trial " << trial << ": written bytes differ" << std::endl;
+                ++errors;
+            }
+            if ( m.stops != m.starts - restarts || m.cr1_hazards || e.state() != i2c_model_master::st_idle ) {
+                std::cout << "dma=" << use_dma << " trial " << trial << ": starts " << m.starts << " stops " << m.stops
+                          << " repeated starts " << restarts << " CR1 writes while STOP pending " << m.cr1_hazards << std::endl;
+                ++errors;
+            }
+        }
+    }
+
+    std::cout << "i2c_master_test: " << transactions << " transactions, " << deferred << " steps in STOP wait ("
+              << late << " trials with a STOP beyond the poll), " << errors << " errors: "
+              << ( errors || deferred == 0 ? "FAILED" : "passed" ) << std::endl;
+    return errors || deferred == 0 ? 1 : 0;
+}
@@ -0,0 +1,302 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+//
+
+#pragma once
+
+#include "i2c_master.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Register level model of an STM32F1 I2C master port with one slave (a register memory) on the bus,
+// for i2c_master< i2c_model > on host.  Register reads and writes have the side effects of RM0008 26.6
+// (SR1 then SR2 clears ADDR, DR access clears RxNE/BTF, ...); tick() moves the bus by one byte time, and
+// a STOP that is ready goes out after 'stop_reads' reads of CR1 as well (the time an ISR polls for it).
+// Reading from the slave streams 'memory' from 'pointer'; bytes written to the slave are appended to
+// 'written', each write phase preceded by a 0xff marker.  A START requested while a STOP is still pending
+// is counted in 'cr1_hazards' (RM0008 26.6.1 forbids any CR1 write then).
+
+namespace stm32f103 {
+namespace test {
+
+    struct i2c_model;
+    typedef i2c_master< i2c_model > i2c_model_master;
+
+    class i2c_model_register {
+        i2c_model * m_;
+        int id_;
+    public:
+        uint32_t value;
+        i2c_model_register( i2c_model * m, int id ) : m_( m ), id_( id ), value( 0 ) {}
+        operator uint32_t ();
+        i2c_model_register& operator = ( uint32_t x );
+        i2c_model_register& operator |= ( uint32_t x ) { return *this = uint32_t( *this ) | x; }
+        i2c_model_register& operator &= ( uint32_t x ) { return *this = uint32_t( *this ) & x; }
+    };
+
+    struct i2c_model {
+        typedef i2c_model_master M;
+        enum register_id { id_cr1, id_cr2, id_dr, id_sr1, id_sr2 };
+        enum phase_type { idle, address, transmit, receive };
+
+        i2c_model_register CR1, CR2, DR, SR1, SR2;
+
+        uint8_t slave_address;
+        std::vector< uint8_t > memory;
+        size_t pointer;
+        std::vector< uint8_t > written;
+
+        phase_type phase;
+        uint32_t sr1;
+        bool sr1_read;          // SR1 read since the last event; first half of the ADDR/SB clear sequences
+        bool master;
+        int dr;                 // transmit: byte waiting in DR; receive: byte received in DR; -1 := empty
+        int shift;              // byte in the shift register
+        bool nack_sent;
+        bool pos_nack_next;
+        int starts;
+        int stops;
+        int cr1_hazards;
+        int stop_reads;         // CR1 reads for a ready STOP to go out
+        int stop_polls;         // CR1 reads since the STOP got ready
+
+        // DMA channels of the port
+        const uint8_t * dma_tx;
+        size_t dma_tx_left;
+        bool dma_tx_done;
+        uint8_t * dma_rx;
+        size_t dma_rx_left;
+        bool dma_rx_done;
+
+        i2c_model( uint8_t address = 0x50 )
+            : CR1( this, id_cr1 ), CR2( this, id_cr2 ), DR( this, id_dr ), SR1( this, id_sr1 ), SR2( this, id_sr2 )
+            , slave_address( address ), pointer( 0 ), phase( idle ), sr1( 0 ), sr1_read( false ), master( false )
+            , dr( -1 ), shift( -1 ), nack_sent( false ), pos_nack_next( false ), starts( 0 ), stops( 0 ), cr1_hazards( 0 )
+            , stop_reads( 8 ), stop_polls( 0 )
+            , dma_tx( nullptr ), dma_tx_left( 0 ), dma_tx_done( false ), dma_rx( nullptr ), dma_rx_left( 0 ), dma_rx_done( false ) {
+            CR1.value = M::CR1_PE;
+        }
+        i2c_model( const i2c_model& ) = delete;  // registers point back to their model
+
+        uint32_t read( int id ) {
+            switch ( id ) {
+            case id_cr1:
+                if ( stop_ready() && ++stop_polls >= stop_reads )
+                    bus_stop();
+                return CR1.value;
+            case id_cr2:
+                return CR2.value;
+            case id_dr: {
+                uint8_t x = uint8_t( dr );
+                dr = -1;
+                sr1 &= ~M::SR1_RxNE;
+                if ( sr1_read )
+                    sr1 &= ~M::SR1_BTF;
+                if ( shift >= 0 ) {
+                    dr = shift;
+                    shift = -1;
+                    sr1 |= M::SR1_RxNE;
+                    sr1 &= ~M::SR1_BTF;
+                }
+                return x;
+            }
+            case id_sr1:
+                sr1_read = true;
+                return sr1;
+            case id_sr2:
+                if ( sr1_read && ( sr1 & M::SR1_ADDR ) ) {
+                    sr1_read = false;
+                    sr1 &= ~M::SR1_ADDR;
+                    if ( phase == transmit )
+                        sr1 |= M::SR1_TxE;
+                }
+                return ( master ? 3 : 0 ) | ( phase == transmit ? 4 : 0 ); // MSL|BUSY, TRA
+            }
+            return 0;
+        }
+
+        void write( int id, uint32_t x ) {
+            switch ( id ) {
+            case id_cr1:
+                if ( ( CR1.value & M::CR1_STOP ) && ( x & M::CR1_START ) )
+                    ++cr1_hazards;
+                CR1.value = x;
+                if ( ( x & M::CR1_START ) && !( x & M::CR1_STOP ) ) {
+                    if ( phase == idle || ( phase == transmit && ( sr1 & M::SR1_BTF ) ) || phase == receive ) {
+                        CR1.value &= ~M::CR1_START;
+                        sr1 = M::SR1_SB;
+                        sr1_read = false;
+                        master = true;
+                        phase = address;
+                        ++starts;
+                    }
+                }
+                break;
+            case id_cr2:
+                CR2.value = x;
+                break;
+            case id_dr:
+                if ( phase == address && sr1_read && ( sr1 & M::SR1_SB ) ) {
+                    sr1 &= ~M::SR1_SB;
+                    sr1_read = false;
+                    if ( ( x >> 1 ) == slave_address ) {
+                        sr1 |= M::SR1_ADDR;
+                        phase = ( x & 1 ) ? receive : transmit;
+                        nack_sent = pos_nack_next = false;
+                        if ( phase == transmit )
+                            written.push_back( 0xff );
+                    } else {
+                        sr1 |= M::SR1_AF;
+                        phase = transmit;
+                    }
+                } else if ( phase == transmit ) {
+                    if ( shift < 0 )
+                        shift = x & 0xff;
+                    else
+                        dr = x & 0xff;
+                    sr1 &= ~M::SR1_BTF;
+                    if ( dr >= 0 )
+                        sr1 &= ~M::SR1_TxE;
+                }
+                break;
+            case id_sr1:
+                sr1 = x;
+                break;
+            }
+        }
+
+        bool stop_ready() const {
+            if ( !( CR1.value & M::CR1_STOP ) || phase == address )
+                return false;
+            return phase == transmit ? shift < 0 : phase == receive ? nack_sent : true;
+        }
+
+        void bus_stop() {
+            CR1.value &= ~M::CR1_STOP;
+            master = false;
+            ++stops;
+            stop_polls = 0;
+            sr1 &= ~( M::SR1_BTF | M::SR1_TxE );
+            if ( phase == transmit )
+                dr = shift = -1;
+            phase = idle;
+        }
+
+        // one byte time on the bus
+        void tick() {
+            if ( stop_ready() ) {
+                bus_stop();
+                return;
+            }
+            if ( phase == transmit && shift >= 0 ) {
+                written.push_back( uint8_t( shift ) );
+                shift = dr;
+                dr = -1;
+                sr1 |= M::SR1_TxE;
+                if ( shift < 0 )
+                    sr1 |= M::SR1_BTF;
+            } else if ( phase == receive && !nack_sent ) {
+                if ( shift >= 0 )
+                    return; // clock stretched until DR is read
+                uint8_t b = pointer < memory.size() ? memory[ pointer ] : 0xee;
+                ++pointer;
+                bool ack;
+                if ( CR1.value & M::CR1_POS ) {
+                    ack = !pos_nack_next;
+                    pos_nack_next = !( CR1.value & M::CR1_ACK );
+                } else {
+                    ack = CR1.value & M::CR1_ACK;
+                }
+                if ( dma_rx_left > 0 && ( CR2.value & M::CR2_DMAEN ) ) {
+                    *dma_rx++ = b;
+                    if ( --dma_rx_left == 0 ) {
+                        dma_rx_done = true;
+                        if ( CR2.value & M::CR2_LAST )
+                            ack = false;
+                    }
+                } else if ( dr < 0 ) {
+                    dr = b;
+                    sr1 |= M::SR1_RxNE;
+                } else {
+                    shift = b;
+                    sr1 |= M::SR1_BTF;
+                }
+                if ( !ack || ( CR1.value & M::CR1_STOP ) )
+                    nack_sent = true;
+            }
+        }
+
+        bool dma_tx_request() const {
+            return phase == transmit && ( CR2.value & M::CR2_DMAEN ) && dma_tx_left
+                && ( sr1 & M::SR1_TxE ) && !( sr1 & M::SR1_ADDR );
+        }
+
+        void dma_service() {
+            if ( dma_tx_request() ) {
+                write( id_dr, *dma_tx++ );
+                if ( --dma_tx_left == 0 )
+                    dma_tx_done = true;
+            }
+        }
+
+        // one step of the port: an error/DMA/event interrupt of 'e' if one is pending, else a bus tick.
+        // A transaction deferred by a pending STOP is resumed as i2c::poll() does.  Returns false when idle.
+        bool step( M& e ) {
+            if ( !( e.busy() || phase != idle ) )
+                return false;
+            const uint32_t cr2 = CR2.value;
+            if ( ( cr2 & M::CR2_ITERREN ) && ( sr1 & M::SR1_ERRORS ) ) {
+                e.handle_error();
+                return true;
+            }
+            if ( dma_tx_done || dma_rx_done ) {
+                dma_tx_done = dma_rx_done = false;
+                e.dma_complete();
+                return true;
+            }
+            bool event = ( sr1 & ( M::SR1_SB | M::SR1_ADDR | M::SR1_BTF ) )
+                || ( ( cr2 & M::CR2_ITBUFEN ) && ( sr1 & ( M::SR1_TxE | M::SR1_RxNE ) ) );
+            if ( ( cr2 & M::CR2_ITEVTEN ) && event && !dma_tx_request() ) {
+                e.handle_event();
+                return true;
+            }
+            if ( e.state() == M::st_stop_wait && !( CR1.value & M::CR1_STOP ) ) {
+                e.resume();
+                return true;
+            }
+            dma_service();
+            tick();
+            return true;
+        }
+    };
+
+    inline i2c_model_register::operator uint32_t () { return m_->read( id_ ); }
+    inline i2c_model_register& i2c_model_register::operator = ( uint32_t x ) { m_->write( id_, x ); return *this; }
+
+    // DMA port bound to 'model', one per bus as __i2c1_dma_port/__i2c2_dma_port on target
+    template< int N > struct i2c_model_dma_port {
+        static i2c_model * model;
+        static constexpr i2c_model_master::dma_port port = {
+            []( const uint8_t * p, size_t n ){
+                model->dma_tx = p;
+                model->dma_tx_left = n;
+                model->dma_tx_done = false;
+                return true;
+            }
+            , []( uint8_t * p, size_t n ){
+                model->dma_rx = p;
+                model->dma_rx_left = n;
+                model->dma_rx_done = false;
+                return true;
+            }
+            , [](){ model->dma_tx_left = model->dma_rx_left = 0; }
+        };
+    };
+    template< int N > i2c_model * i2c_model_dma_port< N >::model;
+    template< int N > constexpr i2c_model_master::dma_port i2c_model_dma_port< N >::port;
+
+}
+}
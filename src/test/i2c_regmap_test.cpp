@@ -0,0 +1,275 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Register cache stm32f103::i2c_regmap (i2c_regmap.hpp) against a register model of the device, one map per
+// write mode.  Random reads and writes on a fresh cache each trial: cached registers come from the bus once,
+// volatile ones every time, a write of the value held is dropped, and a failed commit leaves the registers
+// dirty.  The transactions and bytes of each commit are checked against what the mode packs them into:
+// SINGLE one register per transaction, PAIRS as many pointer/value pairs as fit, INCREMENT one run of
+// adjacent registers per transaction, a single held register between two dirty ones written along.
+//   i2c_regmap_test
+
+#include "i2c_regmap.hpp"
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace stm32f103;
+
+namespace {
+
+    // a run of 'Size' registers fits one INCREMENT write
+    template< typename T, I2C_REGMAP_WRITE Mode, size_t Size = 24 > struct test_map {
+        typedef T value_type;
+        static constexpr uint8_t first = 0x10;
+        static constexpr size_t size = Size;
+        static constexpr bool burst_read = Mode != I2C_REGMAP_WRITE_SINGLE;
+        static constexpr I2C_REGMAP_WRITE write_mode = Mode;
+        static constexpr uint8_t read_pointer( uint8_t reg ) { return reg; }
+        static constexpr uint8_t write_pointer( uint8_t reg ) { return reg; }
+        static constexpr I2C_REGISTER_KIND kind( uint8_t reg ) {
+            return reg % 5 == 2 ? I2C_REGISTER_VOLATILE : I2C_REGISTER_CACHED;
+        }
+    };
+
+    // the device on the bus; decodes the writes as the mode defines them
+    template< typename MAP > struct register_model {
+        typedef typename MAP::value_type value_type;
+        static constexpr size_t width = sizeof( value_type );
+
+        std::vector< value_type > regs;
+        size_t reads;
+        size_t writes;
+        size_t bytes;
+        bool fail;              // the next write fails on the bus
+        int errors;
+
+        register_model() : regs( 256 ), reads( 0 ), writes( 0 ), bytes( 0 ), fail( false ), errors( 0 ) {}
+
+        bool read( uint8_t pointer, uint8_t * p, size_t n ) {
+            ++reads;
+            if ( n == 0 || n % width || ( !MAP::burst_read && n != width ) )
+                ++errors;
+            for ( size_t i = 0; i < n / width; ++i ) {
+                uint32_t v = regs[ uint8_t( pointer + i ) ];
+                for ( size_t k = width; k--; v >>= 8 )
+                    p[ i * width + k ] = uint8_t( v );
+            }
+            return true;
+        }
+
+        void store( uint8_t reg, const uint8_t * p ) {
+            uint32_t v = 0;
+            for ( size_t k = 0; k < width; ++k )
+                v = v << 8 | p[ k ];
+            if ( MAP::kind( reg ) != I2C_REGISTER_CACHED || reg < MAP::first || reg >= MAP::first + MAP::size )
+                ++errors;
+            regs[ reg ] = value_type( v );
+        }
+
+        bool write( const uint8_t * p, size_t n ) {
+            if ( fail ) {
+                fail = false;
+                return false;
+            }
+            ++writes;
+            bytes += n;
+            if ( n > 33 )
+                ++errors;
+            switch ( MAP::write_mode ) {
+            case I2C_REGMAP_WRITE_SINGLE:
+                if ( n != 1 + width )
+                    ++errors;
+                store( p[ 0 ], p + 1 );
+                break;
+            case I2C_REGMAP_WRITE_PAIRS:
+                if ( n % ( 1 + width ) )
+                    ++errors;
+                for ( size_t i = 0; i + 1 + width <= n; i += 1 + width )
+                    store( p[ i ], p + i + 1 );
+                break;
+            case I2C_REGMAP_WRITE_INCREMENT:
+                if ( n < 1 + width || ( n - 1 ) % width )
+                    ++errors;
+                for ( size_t i = 0; 1 + ( i + 1 ) * width <= n; ++i )
+                    store( uint8_t( p[ 0 ] + i ), p + 1 + i * width );
+                break;
+            }
+            return true;
+        }
+    };
+
+    template< typename MAP >
+    int
+    run( const char * name, std::mt19937& gen, size_t trials )
+    {
+        typedef typename MAP::value_type value_type;
+        constexpr size_t width = sizeof( value_type );
+        constexpr uint8_t first = MAP::first;
+        constexpr size_t size = MAP::size;
+        auto cached = []( size_t i ){ return MAP::kind( uint8_t( first + i ) ) == I2C_REGISTER_CACHED; };
+
+        int errors = 0;
+        size_t committed = 0, suppressed = 0, failed = 0;
+
+        for ( size_t trial = 0; trial < trials; ++trial ) {
+            register_model< MAP > dev;
+            i2c_regmap< MAP > map;
+            for ( auto& r: dev.regs )
+                r = value_type( gen() );
+
+            // reference: held values, and which are dirty
+            std::vector< bool > valid( size ), dirty( size );
+            std::vector< value_type > held( size );
+
+            // a random range through the cache; cached ones from the bus once, volatile ones every time
+            const size_t from = gen() % size, count = 1 + gen() % ( size - from );
+            std::vector< value_type > values( count );
+            for ( int pass = 0; pass < 2; ++pass ) {
+                const size_t reads = dev.reads;
+                const auto hits = map.stat().hits, misses = map.stat().misses;
+                if ( !map.read( dev, uint8_t( first + from ), values.data(), count ) )
+                    ++errors;
+                size_t expected_hits = 0, stale = 0;
+                for ( size_t i = 0; i < count; ++i ) {
+                    const size_t x = from + i;
+                    errors += values[ i ] != dev.regs[ first + x ];
+                    if ( cached( x ) && pass )
+                        ++expected_hits;
+                    else
+                        ++stale;
+                }
+                // a burst reads held ones along, between stale ones
+                errors += map.stat().hits - hits + map.stat().misses - misses != count;
+                errors += MAP::burst_read ? map.stat().hits - hits > expected_hits : map.stat().hits - hits != expected_hits;
+                errors += ( stale == 0 ) != ( dev.reads == reads );
+                for ( size_t x = from; x < from + count; ++x ) {
+                    if ( cached( x ) ) {
+                        valid[ x ] = true;
+                        held[ x ] = dev.regs[ first + x ];
+                    } else {
+                        dev.regs[ first + x ] = value_type( dev.regs[ first + x ] + 1 ); // changed by the device
+                    }
+                }
+            }
+            for ( size_t x = 0; x < size; ++x ) {
+                if ( !valid[ x ] )
+                    dev.regs[ first + x ] = value_type( gen() );  // not held, so the device may hold anything
+            }
+
+            // writes go to the cache only; the value held is dropped
+            const size_t reads = dev.reads;
+            for ( size_t x = 0; x < size; ++x ) {
+                const uint32_t op = gen() % 6;
+                if ( op > 2 )
+                    continue;
+                const bool same = op == 0 && valid[ x ];
+                const value_type v = same ? held[ x ] : value_type( gen() );
+                const auto before = map.stat().suppressed;
+                if ( map.write( uint8_t( first + x ), v ) != cached( x ) )
+                    ++errors;
+                if ( !cached( x ) )
+                    continue;
+                if ( valid[ x ] && held[ x ] == v ) {
+                    errors += map.stat().suppressed != before + 1;
+                    ++suppressed;
+                } else {
+                    dirty[ x ] = true;
+                }
+                valid[ x ] = true;
+                held[ x ] = v;
+            }
+            errors += dev.writes != 0 || dev.reads != reads;
+
+            size_t ndirty = 0;
+            for ( size_t x = 0; x < size; ++x ) {
+                ndirty += dirty[ x ];
+                value_type v;
+                if ( dirty[ x ] && ( !map.read( dev, uint8_t( first + x ), v ) || v != held[ x ] ) )
+                    ++errors;           // a dirty register reads back from the cache, ahead of the device
+            }
+            errors += map.dirty() != ( ndirty != 0 ) || dev.reads != reads;
+
+            // transactions and bytes the mode packs the dirty registers into
+            size_t transactions = 0, bytes = 0;
+            switch ( MAP::write_mode ) {
+            case I2C_REGMAP_WRITE_SINGLE:
+                transactions = ndirty;
+                bytes = ndirty * ( 1 + width );
+                break;
+            case I2C_REGMAP_WRITE_PAIRS: {
+                constexpr size_t per = 33 / ( 1 + width );
+                transactions = ( ndirty + per - 1 ) / per;
+                bytes = ndirty * ( 1 + width );
+                break;
+            }
+            case I2C_REGMAP_WRITE_INCREMENT:
+                for ( size_t x = 0; x < size; ++x ) {
+                    const bool bridge = width <= 2 && x >= 1 && x + 1 < size && dirty[ x - 1 ] && !dirty[ x ]
+                        && dirty[ x + 1 ] && valid[ x ] && cached( x );
+                    const bool bridged = width <= 2 && x >= 2 && dirty[ x - 2 ] && !dirty[ x - 1 ]
+                        && valid[ x - 1 ] && cached( x - 1 );
+                    if ( dirty[ x ] && !( x >= 1 && dirty[ x - 1 ] ) && !bridged ) {
+                        bytes += 1;     // pointer of a new run
+                        ++transactions;
+                    }
+                    if ( dirty[ x ] || bridge )
+                        bytes += width;
+                }
+                break;
+            }
+
+            if ( ndirty && gen() % 4 == 0 ) {
+                dev.fail = true;        // nothing is lost; the next commit sends what this one did not
+                ++failed;
+                const auto regs = dev.regs;
+                if ( map.commit( dev ) || !map.dirty() )
+                    ++errors;
+                errors += dev.regs != regs || dev.writes != 0;
+            }
+
+            const auto written = map.stat().written;
+            if ( !map.commit( dev ) || map.dirty() )
+                ++errors;
+            if ( dev.writes != transactions || dev.bytes != bytes ) {
+                std::cout << name << " trial " << trial << ": " << dev.writes << " transactions " << dev.bytes << " bytes, expected "
+                          << transactions << " transactions " << bytes << " bytes" << std::endl;
+                ++errors;
+            }
+            errors += map.stat().written - written != ndirty;
+            for ( size_t x = 0; x < size; ++x ) {
+                if ( cached( x ) && valid[ x ] )
+                    errors += dev.regs[ first + x ] != held[ x ];
+            }
+            committed += dev.writes;
+
+            // nothing left to send
+            const size_t writes = dev.writes;
+            if ( !map.commit( dev ) || dev.writes != writes )
+                ++errors;
+            errors += dev.errors;
+        }
+
+        std::cout << name << ": " << committed << " write transactions, " << suppressed << " suppressed, "
+                  << failed << " failed commits, " << errors << " errors" << std::endl;
+        return errors;
+    }
+
+}
+
+int
+main()
+{
+    std::mt19937 gen( 1 );
+    constexpr size_t trials = 20000;
+    int errors = 0;
+    errors += run< test_map< uint16_t, I2C_REGMAP_WRITE_SINGLE > >( "single", gen, trials );
+    errors += run< test_map< uint8_t, I2C_REGMAP_WRITE_PAIRS > >( "pairs", gen, trials );
+    errors += run< test_map< uint8_t, I2C_REGMAP_WRITE_INCREMENT > >( "increment", gen, trials );
+    errors += run< test_map< uint16_t, I2C_REGMAP_WRITE_INCREMENT, 16 > >( "increment16", gen, trials );
+
+    std::cout << "i2c_regmap_test: " << errors << " errors: " << ( errors ? "FAILED" : "passed" ) << std::endl;
+    return errors ? 1 : 0;
+}
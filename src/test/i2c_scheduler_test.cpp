@@ -0,0 +1,130 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Bus arbitration of stm32f103::i2c_scheduler (i2c_scheduler.hpp) on a simulated bus, 100us per transaction.
+// A high priority device resubmitting as soon as it is served must not starve a low priority one (aging),
+// a request that cannot meet its deadline times out without touching the bus, and the per-device
+// statistics, kept by the dispatcher, add up.
+//   i2c_scheduler_test
+
+#include "i2c_scheduler.hpp"
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+using namespace stm32f103;
+
+namespace {
+
+    uint32_t __clock;
+
+    struct simulated_bus {
+        std::deque< i2c_transaction * > queue;
+        std::vector< uint8_t > order;                 // addresses as they got the bus
+
+        bool submit( i2c_transaction& t ) {     // engine queue of 8
+            if ( queue.size() >= 8 )
+                return false;
+            t.done = false;
+            queue.emplace_back( &t );
+            return true;
+        }
+
+        bool poll() { return !queue.empty(); }
+
+        // runs the transaction at the head of the queue to completion, as the engine's ISR does
+        bool step() {
+            if ( queue.empty() )
+                return false;
+            auto t = queue.front();
+            queue.pop_front();
+            __clock += 100;
+            order.emplace_back( t->address );
+            t->result = I2C_RESULT_SUCCESS;
+            if ( t->completion )
+                t->completion( *t );
+            t->done = true;
+            return true;
+        }
+    };
+}
+
+int
+main()
+{
+    simulated_bus bus;
+    i2c_scheduler< simulated_bus > scheduler;
+    scheduler.init( &bus, []{ return __clock; }, 1 );
+    int errors = 0;
+
+    const uint8_t a = scheduler.register_device( 0x76 );
+    const uint8_t b = scheduler.register_device( 0x10 );
+    const uint8_t c = scheduler.register_device( 0x20 );
+
+    static i2c_request ra[ 4 ], rb[ 8 ], rc;
+    for ( auto& r: rb ) {
+        new ( &r ) i2c_request( b, I2C_PRIORITY_LOW, 0x10 );
+        scheduler.submit( r );
+    }
+    for ( auto& r: ra ) {
+        new ( &r ) i2c_request( a, I2C_PRIORITY_HIGH, 0x76 );
+        scheduler.submit( r );
+    }
+    new ( &rc ) i2c_request( c, I2C_PRIORITY_NORMAL, 0x20, nullptr, 0, nullptr, 0, 150 ); // can't make 150us
+    scheduler.submit( rc );
+
+    uint32_t a_served = 0;
+    for ( int steps = 0; steps < 400 && bus.step(); ++steps ) {
+        for ( auto& r: ra ) {
+            if ( r.done.load() ) {             // device 'a' tries to keep the bus
+                ++a_served;
+                scheduler.submit( r );
+            }
+        }
+        scheduler.poll();
+    }
+
+    int b_done = 0;
+    for ( auto& r: rb )
+        b_done += r.done.load() && r.result() == I2C_RESULT_SUCCESS;
+    if ( b_done != 8 ) {
+        std::cout << "low priority device starved: " << b_done << "/8 done" << std::endl;
+        ++errors;
+    }
+    if ( !rc.done.load() || rc.result() != I2C_TRANSACTION_TIMEOUT
+         || std::find( bus.order.begin(), bus.order.end(), 0x20 ) != bus.order.end() ) {
+        std::cout << "request past its deadline: done " << rc.done.load() << " result " << rc.result() << std::endl;
+        ++errors;
+    }
+
+    const auto& sa = scheduler.stat( a );
+    const auto& sb = scheduler.stat( b );
+    const auto& sc = scheduler.stat( c );
+    for ( auto s: { &sa, &sb, &sc } )
+        std::cout << "device " << std::hex << int( s->address ) << std::dec << "\trequests " << s->requests
+                  << "\tcompleted " << s->completed << "\tfailed " << s->failed << "\tdeadline missed " << s->deadline_missed
+                  << "\twait max " << s->wait_max << "us" << std::endl;
+    // 'b' ages from low to high in 2 aging_us, then takes turns with 'a': one batch in flight, its own two
+    // batches, and one batch of 'a' in between
+    if ( sb.wait_max > 2 * scheduler.aging_us + 3 * scheduler.batch_limit * 100 ) {
+        std::cout << "low priority device waited " << sb.wait_max << "us" << std::endl;
+        ++errors;
+    }
+    if ( sa.completed != a_served || sb.completed != 8 || sb.requests != 8 || sc.requests != 1 || sc.failed != 1
+         || sc.deadline_missed != 1 || sc.completed != 0 ) {
+        std::cout << "statistics do not add up" << std::endl;
+        ++errors;
+    }
+
+    scheduler.clear_stat();
+    if ( scheduler.stat( a ).requests || scheduler.stat( a ).address != 0x76 ) {
+        std::cout << "clear_stat" << std::endl;
+        ++errors;
+    }
+
+    std::cout << "i2c_scheduler_test: " << errors << " errors: " << ( errors ? "FAILED" : "passed" ) << std::endl;
+    return errors ? 1 : 0;
+}
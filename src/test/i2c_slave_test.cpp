@@ -0,0 +1,196 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Register file engine of stm32f103::i2c_slave (i2c_slave.hpp) driven by a scripted bus master.
+// Randomized write bursts (register pointer and data, partly to read-only registers and past the end),
+// register reads on repeated START, and local updates, by interrupt and by DMA; the register file is
+// compared against a reference after every transaction.
+//   i2c_slave_test
+
+#include "i2c_slave.hpp"
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace stm32f103;
+
+namespace {
+
+    struct registers {
+        uint32_t CR1, CR2, OAR1, OAR2, DR, SR1, SR2;
+    };
+
+    typedef i2c_slave< registers, 64 > slave_type;
+
+    slave_type * __slave;
+    registers * __regs;
+
+    struct dma_channel {
+        const uint8_t * tx;
+        uint8_t * rx;
+        size_t size;
+        size_t position;
+        bool active;
+    };
+    dma_channel __tx_dma, __rx_dma;
+
+    const slave_type::dma_port __dma_port = {
+        []( const uint8_t * p, size_t n ){ __tx_dma = { p, nullptr, n, 0, true }; return true; }
+        , []( uint8_t * p, size_t n ){ __rx_dma = { nullptr, p, n, 0, true }; return true; }
+        , []() -> size_t {
+            size_t remain = 0;
+            for ( auto dma: { &__tx_dma, &__rx_dma } ) {
+                if ( dma->active ) {
+                    dma->active = false;
+                    remain = dma->size - dma->position;
+                }
+            }
+            return remain;
+        }
+    };
+
+    int __callbacks;
+
+    // bus events as seen by the slave port
+    void
+    address_match( bool read )
+    {
+        __regs->SR1 |= slave_type::SR1_ADDR;
+        __regs->SR2 = read ? slave_type::SR2_TRA : 0;
+        __slave->handle_event();
+        __regs->SR1 &= ~slave_type::SR1_ADDR;
+    }
+
+    void
+    master_write( uint8_t b )
+    {
+        if ( ( __regs->CR2 & slave_type::CR2_DMAEN ) && __rx_dma.active ) {
+            __rx_dma.rx[ __rx_dma.position++ ] = b;
+            if ( __rx_dma.position == __rx_dma.size ) {
+                __rx_dma.active = false;
+                __slave->dma_complete();
+            }
+            return;
+        }
+        __regs->DR = b;
+        __regs->SR1 |= slave_type::SR1_RxNE;
+        if ( __regs->CR2 & slave_type::CR2_ITBUFEN )
+            __slave->handle_event();
+        __regs->SR1 &= ~slave_type::SR1_RxNE;
+    }
+
+    uint8_t
+    master_read()
+    {
+        if ( ( __regs->CR2 & slave_type::CR2_DMAEN ) && __tx_dma.active ) {
+            uint8_t b = __tx_dma.tx[ __tx_dma.position++ ];
+            if ( __tx_dma.position == __tx_dma.size ) {
+                __tx_dma.active = false;
+                __slave->dma_complete();
+            }
+            return b;
+        }
+        __regs->SR1 |= slave_type::SR1_TxE;
+        if ( __regs->CR2 & slave_type::CR2_ITBUFEN )
+            __slave->handle_event();
+        __regs->SR1 &= ~slave_type::SR1_TxE;
+        return uint8_t( __regs->DR );
+    }
+
+    void
+    master_stop()
+    {
+        __regs->SR1 |= slave_type::SR1_STOPF;
+        __slave->handle_event();
+        __regs->SR1 &= ~slave_type::SR1_STOPF;
+    }
+
+    void
+    master_nack()
+    {
+        __regs->SR1 |= slave_type::SR1_AF;
+        __slave->handle_error();
+    }
+}
+
+int
+main()
+{
+    std::mt19937 gen( 7 );
+    int errors = 0, transactions = 0;
+
+    for ( int use_dma = 0; use_dma < 2; ++use_dma ) {
+        registers regs{};
+        slave_type slave;
+        __slave = &slave;
+        __regs = &regs;
+        slave.init( &regs );
+        if ( use_dma )
+            slave.set_dma( &__dma_port );
+        slave.set_callback( []( uint8_t, size_t, void * ){ ++__callbacks; } );
+        slave.set_writable( 0x20, 32 );
+
+        std::vector< uint8_t > expected( slave_type::size );
+        for ( size_t i = 0; i < expected.size(); ++i )
+            expected[ i ] = uint8_t( i * 3 );
+        slave.update( 0, expected.data(), expected.size() );
+
+        for ( int trial = 0; trial < 20000; ++trial ) {
+            ++transactions;
+            const int kind = gen() % 3;
+            const uint8_t reg = gen() % 70;
+            const size_t n = gen() % 80;
+            if ( kind == 0 ) {          // S addr+W reg data... P
+                const int callbacks = __callbacks;
+                address_match( false );
+                master_write( reg );
+                for ( size_t i = 0; i < n; ++i ) {
+                    uint8_t b = uint8_t( gen() );
+                    master_write( b );
+                    if ( i < slave_type::size && reg + i >= 0x20 && reg + i < slave_type::size )
+                        expected[ reg + i ] = b;
+                }
+                master_stop();
+                if ( n && reg < slave_type::size && __callbacks != callbacks + 1 ) {
+                    std::cout << "dma=" << use_dma << " trial " << trial << ": write callback missing" << std::endl;
+                    ++errors;
+                }
+            } else if ( kind == 1 ) {   // S addr+W reg Sr addr+R data... NACK P
+                address_match( false );
+                master_write( reg );
+                address_match( true );
+                bool ok = true;
+                for ( size_t i = 0; i < n; ++i )
+                    ok &= master_read() == ( reg + i < slave_type::size ? expected[ reg + i ] : 0xff );
+                master_nack();
+                master_stop();
+                if ( !ok ) {
+                    std::cout << "dma=" << use_dma << " trial " << trial << ": read of " << n << " from " << int( reg ) << " differs" << std::endl;
+                    ++errors;
+                }
+            } else {                    // local update
+                const size_t r = gen() % slave_type::size;
+                const uint8_t v = uint8_t( gen() );
+                slave.update( r, &v, 1 );
+                expected[ r ] = v;
+            }
+
+            std::vector< uint8_t > file( slave_type::size );
+            slave.read( 0, file.data(), file.size() );
+            if ( file != expected || slave.state() != slave_type::st_idle ) {
+                std::cout << "dma=" << use_dma << " trial " << trial << ": register file differs, or not idle" << std::endl;
+                expected = file;
+                ++errors;
+            }
+        }
+        const auto& stat = slave.stat();
+        std::cout << "dma=" << use_dma << " reads " << stat.reads << " writes " << stat.writes
+                  << " bytes written " << stat.bytes_written << " dropped " << stat.dropped << std::endl;
+    }
+
+    std::cout << "i2c_slave_test: " << transactions << " transactions, " << errors << " errors: "
+              << ( errors ? "FAILED" : "passed" ) << std::endl;
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,80 @@
+// Copyright (C) 2018 MS-Cheminformatics LLC
+// Licence: CC BY-NC
+// Author: Toshinobu Hondo, Ph.D.
+// Contact: toshi.hondo@qtplatz.com
+
+// Round trip of codec::rice (../codec/rice.hpp) on full range int32_t and uint16_t blocks, and decode of
+// truncated input
+//   rice_test
+
+#include <codec/rice.hpp>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+template< typename T >
+static bool
+round_trip( const std::vector< T >& x, const char * name )
+{
+    std::vector< uint8_t > out( codec::rice::max_encoded_size( x.size() ) );
+    size_t size = codec::rice::encode( x.data(), x.size(), out.data(), out.size() );
+    std::vector< T > y( x.size() );
+    if ( size == 0 || codec::rice::decode( out.data(), size, y.data(), y.size() ) != x.size() || x != y ) {
+        std::cout << name << ": round trip failed" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int
+main()
+{
+    constexpr int32_t min = std::numeric_limits< int32_t >::min();
+    constexpr int32_t max = std::numeric_limits< int32_t >::max();
+    int errors = 0;
+
+    // deltas of +/- 2^32 - 1 wrap around
+    errors += !round_trip( std::vector< int32_t >{ min, max, min, 0, max, -1, min }, "int32 extremes" );
+    errors += !round_trip( std::vector< int32_t >{ 0 }, "single sample" );
+    errors += !round_trip( std::vector< uint16_t >{ 0, 0xffff, 0, 0x8000, 0x7fff, 0xffff }, "uint16 extremes" );
+
+    std::mt19937 gen( 1 );
+    for ( int trial = 0; trial < 2000; ++trial ) {
+        std::vector< int32_t > x( 1 + gen() % 300 );
+        const uint32_t range = trial % 3 == 0 ? 0xffffffff : ( 1u << ( trial % 31 ) );
+        int32_t v = int32_t( gen() );
+        for ( auto& s: x ) {
+            s = v;
+            v = int32_t( uint32_t( v ) + ( gen() & range ) - ( range >> 1 ) ); // random walk, wrapping
+        }
+        if ( !round_trip( x, "random walk" ) )
+            ++errors;
+        std::vector< uint16_t > a( x.size() );
+        for ( size_t i = 0; i < x.size(); ++i )
+            a[ i ] = uint16_t( x[ i ] >> 16 );
+        if ( !round_trip( a, "random walk uint16" ) )
+            ++errors;
+    }
+
+    // short and truncated blocks must be rejected without reading past 'size'
+    std::vector< int32_t > x{ 1, 100, -100, 1000000, 3 };
+    std::vector< uint8_t > out( codec::rice::max_encoded_size( x.size() ) );
+    size_t size = codec::rice::encode( x.data(), x.size(), out.data(), out.size() );
+    std::vector< int32_t > y( x.size() );
+    for ( size_t n = 0; n < size; ++n ) {
+        std::vector< uint8_t > truncated( out.begin(), out.begin() + n );  // exact size, so ASan sees overruns
+        if ( codec::rice::decode( truncated.data(), truncated.size(), y.data(), y.size() ) != 0 ) {
+            std::cout << "truncated block of " << n << " bytes decoded" << std::endl;
+            ++errors;
+        }
+    }
+    if ( codec::rice::decode( out.data(), size, y.data(), y.size() - 1 ) != 0 ) {
+        std::cout << "decode into a short buffer" << std::endl;
+        ++errors;
+    }
+
+    std::cout << "rice_test: " << ( errors ? "FAILED" : "passed" ) << std::endl;
+    return errors ? 1 : 0;
+}